@@ -0,0 +1,545 @@
+// Scan and decode throughput on synthetic DICOM series written with DCMTK, so
+// transfer syntaxes, pixel formats and file layouts can be compared without
+// sharing patient data. Every configuration is timed with the page cache warm
+// and, where the system lets us evict files, cold.
+
+#include "phantom.h"
+#include "dicomseries.h"
+#include "dicomtostl.h"
+#include "dirreader.h"
+#include "dirscanner.h"
+#include "timer.h"
+
+#include <dcmtk/oflog/oflog.h>
+#include <dcmtk/dcmimgle/dcmimage.h>
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+using namespace DicomToStl;
+
+namespace
+{
+
+enum CacheMode
+{
+    CACHE_WARM = 1,
+    CACHE_COLD = 2
+};
+
+struct BenchOptions
+{
+    BenchOptions() : shape(PHANTOM_CT), width(512), height(512), depth(64), repeat(3), cacheModes(CACHE_WARM | CACHE_COLD), dicomdir(false), keep(false), outDir("dicombench") {}
+    PhantomShape shape;
+    int width;
+    int height;
+    int depth;
+    std::vector<PixelType> pixelTypes;
+    std::vector<DicomSyntax> syntaxes;
+    std::vector<bool> multiFrames;
+    int repeat;
+    int cacheModes;
+    bool dicomdir;
+    // Leave the generated series on the disk
+    bool keep;
+    std::string outDir;
+};
+
+struct BenchResult
+{
+    BenchResult() : ms(0.), files(0), slices(0), bytes(0) {}
+    std::string name;
+    // Best time of the repeats
+    double ms;
+    uint64_t files;
+    uint64_t slices;
+    uint64_t bytes;
+};
+
+void MakeDir(const std::string& dirName)
+{
+#ifdef _WIN32
+    _mkdir(dirName.c_str());
+#else
+    mkdir(dirName.c_str(), 0755);
+#endif
+}
+
+uint64_t GetFileSize(const std::string& fileName)
+{
+    struct stat info;
+    return stat(fileName.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+}
+
+// Drops the files from the page cache, false where the system can't do it
+bool EvictFiles(const std::vector<std::string>& files)
+{
+#ifdef __linux__
+    for (auto i = files.begin(); i != files.end(); ++i)
+    {
+        int fd = open(i->c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        // Dirty pages stay in the cache until they are written back
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    return true;
+#else
+    (void)files;
+    return false;
+#endif
+}
+
+// Pixels of every frame of the file, converted the way DcmSliceSource does for one
+bool DecodeFrames(const std::string& fileName, std::vector<int>& pixels)
+{
+    DicomImage image(fileName.c_str());
+    if (image.getStatus() != EIS_Normal)
+    {
+        return false;
+    }
+    const DiPixel* pixelData = image.getInterData();
+    if (pixelData == nullptr)
+    {
+        return false;
+    }
+    pixels.resize(pixelData->getCount());
+    switch (pixelData->getRepresentation())
+    {
+    case EPR_Uint8:
+        std::copy(static_cast<const Uint8*>(pixelData->getData()), static_cast<const Uint8*>(pixelData->getData()) + pixels.size(), pixels.begin());
+        return true;
+    case EPR_Sint8:
+        std::copy(static_cast<const signed char*>(pixelData->getData()), static_cast<const signed char*>(pixelData->getData()) + pixels.size(), pixels.begin());
+        return true;
+    case EPR_Uint16:
+        std::copy(static_cast<const Uint16*>(pixelData->getData()), static_cast<const Uint16*>(pixelData->getData()) + pixels.size(), pixels.begin());
+        return true;
+    case EPR_Sint16:
+        std::copy(static_cast<const Sint16*>(pixelData->getData()), static_cast<const Sint16*>(pixelData->getData()) + pixels.size(), pixels.begin());
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Files of the series the way the converter finds them, from the folder or the DICOMDIR
+std::vector<std::string> ListSeries(const std::string& dirName, bool dicomdir)
+{
+    FileNames files;
+    if (dicomdir)
+    {
+        std::string dicomdirName = dirName + "/DICOMDIR";
+        StudyPairs pairs;
+        GetStudiesPairsFromDir(dicomdirName, pairs);
+        if (!pairs.empty())
+        {
+            GetFileNamesFromDICOMDIR(dicomdirName, pairs.front(), files);
+        }
+    }
+    else
+    {
+        SeriesList series;
+        ScanDicomSeries(dirName, false, series);
+        if (!series.empty())
+        {
+            files.swap(series.front().files);
+        }
+    }
+    return files;
+}
+
+// Runs body repeat times and keeps the fastest, with the cache evicted before every cold run
+double BestOf(int repeat, CacheMode mode, const std::vector<std::string>& files, std::function<void (void)> body)
+{
+    double best = 0.;
+    for (int i = 0; i < repeat; ++i)
+    {
+        if (mode == CACHE_COLD)
+        {
+            EvictFiles(files);
+        }
+        else if (i == 0)
+        {
+            // Untimed run that brings the files into the cache
+            body();
+        }
+        cpptask::Timer timer;
+        body();
+        double ms = timer.End();
+        best = i == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+bool ParseSize(const std::string& text, int& width, int& height, int& depth)
+{
+    char x1 = 0;
+    char x2 = 0;
+    std::istringstream in(text);
+    return (in >> width >> x1 >> height >> x2 >> depth) && x1 == 'x' && x2 == 'x' &&
+           width > 1 && height > 1 && depth > 1 && width <= 65535 && height <= 65535;
+}
+
+void PrintUsage()
+{
+    std::cout << "Usage: dicombench [options]\n"
+              << "  --phantom <name>   sphere, tori, gyroid or ct (default ct)\n"
+              << "  --size <WxHxD>     columns, rows and slices (default 512x512x64)\n"
+              << "  --pixel <type>     uint8, int8, uint16, int16 or all (default int16)\n"
+              << "  --syntax <name>    raw, rle, jpegll or all (default all)\n"
+              << "  --frames <layout>  single, multi or all (default single)\n"
+              << "  --cache <mode>     warm, cold or both (default both, cold needs Linux)\n"
+              << "  --dicomdir <0|1>   add a DICOMDIR and scan the series through it (default 0)\n"
+              << "  --repeat <n>       runs of every benchmark, the best is reported (default 3)\n"
+              << "  --out <dir>        folder of the generated series (default dicombench)\n"
+              << "  --keep <0|1>       leave the generated series on the disk (default 0)\n";
+}
+
+bool ParseOptions(int argc, char* argv[], BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+        {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--phantom")
+        {
+            if (!ParsePhantomShape(value, options.shape))
+            {
+                return false;
+            }
+        }
+        else if (arg == "--size")
+        {
+            if (!ParseSize(value, options.width, options.height, options.depth))
+            {
+                return false;
+            }
+        }
+        else if (arg == "--pixel")
+        {
+            PixelType pixelType = PIXEL_INT16;
+            if (value == "all")
+            {
+                options.pixelTypes.clear();
+                for (int p = PIXEL_UINT8; p <= PIXEL_INT16; ++p)
+                {
+                    options.pixelTypes.push_back(static_cast<PixelType>(p));
+                }
+            }
+            else if (ParsePixelType(value, pixelType) && pixelType <= PIXEL_INT16)
+            {
+                options.pixelTypes.push_back(pixelType);
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (arg == "--syntax")
+        {
+            DicomSyntax syntax = DICOM_SYNTAX_RAW;
+            if (value == "all")
+            {
+                options.syntaxes.clear();
+            }
+            else if (ParseDicomSyntax(value, syntax))
+            {
+                options.syntaxes.push_back(syntax);
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (arg == "--frames")
+        {
+            options.multiFrames.clear();
+            if (value == "single" || value == "all")
+            {
+                options.multiFrames.push_back(false);
+            }
+            if (value == "multi" || value == "all")
+            {
+                options.multiFrames.push_back(true);
+            }
+            if (options.multiFrames.empty())
+            {
+                return false;
+            }
+        }
+        else if (arg == "--cache")
+        {
+            options.cacheModes = value == "warm" ? CACHE_WARM : value == "cold" ? CACHE_COLD : value == "both" ? CACHE_WARM | CACHE_COLD : 0;
+            if (options.cacheModes == 0)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--dicomdir")
+        {
+            options.dicomdir = std::atoi(value.c_str()) != 0;
+        }
+        else if (arg == "--repeat")
+        {
+            options.repeat = std::max(1, std::atoi(value.c_str()));
+        }
+        else if (arg == "--out")
+        {
+            options.outDir = value;
+        }
+        else if (arg == "--keep")
+        {
+            options.keep = std::atoi(value.c_str()) != 0;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if (options.pixelTypes.empty())
+    {
+        options.pixelTypes.push_back(PIXEL_INT16);
+    }
+    if (options.syntaxes.empty())
+    {
+        for (int s = DICOM_SYNTAX_RAW; s <= DICOM_SYNTAX_JPEG_LOSSLESS; ++s)
+        {
+            options.syntaxes.push_back(static_cast<DicomSyntax>(s));
+        }
+    }
+    if (options.multiFrames.empty())
+    {
+        options.multiFrames.push_back(false);
+    }
+    return true;
+}
+
+// Generates one series and times its scan and decode, false when the series
+// doesn't read back as it was written
+bool RunSeries(const Phantom& phantom, const DicomSeriesOptions& seriesOptions, const std::string& dirName,
+               const BenchOptions& options, OFLogger& logger, std::vector<BenchResult>& results)
+{
+    MemorySliceSource expected(phantom.GetVolume());
+    int dx = expected.GetWidth();
+    int dy = expected.GetHeight();
+    int slicesCount = expected.GetSlicesCount();
+    size_t slicePixels = static_cast<size_t>(dx) * dy;
+    bool passed = true;
+
+    MakeDir(dirName);
+    cpptask::Timer generateTimer;
+    std::vector<std::string> written = WriteDicomSeries(phantom, seriesOptions, dirName);
+    BenchResult generate;
+    generate.name = "generate";
+    generate.ms = generateTimer.End();
+    generate.files = written.size();
+    generate.slices = slicesCount;
+    for (auto i = written.begin(); i != written.end(); ++i)
+    {
+        generate.bytes += GetFileSize(*i);
+    }
+    results.push_back(generate);
+
+    bool canEvict = EvictFiles(written);
+    for (int mode = CACHE_WARM; mode <= CACHE_COLD; mode <<= 1)
+    {
+        if ((options.cacheModes & mode) == 0)
+        {
+            continue;
+        }
+        if (mode == CACHE_COLD && !canEvict)
+        {
+            std::cerr << "Can't evict files from the page cache here, skipping the cold runs\n";
+            continue;
+        }
+        const char* suffix = mode == CACHE_COLD ? "-cold" : "-warm";
+
+        // Listing and format of the series, what happens before the pipeline starts
+        std::vector<std::string> files;
+        int formatDx = 0;
+        int formatDy = 0;
+        Vec3 spacing;
+        SlicesPositions slicesPositions;
+        BenchResult scan;
+        scan.name = std::string("scan") + suffix;
+        scan.ms = BestOf(options.repeat, static_cast<CacheMode>(mode), written, [&]()
+        {
+            files = ListSeries(dirName, seriesOptions.dicomdir);
+            ReadFormatDcmFiles(files, logger, formatDx, formatDy, spacing, slicesPositions);
+        });
+        scan.files = generate.files;
+        scan.slices = slicesCount;
+        scan.bytes = generate.bytes;
+        results.push_back(scan);
+
+        size_t expectedFiles = seriesOptions.multiFrame ? 1 : slicesCount;
+        if (files.size() != expectedFiles || slicesPositions.size() != expectedFiles || formatDx != dx || formatDy != dy)
+        {
+            std::cerr << dirName << " : the scan found " << slicesPositions.size() << " files of " << formatDx << "x" << formatDy << "\n";
+            passed = false;
+            continue;
+        }
+
+        // Decoding every slice into the pipeline values
+        std::vector<std::vector<int> > images(slicesCount, std::vector<int>(slicePixels));
+        std::vector<int> frames;
+        bool decoded = true;
+        BenchResult decode;
+        decode.name = std::string("decode") + suffix;
+        if (seriesOptions.multiFrame)
+        {
+            decode.ms = BestOf(options.repeat, static_cast<CacheMode>(mode), written, [&]()
+            {
+                decoded = DecodeFrames(files.front(), frames) && frames.size() == slicePixels * slicesCount;
+            });
+            for (int z = 0; z < slicesCount && decoded; ++z)
+            {
+                std::copy(frames.begin() + z * slicePixels, frames.begin() + (z + 1) * slicePixels, images[z].begin());
+            }
+        }
+        else
+        {
+            DcmSliceSource source(dx, dy, spacing, slicesPositions);
+            decode.ms = BestOf(options.repeat, static_cast<CacheMode>(mode), written, [&]()
+            {
+                std::string error;
+                for (int z = 0; z < slicesCount; ++z)
+                {
+                    if (!source.ReadSlice(z, images[z], error))
+                    {
+                        decoded = false;
+                    }
+                }
+            });
+        }
+        decode.files = generate.files;
+        decode.slices = slicesCount;
+        decode.bytes = generate.bytes;
+        results.push_back(decode);
+
+        // Every syntax is lossless, the pixels have to come back unchanged
+        std::vector<int> slice(slicePixels);
+        for (int z = 0; z < slicesCount && decoded; ++z)
+        {
+            std::string error;
+            expected.ReadSlice(z, slice, error);
+            decoded = slice == images[z];
+        }
+        if (!decoded)
+        {
+            std::cerr << dirName << " : decoded pixels differ from the phantom\n";
+            passed = false;
+        }
+    }
+
+    if (!options.keep)
+    {
+        for (auto i = written.begin(); i != written.end(); ++i)
+        {
+            std::remove(i->c_str());
+        }
+#ifdef _WIN32
+        _rmdir(dirName.c_str());
+#else
+        rmdir(dirName.c_str());
+#endif
+    }
+    return passed;
+}
+
+void PrintResults(const std::string& prefix, const std::vector<BenchResult>& results)
+{
+    std::cout << std::fixed << std::setprecision(1);
+    for (auto i = results.begin(); i != results.end(); ++i)
+    {
+        double seconds = i->ms / 1000.;
+        std::cout << std::left << std::setw(40) << prefix << std::setw(14) << i->name << std::right
+                  << std::setw(10) << i->ms
+                  << std::setw(10) << (seconds > 0. ? i->files / seconds : 0.)
+                  << std::setw(10) << (seconds > 0. ? i->slices / seconds : 0.)
+                  << std::setw(10) << (seconds > 0. ? i->bytes / seconds / (1 << 20) : 0.)
+                  << std::setw(10) << i->bytes / double(1 << 20) << "\n";
+    }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+    OFLog::configure(OFLogger::WARN_LOG_LEVEL);
+    OFLogger logger = OFLog::getLogger("dicombench");
+    RegisterDicomCodecs();
+    MakeDir(options.outDir);
+
+    std::cout << std::left << std::setw(40) << "series" << std::setw(14) << "benchmark" << std::right
+              << std::setw(10) << "ms" << std::setw(10) << "files/s" << std::setw(10) << "slices/s"
+              << std::setw(10) << "MB/s" << std::setw(10) << "MB" << "\n";
+
+    bool passed = true;
+    for (auto pixelType = options.pixelTypes.begin(); pixelType != options.pixelTypes.end(); ++pixelType)
+    {
+        Phantom phantom(options.shape, options.width, options.height, options.depth, *pixelType);
+        for (auto syntax = options.syntaxes.begin(); syntax != options.syntaxes.end(); ++syntax)
+        {
+            for (auto multiFrame = options.multiFrames.begin(); multiFrame != options.multiFrames.end(); ++multiFrame)
+            {
+                DicomSeriesOptions seriesOptions;
+                seriesOptions.syntax = *syntax;
+                seriesOptions.multiFrame = *multiFrame;
+                seriesOptions.dicomdir = options.dicomdir;
+                std::stringstream prefix;
+                prefix << GetPhantomShapeName(options.shape) << "-" << GetPixelTypeName(*pixelType) << "-"
+                       << GetDicomSyntaxName(*syntax) << "-" << (*multiFrame ? "multi" : "single") << "-"
+                       << options.width << "x" << options.height << "x" << options.depth;
+
+                std::vector<BenchResult> results;
+                try
+                {
+                    if (!RunSeries(phantom, seriesOptions, options.outDir + "/" + prefix.str(), options, logger, results))
+                    {
+                        passed = false;
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << prefix.str() << " : " << e.what() << "\n";
+                    passed = false;
+                }
+                PrintResults(prefix.str(), results);
+            }
+        }
+    }
+    std::cout << (passed ? "All checks passed\n" : "Checks FAILED\n");
+    return passed ? 0 : 1;
+}
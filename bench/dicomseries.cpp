@@ -0,0 +1,302 @@
+#include "dicomseries.h"
+
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcuid.h>
+#include <dcmtk/dcmdata/dcddirif.h>
+#include <dcmtk/dcmdata/dcrleerg.h>
+#include <dcmtk/dcmdata/dcrledrg.h>
+#include <dcmtk/dcmdata/dcrlerp.h>
+#include <dcmtk/dcmjpeg/djencode.h>
+#include <dcmtk/dcmjpeg/djdecode.h>
+#include <dcmtk/dcmjpeg/djrplol.h>
+
+#include <initializer_list>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <mutex>
+
+namespace DicomToStl
+{
+
+namespace
+{
+E_TransferSyntax GetTransferSyntax(DicomSyntax syntax)
+{
+    switch (syntax)
+    {
+    case DICOM_SYNTAX_RLE:
+        return EXS_RLELossless;
+    case DICOM_SYNTAX_JPEG_LOSSLESS:
+        return EXS_JPEGProcess14SV1;
+    default:
+        return EXS_LittleEndianExplicit;
+    }
+}
+
+int GetBitsAllocated(PixelType pixelType)
+{
+    switch (pixelType)
+    {
+    case PIXEL_UINT8:
+    case PIXEL_INT8:
+        return 8;
+    case PIXEL_UINT16:
+    case PIXEL_INT16:
+        return 16;
+    default:
+        throw std::runtime_error(std::string("Can't write ") + GetPixelTypeName(pixelType) + " pixels to DICOM");
+    }
+}
+
+// Multi-valued decimal string, the values separated by backslashes
+std::string MakeDecimalString(std::initializer_list<float> values)
+{
+    std::stringstream buf;
+    for (auto i = values.begin(); i != values.end(); ++i)
+    {
+        buf << (i == values.begin() ? "" : "\\") << *i;
+    }
+    return buf.str();
+}
+
+// Name of the n-th file, at most 8 upper case characters as a DICOMDIR requires
+std::string MakeFileName(int index, bool dicomdir)
+{
+    std::stringstream buf;
+    buf << "IM" << std::setw(6) << std::setfill('0') << index << (dicomdir ? "" : ".dcm");
+    return buf.str();
+}
+
+void PutString(DcmDataset* dataset, const DcmTagKey& tag, const std::string& value)
+{
+    if (dataset->putAndInsertString(tag, value.c_str()).bad())
+    {
+        throw std::runtime_error("Can't set a DICOM attribute to " + value);
+    }
+}
+
+// Attributes shared by every file of the series
+struct SeriesInfo
+{
+    std::string studyUid;
+    std::string seriesUid;
+    int width;
+    int height;
+    PixelType pixelType;
+    Vec3 spacing;
+};
+
+void PutImageAttributes(DcmDataset* dataset, const SeriesInfo& info, int instance, int frames, float z)
+{
+    char uid[100];
+    int bits = GetBitsAllocated(info.pixelType);
+    bool isSigned = info.pixelType == PIXEL_INT8 || info.pixelType == PIXEL_INT16;
+    std::stringstream number;
+    number << instance;
+
+    if (frames > 1)
+    {
+        std::stringstream framesCount;
+        framesCount << frames;
+        PutString(dataset, DCM_SOPClassUID, bits == 8 ? UID_MultiframeGrayscaleByteSecondaryCaptureImageStorage
+                                                      : UID_MultiframeGrayscaleWordSecondaryCaptureImageStorage);
+        PutString(dataset, DCM_NumberOfFrames, framesCount.str());
+        dataset->putAndInsertTagKey(DCM_FrameIncrementPointer, DCM_SpacingBetweenSlices);
+    }
+    else
+    {
+        PutString(dataset, DCM_SOPClassUID, UID_CTImageStorage);
+    }
+    PutString(dataset, DCM_SOPInstanceUID, dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT));
+    PutString(dataset, DCM_StudyInstanceUID, info.studyUid);
+    PutString(dataset, DCM_SeriesInstanceUID, info.seriesUid);
+    PutString(dataset, DCM_PatientName, "Phantom^Synthetic");
+    PutString(dataset, DCM_PatientID, "PHANTOM");
+    PutString(dataset, DCM_StudyDate, "20000101");
+    PutString(dataset, DCM_StudyTime, "000000");
+    PutString(dataset, DCM_StudyID, "1");
+    PutString(dataset, DCM_AccessionNumber, "1");
+    PutString(dataset, DCM_Modality, frames > 1 ? "OT" : "CT");
+    PutString(dataset, DCM_SeriesNumber, "1");
+    PutString(dataset, DCM_InstanceNumber, number.str());
+    PutString(dataset, DCM_ImageOrientationPatient, "1\\0\\0\\0\\1\\0");
+    PutString(dataset, DCM_ImagePositionPatient, MakeDecimalString({ 0.f, 0.f, z }));
+    // Row spacing first, then the column spacing
+    PutString(dataset, DCM_PixelSpacing, MakeDecimalString({ info.spacing.y, info.spacing.x }));
+    PutString(dataset, DCM_SliceThickness, MakeDecimalString({ info.spacing.z }));
+    PutString(dataset, DCM_SpacingBetweenSlices, MakeDecimalString({ info.spacing.z }));
+
+    dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1);
+    PutString(dataset, DCM_PhotometricInterpretation, "MONOCHROME2");
+    dataset->putAndInsertUint16(DCM_Rows, static_cast<Uint16>(info.height));
+    dataset->putAndInsertUint16(DCM_Columns, static_cast<Uint16>(info.width));
+    dataset->putAndInsertUint16(DCM_BitsAllocated, static_cast<Uint16>(bits));
+    dataset->putAndInsertUint16(DCM_BitsStored, static_cast<Uint16>(bits));
+    dataset->putAndInsertUint16(DCM_HighBit, static_cast<Uint16>(bits - 1));
+    dataset->putAndInsertUint16(DCM_PixelRepresentation, isSigned ? 1 : 0);
+}
+
+void PutPixels(DcmDataset* dataset, const SeriesInfo& info, const std::vector<const void*>& slices)
+{
+    size_t pixels = static_cast<size_t>(info.width) * info.height;
+    OFCondition status;
+    if (GetBitsAllocated(info.pixelType) == 8)
+    {
+        std::vector<Uint8> data(pixels * slices.size());
+        for (size_t i = 0; i < slices.size(); ++i)
+        {
+            const Uint8* slice = static_cast<const Uint8*>(slices[i]);
+            std::copy(slice, slice + pixels, data.begin() + i * pixels);
+        }
+        status = dataset->putAndInsertUint8Array(DCM_PixelData, data.data(), static_cast<unsigned long>(data.size()));
+    }
+    else
+    {
+        std::vector<Uint16> data(pixels * slices.size());
+        for (size_t i = 0; i < slices.size(); ++i)
+        {
+            const Uint16* slice = static_cast<const Uint16*>(slices[i]);
+            std::copy(slice, slice + pixels, data.begin() + i * pixels);
+        }
+        status = dataset->putAndInsertUint16Array(DCM_PixelData, data.data(), static_cast<unsigned long>(data.size()));
+    }
+    if (status.bad())
+    {
+        throw std::runtime_error(std::string("Can't set the pixel data : ") + status.text());
+    }
+}
+
+void SaveFile(DcmFileFormat& fileformat, DicomSyntax syntax, const std::string& fileName)
+{
+    E_TransferSyntax xfer = GetTransferSyntax(syntax);
+    DcmDataset* dataset = fileformat.getDataset();
+    OFCondition status;
+    if (syntax == DICOM_SYNTAX_RLE)
+    {
+        DcmRLERepresentationParameter params;
+        status = dataset->chooseRepresentation(xfer, &params);
+    }
+    else if (syntax == DICOM_SYNTAX_JPEG_LOSSLESS)
+    {
+        // First order prediction without point transform, the usual lossless JPEG
+        DJ_RPLossless params(1, 0);
+        status = dataset->chooseRepresentation(xfer, &params);
+    }
+    if (status.bad() || !dataset->canWriteXfer(xfer))
+    {
+        throw std::runtime_error("Can't encode " + fileName + " as " + GetDicomSyntaxName(syntax));
+    }
+    status = fileformat.saveFile(fileName.c_str(), xfer);
+    if (status.bad())
+    {
+        throw std::runtime_error("Can't write " + fileName + " : " + status.text());
+    }
+}
+}
+
+bool ParseDicomSyntax(const std::string& name, DicomSyntax& syntax)
+{
+    for (int i = DICOM_SYNTAX_RAW; i <= DICOM_SYNTAX_JPEG_LOSSLESS; ++i)
+    {
+        if (name == GetDicomSyntaxName(static_cast<DicomSyntax>(i)))
+        {
+            syntax = static_cast<DicomSyntax>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetDicomSyntaxName(DicomSyntax syntax)
+{
+    switch (syntax)
+    {
+    case DICOM_SYNTAX_RLE:
+        return "rle";
+    case DICOM_SYNTAX_JPEG_LOSSLESS:
+        return "jpegll";
+    default:
+        return "raw";
+    }
+}
+
+void RegisterDicomCodecs()
+{
+    static std::once_flag registered;
+    std::call_once(registered, []()
+    {
+        DcmRLEEncoderRegistration::registerCodecs();
+        DcmRLEDecoderRegistration::registerCodecs();
+        DJEncoderRegistration::registerCodecs();
+        DJDecoderRegistration::registerCodecs();
+    });
+}
+
+std::vector<std::string> WriteDicomSeries(const Phantom& phantom, const DicomSeriesOptions& options, const std::string& dirName)
+{
+    RegisterDicomCodecs();
+
+    const MemoryVolume& volume = phantom.GetVolume();
+    char uid[100];
+    SeriesInfo info;
+    info.studyUid = dcmGenerateUniqueIdentifier(uid, SITE_STUDY_UID_ROOT);
+    info.seriesUid = dcmGenerateUniqueIdentifier(uid, SITE_SERIES_UID_ROOT);
+    info.width = volume.width;
+    info.height = volume.height;
+    info.pixelType = volume.pixelType;
+    info.spacing = volume.spacing;
+
+    std::string slash = dirName.empty() || dirName[dirName.size() - 1] == '/' ? "" : "/";
+    std::vector<std::string> names;
+    int filesCount = options.multiFrame ? 1 : static_cast<int>(volume.slices.size());
+    for (int i = 0; i < filesCount; ++i)
+    {
+        DcmFileFormat fileformat;
+        DcmDataset* dataset = fileformat.getDataset();
+        std::vector<const void*> slices;
+        if (options.multiFrame)
+        {
+            slices = volume.slices;
+        }
+        else
+        {
+            slices.push_back(volume.slices[i]);
+        }
+        PutImageAttributes(dataset, info, i + 1, static_cast<int>(slices.size()), i * info.spacing.z);
+        PutPixels(dataset, info, slices);
+        names.push_back(MakeFileName(i + 1, options.dicomdir));
+        SaveFile(fileformat, options.syntax, dirName + slash + names.back());
+    }
+
+    std::vector<std::string> files;
+    for (auto name = names.begin(); name != names.end(); ++name)
+    {
+        files.push_back(dirName + slash + *name);
+    }
+    if (options.dicomdir)
+    {
+        std::string dicomdirName = dirName + slash + "DICOMDIR";
+        DicomDirInterface dicomdir;
+        // The general purpose profile only allows uncompressed files
+        dicomdir.disableTransferSyntaxCheck();
+        OFCondition status = dicomdir.createNewDicomDir(DicomDirInterface::AP_GeneralPurpose, dicomdirName.c_str(), "PHANTOM");
+        for (auto name = names.begin(); name != names.end() && status.good(); ++name)
+        {
+            status = dicomdir.addDicomFile(name->c_str(), dirName.c_str());
+        }
+        if (status.good())
+        {
+            status = dicomdir.writeDicomDir();
+        }
+        if (status.bad())
+        {
+            throw std::runtime_error("Can't write " + dicomdirName + " : " + status.text());
+        }
+        files.push_back(dicomdirName);
+    }
+    return files;
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef _DICOM_SERIES_H_
+#define _DICOM_SERIES_H_
+
+#include "phantom.h"
+
+#include <string>
+#include <vector>
+
+namespace DicomToStl
+{
+
+enum DicomSyntax
+{
+    DICOM_SYNTAX_RAW,
+    DICOM_SYNTAX_RLE,
+    DICOM_SYNTAX_JPEG_LOSSLESS
+};
+
+// Accepts "raw", "rle" or "jpegll"
+bool ParseDicomSyntax(const std::string& name, DicomSyntax& syntax);
+
+const char* GetDicomSyntaxName(DicomSyntax syntax);
+
+struct DicomSeriesOptions
+{
+    DicomSeriesOptions() : syntax(DICOM_SYNTAX_RAW), multiFrame(false), dicomdir(false) {}
+    DicomSyntax syntax;
+    // One file holding every slice instead of a file per slice
+    bool multiFrame;
+    // Adds a DICOMDIR, the files are then named without an extension as the
+    // DICOM file IDs have to be
+    bool dicomdir;
+};
+
+// Registers the RLE and JPEG encoders and decoders of DCMTK, once per process
+void RegisterDicomCodecs();
+
+// Writes the phantom into the folder as a CT-like series, 8 or 16 bit after its
+// pixel type, signed or unsigned; int32 and float32 phantoms are not DICOM pixels.
+// The pixels round trip exactly, every syntax is lossless.
+// Returns the files written, the DICOMDIR last; throws std::runtime_error on failure.
+std::vector<std::string> WriteDicomSeries(const Phantom& phantom, const DicomSeriesOptions& options, const std::string& dirName);
+
+}
+
+#endif
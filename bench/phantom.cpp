@@ -0,0 +1,244 @@
+#include "phantom.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+namespace
+{
+const double PI = 3.14159265358979323846;
+
+double Clamp(double value)
+{
+    return std::min(std::max(value, 0.), 1.);
+}
+
+// Density rising from 0 outside to 1 inside over a band of the given width around distance 0
+double Edge(double distance, double width)
+{
+    return Clamp(0.5 + distance / width);
+}
+
+double TorusDistance(double a, double b, double c, double majorRadius, double minorRadius)
+{
+    double ring = std::sqrt(a * a + b * b) - majorRadius;
+    return minorRadius - std::sqrt(ring * ring + c * c);
+}
+
+// Uniform noise from -1 to 1, a hash of the voxel so it does not depend on the order of generation
+double Noise(int x, int y, int z)
+{
+    uint64_t h = static_cast<uint64_t>(x) * 0x9E3779B97F4A7C15ull ^ static_cast<uint64_t>(y) * 0xBF58476D1CE4E5B9ull ^
+                 static_cast<uint64_t>(z) * 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return (h & 0xFFFFFF) / double(0x7FFFFF) - 1.;
+}
+
+// Density from 0 to 1 at the normalized position u, v, w from -1 to 1
+double GetDensity(PhantomShape shape, double u, double v, double w, int x, int y, int z)
+{
+    switch (shape)
+    {
+    case PHANTOM_TORI:
+    {
+        double d = TorusDistance(u, v, w, 0.7, 0.12);
+        d = std::max(d, TorusDistance(u, w, v, 0.45, 0.1));
+        d = std::max(d, TorusDistance(v, w, u, 0.2, 0.08));
+        return Edge(d, 0.1);
+    }
+    case PHANTOM_GYROID:
+    {
+        const double k = 2. * PI * 3.;
+        double g = std::sin(k * u) * std::cos(k * v) + std::sin(k * v) * std::cos(k * w) + std::sin(k * w) * std::cos(k * u);
+        return Clamp(0.5 + g / 3.);
+    }
+    case PHANTOM_CT:
+    {
+        double body = 1. - std::sqrt(u * u / 0.64 + v * v / 0.36 + w * w / 0.9);
+        double radius = std::sqrt(u * u + v * v);
+        double bone = 0.03 - std::fabs(radius - 0.4);
+        double organ = 0.15 - std::sqrt((u - 0.2) * (u - 0.2) + (v + 0.1) * (v + 0.1) + w * w);
+        double density = 0.45 * Edge(body, 0.05);
+        density = std::max(density, 0.85 * Edge(bone, 0.02) * Edge(body, 0.05));
+        density = std::max(density, 0.6 * Edge(organ, 0.05));
+        return Clamp(density + (density > 0.1 ? 0.08 * Noise(x, y, z) : 0.));
+    }
+    default:
+        return Edge(0.7 - std::sqrt(u * u + v * v + w * w), 0.5);
+    }
+}
+
+size_t GetPixelSize(PixelType pixelType)
+{
+    switch (pixelType)
+    {
+    case PIXEL_UINT8:
+    case PIXEL_INT8:
+        return 1;
+    case PIXEL_UINT16:
+    case PIXEL_INT16:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+template<class T>
+void StorePixel(char* out, double value)
+{
+    T pixel = static_cast<T>(std::floor(value + 0.5));
+    std::memcpy(out, &pixel, sizeof(T));
+}
+}
+
+bool ParsePhantomShape(const std::string& name, PhantomShape& shape)
+{
+    for (int i = PHANTOM_SPHERE; i <= PHANTOM_CT; ++i)
+    {
+        if (name == GetPhantomShapeName(static_cast<PhantomShape>(i)))
+        {
+            shape = static_cast<PhantomShape>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetPhantomShapeName(PhantomShape shape)
+{
+    switch (shape)
+    {
+    case PHANTOM_TORI:
+        return "tori";
+    case PHANTOM_GYROID:
+        return "gyroid";
+    case PHANTOM_CT:
+        return "ct";
+    default:
+        return "sphere";
+    }
+}
+
+bool ParsePixelType(const std::string& name, PixelType& pixelType)
+{
+    for (int i = PIXEL_UINT8; i <= PIXEL_FLOAT32; ++i)
+    {
+        if (name == GetPixelTypeName(static_cast<PixelType>(i)))
+        {
+            pixelType = static_cast<PixelType>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetPixelTypeName(PixelType pixelType)
+{
+    switch (pixelType)
+    {
+    case PIXEL_UINT8:
+        return "uint8";
+    case PIXEL_INT8:
+        return "int8";
+    case PIXEL_UINT16:
+        return "uint16";
+    case PIXEL_INT32:
+        return "int32";
+    case PIXEL_FLOAT32:
+        return "float32";
+    default:
+        return "int16";
+    }
+}
+
+Phantom::Phantom(PhantomShape shape, int width, int height, int depth, PixelType pixelType)
+    : minValue(-1000.)
+    , maxValue(1000.)
+{
+    switch (pixelType)
+    {
+    case PIXEL_UINT8:
+        this->minValue = 0.;
+        this->maxValue = 250.;
+        break;
+    case PIXEL_INT8:
+        this->minValue = -120.;
+        this->maxValue = 120.;
+        break;
+    case PIXEL_UINT16:
+        this->minValue = 0.;
+        this->maxValue = 2000.;
+        break;
+    default:
+        break;
+    }
+
+    this->volume.width = width;
+    this->volume.height = height;
+    this->volume.pixelType = pixelType;
+    this->volume.spacing = Vec3(1.f, 1.f, 1.f);
+    size_t pixelSize = GetPixelSize(pixelType);
+    this->slices.resize(depth, std::vector<char>(static_cast<size_t>(width) * height * pixelSize));
+    for (int z = 0; z < depth; ++z)
+    {
+        double w = depth > 1 ? 2. * z / (depth - 1) - 1. : 0.;
+        char* out = this->slices[z].data();
+        for (int y = 0; y < height; ++y)
+        {
+            double v = height > 1 ? 2. * y / (height - 1) - 1. : 0.;
+            for (int x = 0; x < width; ++x, out += pixelSize)
+            {
+                double u = width > 1 ? 2. * x / (width - 1) - 1. : 0.;
+                double value = GetValue(GetDensity(shape, u, v, w, x, y, z));
+                switch (pixelType)
+                {
+                case PIXEL_UINT8:
+                    StorePixel<uint8_t>(out, value);
+                    break;
+                case PIXEL_INT8:
+                    StorePixel<int8_t>(out, value);
+                    break;
+                case PIXEL_UINT16:
+                    StorePixel<uint16_t>(out, value);
+                    break;
+                case PIXEL_INT16:
+                    StorePixel<int16_t>(out, value);
+                    break;
+                case PIXEL_INT32:
+                    StorePixel<int32_t>(out, value);
+                    break;
+                case PIXEL_FLOAT32:
+                {
+                    float pixel = static_cast<float>(value);
+                    std::memcpy(out, &pixel, sizeof(pixel));
+                    break;
+                }
+                }
+            }
+        }
+        this->volume.slices.push_back(this->slices[z].data());
+    }
+}
+
+const MemoryVolume& Phantom::GetVolume() const
+{
+    return this->volume;
+}
+
+int Phantom::GetIsoLevel() const
+{
+    return static_cast<int>(std::floor(GetValue(0.5) + 0.5));
+}
+
+double Phantom::GetValue(double f) const
+{
+    return this->minValue + f * (this->maxValue - this->minValue);
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef _PHANTOM_H_
+#define _PHANTOM_H_
+
+#include "slicesource.h"
+
+#include <string>
+#include <vector>
+
+namespace DicomToStl
+{
+
+enum PhantomShape
+{
+    PHANTOM_SPHERE,
+    PHANTOM_TORI,
+    PHANTOM_GYROID,
+    PHANTOM_CT
+};
+
+// Accepts "sphere", "tori", "gyroid" or "ct"
+bool ParsePhantomShape(const std::string& name, PhantomShape& shape);
+
+const char* GetPhantomShapeName(PhantomShape shape);
+
+// Accepts "uint8", "int8", "uint16", "int16", "int32" or "float32"
+bool ParsePixelType(const std::string& name, PixelType& pixelType);
+
+const char* GetPixelTypeName(PixelType pixelType);
+
+// Analytic volume generated in memory, the same arguments give the same pixels
+// on every machine. Values span the range of the pixel type the way CT values do:
+// about -1000 to 1000 for the signed types, shifted or scaled down for the others.
+//   sphere - smooth ball in the middle of the volume
+//   tori   - three nested tori in perpendicular planes
+//   gyroid - triply periodic surface filling the whole volume, many triangles
+//   ct     - body, bone ring and organs with partial volume edges and noise
+class Phantom
+{
+public:
+    Phantom(PhantomShape shape, int width, int height, int depth, PixelType pixelType);
+    const MemoryVolume& GetVolume() const;
+    // Halfway through the value range, on the surface of every shape
+    int GetIsoLevel() const;
+    // Pixel value of the normalized density f from 0 to 1
+    double GetValue(double f) const;
+private:
+    Phantom(const Phantom&);
+    Phantom& operator=(const Phantom&);
+private:
+    MemoryVolume volume;
+    std::vector<std::vector<char> > slices;
+    double minValue;
+    double maxValue;
+};
+
+}
+
+#endif
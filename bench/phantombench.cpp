@@ -0,0 +1,539 @@
+// Benchmarks of the extraction kernels, the pipeline and the mesh writers on
+// analytic phantoms, so no patient data is needed on the benchmark machines.
+// Every run checks that the kernels and the pipeline agree on the geometry, and
+// with --check that the checksums match a baseline saved by --save, so an
+// optimization can't change the output unnoticed.
+
+#include "phantom.h"
+#include "dicomtostl.h"
+#include "timer.h"
+
+#include <dcmtk/oflog/oflog.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+using namespace DicomToStl;
+
+namespace
+{
+
+struct BenchOptions
+{
+    BenchOptions() : width(256), height(256), depth(128), repeat(3), threads(2), isoLevel(0), hasIsoLevel(false), outDir(".") {}
+    std::vector<PhantomShape> shapes;
+    std::vector<PixelType> pixelTypes;
+    int width;
+    int height;
+    int depth;
+    int repeat;
+    // Read and grid threads of the pipeline benchmark
+    int threads;
+    int isoLevel;
+    bool hasIsoLevel;
+    std::string outDir;
+    std::string saveFile;
+    std::string checkFile;
+};
+
+struct BenchResult
+{
+    BenchResult() : ms(0.), cells(0), triangles(0), bytes(0), checksum(0), hasChecksum(false) {}
+    std::string name;
+    // Best time of the repeats
+    double ms;
+    uint64_t cells;
+    uint64_t triangles;
+    uint64_t bytes;
+    uint64_t checksum;
+    bool hasChecksum;
+};
+
+const uint64_t FNV_OFFSET = 0xCBF29CE484222325ull;
+const uint64_t FNV_PRIME = 0x100000001B3ull;
+
+uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t HashFile(const std::string& fileName)
+{
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    std::vector<char> block(1 << 20);
+    uint64_t hash = FNV_OFFSET;
+    while (in.read(block.data(), block.size()) || in.gcount() > 0)
+    {
+        hash = HashBytes(hash, block.data(), static_cast<size_t>(in.gcount()));
+    }
+    return hash;
+}
+
+// Hash of the triangles in the order they come, the geometry check of the kernels
+class ChecksumMeshWriter : public MeshWriter
+{
+public:
+    ChecksumMeshWriter() : hash(FNV_OFFSET) {}
+    virtual void Write(const Triangle& tri)
+    {
+        this->hash = HashBytes(this->hash, &std::get<0>(tri), sizeof(Vec3));
+        this->hash = HashBytes(this->hash, &std::get<1>(tri), sizeof(Vec3));
+        this->hash = HashBytes(this->hash, &std::get<2>(tri), sizeof(Vec3));
+        ++this->triCount;
+    }
+    virtual void Close()
+    {
+    }
+    uint64_t GetChecksum() const
+    {
+        return this->hash;
+    }
+private:
+    uint64_t hash;
+};
+
+// Fastest of the repeats, body returns the milliseconds it measured itself
+double BestOf(int repeat, std::function<double (void)> body)
+{
+    double best = 0.;
+    for (int i = 0; i < repeat; ++i)
+    {
+        double ms = body();
+        best = i == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+bool ParseSize(const std::string& text, int& width, int& height, int& depth)
+{
+    char x1 = 0;
+    char x2 = 0;
+    std::istringstream in(text);
+    return (in >> width >> x1 >> height >> x2 >> depth) && x1 == 'x' && x2 == 'x' &&
+           width > 1 && height > 1 && depth > 1;
+}
+
+void PrintUsage()
+{
+    std::cout << "Usage: phantombench [options]\n"
+              << "  --phantom <name>   sphere, tori, gyroid, ct or all (default all)\n"
+              << "  --size <WxHxD>     volume size (default 256x256x128)\n"
+              << "  --pixel <type>     uint8, int8, uint16, int16, int32, float32 or all (default int16)\n"
+              << "  --isolevel <n>     iso level (default halfway through the pixel range)\n"
+              << "  --repeat <n>       runs of every benchmark, the best is reported (default 3)\n"
+              << "  --threads <n>      read and grid threads of the pipeline benchmark (default 2)\n"
+              << "  --out <dir>        folder of the writer benchmark files (default .)\n"
+              << "  --save <file>      save the checksums as a baseline\n"
+              << "  --check <file>     compare the checksums with a saved baseline\n";
+}
+
+bool ParseOptions(int argc, char* argv[], BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+        {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--phantom")
+        {
+            PhantomShape shape = PHANTOM_SPHERE;
+            if (value == "all")
+            {
+                options.shapes.clear();
+                for (int s = PHANTOM_SPHERE; s <= PHANTOM_CT; ++s)
+                {
+                    options.shapes.push_back(static_cast<PhantomShape>(s));
+                }
+            }
+            else if (ParsePhantomShape(value, shape))
+            {
+                options.shapes.push_back(shape);
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (arg == "--pixel")
+        {
+            PixelType pixelType = PIXEL_INT16;
+            if (value == "all")
+            {
+                options.pixelTypes.clear();
+                for (int p = PIXEL_UINT8; p <= PIXEL_FLOAT32; ++p)
+                {
+                    options.pixelTypes.push_back(static_cast<PixelType>(p));
+                }
+            }
+            else if (ParsePixelType(value, pixelType))
+            {
+                options.pixelTypes.push_back(pixelType);
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (arg == "--size")
+        {
+            if (!ParseSize(value, options.width, options.height, options.depth))
+            {
+                return false;
+            }
+        }
+        else if (arg == "--isolevel")
+        {
+            options.isoLevel = std::atoi(value.c_str());
+            options.hasIsoLevel = true;
+        }
+        else if (arg == "--repeat")
+        {
+            options.repeat = std::max(1, std::atoi(value.c_str()));
+        }
+        else if (arg == "--threads")
+        {
+            options.threads = std::max(1, std::atoi(value.c_str()));
+        }
+        else if (arg == "--out")
+        {
+            options.outDir = value;
+        }
+        else if (arg == "--save")
+        {
+            options.saveFile = value;
+        }
+        else if (arg == "--check")
+        {
+            options.checkFile = value;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if (options.shapes.empty())
+    {
+        for (int s = PHANTOM_SPHERE; s <= PHANTOM_CT; ++s)
+        {
+            options.shapes.push_back(static_cast<PhantomShape>(s));
+        }
+    }
+    if (options.pixelTypes.empty())
+    {
+        options.pixelTypes.push_back(PIXEL_INT16);
+    }
+    return true;
+}
+
+struct WriterMode
+{
+    const char* name;
+    MeshFormat format;
+    OutputCompression compression;
+};
+
+const WriterMode WRITER_MODES[] =
+{
+    { "write-stl-binary", MESH_FORMAT_STL_BINARY, OUTPUT_COMPRESSION_NONE },
+    { "write-stl-ascii", MESH_FORMAT_STL_ASCII, OUTPUT_COMPRESSION_NONE },
+    { "write-ply", MESH_FORMAT_PLY, OUTPUT_COMPRESSION_NONE },
+    { "write-obj", MESH_FORMAT_OBJ, OUTPUT_COMPRESSION_NONE },
+    { "write-qmesh", MESH_FORMAT_COMPACT, OUTPUT_COMPRESSION_NONE },
+#ifdef DICOMTOSTL_WITH_ZLIB
+    { "write-stl-binary-gzip", MESH_FORMAT_STL_BINARY, OUTPUT_COMPRESSION_GZIP },
+#endif
+#ifdef DICOMTOSTL_WITH_ZSTD
+    { "write-stl-binary-zstd", MESH_FORMAT_STL_BINARY, OUTPUT_COMPRESSION_ZSTD },
+#endif
+};
+
+// Runs every benchmark on one phantom, false when the kernels disagree
+bool RunPhantom(const Phantom& phantom, int isoLevel, const BenchOptions& options, OFLogger& logger, std::vector<BenchResult>& results)
+{
+    MemorySliceSource source(phantom.GetVolume());
+    int dx = source.GetWidth();
+    int dy = source.GetHeight();
+    int slicesCount = source.GetSlicesCount();
+    GridAxes axes;
+    PatientTransform transform;
+    MakeGridFrame(dx, dy, source.GetSpacing(), source.GetGeometry(), axes, transform);
+    uint64_t pairCells = static_cast<uint64_t>(dx - 1) * (dy - 1);
+    uint64_t cellsCount = pairCells * (slicesCount - 1);
+    std::vector<std::vector<int> > images(slicesCount, std::vector<int>(static_cast<size_t>(dx) * dy));
+    std::vector<GridCell> cells(pairCells);
+    bool agree = true;
+
+    BenchResult decode;
+    decode.name = "decode";
+    decode.bytes = source.GetSliceBytes(0) * slicesCount;
+    decode.ms = BestOf(options.repeat, [&]() -> double
+    {
+        cpptask::Timer timer;
+        std::string error;
+        for (int z = 0; z < slicesCount; ++z)
+        {
+            source.ReadSlice(z, images[z], error);
+        }
+        return timer.End();
+    });
+    decode.checksum = FNV_OFFSET;
+    for (int z = 0; z < slicesCount; ++z)
+    {
+        decode.checksum = HashBytes(decode.checksum, images[z].data(), images[z].size() * sizeof(int));
+    }
+    decode.hasChecksum = true;
+    results.push_back(decode);
+
+    BenchResult classify;
+    classify.name = "classify";
+    classify.cells = cellsCount;
+    classify.ms = BestOf(options.repeat, [&]() -> double
+    {
+        cpptask::Timer timer;
+        uint64_t triangles = 0;
+        for (int z = 0; z + 1 < slicesCount; ++z)
+        {
+            triangles += CountSliceTriangles(images[z], images[z + 1], dx, dy, isoLevel);
+        }
+        classify.triangles = triangles;
+        return timer.End();
+    });
+    results.push_back(classify);
+
+    BenchResult grid;
+    grid.name = "grid";
+    grid.cells = cellsCount;
+    grid.ms = BestOf(options.repeat, [&]() -> double
+    {
+        cpptask::Timer timer;
+        for (int z = 0; z + 1 < slicesCount; ++z)
+        {
+            BuildGridCells(cells, axes, z, images[z], images[z + 1]);
+        }
+        return timer.End();
+    });
+    results.push_back(grid);
+
+    // The triangles of the kernels are kept for the writers
+    MemoryMeshWriter mesh;
+    BenchResult triangulate;
+    triangulate.name = "triangulate";
+    triangulate.cells = cellsCount;
+    triangulate.hasChecksum = true;
+    triangulate.ms = BestOf(options.repeat, [&]() -> double
+    {
+        ChecksumMeshWriter checksum;
+        double ms = 0.;
+        for (int z = 0; z + 1 < slicesCount; ++z)
+        {
+            BuildGridCells(cells, axes, z, images[z], images[z + 1]);
+            cpptask::Timer timer;
+            std::for_each(cells.begin(), cells.end(), [&](const GridCell& cell)
+            {
+                TriangulateGridCell(cell, isoLevel, transform, checksum);
+            });
+            ms += timer.End();
+        }
+        triangulate.triangles = checksum.GetTrianglesCount();
+        triangulate.checksum = checksum.GetChecksum();
+        return ms;
+    });
+    results.push_back(triangulate);
+    for (int z = 0; z + 1 < slicesCount; ++z)
+    {
+        BuildGridCells(cells, axes, z, images[z], images[z + 1]);
+        std::for_each(cells.begin(), cells.end(), [&](const GridCell& cell)
+        {
+            TriangulateGridCell(cell, isoLevel, transform, mesh);
+        });
+    }
+
+    BenchResult pipeline;
+    pipeline.name = "pipeline";
+    pipeline.cells = cellsCount;
+    pipeline.hasChecksum = true;
+    PipelineOptions pipelineOptions;
+    pipelineOptions.readThreads = options.threads;
+    pipelineOptions.gridThreads = options.threads;
+    pipeline.ms = BestOf(options.repeat, [&]() -> double
+    {
+        ChecksumMeshWriter checksum;
+        cpptask::Timer timer;
+        TriangulateVolume(source, isoLevel, checksum, pipelineOptions, logger, nullptr);
+        double ms = timer.End();
+        pipeline.triangles = checksum.GetTrianglesCount();
+        pipeline.checksum = checksum.GetChecksum();
+        return ms;
+    });
+    results.push_back(pipeline);
+
+    if (classify.triangles != triangulate.triangles)
+    {
+        std::cerr << "classify counted " << classify.triangles << " triangles, triangulate emitted " << triangulate.triangles << "\n";
+        agree = false;
+    }
+    if (pipeline.checksum != triangulate.checksum || pipeline.triangles != triangulate.triangles)
+    {
+        std::cerr << "pipeline geometry differs from the kernels\n";
+        agree = false;
+    }
+
+    const Triangles& triangles = mesh.GetTriangles();
+    for (size_t i = 0; i < sizeof(WRITER_MODES) / sizeof(WRITER_MODES[0]); ++i)
+    {
+        const WriterMode& mode = WRITER_MODES[i];
+        OutputOptions output;
+        output.format = mode.format;
+        output.stream.compression = mode.compression;
+        std::string fileName = options.outDir + "/phantombench" + GetMeshFormatExtension(mode.format) + GetCompressionExtension(mode.compression);
+
+        BenchResult write;
+        write.name = mode.name;
+        write.triangles = triangles.size();
+        write.hasChecksum = true;
+        write.ms = BestOf(options.repeat, [&]() -> double
+        {
+            cpptask::Timer timer;
+            std::unique_ptr<MeshWriter> meshWriter = CreateMeshWriter(fileName, output);
+            std::for_each(triangles.begin(), triangles.end(), [&](const Triangle& tri)
+            {
+                meshWriter->Write(tri);
+            });
+            meshWriter->Close();
+            write.bytes = meshWriter->GetBytesWritten();
+            return timer.End();
+        });
+        write.checksum = HashFile(fileName);
+        std::remove(fileName.c_str());
+        results.push_back(write);
+    }
+    return agree;
+}
+
+void PrintResults(const std::string& prefix, const std::vector<BenchResult>& results)
+{
+    std::cout << std::fixed << std::setprecision(1);
+    for (auto i = results.begin(); i != results.end(); ++i)
+    {
+        double seconds = i->ms / 1000.;
+        std::cout << std::left << std::setw(28) << prefix << std::setw(24) << i->name << std::right
+                  << std::setw(10) << i->ms
+                  << std::setw(12) << (i->cells > 0 && seconds > 0. ? i->cells / seconds / 1e6 : 0.)
+                  << std::setw(12) << (i->triangles > 0 && seconds > 0. ? i->triangles / seconds / 1e6 : 0.)
+                  << std::setw(10) << (i->bytes > 0 && seconds > 0. ? i->bytes / seconds / (1 << 20) : 0.)
+                  << std::setw(12) << i->triangles << "  ";
+        if (i->hasChecksum)
+        {
+            std::cout << std::hex << std::setw(16) << std::setfill('0') << i->checksum << std::dec << std::setfill(' ');
+        }
+        std::cout << "\n";
+    }
+}
+
+bool LoadBaseline(const std::string& fileName, std::map<std::string, uint64_t>& baseline)
+{
+    std::ifstream in(fileName.c_str());
+    std::string key;
+    uint64_t checksum = 0;
+    while (in >> key >> std::hex >> checksum >> std::dec)
+    {
+        baseline[key] = checksum;
+    }
+    return !baseline.empty();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+    OFLog::configure(OFLogger::WARN_LOG_LEVEL);
+    OFLogger logger = OFLog::getLogger("phantombench");
+
+    std::map<std::string, uint64_t> baseline;
+    if (!options.checkFile.empty() && !LoadBaseline(options.checkFile, baseline))
+    {
+        std::cerr << "Can't read the baseline " << options.checkFile << "\n";
+        return 2;
+    }
+
+    std::cout << std::left << std::setw(28) << "phantom" << std::setw(24) << "benchmark" << std::right
+              << std::setw(10) << "ms" << std::setw(12) << "Mcells/s" << std::setw(12) << "Mtri/s"
+              << std::setw(10) << "MB/s" << std::setw(12) << "triangles" << "  checksum\n";
+
+    std::map<std::string, uint64_t> checksums;
+    bool passed = true;
+    for (auto shape = options.shapes.begin(); shape != options.shapes.end(); ++shape)
+    {
+        for (auto pixelType = options.pixelTypes.begin(); pixelType != options.pixelTypes.end(); ++pixelType)
+        {
+            Phantom phantom(*shape, options.width, options.height, options.depth, *pixelType);
+            int isoLevel = options.hasIsoLevel ? options.isoLevel : phantom.GetIsoLevel();
+            std::stringstream prefix;
+            prefix << GetPhantomShapeName(*shape) << "-" << GetPixelTypeName(*pixelType) << "-"
+                   << options.width << "x" << options.height << "x" << options.depth << "-" << isoLevel;
+
+            std::vector<BenchResult> results;
+            if (!RunPhantom(phantom, isoLevel, options, logger, results))
+            {
+                std::cerr << prefix.str() << " : the kernels disagree\n";
+                passed = false;
+            }
+            PrintResults(prefix.str(), results);
+
+            for (auto i = results.begin(); i != results.end(); ++i)
+            {
+                if (!i->hasChecksum)
+                {
+                    continue;
+                }
+                std::string key = prefix.str() + "/" + i->name;
+                checksums[key] = i->checksum;
+                auto expected = baseline.find(key);
+                if (expected != baseline.end() && expected->second != i->checksum)
+                {
+                    std::cerr << key << " : checksum differs from the baseline\n";
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    if (!options.saveFile.empty())
+    {
+        std::ofstream out(options.saveFile.c_str());
+        for (auto i = checksums.begin(); i != checksums.end(); ++i)
+        {
+            out << i->first << " " << std::hex << std::setw(16) << std::setfill('0') << i->second << std::dec << std::setfill(' ') << "\n";
+        }
+        if (!out)
+        {
+            std::cerr << "Can't write the baseline " << options.saveFile << "\n";
+            return 2;
+        }
+    }
+    std::cout << (passed ? "All checks passed\n" : "Checks FAILED\n");
+    return passed ? 0 : 1;
+}
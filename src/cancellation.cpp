@@ -0,0 +1,46 @@
+#include "cancellation.h"
+
+#include <csignal>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// Only lock free atomics may be touched from a signal handler
+std::atomic<CancellationToken*> signalToken(nullptr);
+
+extern "C" void CancelOnSignal(int signal)
+{
+    std::signal(signal, SIG_DFL);
+    CancellationToken* token = signalToken.load();
+    if (token != nullptr)
+    {
+        token->Cancel();
+    }
+}
+}
+
+CancellationToken::CancellationToken()
+    : cancelled(false)
+{
+}
+
+void CancellationToken::Cancel()
+{
+    this->cancelled.store(true);
+}
+
+bool CancellationToken::IsCancelled() const
+{
+    return this->cancelled.load();
+}
+
+void CancelOnSignals(CancellationToken& token)
+{
+    signalToken.store(&token);
+    std::signal(SIGINT, CancelOnSignal);
+    std::signal(SIGTERM, CancelOnSignal);
+}
+
+}
@@ -0,0 +1,30 @@
+#ifndef _CANCELLATION_H_
+#define _CANCELLATION_H_
+
+#include <atomic>
+
+namespace DicomToStl
+{
+
+// Stop request shared by the console poll, the signal handlers and the
+// pipeline stages, which check it between slice pairs
+class CancellationToken
+{
+public:
+    CancellationToken();
+    void Cancel();
+    bool IsCancelled() const;
+private:
+    CancellationToken(const CancellationToken&);
+    CancellationToken& operator=(const CancellationToken&);
+private:
+    std::atomic<bool> cancelled;
+};
+
+// SIGINT and SIGTERM cancel the token instead of killing the process, so the
+// outputs are closed and the checkpoint is kept. A second signal kills as usual.
+void CancelOnSignals(CancellationToken& token);
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "checkpoint.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+const char* CHECKPOINT_MAGIC = "dicomtostl-checkpoint 1";
+}
+
+std::string GetCheckpointFileName(const std::string& fileName)
+{
+    return fileName + ".checkpoint";
+}
+
+Checkpoint::Checkpoint(const std::string& fileName, const std::string& run, int slabsCount)
+    : fileName(fileName)
+    , run(run)
+    , slabs(slabsCount)
+{
+}
+
+bool Checkpoint::Load()
+{
+    std::ifstream file(this->fileName.c_str());
+    std::string line;
+    if (!std::getline(file, line) || line != CHECKPOINT_MAGIC ||
+        !std::getline(file, line) || line != "run " + this->run)
+    {
+        return false;
+    }
+    int slabsCount = 0;
+    std::string key;
+    if (!std::getline(file, line) || !(std::istringstream(line) >> key >> slabsCount) ||
+        slabsCount != static_cast<int>(this->slabs.size()))
+    {
+        return false;
+    }
+
+    std::vector<SlabProgress> loaded(slabsCount);
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+        int slab = -1;
+        int done = 0;
+        SlabProgress progress;
+        if (!(in >> key >> slab >> done >> progress.triangles >> progress.bytes
+                 >> progress.boundsMin.x >> progress.boundsMin.y >> progress.boundsMin.z
+                 >> progress.boundsMax.x >> progress.boundsMax.y >> progress.boundsMax.z) ||
+            slab < 0 || slab >= slabsCount)
+        {
+            return false;
+        }
+        progress.done = done != 0;
+        loaded[slab] = progress;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->slabs.swap(loaded);
+    return true;
+}
+
+int Checkpoint::GetSlabsCount() const
+{
+    return static_cast<int>(this->slabs.size());
+}
+
+SlabProgress Checkpoint::Get(int slab) const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->slabs[slab];
+}
+
+void Checkpoint::Update(int slab, const SlabProgress& progress)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->slabs[slab] = progress;
+    Save();
+}
+
+void Checkpoint::Reset(int slab)
+{
+    Update(slab, SlabProgress());
+}
+
+void Checkpoint::Remove()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::remove(this->fileName.c_str());
+}
+
+void Checkpoint::Save()
+{
+    // Written aside and renamed, an interruption leaves the previous checkpoint intact
+    std::string tempName = this->fileName + ".tmp";
+    {
+        std::ofstream file(tempName.c_str());
+        if (!file)
+        {
+            throw std::invalid_argument("Can't create checkpoint file");
+        }
+        file << CHECKPOINT_MAGIC << "\n"
+             << "run " << this->run << "\n"
+             << "slabs " << this->slabs.size() << "\n"
+             << std::setprecision(9);
+        for (size_t i = 0; i < this->slabs.size(); ++i)
+        {
+            const SlabProgress& progress = this->slabs[i];
+            file << "slab " << i << " " << (progress.done ? 1 : 0) << " " << progress.triangles << " " << progress.bytes << " "
+                 << progress.boundsMin.x << " " << progress.boundsMin.y << " " << progress.boundsMin.z << " "
+                 << progress.boundsMax.x << " " << progress.boundsMax.y << " " << progress.boundsMax.z << "\n";
+        }
+        file.close();
+        if (!file)
+        {
+            throw std::runtime_error("Can't write checkpoint file");
+        }
+    }
+#ifdef _WIN32
+    std::remove(this->fileName.c_str());
+#endif
+    if (std::rename(tempName.c_str(), this->fileName.c_str()) != 0)
+    {
+        throw std::runtime_error("Can't write checkpoint file");
+    }
+}
+
+}
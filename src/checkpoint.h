@@ -0,0 +1,61 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "vec3.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// State of one slab of a conversion split along z
+struct SlabProgress
+{
+    SlabProgress() : done(false), triangles(0), bytes(0) {}
+    bool done;
+    size_t triangles;
+    // Bytes of the slab flushed to disk: the size of its chunk or spool file,
+    // or the end of its records in a mapped file
+    uint64_t bytes;
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+};
+
+// "dir/name.stl" gives "dir/name.stl.checkpoint"
+std::string GetCheckpointFileName(const std::string& fileName);
+
+// Progress of a slabbed conversion kept next to its output. The file is
+// rewritten every time a slab is finished, so an interrupted run can be
+// resumed from the slabs already on disk. The run string identifies the
+// series and the options, a checkpoint of another run is never resumed.
+class Checkpoint
+{
+public:
+    Checkpoint(const std::string& fileName, const std::string& run, int slabsCount);
+    // Loads the progress of an interrupted run, false if there is none for this run
+    bool Load();
+    int GetSlabsCount() const;
+    SlabProgress Get(int slab) const;
+    // Records the slab and rewrites the file, thread safe
+    void Update(int slab, const SlabProgress& progress);
+    // Drops the progress of a slab whose output turned out to be damaged
+    void Reset(int slab);
+    // Deletes the file once the output is complete
+    void Remove();
+private:
+    Checkpoint(const Checkpoint&);
+    Checkpoint& operator=(const Checkpoint&);
+    void Save();
+private:
+    std::string fileName;
+    std::string run;
+    std::vector<SlabProgress> slabs;
+    mutable std::mutex mutex;
+};
+
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "chunkedmesh.h"
+#include "meshreader.h"
+#include "floatformat.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+size_t GetFileNamePos(const std::string& fileName)
+{
+    auto pos = fileName.find_last_of("\\/");
+    return pos == std::string::npos ? 0 : pos + 1;
+}
+
+// Position of the first extension, "name.stl.gz" is split before ".stl.gz"
+size_t GetExtensionPos(const std::string& fileName)
+{
+    auto pos = fileName.find('.', GetFileNamePos(fileName));
+    return pos == std::string::npos ? fileName.size() : pos;
+}
+
+std::string FormatNumber(float value)
+{
+    char buf[FLOAT_FORMAT_MAX_LENGTH];
+    return std::string(buf, FormatFloat(value, buf));
+}
+
+std::string FormatVec3(const Vec3& v)
+{
+    return "[" + FormatNumber(v.x) + ", " + FormatNumber(v.y) + ", " + FormatNumber(v.z) + "]";
+}
+
+std::string EscapeJson(const std::string& str)
+{
+    std::string res;
+    for (auto i = str.begin(); i != str.end(); ++i)
+    {
+        if (*i == '"' || *i == '\\')
+        {
+            res += '\\';
+        }
+        res += *i;
+    }
+    return res;
+}
+
+// Text following "key": in a line of the manifest
+bool FindJsonValue(const std::string& line, const std::string& key, std::string& value)
+{
+    auto pos = line.find("\"" + key + "\"");
+    if (pos == std::string::npos)
+    {
+        return false;
+    }
+    pos = line.find(':', pos);
+    if (pos == std::string::npos)
+    {
+        return false;
+    }
+    value = line.substr(pos + 1);
+    return true;
+}
+
+std::string ParseJsonString(const std::string& value)
+{
+    std::string res;
+    auto pos = value.find('"');
+    for (++pos; pos < value.size() && value[pos] != '"'; ++pos)
+    {
+        if (value[pos] == '\\' && pos + 1 < value.size())
+        {
+            ++pos;
+        }
+        res += value[pos];
+    }
+    return res;
+}
+
+Vec3 ParseJsonVec3(const std::string& value)
+{
+    const char* p = value.c_str() + value.find('[') + 1;
+    char* end = nullptr;
+    Vec3 v;
+    v.x = std::strtof(p, &end);
+    v.y = std::strtof(end + 1, &end);
+    v.z = std::strtof(end + 1, &end);
+    return v;
+}
+}
+
+std::string GetChunkFileName(const std::string& fileName, size_t index)
+{
+    size_t pos = GetExtensionPos(fileName);
+    std::stringstream buf;
+    buf << fileName.substr(0, pos) << "_" << std::setw(4) << std::setfill('0') << index << fileName.substr(pos);
+    return buf.str();
+}
+
+std::string GetManifestFileName(const std::string& fileName)
+{
+    return fileName.substr(0, GetExtensionPos(fileName)) + ".manifest.json";
+}
+
+void WriteManifest(const std::string& manifestFile, MeshFormat format, int slabSlices, const ChunkInfos& chunks)
+{
+    std::ofstream file(manifestFile.c_str(), std::ios::binary);
+    if (!file)
+    {
+        throw std::invalid_argument("Can't create manifest file");
+    }
+    // One chunk per line keeps the file easy to read back
+    file << "{\n"
+         << "  \"version\": 1,\n"
+         << "  \"format\": \"" << GetMeshFormatName(format) << "\",\n"
+         << "  \"slabSlices\": " << slabSlices << ",\n"
+         << "  \"chunks\": [\n";
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        const ChunkInfo& chunk = chunks[i];
+        file << "    {\"file\": \"" << EscapeJson(chunk.fileName.substr(GetFileNamePos(chunk.fileName))) << "\""
+             << ", \"firstSlice\": " << chunk.firstSlice
+             << ", \"lastSlice\": " << chunk.lastSlice
+             << ", \"triangles\": " << chunk.triangles
+             << ", \"min\": " << FormatVec3(chunk.boundsMin)
+             << ", \"max\": " << FormatVec3(chunk.boundsMax)
+             << "}" << (i + 1 < chunks.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n"
+         << "}\n";
+    if (!file)
+    {
+        throw std::runtime_error("Can't write manifest file");
+    }
+}
+
+void ReadManifest(const std::string& manifestFile, ChunkInfos& chunks)
+{
+    std::ifstream file(manifestFile.c_str(), std::ios::binary);
+    if (!file)
+    {
+        throw std::invalid_argument("Can't open manifest file " + manifestFile);
+    }
+    std::string dir = manifestFile.substr(0, GetFileNamePos(manifestFile));
+
+    chunks.clear();
+    std::string line;
+    std::string value;
+    while (std::getline(file, line))
+    {
+        if (!FindJsonValue(line, "file", value))
+        {
+            continue;
+        }
+        ChunkInfo chunk;
+        chunk.fileName = dir + ParseJsonString(value);
+        if (FindJsonValue(line, "firstSlice", value))
+        {
+            chunk.firstSlice = std::atoi(value.c_str());
+        }
+        if (FindJsonValue(line, "lastSlice", value))
+        {
+            chunk.lastSlice = std::atoi(value.c_str());
+        }
+        if (FindJsonValue(line, "triangles", value))
+        {
+            chunk.triangles = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        }
+        if (FindJsonValue(line, "min", value))
+        {
+            chunk.boundsMin = ParseJsonVec3(value);
+        }
+        if (FindJsonValue(line, "max", value))
+        {
+            chunk.boundsMax = ParseJsonVec3(value);
+        }
+        chunks.push_back(chunk);
+    }
+}
+
+void MergeChunks(const std::string& manifestFile, const std::string& outFile, const OutputOptions& output)
+{
+    ChunkInfos chunks;
+    ReadManifest(manifestFile, chunks);
+
+    std::unique_ptr<MeshWriter> meshWriter = CreateMeshWriter(outFile, output);
+    for (auto i = chunks.begin(); i != chunks.end(); ++i)
+    {
+        ReadMeshFile(i->fileName, *meshWriter);
+    }
+    meshWriter->Close();
+}
+
+}
@@ -0,0 +1,44 @@
+#ifndef _CHUNKED_MESH_H_
+#define _CHUNKED_MESH_H_
+
+#include "meshwriter.h"
+
+#include <string>
+#include <vector>
+
+namespace DicomToStl
+{
+
+// One file of a mesh split along z
+struct ChunkInfo
+{
+    ChunkInfo() : firstSlice(0), lastSlice(0), triangles(0) {}
+    // Relative to the manifest directory
+    std::string fileName;
+    int firstSlice;
+    int lastSlice;
+    size_t triangles;
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+};
+
+typedef std::vector<ChunkInfo> ChunkInfos;
+
+// "dir/name.stl" gives "dir/name_0007.stl" for the chunk 7
+std::string GetChunkFileName(const std::string& fileName, size_t index);
+
+// "dir/name.stl" gives "dir/name.manifest.json"
+std::string GetManifestFileName(const std::string& fileName);
+
+// Writes the JSON manifest, chunk file names are stored without the directory
+void WriteManifest(const std::string& manifestFile, MeshFormat format, int slabSlices, const ChunkInfos& chunks);
+
+// Reads a manifest made by WriteManifest, file names are returned with the manifest directory
+void ReadManifest(const std::string& manifestFile, ChunkInfos& chunks);
+
+// Joins the chunks listed in the manifest into one mesh
+void MergeChunks(const std::string& manifestFile, const std::string& outFile, const OutputOptions& output);
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#include "compactmesh.h"
+
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// Decodes one zigzag varint, returns nullptr past the end of the data
+const unsigned char* ReadCompactDelta(const unsigned char* in, const unsigned char* end, int64_t& delta)
+{
+    uint64_t value = 0;
+    for (int shift = 0; in != end && shift < 64; shift += 7)
+    {
+        unsigned char byte = *in++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            delta = static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+            return in;
+        }
+    }
+    return nullptr;
+}
+}
+
+size_t CompactMesh::GetVerticesCount() const
+{
+    return positions.size() / 3;
+}
+
+size_t CompactMesh::GetFacesCount() const
+{
+    return indices.size() / 3;
+}
+
+Vec3 CompactMesh::GetVertex(size_t index) const
+{
+    const uint16_t* q = &positions[index * 3];
+    return Vec3(boundsMin.x + q[0] * ((boundsMax.x - boundsMin.x) / COMPACT_MESH_STEPS),
+                boundsMin.y + q[1] * ((boundsMax.y - boundsMin.y) / COMPACT_MESH_STEPS),
+                boundsMin.z + q[2] * ((boundsMax.z - boundsMin.z) / COMPACT_MESH_STEPS));
+}
+
+void ReadCompactMesh(const std::string& fileName, CompactMesh& mesh)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file)
+    {
+        throw std::invalid_argument("Can't open mesh file " + fileName);
+    }
+
+    char header[COMPACT_MESH_HEADER_SIZE];
+    if (!file.read(header, sizeof(header)) || std::memcmp(header, COMPACT_MESH_MAGIC, sizeof(COMPACT_MESH_MAGIC)) != 0)
+    {
+        throw std::runtime_error("Not a compact mesh file " + fileName);
+    }
+    uint32_t verticesCount = 0;
+    uint32_t facesCount = 0;
+    uint64_t facesSize = 0;
+    std::memcpy(&verticesCount, header + 4, sizeof(verticesCount));
+    std::memcpy(&facesCount, header + 8, sizeof(facesCount));
+    std::memcpy(&mesh.boundsMin, header + 12, sizeof(Vec3));
+    std::memcpy(&mesh.boundsMax, header + 24, sizeof(Vec3));
+    std::memcpy(&facesSize, header + 36, sizeof(facesSize));
+
+    mesh.positions.resize(static_cast<size_t>(verticesCount) * 3);
+    std::vector<unsigned char> faces(static_cast<size_t>(facesSize));
+    if (!file.read(reinterpret_cast<char*>(mesh.positions.data()), mesh.positions.size() * sizeof(uint16_t)) ||
+        !file.read(reinterpret_cast<char*>(faces.data()), faces.size()))
+    {
+        throw std::runtime_error("Truncated mesh file " + fileName);
+    }
+
+    mesh.indices.resize(static_cast<size_t>(facesCount) * 3);
+    const unsigned char* in = faces.data();
+    const unsigned char* end = in + faces.size();
+    int64_t index = 0;
+    for (size_t i = 0; i < mesh.indices.size(); ++i)
+    {
+        int64_t delta = 0;
+        in = ReadCompactDelta(in, end, delta);
+        index += delta;
+        if (in == nullptr || index < 0 || index >= verticesCount)
+        {
+            throw std::runtime_error("Corrupted faces in mesh file " + fileName);
+        }
+        mesh.indices[i] = static_cast<uint32_t>(index);
+    }
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef _COMPACT_MESH_H_
+#define _COMPACT_MESH_H_
+
+#include "vec3.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// Compact indexed mesh, all values little endian:
+//   char     magic[4]        "DQM1"
+//   uint32   vertices count
+//   uint32   faces count
+//   float    boundsMin[3], boundsMax[3]
+//   uint64   size of the faces block in bytes
+//   uint16   positions[vertices][3]  quantized over the bounds, 0 - boundsMin, 65535 - boundsMax
+//   faces block: three varint indices per face, each one is the zigzag encoded
+//   difference from the index before it
+const char COMPACT_MESH_MAGIC[4] = {'D', 'Q', 'M', '1'};
+const size_t COMPACT_MESH_HEADER_SIZE = 44;
+const float COMPACT_MESH_STEPS = 65535.0f;
+
+struct CompactMesh
+{
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+    // Three quantized coordinates per vertex
+    std::vector<uint16_t> positions;
+    // Three vertex indices per face
+    std::vector<uint32_t> indices;
+
+    size_t GetVerticesCount() const;
+    size_t GetFacesCount() const;
+    Vec3 GetVertex(size_t index) const;
+};
+
+// Loads the whole file with two bulk reads; throws on errors
+void ReadCompactMesh(const std::string& fileName, CompactMesh& mesh);
+
+// Appends the varint of the zigzag encoded delta
+inline void AppendCompactDelta(std::vector<char>& out, int64_t delta)
+{
+    uint64_t value = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "compactwriter.h"
+#include "compactmesh.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// Three varints of at most five bytes for 32 bit deltas
+const size_t COMPACT_FACE_MAX_SIZE = 15;
+const size_t FACES_BUF_SIZE = 1 << 20;
+const size_t VERTICES_BLOCK_SIZE = 1 << 16;
+
+uint16_t Quantize(float value, float minValue, float scale)
+{
+    float q = std::floor((value - minValue) * scale + 0.5f);
+    return static_cast<uint16_t>(std::min(std::max(q, 0.0f), COMPACT_MESH_STEPS));
+}
+}
+
+CompactWriter::CompactWriter(const std::string& fileName, const StreamOptions& options)
+    : fileName(fileName)
+    , out(CreateOutputStream(fileName, options))
+    , facesFile(CreateSpoolStream(fileName + "f", options))
+    , isClosed(false)
+    , facesSize(0)
+    , lastIndex(0)
+{
+    faces.reserve(FACES_BUF_SIZE);
+}
+
+CompactWriter::~CompactWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+}
+
+uint32_t CompactWriter::AddVertex(const Vec3& v)
+{
+    bool isNew = false;
+    uint32_t index = vertexMap.Add(v, isNew);
+    if (isNew)
+    {
+        vertices.push_back(v);
+    }
+    return index;
+}
+
+void CompactWriter::Write(const Triangle& tri)
+{
+    uint32_t indices[3] = {AddVertex(std::get<0>(tri)),
+                           AddVertex(std::get<1>(tri)),
+                           AddVertex(std::get<2>(tri))};
+    // Collapsed faces carry no surface
+    if (indices[0] == indices[1] || indices[1] == indices[2] || indices[0] == indices[2])
+    {
+        return;
+    }
+
+    // Neighbouring facets share vertices, so the deltas mostly fit one or two bytes
+    for (int i = 0; i < 3; ++i)
+    {
+        AppendCompactDelta(faces, static_cast<int64_t>(indices[i]) - static_cast<int64_t>(lastIndex));
+        lastIndex = indices[i];
+    }
+    if (faces.size() + COMPACT_FACE_MAX_SIZE > FACES_BUF_SIZE)
+    {
+        FlushFaces();
+    }
+    AddToBounds(tri);
+    ++triCount;
+}
+
+void CompactWriter::FlushFaces()
+{
+    if (!faces.empty())
+    {
+        facesFile->Write(faces.data(), faces.size());
+        facesSize += faces.size();
+        faces.clear();
+    }
+}
+
+void CompactWriter::Close()
+{
+    if (this->isClosed)
+    {
+        return;
+    }
+    this->isClosed = true;
+
+    FlushFaces();
+    vertCount = vertices.size();
+
+    // Vertices of the dropped faces are stored too, so the bounds cover all of them
+    Vec3 minPos = boundsMin;
+    Vec3 maxPos = boundsMax;
+    std::for_each(vertices.begin(), vertices.end(), [&](const Vec3& v)
+    {
+        minPos.x = std::min(minPos.x, v.x);
+        minPos.y = std::min(minPos.y, v.y);
+        minPos.z = std::min(minPos.z, v.z);
+        maxPos.x = std::max(maxPos.x, v.x);
+        maxPos.y = std::max(maxPos.y, v.y);
+        maxPos.z = std::max(maxPos.z, v.z);
+    });
+    if (vertices.empty())
+    {
+        minPos = maxPos = Vec3(0, 0, 0);
+    }
+
+    char header[COMPACT_MESH_HEADER_SIZE];
+    uint32_t verticesCount = static_cast<uint32_t>(vertCount);
+    uint32_t facesCount = static_cast<uint32_t>(triCount);
+    std::memcpy(header, COMPACT_MESH_MAGIC, sizeof(COMPACT_MESH_MAGIC));
+    std::memcpy(header + 4, &verticesCount, sizeof(verticesCount));
+    std::memcpy(header + 8, &facesCount, sizeof(facesCount));
+    std::memcpy(header + 12, &minPos, sizeof(Vec3));
+    std::memcpy(header + 24, &maxPos, sizeof(Vec3));
+    std::memcpy(header + 36, &facesSize, sizeof(facesSize));
+    WriteBlock(*out, header, sizeof(header));
+
+    Vec3 scale(maxPos.x > minPos.x ? COMPACT_MESH_STEPS / (maxPos.x - minPos.x) : 0.0f,
+               maxPos.y > minPos.y ? COMPACT_MESH_STEPS / (maxPos.y - minPos.y) : 0.0f,
+               maxPos.z > minPos.z ? COMPACT_MESH_STEPS / (maxPos.z - minPos.z) : 0.0f);
+    std::vector<uint16_t> positions;
+    positions.reserve(VERTICES_BLOCK_SIZE * 3);
+    for (size_t first = 0; first < vertices.size(); first += VERTICES_BLOCK_SIZE)
+    {
+        size_t last = std::min(first + VERTICES_BLOCK_SIZE, vertices.size());
+        positions.clear();
+        for (size_t i = first; i < last; ++i)
+        {
+            positions.push_back(Quantize(vertices[i].x, minPos.x, scale.x));
+            positions.push_back(Quantize(vertices[i].y, minPos.y, scale.y));
+            positions.push_back(Quantize(vertices[i].z, minPos.z, scale.z));
+        }
+        WriteBlock(*out, reinterpret_cast<const char*>(positions.data()), positions.size() * sizeof(uint16_t));
+    }
+    std::vector<Vec3>().swap(vertices);
+
+    CopySpool(*out, *facesFile, fileName + "f", this->facesSize);
+    out->Close();
+}
+
+}
@@ -0,0 +1,40 @@
+#ifndef _COMPACT_WRITER_H_
+#define _COMPACT_WRITER_H_
+
+#include "meshwriter.h"
+
+#include <string>
+#include <vector>
+
+namespace DicomToStl
+{
+
+// Compact mesh described in compactmesh.h. Vertices are kept in memory and
+// quantized over the final bounds on Close, the delta coded faces are spooled
+// to a temporary file like the PLY faces.
+class CompactWriter : public MeshWriter
+{
+public:
+    CompactWriter(const std::string& fileName, const StreamOptions& options = StreamOptions());
+    virtual ~CompactWriter();
+    virtual void Write(const Triangle& tri);
+    virtual void Close();
+private:
+    CompactWriter(const CompactWriter&);
+    CompactWriter& operator=(const CompactWriter&);
+    uint32_t AddVertex(const Vec3& v);
+    void FlushFaces();
+private:
+    std::string fileName;
+    std::unique_ptr<OutputStream> out;
+    std::unique_ptr<OutputStream> facesFile;
+    bool isClosed;
+    VertexMap vertexMap;
+    std::vector<Vec3> vertices;
+    std::vector<char> faces;
+    uint64_t facesSize;
+    uint32_t lastIndex;
+};
+
+}
+#endif
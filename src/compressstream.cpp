@@ -0,0 +1,526 @@
+#include "compressstream.h"
+
+#ifdef DICOMTOSTL_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef DICOMTOSTL_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <map>
+#include <exception>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+const size_t COMPRESS_BLOCK_SIZE = 4 << 20;
+
+class Compressor
+{
+public:
+    Compressor() {}
+    virtual ~Compressor() {}
+    // Compresses the whole block into one self contained frame
+    virtual bool Compress(const std::vector<char>& in, std::vector<char>& out) = 0;
+private:
+    Compressor(const Compressor&);
+    Compressor& operator=(const Compressor&);
+};
+
+#ifdef DICOMTOSTL_WITH_ZLIB
+class GzipCompressor : public Compressor
+{
+public:
+    GzipCompressor()
+    {
+        std::memset(&stream, 0, sizeof(stream));
+        // 16 added to the window bits selects the gzip wrapper
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw std::runtime_error("Can't initialize gzip compression");
+        }
+    }
+    virtual ~GzipCompressor()
+    {
+        deflateEnd(&stream);
+    }
+    virtual bool Compress(const std::vector<char>& in, std::vector<char>& out)
+    {
+        if (deflateReset(&stream) != Z_OK)
+        {
+            return false;
+        }
+        out.resize(deflateBound(&stream, static_cast<uLong>(in.size())));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        stream.avail_in = static_cast<uInt>(in.size());
+        stream.next_out = reinterpret_cast<Bytef*>(out.data());
+        stream.avail_out = static_cast<uInt>(out.size());
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        {
+            return false;
+        }
+        out.resize(stream.total_out);
+        return true;
+    }
+private:
+    z_stream stream;
+};
+#endif
+
+#ifdef DICOMTOSTL_WITH_ZSTD
+class ZstdCompressor : public Compressor
+{
+public:
+    ZstdCompressor()
+        : context(ZSTD_createCCtx())
+    {
+        if (context == nullptr)
+        {
+            throw std::runtime_error("Can't initialize zstd compression");
+        }
+        ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+        ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1);
+    }
+    virtual ~ZstdCompressor()
+    {
+        ZSTD_freeCCtx(context);
+    }
+    virtual bool Compress(const std::vector<char>& in, std::vector<char>& out)
+    {
+        out.resize(ZSTD_compressBound(in.size()));
+        size_t res = ZSTD_compress2(context, out.data(), out.size(), in.data(), in.size());
+        if (ZSTD_isError(res))
+        {
+            return false;
+        }
+        out.resize(res);
+        return true;
+    }
+private:
+    ZSTD_CCtx* context;
+};
+#endif
+
+void CheckCompressionSupport(OutputCompression compression)
+{
+#ifndef DICOMTOSTL_WITH_ZLIB
+    if (compression == OUTPUT_COMPRESSION_GZIP)
+    {
+        throw std::invalid_argument("gzip compression support is not compiled in");
+    }
+#endif
+#ifndef DICOMTOSTL_WITH_ZSTD
+    if (compression == OUTPUT_COMPRESSION_ZSTD)
+    {
+        throw std::invalid_argument("zstd compression support is not compiled in");
+    }
+#endif
+    (void)compression;
+}
+
+std::unique_ptr<Compressor> CreateCompressor(OutputCompression compression)
+{
+    switch (compression)
+    {
+#ifdef DICOMTOSTL_WITH_ZLIB
+    case OUTPUT_COMPRESSION_GZIP:
+        return std::unique_ptr<Compressor>(new GzipCompressor());
+#endif
+#ifdef DICOMTOSTL_WITH_ZSTD
+    case OUTPUT_COMPRESSION_ZSTD:
+        return std::unique_ptr<Compressor>(new ZstdCompressor());
+#endif
+    default:
+        throw std::invalid_argument("Unsupported compression");
+    }
+}
+}
+
+class CompressAgent : public Agent
+{
+public:
+    CompressAgent(OutputCompression compression,
+                  MsgCompressBlock& filledBlocks,
+                  MsgCompressBlock& compressedBlocks)
+        : compression(compression),
+          filledBlocks(filledBlocks),
+          compressedBlocks(compressedBlocks),
+          failed(false)
+    {
+    }
+
+    virtual void Run()
+    {
+        std::unique_ptr<Compressor> compressor;
+        try
+        {
+            compressor = CreateCompressor(compression);
+        }
+        catch (...)
+        {
+            failed = true;
+        }
+
+        bool done = false;
+        while (!done)
+        {
+            CompressBlock* block = nullptr;
+            this->filledBlocks.Pop(block);
+            try
+            {
+                if (block != nullptr && block->isEncoded)
+                {
+                    block->compressed.assign(block->data.begin(), block->data.end());
+                }
+                else if (block != nullptr && (!compressor || !compressor->Compress(block->data, block->compressed)))
+                {
+                    block->compressed.clear();
+                    failed = true;
+                }
+            }
+            catch (...)
+            {
+                // The block still goes on, the writer must not wait for it
+                block->compressed.clear();
+                failed = true;
+            }
+            done = block == nullptr;
+            // The stop message is forwarded after the last block of this agent
+            this->compressedBlocks.Push(block);
+        }
+    }
+
+    bool IsFailed() const
+    {
+        return failed;
+    }
+private:
+    CompressAgent(const CompressAgent&);
+    CompressAgent& operator= (const CompressAgent&);
+private:
+    OutputCompression compression;
+    MsgCompressBlock& filledBlocks;
+    MsgCompressBlock& compressedBlocks;
+    bool failed;
+};
+
+class CompressWriteAgent : public Agent
+{
+public:
+    CompressWriteAgent(OutputStream& sink,
+                       size_t compressAgentsCount,
+                       MsgCompressBlock& compressedBlocks,
+                       MsgCompressBlock& freeBlocks)
+        : sink(sink),
+          compressAgentsCount(compressAgentsCount),
+          compressedBlocks(compressedBlocks),
+          freeBlocks(freeBlocks),
+          failed(false)
+    {
+    }
+
+    virtual void Run()
+    {
+        std::map<size_t, CompressBlock*> pending;
+        size_t nextIndex = 0;
+        size_t stopped = 0;
+        while (stopped < compressAgentsCount)
+        {
+            CompressBlock* block = nullptr;
+            this->compressedBlocks.Pop(block);
+            if (block == nullptr)
+            {
+                ++stopped;
+                continue;
+            }
+            pending[block->index] = block;
+
+            // Blocks may come back out of order from the pool
+            auto i = pending.begin();
+            while (i != pending.end() && i->first == nextIndex)
+            {
+                CompressBlock* ready = i->second;
+                try
+                {
+                    if (!failed)
+                    {
+                        sink.Write(ready->compressed.data(), ready->compressed.size());
+                    }
+                }
+                catch (...)
+                {
+                    // The blocks left are still taken back, so the producer never stalls
+                    failed = true;
+                }
+                ready->data.clear();
+                ready->isEncoded = false;
+                this->freeBlocks.Push(ready);
+                ++nextIndex;
+                i = pending.erase(i);
+            }
+        }
+    }
+
+    bool IsFailed() const
+    {
+        return failed;
+    }
+private:
+    CompressWriteAgent(const CompressWriteAgent&);
+    CompressWriteAgent& operator= (const CompressWriteAgent&);
+private:
+    OutputStream& sink;
+    size_t compressAgentsCount;
+    MsgCompressBlock& compressedBlocks;
+    MsgCompressBlock& freeBlocks;
+    bool failed;
+};
+
+CompressedOutputStream::CompressedOutputStream(std::unique_ptr<OutputStream> sink, OutputCompression compression, int threads)
+    : sink(std::move(sink))
+    , current(nullptr)
+    , blocksCount(0)
+    , isClosed(false)
+{
+    CheckCompressionSupport(compression);
+
+    size_t agentsCount = static_cast<size_t>(std::max(threads, 1));
+    // Enough blocks in flight to keep every compressor busy while the next ones are filled
+    size_t poolSize = 2 * agentsCount + 2;
+    for (size_t i = 0; i < poolSize; ++i)
+    {
+        blocks.push_back(std::unique_ptr<CompressBlock>(new CompressBlock()));
+        blocks.back()->data.reserve(COMPRESS_BLOCK_SIZE);
+        freeBlocks.Push(blocks.back().get());
+    }
+
+    for (size_t i = 0; i < agentsCount; ++i)
+    {
+        compressAgents.push_back(std::unique_ptr<CompressAgent>(new CompressAgent(compression, filledBlocks, compressedBlocks)));
+        compressAgents.back()->Start();
+    }
+    writeAgent.reset(new CompressWriteAgent(*this->sink, agentsCount, compressedBlocks, freeBlocks));
+    writeAgent->Start();
+
+    freeBlocks.Pop(current);
+}
+
+CompressedOutputStream::~CompressedOutputStream()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void CompressedOutputStream::Write(const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        size_t count = std::min(size, COMPRESS_BLOCK_SIZE - current->data.size());
+        current->data.insert(current->data.end(), data, data + count);
+        data += count;
+        size -= count;
+        if (current->data.size() == COMPRESS_BLOCK_SIZE)
+        {
+            SendBlock();
+            freeBlocks.Pop(current);
+        }
+    }
+}
+
+void CompressedOutputStream::WriteEncoded(const char* data, size_t size)
+{
+    // The block being filled goes out first, the frames must stay whole
+    if (!current->data.empty())
+    {
+        SendBlock();
+        freeBlocks.Pop(current);
+    }
+    while (size > 0)
+    {
+        size_t count = std::min(size, COMPRESS_BLOCK_SIZE);
+        current->data.assign(data, data + count);
+        current->isEncoded = true;
+        data += count;
+        size -= count;
+        SendBlock();
+        freeBlocks.Pop(current);
+    }
+}
+
+void CompressedOutputStream::SendBlock()
+{
+    current->index = blocksCount++;
+    filledBlocks.Push(current);
+    current = nullptr;
+}
+
+void CompressedOutputStream::Close()
+{
+    if (this->isClosed)
+    {
+        return;
+    }
+    this->isClosed = true;
+
+    if (!current->data.empty())
+    {
+        SendBlock();
+    }
+    for (size_t i = 0; i < compressAgents.size(); ++i)
+    {
+        filledBlocks.Push(nullptr);
+    }
+
+    // Every agent is joined before the first error is rethrown
+    std::exception_ptr error;
+    bool failed = false;
+    for (size_t i = 0; i < compressAgents.size(); ++i)
+    {
+        try
+        {
+            compressAgents[i]->Wait();
+        }
+        catch (...)
+        {
+            error = error ? error : std::current_exception();
+        }
+        failed |= compressAgents[i]->IsFailed();
+    }
+    try
+    {
+        writeAgent->Wait();
+    }
+    catch (...)
+    {
+        error = error ? error : std::current_exception();
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    if (failed)
+    {
+        throw std::runtime_error("Can't compress output file");
+    }
+    if (writeAgent->IsFailed())
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+    sink->Close();
+}
+
+uint64_t CompressedOutputStream::GetBytesWritten() const
+{
+    return sink->GetBytesWritten();
+}
+
+void DecompressFile(const std::string& inName, const std::string& outName, OutputCompression compression)
+{
+    CheckCompressionSupport(compression);
+    std::ifstream in(inName.c_str(), std::ios::binary);
+    if (!in)
+    {
+        throw std::invalid_argument("Can't open compressed file " + inName);
+    }
+    std::ofstream out(outName.c_str(), std::ios::binary);
+    if (!out)
+    {
+        throw std::invalid_argument("Can't create file " + outName);
+    }
+    std::vector<char> input(COMPRESS_BLOCK_SIZE);
+    std::vector<char> output(COMPRESS_BLOCK_SIZE);
+    bool isComplete = true;
+#ifdef DICOMTOSTL_WITH_ZLIB
+    if (compression == OUTPUT_COMPRESSION_GZIP)
+    {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        // 16 added to the window bits reads the gzip wrapper
+        if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        {
+            throw std::runtime_error("Can't initialize gzip decompression");
+        }
+        bool isFailed = false;
+        bool isInMember = false;
+        while (!isFailed && in.read(input.data(), input.size()).gcount() > 0)
+        {
+            stream.next_in = reinterpret_cast<Bytef*>(input.data());
+            stream.avail_in = static_cast<uInt>(in.gcount());
+            // A full output buffer may leave more to flush with no input left
+            do
+            {
+                stream.next_out = reinterpret_cast<Bytef*>(output.data());
+                stream.avail_out = static_cast<uInt>(output.size());
+                int status = inflate(&stream, Z_NO_FLUSH);
+                if (status == Z_STREAM_END)
+                {
+                    // The next block is a gzip member of its own
+                    inflateReset(&stream);
+                    isInMember = false;
+                }
+                else if (status == Z_OK)
+                {
+                    isInMember = true;
+                }
+                else if (status != Z_BUF_ERROR)
+                {
+                    isFailed = true;
+                }
+                out.write(output.data(), output.size() - stream.avail_out);
+            }
+            while (!isFailed && (stream.avail_in > 0 || stream.avail_out == 0));
+        }
+        isComplete = !isFailed && !isInMember;
+        inflateEnd(&stream);
+    }
+#endif
+#ifdef DICOMTOSTL_WITH_ZSTD
+    if (compression == OUTPUT_COMPRESSION_ZSTD)
+    {
+        ZSTD_DCtx* context = ZSTD_createDCtx();
+        if (context == nullptr)
+        {
+            throw std::runtime_error("Can't initialize zstd decompression");
+        }
+        // 0 once the last frame is complete
+        size_t left = 0;
+        while (!ZSTD_isError(left) && in.read(input.data(), input.size()).gcount() > 0)
+        {
+            ZSTD_inBuffer inBuffer = { input.data(), static_cast<size_t>(in.gcount()), 0 };
+            ZSTD_outBuffer outBuffer = { output.data(), output.size(), 0 };
+            do
+            {
+                outBuffer.pos = 0;
+                left = ZSTD_decompressStream(context, &outBuffer, &inBuffer);
+                out.write(output.data(), ZSTD_isError(left) ? 0 : outBuffer.pos);
+            }
+            while (!ZSTD_isError(left) && (inBuffer.pos < inBuffer.size || outBuffer.pos == outBuffer.size));
+        }
+        isComplete = left == 0;
+        ZSTD_freeDCtx(context);
+    }
+#endif
+    out.close();
+    if (!isComplete)
+    {
+        throw std::runtime_error("Compressed file " + inName + " is damaged or truncated");
+    }
+    if (!out)
+    {
+        throw std::runtime_error("Can't write file " + outName);
+    }
+}
+
+}
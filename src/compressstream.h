@@ -0,0 +1,65 @@
+#ifndef _COMPRESS_STREAM_H_
+#define _COMPRESS_STREAM_H_
+
+#include "outputstream.h"
+#include "pipeline.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+
+namespace DicomToStl
+{
+
+struct CompressBlock
+{
+    CompressBlock() : index(0), isEncoded(false) {}
+    size_t index;
+    // The data is compressed already and goes out unchanged
+    bool isEncoded;
+    std::vector<char> data;
+    std::vector<char> compressed;
+};
+
+typedef BoundedQueue<CompressBlock*> MsgCompressBlock;
+
+class CompressAgent;
+class CompressWriteAgent;
+
+// Output compressed on a small pool of agents. Every block becomes an independent
+// gzip member or zstd frame, so the concatenated blocks form a valid stream.
+// Blocks are written to the underlying stream in order by a dedicated agent.
+// Encoded bytes are members or frames of the same compression, they follow the
+// block being filled as they are.
+class CompressedOutputStream : public OutputStream
+{
+public:
+    CompressedOutputStream(std::unique_ptr<OutputStream> sink, OutputCompression compression, int threads);
+    virtual ~CompressedOutputStream();
+    virtual void Write(const char* data, size_t size);
+    virtual void WriteEncoded(const char* data, size_t size);
+    virtual void Close();
+    // The compressed bytes of the sink
+    virtual uint64_t GetBytesWritten() const;
+private:
+    void SendBlock();
+private:
+    std::unique_ptr<OutputStream> sink;
+    std::vector<std::unique_ptr<CompressBlock> > blocks;
+    MsgCompressBlock freeBlocks;
+    MsgCompressBlock filledBlocks;
+    MsgCompressBlock compressedBlocks;
+    std::vector<std::unique_ptr<CompressAgent> > compressAgents;
+    std::unique_ptr<CompressWriteAgent> writeAgent;
+    CompressBlock* current;
+    size_t blocksCount;
+    bool isClosed;
+};
+
+// Writes the content of a gzip or zstd file to outName, every member or frame of
+// a CompressedOutputStream included. Throws on errors.
+void DecompressFile(const std::string& inName, const std::string& outName, OutputCompression compression);
+
+}
+
+#endif
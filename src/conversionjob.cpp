@@ -0,0 +1,149 @@
+#include "conversionjob.h"
+
+#include <iostream>
+#include <sstream>
+
+namespace DicomToStl
+{
+
+std::string MakeOutputFileName(const std::string& outputDir,
+                               const std::string& firstFile,
+                               const std::string& suffix,
+                               const OutputOptions& output)
+{
+    std::string outDir = outputDir;
+    if (outDir.empty() || (outDir.back() != '\\' && outDir.back() != '/'))
+    {
+#ifdef _WIN32
+        outDir += "\\";
+#else
+        outDir += "/";
+#endif
+    }
+    auto posStart = firstFile.find_last_of("\\/") + 1;
+    auto posEnd = firstFile.find_last_of('.');
+    std::string fileName = firstFile.substr(posStart, posEnd - posStart);
+    return outDir + fileName + suffix + GetMeshFormatExtension(output.format) + GetCompressionExtension(output.stream.compression);
+}
+
+void WriteJob(std::ostream& out, const ConversionJob& job)
+{
+    out << "input " << job.inputDir << "\n"
+        << "output " << job.outputDir << "\n";
+    for (auto i = job.isoLevels.begin(); i != job.isoLevels.end(); ++i)
+    {
+        out << "isolevel " << *i << "\n";
+    }
+    out << "format " << job.output.format << "\n"
+        << "compression " << job.output.stream.compression << "\n"
+        << "compressThreads " << job.output.stream.compressThreads << "\n"
+        << "directIo " << job.output.stream.directIo << "\n"
+        << "chunkSlices " << job.output.chunkSlices << "\n"
+        << "chunkWorkers " << job.output.chunkWorkers << "\n"
+        << "mappedStl " << job.output.mappedStl << "\n"
+        << "readThreads " << job.pipeline.readThreads << "\n"
+        << "gridThreads " << job.pipeline.gridThreads << "\n"
+        << "depth " << job.pipeline.depth << "\n"
+        << "slabs " << job.pipeline.slabs << "\n"
+        << "memoryLimit " << job.pipeline.memoryLimit << "\n"
+        << "checkpoint " << job.pipeline.checkpoint << "\n"
+        << "resume " << job.pipeline.resume << "\n"
+        << "end\n";
+}
+
+bool ReadJob(std::istream& in, ConversionJob& job)
+{
+    job = ConversionJob();
+    std::string line;
+    while (std::getline(in, line))
+    {
+        auto pos = line.find(' ');
+        std::string key = line.substr(0, pos);
+        std::string value = pos == std::string::npos ? std::string() : line.substr(pos + 1);
+        std::istringstream buf(value);
+        int number = 0;
+        if (key == "end")
+        {
+            return !job.inputDir.empty() && !job.outputDir.empty() && !job.isoLevels.empty();
+        }
+        else if (key == "input")
+        {
+            job.inputDir = value;
+        }
+        else if (key == "output")
+        {
+            job.outputDir = value;
+        }
+        else if (key == "memoryLimit")
+        {
+            buf >> job.pipeline.memoryLimit;
+        }
+        else if (!(buf >> number))
+        {
+            return false;
+        }
+        else if (key == "isolevel")
+        {
+            job.isoLevels.push_back(number);
+        }
+        else if (key == "format")
+        {
+            job.output.format = static_cast<MeshFormat>(number);
+        }
+        else if (key == "compression")
+        {
+            job.output.stream.compression = static_cast<OutputCompression>(number);
+        }
+        else if (key == "compressThreads")
+        {
+            job.output.stream.compressThreads = number;
+        }
+        else if (key == "directIo")
+        {
+            job.output.stream.directIo = number != 0;
+        }
+        else if (key == "chunkSlices")
+        {
+            job.output.chunkSlices = number;
+        }
+        else if (key == "chunkWorkers")
+        {
+            job.output.chunkWorkers = number;
+        }
+        else if (key == "mappedStl")
+        {
+            job.output.mappedStl = number != 0;
+        }
+        else if (key == "readThreads")
+        {
+            job.pipeline.readThreads = number;
+        }
+        else if (key == "gridThreads")
+        {
+            job.pipeline.gridThreads = number;
+        }
+        else if (key == "depth")
+        {
+            job.pipeline.depth = number;
+        }
+        else if (key == "slabs")
+        {
+            job.pipeline.slabs = number;
+        }
+        else if (key == "checkpoint")
+        {
+            job.pipeline.checkpoint = number != 0;
+        }
+        else if (key == "resume")
+        {
+            job.pipeline.resume = number != 0;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,39 @@
+#ifndef _CONVERSION_JOB_H_
+#define _CONVERSION_JOB_H_
+
+#include "meshwriter.h"
+#include "volumereader.h"
+
+#include <string>
+#include <vector>
+#include <iosfwd>
+
+namespace DicomToStl
+{
+
+// One conversion as submitted to the daemon: a series folder, the iso levels
+// to extract from it and the options of the command line
+struct ConversionJob
+{
+    std::string inputDir;
+    std::string outputDir;
+    std::vector<int> isoLevels;
+    OutputOptions output;
+    PipelineOptions pipeline;
+};
+
+// "out/" + the name of the first slice file + the extensions of the output,
+// suffix goes before the extensions
+std::string MakeOutputFileName(const std::string& outputDir,
+                               const std::string& firstFile,
+                               const std::string& suffix,
+                               const OutputOptions& output);
+
+// Line based "key value" form of the job, ended by an "end" line
+void WriteJob(std::ostream& out, const ConversionJob& job);
+// False if a line is not understood or the end is missing
+bool ReadJob(std::istream& in, ConversionJob& job);
+
+}
+
+#endif
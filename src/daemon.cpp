@@ -0,0 +1,725 @@
+#include "daemon.h"
+#include "dirreader.h"
+#include "dirscanner.h"
+#include "formatreader.h"
+#include "slicesource.h"
+#include "volumecache.h"
+#include "pipeline.h"
+
+#include <dcmtk/oflog/oflog.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace DicomToStl
+{
+
+#ifdef _WIN32
+void RunDaemon(const std::string&, const DaemonOptions&, OFLogger&, CancellationToken&)
+{
+    throw std::runtime_error("Daemon mode needs Unix domain sockets");
+}
+
+bool SubmitJob(const std::string&, const ConversionJob&, JobResult& result)
+{
+    result.status = "failed daemon mode needs Unix domain sockets";
+    return false;
+}
+
+bool PrintDaemonStats(const std::string&, std::ostream&)
+{
+    return false;
+}
+#else
+
+namespace
+{
+const int ACCEPT_POLL_MS = 200;
+// A client that does not send its request in time is dropped, so it can't hold the shutdown
+const int REQUEST_TIMEOUT_SECONDS = 10;
+
+double ElapsedMs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Closes the descriptor when it goes out of scope
+class Socket
+{
+public:
+    explicit Socket(int fd) : fd(fd) {}
+    ~Socket()
+    {
+        if (this->fd >= 0)
+        {
+            close(this->fd);
+        }
+    }
+    int Get() const
+    {
+        return this->fd;
+    }
+private:
+    Socket(const Socket&);
+    Socket& operator=(const Socket&);
+private:
+    int fd;
+};
+
+sockaddr_un MakeAddress(const std::string& socketPath)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+    {
+        throw std::invalid_argument("Wrong socket path " + socketPath);
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+    return address;
+}
+
+// -1 if nobody listens on the socket
+int Connect(const std::string& socketPath)
+{
+    sockaddr_un address = MakeAddress(socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool SendText(int fd, const std::string& text)
+{
+    const char* data = text.data();
+    size_t left = text.size();
+    while (left > 0)
+    {
+        // A peer gone away must not kill the process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+        ssize_t sent = send(fd, data, left, MSG_NOSIGNAL);
+#else
+        ssize_t sent = send(fd, data, left, 0);
+#endif
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        left -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Lines of a connection, the text received past the last line waits for the next call
+class LineReader
+{
+public:
+    explicit LineReader(int fd) : fd(fd) {}
+
+    bool ReadLine(std::string& line)
+    {
+        for (;;)
+        {
+            auto pos = this->pending.find('\n');
+            if (pos != std::string::npos)
+            {
+                line = this->pending.substr(0, pos);
+                this->pending.erase(0, pos + 1);
+                return true;
+            }
+            char block[4096];
+            ssize_t count = recv(this->fd, block, sizeof(block), 0);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            this->pending.append(block, static_cast<size_t>(count));
+        }
+    }
+
+    // Lines up to the "end" one included
+    bool ReadMessage(std::string& message)
+    {
+        message.clear();
+        std::string line;
+        while (ReadLine(line))
+        {
+            message += line + "\n";
+            if (line == "end")
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    LineReader(const LineReader&);
+    LineReader& operator=(const LineReader&);
+private:
+    int fd;
+    std::string pending;
+};
+
+void SplitLine(const std::string& line, std::string& key, std::string& value)
+{
+    auto pos = line.find(' ');
+    key = line.substr(0, pos);
+    value = pos == std::string::npos ? std::string() : line.substr(pos + 1);
+}
+
+std::string GetAbsolutePath(const std::string& path)
+{
+    if (path.empty() || path[0] == '/')
+    {
+        return path;
+    }
+    char buffer[4096];
+    if (getcwd(buffer, sizeof(buffer)) == nullptr)
+    {
+        return path;
+    }
+    return std::string(buffer) + "/" + path;
+}
+
+// Modification time of the folder, it changes when a file is added or removed
+int64_t GetDirStamp(const std::string& dirName)
+{
+    struct stat info;
+    if (stat(dirName.c_str(), &info) != 0)
+    {
+        return -1;
+    }
+#ifdef __linux__
+    return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#else
+    return static_cast<int64_t>(info.st_mtime);
+#endif
+}
+
+// Listing and format of a series folder, valid while the folder stamp is the same
+struct SeriesInfo
+{
+    SeriesInfo() : stamp(-1), dx(0), dy(0) {}
+    int64_t stamp;
+    std::string firstFile;
+    int dx;
+    int dy;
+    Vec3 spacing;
+    SlicesPositions slicesPositions;
+    Vec3 rowDirection;
+    Vec3 columnDirection;
+};
+
+struct PendingJob
+{
+    PendingJob() : isDone(false) {}
+    ConversionJob job;
+    JobResult result;
+    std::chrono::steady_clock::time_point queuedAt;
+    std::mutex mutex;
+    std::condition_variable done;
+    bool isDone;
+};
+
+class Daemon
+{
+public:
+    Daemon(const DaemonOptions& options, OFLogger& logger, CancellationToken& cancellation);
+    ~Daemon();
+    // Waits for the workers, the jobs left in the queue end as cancelled
+    void Stop();
+    // Answers one client, a job request returns when the job is finished
+    void Serve(int connection);
+private:
+    Daemon(const Daemon&);
+    Daemon& operator=(const Daemon&);
+    void RunWorker();
+    void Convert(PendingJob& pending);
+    std::shared_ptr<const SeriesInfo> GetSeries(const std::string& inputDir);
+    std::string GetStats();
+private:
+    OFLogger& logger;
+    CancellationToken& cancellation;
+    BoundedQueue<std::shared_ptr<PendingJob> > jobs;
+    std::vector<std::thread> workers;
+    VolumeCache slices;
+    std::atomic<size_t> lastId;
+
+    std::mutex seriesMutex;
+    std::map<std::string, std::shared_ptr<const SeriesInfo> > series;
+    size_t seriesHits;
+    size_t seriesMisses;
+
+    std::mutex statsMutex;
+    size_t queued;
+    size_t running;
+    size_t completed;
+    size_t failed;
+    size_t cancelled;
+    double latencySum;
+    double latencyMax;
+    double latencyLast;
+    double queueSum;
+};
+
+Daemon::Daemon(const DaemonOptions& options, OFLogger& logger, CancellationToken& cancellation)
+    : logger(logger)
+    , cancellation(cancellation)
+    , slices(options.cacheBytes)
+    , lastId(0)
+    , seriesHits(0)
+    , seriesMisses(0)
+    , queued(0)
+    , running(0)
+    , completed(0)
+    , failed(0)
+    , cancelled(0)
+    , latencySum(0.)
+    , latencyMax(0.)
+    , latencyLast(0.)
+    , queueSum(0.)
+{
+    for (int i = 0; i < std::max(options.workers, 1); ++i)
+    {
+        this->workers.push_back(std::thread([this]() { RunWorker(); }));
+    }
+}
+
+Daemon::~Daemon()
+{
+    Stop();
+}
+
+void Daemon::Stop()
+{
+    this->jobs.Close();
+    std::for_each(this->workers.begin(), this->workers.end(), [](std::thread& worker) { worker.join(); });
+    this->workers.clear();
+}
+
+void Daemon::RunWorker()
+{
+    std::shared_ptr<PendingJob> pending;
+    while (this->jobs.Pop(pending))
+    {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            --this->queued;
+            ++this->running;
+        }
+        std::string status = "ok";
+        try
+        {
+            Convert(*pending);
+            if (this->cancellation.IsCancelled())
+            {
+                status = "cancelled";
+            }
+        }
+        catch (std::exception& err)
+        {
+            status = std::string("failed ") + err.what();
+        }
+        auto end = std::chrono::steady_clock::now();
+        double latency = ElapsedMs(pending->queuedAt, end);
+        double queueTime = ElapsedMs(pending->queuedAt, start);
+        OFLOG_INFO(this->logger, "Job " << pending->result.id << " " << status << " in " << latency << " ms, "
+                                 << queueTime << " ms in the queue" << OFendl);
+        {
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            --this->running;
+            if (status == "ok")
+            {
+                ++this->completed;
+            }
+            else if (status == "cancelled")
+            {
+                ++this->cancelled;
+            }
+            else
+            {
+                ++this->failed;
+            }
+            this->latencySum += latency;
+            this->latencyMax = std::max(this->latencyMax, latency);
+            this->latencyLast = latency;
+            this->queueSum += queueTime;
+        }
+        {
+            std::lock_guard<std::mutex> lock(pending->mutex);
+            pending->result.status = status;
+            pending->result.latencyMs = latency;
+            pending->result.queueMs = queueTime;
+            pending->isDone = true;
+        }
+        pending->done.notify_all();
+        pending.reset();
+    }
+}
+
+void Daemon::Convert(PendingJob& pending)
+{
+    const ConversionJob& job = pending.job;
+    if (this->cancellation.IsCancelled())
+    {
+        return;
+    }
+    if (IsDICOMDIR(job.inputDir))
+    {
+        throw std::invalid_argument("DICOMDIR input needs an interactive series choice");
+    }
+    std::shared_ptr<const SeriesInfo> info = GetSeries(job.inputDir);
+    if (info->slicesPositions.size() < 2)
+    {
+        throw std::invalid_argument("There is not enough slices to recover a 3D model");
+    }
+    DcmSliceSource files(info->dx, info->dy, info->spacing, info->slicesPositions, info->rowDirection, info->columnDirection);
+    CachedSliceSource source(files, this->slices);
+    for (auto i = job.isoLevels.begin(); i != job.isoLevels.end() && !this->cancellation.IsCancelled(); ++i)
+    {
+        std::string suffix = job.isoLevels.size() > 1 ? "_il" + std::to_string(*i) : std::string();
+        std::string fileName = MakeOutputFileName(job.outputDir, info->firstFile, suffix, job.output);
+        WriteVolume(source, *i, fileName, job.output, job.pipeline, this->logger, [this]() -> bool
+        {
+            return this->cancellation.IsCancelled();
+        });
+        if (!this->cancellation.IsCancelled())
+        {
+            pending.result.outputs.push_back(fileName);
+        }
+    }
+}
+
+std::shared_ptr<const SeriesInfo> Daemon::GetSeries(const std::string& inputDir)
+{
+    int64_t stamp = GetDirStamp(inputDir);
+    {
+        std::lock_guard<std::mutex> lock(this->seriesMutex);
+        auto i = this->series.find(inputDir);
+        if (i != this->series.end() && stamp >= 0 && i->second->stamp == stamp)
+        {
+            ++this->seriesHits;
+            return i->second;
+        }
+        ++this->seriesMisses;
+    }
+
+    std::shared_ptr<SeriesInfo> info = std::make_shared<SeriesInfo>();
+    info->stamp = stamp;
+    SeriesList series;
+    ScanDicomSeries(inputDir, false, series);
+    if (series.empty())
+    {
+        throw std::invalid_argument("There are no files in the input directory");
+    }
+    if (series.size() > 1)
+    {
+        OFLOG_WARN(this->logger, inputDir << " holds " << series.size() << " series, the largest one "
+                                 << series[0].seriesInstanceUid << " is converted" << OFendl);
+    }
+    const FileNames& files = series[0].files;
+    info->firstFile = files[0];
+    ReadFormatDcmFiles(files, this->logger, info->dx, info->dy, info->spacing, info->slicesPositions,
+                       info->rowDirection, info->columnDirection);
+
+    std::lock_guard<std::mutex> lock(this->seriesMutex);
+    this->series[inputDir] = info;
+    return info;
+}
+
+std::string Daemon::GetStats()
+{
+    CacheStats sliceStats = this->slices.GetStats();
+    std::stringstream buf;
+    {
+        std::lock_guard<std::mutex> lock(this->seriesMutex);
+        buf << "series_cache_hits " << this->seriesHits << "\n"
+            << "series_cache_misses " << this->seriesMisses << "\n";
+    }
+    buf << "slice_cache_hits " << sliceStats.hits << "\n"
+        << "slice_cache_misses " << sliceStats.misses << "\n"
+        << "slice_cache_entries " << sliceStats.entries << "\n"
+        << "slice_cache_bytes " << sliceStats.bytes << "\n";
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    size_t finished = this->completed + this->failed + this->cancelled;
+    buf << "queued " << this->queued << "\n"
+        << "running " << this->running << "\n"
+        << "completed " << this->completed << "\n"
+        << "failed " << this->failed << "\n"
+        << "cancelled " << this->cancelled << "\n"
+        << "latency_mean_ms " << (finished > 0 ? this->latencySum / finished : 0.) << "\n"
+        << "latency_max_ms " << this->latencyMax << "\n"
+        << "latency_last_ms " << this->latencyLast << "\n"
+        << "queue_wait_mean_ms " << (finished > 0 ? this->queueSum / finished : 0.) << "\n"
+        << "end\n";
+    return buf.str();
+}
+
+void Daemon::Serve(int connection)
+{
+    timeval timeout;
+    timeout.tv_sec = REQUEST_TIMEOUT_SECONDS;
+    timeout.tv_usec = 0;
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    LineReader reader(connection);
+    std::string request;
+    if (!reader.ReadLine(request))
+    {
+        return;
+    }
+    if (request == "stats")
+    {
+        SendText(connection, GetStats());
+        return;
+    }
+    std::string message;
+    std::shared_ptr<PendingJob> pending = std::make_shared<PendingJob>();
+    if (request != "job" || !reader.ReadMessage(message))
+    {
+        SendText(connection, "error unknown request\nend\n");
+        return;
+    }
+    std::istringstream in(message);
+    if (!ReadJob(in, pending->job))
+    {
+        SendText(connection, "error malformed job\nend\n");
+        return;
+    }
+
+    pending->result.id = ++this->lastId;
+    pending->queuedAt = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(this->statsMutex);
+        pending->result.queuePosition = ++this->queued;
+    }
+    if (!this->jobs.Push(pending))
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            --this->queued;
+        }
+        SendText(connection, "error daemon is stopping\nend\n");
+        return;
+    }
+    OFLOG_INFO(this->logger, "Job " << pending->result.id << " queued for " << pending->job.inputDir
+                             << ", " << pending->result.queuePosition << " in the queue" << OFendl);
+    std::stringstream queuedReply;
+    queuedReply << "queued " << pending->result.id << " " << pending->result.queuePosition << "\n";
+    SendText(connection, queuedReply.str());
+
+    std::unique_lock<std::mutex> lock(pending->mutex);
+    pending->done.wait(lock, [&]() { return pending->isDone; });
+    std::stringstream reply;
+    reply << "latency " << pending->result.latencyMs << " " << pending->result.queueMs << "\n";
+    std::for_each(pending->result.outputs.begin(), pending->result.outputs.end(), [&](const std::string& output)
+    {
+        reply << "output " << output << "\n";
+    });
+    reply << "status " << pending->result.status << "\n"
+          << "end\n";
+    SendText(connection, reply.str());
+}
+
+// Client thread and whether it is over, finished ones are joined by the accept loop
+struct Connection
+{
+    std::thread thread;
+    std::shared_ptr<std::atomic<bool> > finished;
+};
+}
+
+void RunDaemon(const std::string& socketPath,
+               const DaemonOptions& options,
+               OFLogger& logger,
+               CancellationToken& cancellation)
+{
+    sockaddr_un address = MakeAddress(socketPath);
+    {
+        Socket probe(Connect(socketPath));
+        if (probe.Get() >= 0)
+        {
+            throw std::runtime_error("Another daemon listens on " + socketPath);
+        }
+    }
+    // Left behind by a daemon that was killed
+    unlink(socketPath.c_str());
+
+    // Jobs read and write files as the daemon user, so only that user may connect.
+    // The mask is set around bind, the socket never exists with looser permissions.
+    Socket listener(socket(AF_UNIX, SOCK_STREAM, 0));
+    mode_t oldMask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    bool isBound = listener.Get() >= 0 && bind(listener.Get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    umask(oldMask);
+    if (!isBound || listen(listener.Get(), SOMAXCONN) != 0)
+    {
+        throw std::runtime_error("Can't listen on " + socketPath);
+    }
+
+    Daemon daemon(options, logger, cancellation);
+    OFLOG_INFO(logger, "Listening on " << socketPath << " with " << std::max(options.workers, 1) << " workers" << OFendl);
+
+    std::list<Connection> connections;
+    while (!cancellation.IsCancelled())
+    {
+        pollfd pfd;
+        pfd.fd = listener.Get();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ready = poll(&pfd, 1, ACCEPT_POLL_MS);
+
+        for (auto i = connections.begin(); i != connections.end();)
+        {
+            if (i->finished->load())
+            {
+                i->thread.join();
+                i = connections.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        if (ready > 0 && (pfd.revents & POLLIN))
+        {
+            int fd = accept(listener.Get(), nullptr, nullptr);
+            if (fd >= 0)
+            {
+                Connection connection;
+                connection.finished = std::make_shared<std::atomic<bool> >(false);
+                std::shared_ptr<std::atomic<bool> > finished = connection.finished;
+                connection.thread = std::thread([&daemon, &logger, fd, finished]()
+                {
+                    Socket client(fd);
+                    try
+                    {
+                        daemon.Serve(client.Get());
+                    }
+                    catch (std::exception& err)
+                    {
+                        OFLOG_ERROR(logger, "Client request failed : " << err.what() << OFendl);
+                    }
+                    finished->store(true);
+                });
+                connections.push_back(std::move(connection));
+            }
+        }
+    }
+
+    OFLOG_INFO(logger, "Daemon stopping, the running jobs are cancelled" << OFendl);
+    daemon.Stop();
+    std::for_each(connections.begin(), connections.end(), [](Connection& connection) { connection.thread.join(); });
+    unlink(socketPath.c_str());
+}
+
+bool SubmitJob(const std::string& socketPath, const ConversionJob& job, JobResult& result)
+{
+    result = JobResult();
+    ConversionJob request = job;
+    request.inputDir = GetAbsolutePath(job.inputDir);
+    request.outputDir = GetAbsolutePath(job.outputDir);
+
+    Socket connection(Connect(socketPath));
+    std::stringstream text;
+    text << "job\n";
+    WriteJob(text, request);
+    if (connection.Get() < 0 || !SendText(connection.Get(), text.str()))
+    {
+        result.status = "failed no daemon listens on " + socketPath;
+        return false;
+    }
+
+    LineReader reader(connection.Get());
+    std::string line;
+    std::string key;
+    std::string value;
+    while (reader.ReadLine(line))
+    {
+        SplitLine(line, key, value);
+        std::istringstream buf(value);
+        if (key == "end")
+        {
+            return result.status == "ok";
+        }
+        else if (key == "error")
+        {
+            result.status = "failed " + value;
+        }
+        else if (key == "queued")
+        {
+            buf >> result.id >> result.queuePosition;
+        }
+        else if (key == "latency")
+        {
+            buf >> result.latencyMs >> result.queueMs;
+        }
+        else if (key == "output")
+        {
+            result.outputs.push_back(value);
+        }
+        else if (key == "status")
+        {
+            result.status = value;
+        }
+    }
+    result.status = "failed connection to the daemon was lost";
+    return false;
+}
+
+bool PrintDaemonStats(const std::string& socketPath, std::ostream& out)
+{
+    Socket connection(Connect(socketPath));
+    if (connection.Get() < 0 || !SendText(connection.Get(), "stats\n"))
+    {
+        return false;
+    }
+    LineReader reader(connection.Get());
+    std::string line;
+    while (reader.ReadLine(line))
+    {
+        if (line == "end")
+        {
+            return true;
+        }
+        out << line << "\n";
+    }
+    return false;
+}
+#endif
+
+}
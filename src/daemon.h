@@ -0,0 +1,61 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include "conversionjob.h"
+#include "cancellation.h"
+
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <cstdint>
+
+class OFLogger;
+
+namespace DicomToStl
+{
+
+struct DaemonOptions
+{
+    DaemonOptions() : workers(2), cacheBytes(1ull << 30) {}
+    // Jobs converted at once, each one still runs its own pipeline threads
+    int workers;
+    // Bytes of decoded slices kept between the jobs
+    uint64_t cacheBytes;
+};
+
+// Serves conversion jobs on a Unix domain socket until the token is cancelled.
+// The series listings and formats and the decoded slices stay cached between
+// the jobs, so converting a series again only runs the triangulation.
+// Throws std::runtime_error if the socket can't be created or another daemon
+// already listens on it.
+void RunDaemon(const std::string& socketPath,
+               const DaemonOptions& options,
+               OFLogger& logger,
+               CancellationToken& cancellation);
+
+// Reply of the daemon to a submitted job
+struct JobResult
+{
+    JobResult() : id(0), queuePosition(0), latencyMs(0.), queueMs(0.) {}
+    size_t id;
+    // Jobs waiting in the queue when this one was added, itself included
+    size_t queuePosition;
+    // "ok", "cancelled" or "failed" followed by the reason
+    std::string status;
+    std::vector<std::string> outputs;
+    // From the submission to the end of the job, and the part spent in the queue
+    double latencyMs;
+    double queueMs;
+};
+
+// Sends the job to the daemon and waits until it is finished. Relative folders
+// are resolved against the current directory. Returns false if the daemon can't
+// be reached or the job did not succeed, the status tells why.
+bool SubmitJob(const std::string& socketPath, const ConversionJob& job, JobResult& result);
+
+// Copies the queue, latency and cache counters of the daemon to out
+bool PrintDaemonStats(const std::string& socketPath, std::ostream& out);
+
+}
+
+#endif
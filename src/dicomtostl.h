@@ -0,0 +1,25 @@
+#ifndef _DICOM_TO_STL_H_
+#define _DICOM_TO_STL_H_
+
+// Library interface of the converter. A series comes either from DICOM files
+// (OpenDcmSeries) or from slices in the caller's memory (MemorySliceSource),
+// the mesh goes to a file (WriteVolume) or to a MeshWriter such as
+// CallbackMeshWriter and MemoryMeshWriter (TriangulateVolume).
+// PipelineOptions::progress receives ProgressEvent updates while either one runs.
+// PreviewSliceSource wraps a source into a coarse one for trying isolevels quickly.
+//
+//     MemorySliceSource source(volume);
+//     MemoryMeshWriter mesh;
+//     TriangulateVolume(source, isoLevel, mesh, PipelineOptions(), logger, nullptr);
+//     mesh.GetBinaryStl(bytes);
+
+#include "slicesource.h"
+#include "volumereader.h"
+#include "meshwriter.h"
+#include "memorywriter.h"
+#include "meshreader.h"
+#include "chunkedmesh.h"
+#include "progress.h"
+#include "previewsource.h"
+
+#endif
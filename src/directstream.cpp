@@ -0,0 +1,405 @@
+#include "directstream.h"
+
+#ifdef __linux__
+
+#ifdef DICOMTOSTL_WITH_URING
+#include <liburing.h>
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// Satisfies the logical block size of any common device
+const size_t DIRECT_ALIGNMENT = 4096;
+const size_t DIRECT_BUFFER_SIZE = 4 << 20;
+const size_t DIRECT_BUFFERS_COUNT = 8;
+}
+
+class DiskQueue
+{
+public:
+    DiskQueue() {}
+    virtual ~DiskQueue() {}
+    // False when the buffer could not be queued, it stays with the caller and the
+    // queue is failed
+    virtual bool Submit(DirectBuffer* buffer) = 0;
+    // Blocks until one of the submitted buffers is on disk and returns it, nullptr
+    // when the queue failed and nothing can be waited for any more
+    virtual DirectBuffer* WaitCompleted() = 0;
+    virtual bool IsFailed() const = 0;
+private:
+    DiskQueue(const DiskQueue&);
+    DiskQueue& operator=(const DiskQueue&);
+};
+
+namespace
+{
+class ThreadDiskQueue : public DiskQueue
+{
+public:
+    ThreadDiskQueue(int fd, bool isDirect)
+        : fd(fd),
+          isDirect(isDirect),
+          stop(false),
+          failed(false)
+    {
+        writer = std::thread([this]() { this->Run(); });
+    }
+    virtual ~ThreadDiskQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            stop = true;
+        }
+        submittedCondition.notify_one();
+        writer.join();
+    }
+    virtual bool Submit(DirectBuffer* buffer)
+    {
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            submitted.push_back(buffer);
+        }
+        submittedCondition.notify_one();
+        return true;
+    }
+    virtual DirectBuffer* WaitCompleted()
+    {
+        std::unique_lock<std::mutex> lock(guard);
+        completedCondition.wait(lock, [this]() { return !completed.empty(); });
+        DirectBuffer* buffer = completed.front();
+        completed.pop_front();
+        return buffer;
+    }
+    virtual bool IsFailed() const
+    {
+        std::lock_guard<std::mutex> lock(guard);
+        return failed;
+    }
+private:
+    void Run()
+    {
+        for (;;)
+        {
+            DirectBuffer* buffer = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(guard);
+                submittedCondition.wait(lock, [this]() { return stop || !submitted.empty(); });
+                if (submitted.empty())
+                {
+                    return;
+                }
+                buffer = submitted.front();
+                submitted.pop_front();
+            }
+
+            bool ok = WriteBuffer(*buffer);
+
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                failed |= !ok;
+                completed.push_back(buffer);
+            }
+            completedCondition.notify_one();
+        }
+    }
+    bool WriteBuffer(const DirectBuffer& buffer)
+    {
+        size_t written = 0;
+        while (written < buffer.size)
+        {
+            ssize_t res = ::pwrite(fd, buffer.data + written, buffer.size - written, buffer.offset + written);
+            if (res <= 0)
+            {
+                return false;
+            }
+            written += static_cast<size_t>(res);
+        }
+        if (!isDirect)
+        {
+            // Without O_DIRECT write back right away and drop the pages from the cache
+            ::sync_file_range(fd, buffer.offset, buffer.size, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            ::posix_fadvise(fd, buffer.offset, buffer.size, POSIX_FADV_DONTNEED);
+        }
+        return true;
+    }
+private:
+    int fd;
+    bool isDirect;
+    std::thread writer;
+    mutable std::mutex guard;
+    std::condition_variable submittedCondition;
+    std::condition_variable completedCondition;
+    std::deque<DirectBuffer*> submitted;
+    std::deque<DirectBuffer*> completed;
+    bool stop;
+    bool failed;
+};
+
+#ifdef DICOMTOSTL_WITH_URING
+class UringDiskQueue : public DiskQueue
+{
+public:
+    UringDiskQueue(int fd)
+        : fd(fd),
+          failed(false)
+    {
+        if (io_uring_queue_init(DIRECT_BUFFERS_COUNT, &ring, 0) < 0)
+        {
+            throw std::runtime_error("Can't initialize io_uring");
+        }
+    }
+    virtual ~UringDiskQueue()
+    {
+        io_uring_queue_exit(&ring);
+    }
+    virtual bool Submit(DirectBuffer* buffer)
+    {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr)
+        {
+            failed = true;
+            return false;
+        }
+        io_uring_prep_write(sqe, fd, buffer->data, static_cast<unsigned>(buffer->size), buffer->offset);
+        io_uring_sqe_set_data(sqe, buffer);
+        int res = io_uring_submit(&ring);
+        while (res == -EINTR)
+        {
+            res = io_uring_submit(&ring);
+        }
+        if (res < 0)
+        {
+            // The entry may still be in the ring, nothing is submitted after a
+            // failure so it never goes out; nothing is waited for it
+            failed = true;
+            return false;
+        }
+        return true;
+    }
+    virtual DirectBuffer* WaitCompleted()
+    {
+        io_uring_cqe* cqe = nullptr;
+        int res = io_uring_wait_cqe(&ring, &cqe);
+        while (res == -EINTR)
+        {
+            // A signal such as the Ctrl+C of the cancellation
+            res = io_uring_wait_cqe(&ring, &cqe);
+        }
+        if (res < 0)
+        {
+            failed = true;
+            return nullptr;
+        }
+        DirectBuffer* buffer = static_cast<DirectBuffer*>(io_uring_cqe_get_data(cqe));
+        if (cqe->res != static_cast<int>(buffer->size))
+        {
+            failed = true;
+        }
+        io_uring_cqe_seen(&ring, cqe);
+        return buffer;
+    }
+    virtual bool IsFailed() const
+    {
+        return failed;
+    }
+private:
+    int fd;
+    io_uring ring;
+    bool failed;
+};
+#endif
+}
+
+DirectOutputStream::DirectOutputStream(const std::string& fileName)
+    : fd(-1)
+    , isDirect(true)
+    , isClosed(false)
+    , current(nullptr)
+    , inFlight(0)
+    , offset(0)
+    , bytesWritten(0)
+{
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0)
+    {
+        // Some file systems (tmpfs for instance) refuse O_DIRECT
+        isDirect = false;
+        fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0)
+    {
+        throw std::invalid_argument("Can't create output file");
+    }
+
+    buffers.resize(DIRECT_BUFFERS_COUNT);
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        void* data = nullptr;
+        if (::posix_memalign(&data, DIRECT_ALIGNMENT, DIRECT_BUFFER_SIZE) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        buffers[i].data = static_cast<char*>(data);
+        buffers[i].size = 0;
+        buffers[i].offset = 0;
+        freeBuffers.push_back(&buffers[i]);
+    }
+
+#ifdef DICOMTOSTL_WITH_URING
+    queue.reset(new UringDiskQueue(fd));
+#else
+    queue.reset(new ThreadDiskQueue(fd, isDirect));
+#endif
+    current = Acquire();
+}
+
+DirectOutputStream::~DirectOutputStream()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+    queue.reset();
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        ::free(buffers[i].data);
+    }
+}
+
+DirectBuffer* DirectOutputStream::Acquire()
+{
+    // A failed queue takes no more data, Close reports the failure
+    if (queue->IsFailed())
+    {
+        return nullptr;
+    }
+    if (freeBuffers.empty())
+    {
+        DirectBuffer* buffer = queue->WaitCompleted();
+        if (buffer == nullptr)
+        {
+            return nullptr;
+        }
+        freeBuffers.push_back(buffer);
+        --inFlight;
+    }
+    DirectBuffer* buffer = freeBuffers.front();
+    freeBuffers.pop_front();
+    buffer->size = 0;
+    buffer->offset = offset;
+    return buffer;
+}
+
+void DirectOutputStream::Submit()
+{
+    // Counted in flight only once submitted, a failed submit is never waited for
+    if (queue->Submit(current))
+    {
+        offset += current->size;
+        ++inFlight;
+    }
+    else
+    {
+        freeBuffers.push_back(current);
+    }
+    current = nullptr;
+}
+
+void DirectOutputStream::Write(const char* data, size_t size)
+{
+    bytesWritten += size;
+    // After a failure the data is dropped, Close throws
+    while (size > 0 && current != nullptr)
+    {
+        size_t count = std::min(size, DIRECT_BUFFER_SIZE - current->size);
+        std::memcpy(current->data + current->size, data, count);
+        current->size += count;
+        data += count;
+        size -= count;
+        if (current->size == DIRECT_BUFFER_SIZE)
+        {
+            Submit();
+            current = Acquire();
+        }
+    }
+}
+
+void DirectOutputStream::Close()
+{
+    if (this->isClosed)
+    {
+        return;
+    }
+    this->isClosed = true;
+
+    // After a failure there is no current buffer, or one that never goes out
+    uint64_t fileSize = offset + (current != nullptr ? current->size : 0);
+    if (current != nullptr && current->size > 0 && !queue->IsFailed())
+    {
+        if (isDirect)
+        {
+            // O_DIRECT writes whole blocks, the padding is cut off below
+            size_t padded = (current->size + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+            std::memset(current->data + current->size, 0, padded - current->size);
+            current->size = padded;
+        }
+        Submit();
+    }
+    else if (current != nullptr)
+    {
+        freeBuffers.push_back(current);
+        current = nullptr;
+    }
+    while (inFlight > 0)
+    {
+        DirectBuffer* buffer = queue->WaitCompleted();
+        if (buffer == nullptr)
+        {
+            break;
+        }
+        freeBuffers.push_back(buffer);
+        --inFlight;
+    }
+
+    bool failed = queue->IsFailed();
+    if (::ftruncate(fd, static_cast<off_t>(fileSize)) != 0)
+    {
+        failed = true;
+    }
+    if (::close(fd) != 0)
+    {
+        failed = true;
+    }
+    fd = -1;
+    if (failed)
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+}
+
+uint64_t DirectOutputStream::GetBytesWritten() const
+{
+    return bytesWritten;
+}
+
+}
+
+#endif
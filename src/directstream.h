@@ -0,0 +1,57 @@
+#ifndef _DIRECT_STREAM_H_
+#define _DIRECT_STREAM_H_
+
+#include "outputstream.h"
+
+#ifdef __linux__
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+struct DirectBuffer
+{
+    char* data;
+    size_t size;
+    uint64_t offset;
+};
+
+class DiskQueue;
+
+// Linux output which bypasses the page cache. Data is copied into a ring of
+// aligned buffers which are written with O_DIRECT by io_uring (when built with
+// liburing) or by a writer thread, so the caller never waits for the disk
+// unless the whole ring is in flight.
+class DirectOutputStream : public OutputStream
+{
+public:
+    DirectOutputStream(const std::string& fileName);
+    virtual ~DirectOutputStream();
+    virtual void Write(const char* data, size_t size);
+    virtual void Close();
+    virtual uint64_t GetBytesWritten() const;
+private:
+    void Submit();
+    DirectBuffer* Acquire();
+private:
+    int fd;
+    bool isDirect;
+    bool isClosed;
+    std::vector<DirectBuffer> buffers;
+    std::deque<DirectBuffer*> freeBuffers;
+    std::unique_ptr<DiskQueue> queue;
+    DirectBuffer* current;
+    size_t inFlight;
+    uint64_t offset;
+    uint64_t bytesWritten;
+};
+
+}
+
+#endif
+
+#endif
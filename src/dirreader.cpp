@@ -3,7 +3,12 @@
 #include <dcmtk/dcmdata/dcdicdir.h>
 #include <dcmtk/dcmdata/dcdeftag.h>
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
 #include <algorithm>
 
@@ -19,6 +24,7 @@ bool IsDICOMDIR(std::string dirName)
     return (pos >= 8 && (dirName.substr(pos - 8, 8) == "DICOMDIR" || dirName.substr(pos - 8, 8) == "dicomdir"));
 }
 
+#ifdef _WIN32
 void GetFileNamesFromOSDir(const std::string& dirName, FileNames& files)
 {
     WIN32_FIND_DATA ffd;
@@ -56,6 +62,45 @@ void GetFileNamesFromOSDir(const std::string& dirName, FileNames& files)
     }
     while (FindNextFile(hFind, &ffd) != 0);
 }
+#else
+void GetFileNamesFromOSDir(const std::string& dirName, FileNames& files)
+{
+    std::string slash = "";
+    if (dirName.back() != '/')
+    {
+        slash = "/";
+    }
+
+    DIR* dir = opendir(dirName.c_str());
+    if (dir == nullptr)
+    {
+        return;
+    }
+
+    // Same match as the *.dcm search on Windows, which ignores the case
+    for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.size() < 4)
+        {
+            continue;
+        }
+        std::string ext = name.substr(name.size() - 4);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext != ".dcm")
+        {
+            continue;
+        }
+        std::string path = dirName + slash + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+        {
+            files.push_back(path);
+        }
+    }
+    closedir(dir);
+}
+#endif
 
 void GetStudiesPairsFromDir(const std::string& dirName, StudyPairs& pairs)
 {
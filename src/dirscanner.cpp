@@ -0,0 +1,340 @@
+#include "dirscanner.h"
+#include "pipeline.h"
+
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+namespace
+{
+struct SeriesKey
+{
+    std::string uid;
+    std::string number;
+};
+
+void GroupBySeries(const FileNames& files, const std::vector<SeriesKey>& keys, SeriesList& series)
+{
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        auto found = index.find(keys[i].uid);
+        if (found == index.end())
+        {
+            found = index.insert(std::make_pair(keys[i].uid, series.size())).first;
+            SeriesFiles group;
+            group.seriesInstanceUid = keys[i].uid;
+            group.seriesNumber = keys[i].number;
+            series.push_back(group);
+        }
+        series[found->second].files.push_back(files[i]);
+    }
+    std::stable_sort(series.begin(), series.end(), [](const SeriesFiles& a, const SeriesFiles& b)
+    {
+        return a.files.size() > b.files.size();
+    });
+}
+
+#ifdef __linux__
+// Bytes read at first, enough for the meta header and the start of the dataset
+const size_t PROBE_BYTES = 4096;
+// Bytes read when the series tags are further in, past that DCMTK parses the file
+const size_t PROBE_MAX_BYTES = 65536;
+const size_t DICM_OFFSET = 128;
+// Values longer than this are skipped by DCMTK in the fallback
+const unsigned long FALLBACK_MAX_READ_LENGTH = 256;
+const uint32_t TAG_SERIES_INSTANCE_UID = 0x0020000E;
+const uint32_t TAG_SERIES_NUMBER = 0x00200011;
+const uint32_t UNDEFINED_LENGTH = 0xFFFFFFFF;
+
+enum HeaderStatus
+{
+    HEADER_FOUND,
+    HEADER_TRUNCATED,
+    // Big endian, deflated or a sequence of undefined length before the series tags
+    HEADER_UNSUPPORTED
+};
+
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+uint16_t ReadUint16(const unsigned char* p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t ReadUint32(const unsigned char* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// VRs with a reserved field and a 32 bit length in the explicit syntaxes
+bool HasLongLength(const unsigned char* vr)
+{
+    static const char* const longVrs[] = { "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV" };
+    return std::any_of(longVrs, longVrs + sizeof(longVrs) / sizeof(longVrs[0]),
+                       [vr](const char* longVr) { return vr[0] == longVr[0] && vr[1] == longVr[1]; });
+}
+
+// Text value without the padding
+std::string GetText(const unsigned char* value, uint32_t length)
+{
+    std::string text(reinterpret_cast<const char*>(value), length);
+    size_t end = text.find_last_not_of(std::string(" \0", 2));
+    size_t begin = text.find_first_not_of(' ');
+    return end == std::string::npos || begin > end ? std::string() : text.substr(begin, end - begin + 1);
+}
+
+// Walks the tags of the little endian syntaxes up to the series ones. isWhole tells
+// the data is the whole file, running out of it then means the tags are missing.
+HeaderStatus ParseSeriesKey(const unsigned char* data, size_t size, bool isWhole, SeriesKey& key)
+{
+    size_t pos = DICM_OFFSET + 4;
+    bool isMeta = true;
+    bool isExplicit = true;
+    std::string syntax;
+    for (;;)
+    {
+        if (pos + 8 > size)
+        {
+            return isWhole ? HEADER_FOUND : HEADER_TRUNCATED;
+        }
+        uint16_t group = ReadUint16(data + pos);
+        uint32_t tag = (static_cast<uint32_t>(group) << 16) | ReadUint16(data + pos + 2);
+        if (isMeta && group != 0x0002)
+        {
+            isMeta = false;
+            if (syntax == "1.2.840.10008.1.2")
+            {
+                isExplicit = false;
+            }
+            else if (syntax == "1.2.840.10008.1.2.2" || syntax == "1.2.840.10008.1.2.1.99")
+            {
+                return HEADER_UNSUPPORTED;
+            }
+        }
+        if (!isMeta && tag > TAG_SERIES_NUMBER)
+        {
+            return HEADER_FOUND;
+        }
+
+        size_t header = 8;
+        uint32_t length = 0;
+        if (isMeta || isExplicit)
+        {
+            if (HasLongLength(data + pos + 4))
+            {
+                if (pos + 12 > size)
+                {
+                    return isWhole ? HEADER_FOUND : HEADER_TRUNCATED;
+                }
+                length = ReadUint32(data + pos + 8);
+                header = 12;
+            }
+            else
+            {
+                length = ReadUint16(data + pos + 6);
+            }
+        }
+        else
+        {
+            length = ReadUint32(data + pos + 4);
+        }
+        if (length == UNDEFINED_LENGTH)
+        {
+            return HEADER_UNSUPPORTED;
+        }
+        if (pos + header + length > size)
+        {
+            return isWhole ? HEADER_FOUND : HEADER_TRUNCATED;
+        }
+
+        const unsigned char* value = data + pos + header;
+        if (isMeta && tag == 0x00020010)
+        {
+            syntax = GetText(value, length);
+        }
+        else if (!isMeta && tag == TAG_SERIES_INSTANCE_UID)
+        {
+            key.uid = GetText(value, length);
+        }
+        else if (!isMeta && tag == TAG_SERIES_NUMBER)
+        {
+            key.number = GetText(value, length);
+        }
+        pos += header + length;
+    }
+}
+
+void ReadSeriesKeyWithDcmtk(const std::string& fileName, SeriesKey& key)
+{
+    DcmFileFormat fileformat;
+    if (fileformat.loadFile(fileName.c_str(), EXS_Unknown, EGL_withoutGL, FALLBACK_MAX_READ_LENGTH).bad())
+    {
+        return;
+    }
+    OFString value;
+    if (fileformat.getDataset()->findAndGetOFString(DCM_SeriesInstanceUID, value).good())
+    {
+        key.uid = value.c_str();
+    }
+    if (fileformat.getDataset()->findAndGetOFString(DCM_SeriesNumber, value).good())
+    {
+        key.number = value.c_str();
+    }
+}
+
+// False when the file is no regular DICOM file with a preamble
+bool ProbeFile(const std::string& fileName, SeriesKey& key)
+{
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool isDicom = false;
+    HeaderStatus status = HEADER_FOUND;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && static_cast<size_t>(info.st_size) >= DICM_OFFSET + 4)
+    {
+        size_t fileSize = static_cast<size_t>(info.st_size);
+        std::vector<unsigned char> buffer(std::min(PROBE_BYTES, fileSize));
+        ssize_t read = pread(fd, buffer.data(), buffer.size(), 0);
+        isDicom = read >= static_cast<ssize_t>(DICM_OFFSET + 4) && std::memcmp(&buffer[DICM_OFFSET], "DICM", 4) == 0;
+        if (isDicom)
+        {
+            status = ParseSeriesKey(buffer.data(), read, static_cast<size_t>(read) == fileSize, key);
+            if (status == HEADER_TRUNCATED)
+            {
+                buffer.resize(std::min(PROBE_MAX_BYTES, fileSize));
+                read = pread(fd, buffer.data(), buffer.size(), 0);
+                status = read > 0 ? ParseSeriesKey(buffer.data(), read, static_cast<size_t>(read) == fileSize, key) : HEADER_UNSUPPORTED;
+            }
+        }
+    }
+    close(fd);
+    if (isDicom && status != HEADER_FOUND)
+    {
+        key = SeriesKey();
+        ReadSeriesKeyWithDcmtk(fileName, key);
+    }
+    return isDicom;
+}
+
+// Names of the files in the folder, the subfolders too when recursive. Symbolic
+// links are probed as files, links to folders are not followed.
+void ListFolder(int dirFd, const std::string& dirName, bool recursive, FileNames& files)
+{
+    std::string slash = dirName.empty() || dirName.back() != '/' ? "/" : "";
+    std::vector<char> buffer(1 << 15);
+    for (;;)
+    {
+        long bytes = syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+        if (bytes <= 0)
+        {
+            break;
+        }
+        for (long offset = 0; offset < bytes;)
+        {
+            const LinuxDirent64* entry = reinterpret_cast<const LinuxDirent64*>(&buffer[offset]);
+            offset += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0)
+            {
+                continue;
+            }
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN)
+            {
+                // Some file systems give no type, the entry is looked at
+                struct stat info;
+                if (fstatat(dirFd, name, &info, AT_SYMLINK_NOFOLLOW) == 0)
+                {
+                    type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : S_ISLNK(info.st_mode) ? DT_LNK : DT_UNKNOWN;
+                }
+            }
+            if (type == DT_DIR && recursive)
+            {
+                int subFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (subFd >= 0)
+                {
+                    ListFolder(subFd, dirName + slash + name, recursive, files);
+                    close(subFd);
+                }
+            }
+            else if (type == DT_REG || type == DT_LNK)
+            {
+                files.push_back(dirName + slash + name);
+            }
+        }
+    }
+}
+#endif
+}
+
+#ifdef __linux__
+void ScanDicomSeries(const std::string& dirName, bool recursive, SeriesList& series)
+{
+    series.clear();
+    int dirFd = open(dirName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0)
+    {
+        return;
+    }
+    FileNames candidates;
+    ListFolder(dirFd, dirName, recursive, candidates);
+    close(dirFd);
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<SeriesKey> keys(candidates.size());
+    std::vector<char> isDicom(candidates.size());
+    ParallelFor(size_t(0), candidates.size(), [&](size_t i)
+    {
+        isDicom[i] = ProbeFile(candidates[i], keys[i]) ? 1 : 0;
+    });
+
+    FileNames files;
+    std::vector<SeriesKey> fileKeys;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (isDicom[i])
+        {
+            files.push_back(candidates[i]);
+            fileKeys.push_back(keys[i]);
+        }
+    }
+    GroupBySeries(files, fileKeys, series);
+}
+#else
+void ScanDicomSeries(const std::string& dirName, bool, SeriesList& series)
+{
+    series.clear();
+    FileNames files;
+    GetFileNamesFromOSDir(dirName, files);
+    GroupBySeries(files, std::vector<SeriesKey>(files.size()), series);
+}
+#endif
+
+}
@@ -0,0 +1,31 @@
+#ifndef _DIR_SCANNER_H_
+#define _DIR_SCANNER_H_
+
+#include "dirreader.h"
+
+#include <string>
+#include <vector>
+
+namespace DicomToStl
+{
+
+// DICOM files of one series found in a folder
+struct SeriesFiles
+{
+    std::string seriesInstanceUid;
+    std::string seriesNumber;
+    FileNames files;
+};
+
+typedef std::vector<SeriesFiles> SeriesList;
+
+// Finds the DICOM files in the folder, and in its subfolders when recursive, by their
+// content rather than their name: the 128 byte preamble followed by "DICM", read with
+// one small pread. The files are grouped by SeriesInstanceUID, the largest series first.
+// On Linux the folders are listed with getdents64 and the files are probed on the
+// shared workers; elsewhere the *.dcm files of GetFileNamesFromOSDir make one series.
+void ScanDicomSeries(const std::string& dirName, bool recursive, SeriesList& series);
+
+}
+
+#endif
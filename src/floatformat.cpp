@@ -0,0 +1,444 @@
+#include "floatformat.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// Shortest round-trip conversion follows Ulf Adams' Ryu algorithm
+// ("Ryu: fast float-to-string conversion", PLDI 2018) for 32-bit floats.
+
+const int FLOAT_MANTISSA_BITS = 23;
+const int FLOAT_BIAS = 127;
+const int FLOAT_POW5_INV_BITCOUNT = 59;
+const int FLOAT_POW5_BITCOUNT = 61;
+const int FLOAT_POW5_INV_TABLE_SIZE = 31;
+const int FLOAT_POW5_TABLE_SIZE = 47;
+
+// ceil(log2(5^e)) for e > 0, 1 for e == 0
+int32_t Pow5Bits(int32_t e)
+{
+    return static_cast<int32_t>((static_cast<uint32_t>(e) * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e))
+uint32_t Log10Pow2(int32_t e)
+{
+    return (static_cast<uint32_t>(e) * 78913) >> 18;
+}
+
+// floor(log10(5^e))
+uint32_t Log10Pow5(int32_t e)
+{
+    return (static_cast<uint32_t>(e) * 732923) >> 20;
+}
+
+// Minimal fixed width unsigned integer, only used to build the power of five tables once.
+class BigUInt
+{
+public:
+    explicit BigUInt(uint32_t value = 0)
+    {
+        std::memset(limbs, 0, sizeof(limbs));
+        limbs[0] = value;
+    }
+    void Mul(uint32_t factor)
+    {
+        uint64_t carry = 0;
+        for (int i = 0; i < LIMBS; ++i)
+        {
+            uint64_t v = static_cast<uint64_t>(limbs[i]) * factor + carry;
+            limbs[i] = static_cast<uint32_t>(v);
+            carry = v >> 32;
+        }
+    }
+    void ShiftLeft1(uint32_t lowBit)
+    {
+        for (int i = LIMBS - 1; i > 0; --i)
+        {
+            limbs[i] = (limbs[i] << 1) | (limbs[i - 1] >> 31);
+        }
+        limbs[0] = (limbs[0] << 1) | lowBit;
+    }
+    bool Less(const BigUInt& other) const
+    {
+        for (int i = LIMBS - 1; i >= 0; --i)
+        {
+            if (limbs[i] != other.limbs[i])
+            {
+                return limbs[i] < other.limbs[i];
+            }
+        }
+        return false;
+    }
+    void Sub(const BigUInt& other)
+    {
+        int64_t borrow = 0;
+        for (int i = 0; i < LIMBS; ++i)
+        {
+            int64_t v = static_cast<int64_t>(limbs[i]) - other.limbs[i] - borrow;
+            borrow = v < 0 ? 1 : 0;
+            limbs[i] = static_cast<uint32_t>(v);
+        }
+    }
+    bool Bit(int index) const
+    {
+        return ((limbs[index / 32] >> (index % 32)) & 1) != 0;
+    }
+    // 64 bits starting at bit position shift
+    uint64_t Bits64(int shift) const
+    {
+        uint64_t result = 0;
+        for (int i = 63; i >= 0; --i)
+        {
+            int index = shift + i;
+            result <<= 1;
+            if (index >= 0 && index < LIMBS * 32 && Bit(index))
+            {
+                result |= 1;
+            }
+        }
+        return result;
+    }
+private:
+    static const int LIMBS = 5;
+    uint32_t limbs[LIMBS];
+};
+
+struct Pow5Tables
+{
+    Pow5Tables()
+    {
+        BigUInt pow5(1);
+        for (int i = 0; i < FLOAT_POW5_TABLE_SIZE; ++i)
+        {
+            // Top FLOAT_POW5_BITCOUNT bits of 5^i
+            split[i] = pow5.Bits64(Pow5Bits(i) - FLOAT_POW5_BITCOUNT);
+
+            if (i < FLOAT_POW5_INV_TABLE_SIZE)
+            {
+                // floor(2^j / 5^i) + 1, by binary long division
+                int j = Pow5Bits(i) - 1 + FLOAT_POW5_INV_BITCOUNT;
+                BigUInt remainder;
+                uint64_t quotient = 0;
+                for (int bit = j; bit >= 0; --bit)
+                {
+                    remainder.ShiftLeft1(bit == j ? 1 : 0);
+                    quotient <<= 1;
+                    if (!remainder.Less(pow5))
+                    {
+                        remainder.Sub(pow5);
+                        quotient |= 1;
+                    }
+                }
+                invSplit[i] = quotient + 1;
+            }
+            pow5.Mul(5);
+        }
+    }
+    uint64_t split[FLOAT_POW5_TABLE_SIZE];
+    uint64_t invSplit[FLOAT_POW5_INV_TABLE_SIZE];
+};
+
+const Pow5Tables pow5Tables;
+
+uint32_t Pow5Factor(uint32_t value)
+{
+    uint32_t count = 0;
+    for (;;)
+    {
+        uint32_t q = value / 5;
+        uint32_t r = value - 5 * q;
+        if (r != 0)
+        {
+            break;
+        }
+        value = q;
+        ++count;
+    }
+    return count;
+}
+
+bool MultipleOfPowerOf5(uint32_t value, uint32_t p)
+{
+    return Pow5Factor(value) >= p;
+}
+
+bool MultipleOfPowerOf2(uint32_t value, uint32_t p)
+{
+    return (value & ((1u << p) - 1)) == 0;
+}
+
+uint32_t MulShift(uint32_t m, uint64_t factor, int32_t shift)
+{
+    uint64_t bits0 = static_cast<uint64_t>(m) * static_cast<uint32_t>(factor);
+    uint64_t bits1 = static_cast<uint64_t>(m) * static_cast<uint32_t>(factor >> 32);
+    uint64_t sum = (bits0 >> 32) + bits1;
+    return static_cast<uint32_t>(sum >> (shift - 32));
+}
+
+// Converts a finite non-zero float to the shortest decimal output * 10^exponent
+void ShortestDecimal(uint32_t ieeeMantissa, uint32_t ieeeExponent, uint32_t& output, int32_t& exponent)
+{
+    int32_t e2(0);
+    uint32_t m2(0);
+    if (ieeeExponent == 0)
+    {
+        e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = ieeeMantissa;
+    }
+    else
+    {
+        e2 = static_cast<int32_t>(ieeeExponent) - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = (1u << FLOAT_MANTISSA_BITS) | ieeeMantissa;
+    }
+    const bool acceptBounds = (m2 & 1) == 0;
+
+    // Halfway points to the neighbouring floats
+    const uint32_t mv = 4 * m2;
+    const uint32_t mp = 4 * m2 + 2;
+    const uint32_t mmShift = (ieeeMantissa != 0 || ieeeExponent <= 1) ? 1 : 0;
+    const uint32_t mm = 4 * m2 - 1 - mmShift;
+
+    uint32_t vr(0);
+    uint32_t vp(0);
+    uint32_t vm(0);
+    int32_t e10(0);
+    bool vmIsTrailingZeros = false;
+    bool vrIsTrailingZeros = false;
+    uint32_t lastRemovedDigit = 0;
+    if (e2 >= 0)
+    {
+        const uint32_t q = Log10Pow2(e2);
+        e10 = static_cast<int32_t>(q);
+        const int32_t k = FLOAT_POW5_INV_BITCOUNT + Pow5Bits(static_cast<int32_t>(q)) - 1;
+        const int32_t i = -e2 + static_cast<int32_t>(q) + k;
+        vr = MulShift(mv, pow5Tables.invSplit[q], i);
+        vp = MulShift(mp, pow5Tables.invSplit[q], i);
+        vm = MulShift(mm, pow5Tables.invSplit[q], i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10)
+        {
+            const int32_t l = FLOAT_POW5_INV_BITCOUNT + Pow5Bits(static_cast<int32_t>(q - 1)) - 1;
+            lastRemovedDigit = MulShift(mv, pow5Tables.invSplit[q - 1], -e2 + static_cast<int32_t>(q) - 1 + l) % 10;
+        }
+        if (q <= 9)
+        {
+            if (mv % 5 == 0)
+            {
+                vrIsTrailingZeros = MultipleOfPowerOf5(mv, q);
+            }
+            else if (acceptBounds)
+            {
+                vmIsTrailingZeros = MultipleOfPowerOf5(mm, q);
+            }
+            else
+            {
+                vp -= MultipleOfPowerOf5(mp, q) ? 1 : 0;
+            }
+        }
+    }
+    else
+    {
+        const uint32_t q = Log10Pow5(-e2);
+        e10 = static_cast<int32_t>(q) + e2;
+        const int32_t i = -e2 - static_cast<int32_t>(q);
+        const int32_t k = Pow5Bits(i) - FLOAT_POW5_BITCOUNT;
+        int32_t j = static_cast<int32_t>(q) - k;
+        vr = MulShift(mv, pow5Tables.split[i], j);
+        vp = MulShift(mp, pow5Tables.split[i], j);
+        vm = MulShift(mm, pow5Tables.split[i], j);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10)
+        {
+            j = static_cast<int32_t>(q) - 1 - (Pow5Bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            lastRemovedDigit = MulShift(mv, pow5Tables.split[i + 1], j) % 10;
+        }
+        if (q <= 1)
+        {
+            vrIsTrailingZeros = true;
+            if (acceptBounds)
+            {
+                vmIsTrailingZeros = mmShift == 1;
+            }
+            else
+            {
+                --vp;
+            }
+        }
+        else if (q < 31)
+        {
+            vrIsTrailingZeros = MultipleOfPowerOf2(mv, q - 1);
+        }
+    }
+
+    // Drop digits while the bounds still differ
+    int32_t removed = 0;
+    if (vmIsTrailingZeros || vrIsTrailingZeros)
+    {
+        while (vp / 10 > vm / 10)
+        {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        if (vmIsTrailingZeros)
+        {
+            while (vm % 10 == 0)
+            {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                ++removed;
+            }
+        }
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+        {
+            // Round even if the exact value is .....50..0
+            lastRemovedDigit = 4;
+        }
+        output = vr + (((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5) ? 1 : 0);
+    }
+    else
+    {
+        while (vp / 10 > vm / 10)
+        {
+            lastRemovedDigit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        output = vr + ((vr == vm || lastRemovedDigit >= 5) ? 1 : 0);
+    }
+    exponent = e10 + removed;
+}
+
+size_t DecimalLength(uint32_t v)
+{
+    size_t length = 1;
+    while (v >= 10)
+    {
+        v /= 10;
+        ++length;
+    }
+    return length;
+}
+
+void WriteDigits(uint32_t v, char* buffer, size_t length)
+{
+    for (size_t i = length; i > 0; --i)
+    {
+        buffer[i - 1] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    }
+}
+}
+
+size_t FormatFloat(float value, char* buffer)
+{
+    uint32_t bits(0);
+    std::memcpy(&bits, &value, sizeof(bits));
+    const bool sign = (bits >> 31) != 0;
+    const uint32_t ieeeMantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+    const uint32_t ieeeExponent = (bits >> FLOAT_MANTISSA_BITS) & 0xff;
+
+    char* out = buffer;
+    if (ieeeExponent == 0xff)
+    {
+        if (ieeeMantissa != 0)
+        {
+            std::memcpy(out, "nan", 3);
+            return 3;
+        }
+        if (sign)
+        {
+            *out++ = '-';
+        }
+        std::memcpy(out, "inf", 3);
+        return out - buffer + 3;
+    }
+    if (sign)
+    {
+        *out++ = '-';
+    }
+    if (ieeeExponent == 0 && ieeeMantissa == 0)
+    {
+        *out++ = '0';
+        return out - buffer;
+    }
+
+    uint32_t digits(0);
+    int32_t exponent(0);
+    ShortestDecimal(ieeeMantissa, ieeeExponent, digits, exponent);
+
+    const size_t length = DecimalLength(digits);
+    // Position of the decimal point relative to the first digit
+    const int32_t point = static_cast<int32_t>(length) + exponent;
+
+    if (exponent >= 0 && point <= 9)
+    {
+        // Integer value: ddd000
+        WriteDigits(digits, out, length);
+        out += length;
+        std::memset(out, '0', exponent);
+        out += exponent;
+    }
+    else if (point > 0 && point <= 9)
+    {
+        // ddd.ddd
+        WriteDigits(digits, out + 1, length);
+        std::memmove(out, out + 1, point);
+        out[point] = '.';
+        out += length + 1;
+    }
+    else if (point <= 0 && point > -4)
+    {
+        // 0.000ddd
+        *out++ = '0';
+        *out++ = '.';
+        std::memset(out, '0', -point);
+        out += -point;
+        WriteDigits(digits, out, length);
+        out += length;
+    }
+    else
+    {
+        // d.ddde+XX
+        WriteDigits(digits, out + 1, length);
+        out[0] = out[1];
+        if (length > 1)
+        {
+            out[1] = '.';
+            out += length + 1;
+        }
+        else
+        {
+            out += 1;
+        }
+        int32_t scientificExponent = point - 1;
+        *out++ = 'e';
+        if (scientificExponent < 0)
+        {
+            *out++ = '-';
+            scientificExponent = -scientificExponent;
+        }
+        else
+        {
+            *out++ = '+';
+        }
+        out[0] = static_cast<char>('0' + scientificExponent / 10);
+        out[1] = static_cast<char>('0' + scientificExponent % 10);
+        out += 2;
+    }
+    return out - buffer;
+}
+
+}
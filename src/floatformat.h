@@ -0,0 +1,18 @@
+#ifndef _FLOAT_FORMAT_H_
+#define _FLOAT_FORMAT_H_
+
+#include <cstddef>
+
+namespace DicomToStl
+{
+
+// Enough for the sign, nine significant digits, the decimal point and a two digit exponent.
+const size_t FLOAT_FORMAT_MAX_LENGTH = 16;
+
+// Writes the shortest decimal representation of value that reads back as the same float.
+// The result is not null-terminated; returns the number of characters written.
+size_t FormatFloat(float value, char* buffer);
+
+}
+
+#endif
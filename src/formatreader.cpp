@@ -27,6 +27,20 @@ void ReadFormatDcmFiles(const std::vector<std::string>& files,
                         int& dy,
                         Vec3& spacing,
                         SlicesPositions& slicesPositions)
+{
+    Vec3 rowDirection;
+    Vec3 columnDirection;
+    ReadFormatDcmFiles(files, logger, dx, dy, spacing, slicesPositions, rowDirection, columnDirection);
+}
+
+void ReadFormatDcmFiles(const std::vector<std::string>& files, 
+                        OFLogger& logger,
+                        int& dx,
+                        int& dy,
+                        Vec3& spacing,
+                        SlicesPositions& slicesPositions,
+                        Vec3& rowDirection,
+                        Vec3& columnDirection)
 {
     // Read files format
     bool formatIsRead = false;
@@ -35,6 +49,8 @@ void ReadFormatDcmFiles(const std::vector<std::string>& files,
     float colspacing(1);
     OFString tmpString;
 
+    rowDirection = Vec3(1, 0, 0);
+    columnDirection = Vec3(0, 1, 0);
     slicesPositions.clear();
     slicesPositions.reserve(files.size());
 
@@ -66,6 +82,20 @@ void ReadFormatDcmFiles(const std::vector<std::string>& files,
                     rowspacing = static_cast<float>(atof(rowspacing_str.c_str()));
                     colspacing = static_cast<float>(atof(colspacing_str.c_str()));
                 }
+                Float64 cosines[6];
+                bool hasOrientation = true;
+                for (unsigned long i = 0; i < 6 && hasOrientation; ++i)
+                {
+                    hasOrientation = dataset->findAndGetFloat64(DCM_ImageOrientationPatient, cosines[i], i).good();
+                }
+                Vec3 row(static_cast<float>(cosines[0]), static_cast<float>(cosines[1]), static_cast<float>(cosines[2]));
+                Vec3 column(static_cast<float>(cosines[3]), static_cast<float>(cosines[4]), static_cast<float>(cosines[5]));
+                // Orientations which are no pair of crossing directions are ignored
+                if (hasOrientation && VecLength(VecCross(row, column)) > 0.5f)
+                {
+                    rowDirection = row;
+                    columnDirection = column;
+                }
             }
 
             OFString tmpStrPosX;
@@ -121,6 +151,31 @@ void ReadFormatDcmFiles(const std::vector<std::string>& files,
 
     OFLOG_INFO(logger, "Image properties : width " << dx << " height " << dy << OFendl);
     OFLOG_INFO(logger, "Spacing properties : x " << colspacing << " y " << rowspacing << " z " << slicespacing << OFendl);
+    OFLOG_INFO(logger, "Orientation properties : rows " << rowDirection.x << " " << rowDirection.y << " " << rowDirection.z
+                       << " columns " << columnDirection.x << " " << columnDirection.y << " " << columnDirection.z << OFendl);
+}
+
+void ReadModalityRescale(const std::string& fileName, ModalityRescale& rescale)
+{
+    rescale = ModalityRescale();
+    DcmFileFormat fileformat;
+    if (fileformat.loadFile(fileName.c_str()).bad())
+    {
+        return;
+    }
+    DcmDataset *dataset = fileformat.getDataset();
+    Float64 slope(1);
+    Float64 intercept(0);
+    bool hasSlope = dataset->findAndGetFloat64(DCM_RescaleSlope, slope).good();
+    bool hasIntercept = dataset->findAndGetFloat64(DCM_RescaleIntercept, intercept).good();
+    rescale.isPresent = hasSlope || hasIntercept;
+    rescale.slope = slope;
+    rescale.intercept = intercept;
+    OFString modality;
+    if (dataset->findAndGetOFString(DCM_Modality, modality).good())
+    {
+        rescale.modality = modality.c_str();
+    }
 }
 
 }
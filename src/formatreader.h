@@ -19,6 +19,30 @@ void ReadFormatDcmFiles(const std::vector<std::string>& files,
                         Vec3& spacing,
                         SlicesPositions& slicesPositions);
 
+// Same, also gives the row and column directions of ImageOrientationPatient,
+// (1, 0, 0) and (0, 1, 0) when the files have none
+void ReadFormatDcmFiles(const std::vector<std::string>& files, 
+                        OFLogger& logger,
+                        int& dx,
+                        int& dy,
+                        Vec3& spacing,
+                        SlicesPositions& slicesPositions,
+                        Vec3& rowDirection,
+                        Vec3& columnDirection);
+
+// RescaleSlope and RescaleIntercept of a DICOM file, the decoded pixels have them applied already
+struct ModalityRescale
+{
+    ModalityRescale() : isPresent(false), slope(1.), intercept(0.) {}
+    bool isPresent;
+    double slope;
+    double intercept;
+    std::string modality;
+};
+
+// Rescale of the file, isPresent is false when it has none or can't be read
+void ReadModalityRescale(const std::string& fileName, ModalityRescale& rescale);
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "gridframe.h"
+
+#include <limits>
+
+namespace DicomToStl
+{
+
+namespace
+{
+bool IsSame(const Vec3& a, const Vec3& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+}
+
+PatientTransform::PatientTransform()
+    : xAxis(1, 0, 0)
+    , yAxis(0, 1, 0)
+    , zAxis(0, 0, 1)
+    , isIdentity(true)
+    , isMirrored(false)
+{
+}
+
+PatientTransform::PatientTransform(const Vec3& origin, const Vec3& xAxis, const Vec3& yAxis, const Vec3& zAxis)
+    : origin(origin)
+    , xAxis(xAxis)
+    , yAxis(yAxis)
+    , zAxis(zAxis)
+{
+    this->isIdentity = IsSame(origin, Vec3()) && IsSame(xAxis, Vec3(1, 0, 0)) &&
+                       IsSame(yAxis, Vec3(0, 1, 0)) && IsSame(zAxis, Vec3(0, 0, 1));
+    this->isMirrored = VecDot(VecCross(xAxis, yAxis), zAxis) < 0.f;
+}
+
+void MakeGridFrame(int dx, int dy, const Vec3& spacing, const SeriesGeometry& geometry,
+                   GridAxes& axes, PatientTransform& transform)
+{
+    axes.x.resize(dx);
+    for (int x = 0; x < dx; ++x)
+    {
+        axes.x[x] = x * spacing.x;
+    }
+    axes.y.resize(dy);
+    for (int y = 0; y < dy; ++y)
+    {
+        axes.y[y] = y * spacing.y;
+    }
+
+    Vec3 row = geometry.rowDirection;
+    Vec3 column = geometry.columnDirection;
+    VecNormalize(row);
+    VecNormalize(column);
+    Vec3 normal = VecCross(row, column);
+    VecNormalize(normal);
+
+    const std::vector<Vec3>& positions = geometry.positions;
+    size_t count = positions.size();
+    bool hasPositions = count > 1 &&
+                        VecLength(positions.back() - positions.front()) > std::numeric_limits<float>::epsilon();
+    if (hasPositions && VecDot(positions.back() - positions.front(), normal) < 0.f)
+    {
+        normal = normal * -1.f;
+    }
+
+    axes.slices.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (hasPositions)
+        {
+            Vec3 offset = positions[i] - positions.front();
+            axes.slices[i] = Vec3(VecDot(offset, row), VecDot(offset, column), VecDot(offset, normal));
+        }
+        else
+        {
+            axes.slices[i] = Vec3(0, 0, i * spacing.z);
+        }
+    }
+
+    Vec3 origin = count > 0 ? positions.front() : Vec3();
+    transform = PatientTransform(origin, row, column, normal);
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef _GRID_FRAME_H_
+#define _GRID_FRAME_H_
+
+#include "vec3.h"
+
+#include <vector>
+
+namespace DicomToStl
+{
+
+// Place of a series in the patient coordinates, from ImagePositionPatient and
+// ImageOrientationPatient
+struct SeriesGeometry
+{
+    SeriesGeometry() : rowDirection(1, 0, 0), columnDirection(0, 1, 0) {}
+    // Direction along a row of pixels and down the rows
+    Vec3 rowDirection;
+    Vec3 columnDirection;
+    // First pixel of every slice in the z order, all the same when the files have no position
+    std::vector<Vec3> positions;
+};
+
+// Coordinates of the pixel columns and rows, and the offset of every slice, in the
+// frame of the grid: x along the rows, y down the rows and z from the first slice.
+// The offset of a slice carries the in-plane shift of a tilted series, so neither
+// uneven spacing nor the tilt costs anything once the tables are built.
+struct GridAxes
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<Vec3> slices;
+};
+
+// Moves a vertex from the frame of the grid to the patient coordinates
+class PatientTransform
+{
+public:
+    // Leaves the vertices as they are
+    PatientTransform();
+    PatientTransform(const Vec3& origin, const Vec3& xAxis, const Vec3& yAxis, const Vec3& zAxis);
+    bool IsIdentity() const
+    {
+        return this->isIdentity;
+    }
+    // Set when the axes are a mirror image of the grid frame, the triangles are
+    // then wound the other way to keep their normals out of the surface
+    bool IsMirrored() const
+    {
+        return this->isMirrored;
+    }
+    Vec3 Apply(const Vec3& p) const
+    {
+        return this->origin + this->xAxis * p.x + this->yAxis * p.y + this->zAxis * p.z;
+    }
+private:
+    Vec3 origin;
+    Vec3 xAxis;
+    Vec3 yAxis;
+    Vec3 zAxis;
+    bool isIdentity;
+    bool isMirrored;
+};
+
+// Axes of a dx * dy grid of the series and the transform of its vertices. Without
+// positions the slices are spacing.z apart; the slice axis points the way the
+// slices go, which mirrors the frame when they are sorted against the normal.
+void MakeGridFrame(int dx, int dy, const Vec3& spacing, const SeriesGeometry& geometry,
+                   GridAxes& axes, PatientTransform& transform);
+
+}
+
+#endif
@@ -0,0 +1,326 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+
+namespace DicomToStl
+{
+
+namespace
+{
+const int COARSE_BINS = 256;
+// Share of the pixels a peak needs, below it a bump is noise
+const double PEAK_MIN_FRACTION = 0.002;
+// Part of its height a peak rises above the valleys next to it
+const double PEAK_MIN_PROMINENCE = 0.3;
+
+// The histogram in at most COARSE_BINS bins of width values from first on
+struct CoarseHistogram
+{
+    CoarseHistogram() : first(0), width(1) {}
+    int first;
+    int width;
+    std::vector<double> counts;
+
+    int GetCenter(size_t bin) const
+    {
+        return this->first + static_cast<int>(bin) * this->width + (this->width - 1) / 2;
+    }
+};
+
+CoarseHistogram MakeCoarseHistogram(const IntensityHistogram& histogram)
+{
+    CoarseHistogram coarse;
+    if (histogram.GetTotal() == 0)
+    {
+        return coarse;
+    }
+    int first = std::max(histogram.GetMin(), static_cast<int>(IntensityHistogram::MIN_VALUE));
+    int last = std::min(histogram.GetMax(), static_cast<int>(IntensityHistogram::MAX_VALUE));
+    coarse.first = first;
+    coarse.width = std::max(1, (last - first + COARSE_BINS) / COARSE_BINS);
+    coarse.counts.resize((last - first) / coarse.width + 1);
+    for (int value = first; value <= last; ++value)
+    {
+        coarse.counts[(value - first) / coarse.width] += static_cast<double>(histogram.GetCount(value));
+    }
+    return coarse;
+}
+
+std::string FormatLevel(int value, const ModalityRescale& rescale, const char* unit)
+{
+    std::stringstream buf;
+    buf << value << unit;
+    if (rescale.isPresent && rescale.slope != 0.)
+    {
+        buf << " (stored " << std::setprecision(6) << (value - rescale.intercept) / rescale.slope << ")";
+    }
+    return buf.str();
+}
+}
+
+IntensityHistogram::IntensityHistogram()
+    : counts(MAX_VALUE - MIN_VALUE + 1)
+    , total(0)
+    , clamped(0)
+    , minValue(std::numeric_limits<int>::max())
+    , maxValue(std::numeric_limits<int>::min())
+{
+}
+
+void IntensityHistogram::Add(const int* pixels, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    // A loop the compiler vectorizes finds the range first, the counting
+    // then needs no clamping for the usual 16 bit slices
+    int low = pixels[0];
+    int high = pixels[0];
+    for (size_t i = 1; i < count; ++i)
+    {
+        low = pixels[i] < low ? pixels[i] : low;
+        high = pixels[i] > high ? pixels[i] : high;
+    }
+    this->minValue = std::min(this->minValue, low);
+    this->maxValue = std::max(this->maxValue, high);
+    this->total += count;
+
+    uint64_t* bins = &this->counts[0] - MIN_VALUE;
+    if (low >= MIN_VALUE && high <= MAX_VALUE)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            ++bins[pixels[i]];
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        int value = pixels[i];
+        if (value < MIN_VALUE || value > MAX_VALUE)
+        {
+            ++this->clamped;
+            value = value < MIN_VALUE ? MIN_VALUE : MAX_VALUE;
+        }
+        ++bins[value];
+    }
+}
+
+void IntensityHistogram::Merge(const IntensityHistogram& other)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (size_t i = 0; i < this->counts.size(); ++i)
+    {
+        this->counts[i] += other.counts[i];
+    }
+    this->total += other.total;
+    this->clamped += other.clamped;
+    this->minValue = std::min(this->minValue, other.minValue);
+    this->maxValue = std::max(this->maxValue, other.maxValue);
+}
+
+uint64_t IntensityHistogram::GetTotal() const
+{
+    return this->total;
+}
+
+int IntensityHistogram::GetMin() const
+{
+    return this->minValue;
+}
+
+int IntensityHistogram::GetMax() const
+{
+    return this->maxValue;
+}
+
+uint64_t IntensityHistogram::GetCount(int value) const
+{
+    if (value < MIN_VALUE || value > MAX_VALUE)
+    {
+        return 0;
+    }
+    return this->counts[value - MIN_VALUE];
+}
+
+uint64_t IntensityHistogram::GetClampedCount() const
+{
+    return this->clamped;
+}
+
+std::vector<HistogramPeak> FindHistogramPeaks(const IntensityHistogram& histogram, size_t maxPeaks)
+{
+    CoarseHistogram coarse = MakeCoarseHistogram(histogram);
+    size_t bins = coarse.counts.size();
+    std::vector<double> smooth(bins);
+    for (size_t i = 0; i < bins; ++i)
+    {
+        size_t first = i >= 2 ? i - 2 : 0;
+        size_t last = std::min(i + 3, bins);
+        for (size_t j = first; j < last; ++j)
+        {
+            smooth[i] += coarse.counts[j];
+        }
+        smooth[i] /= static_cast<double>(last - first);
+    }
+
+    std::vector<std::pair<double, size_t> > maxima;
+    double minCount = PEAK_MIN_FRACTION * static_cast<double>(histogram.GetTotal());
+    for (size_t i = 0; i < bins; ++i)
+    {
+        bool isMaximum = (i == 0 || smooth[i] > smooth[i - 1]) && (i + 1 == bins || smooth[i] >= smooth[i + 1]);
+        if (!isMaximum || smooth[i] < minCount)
+        {
+            continue;
+        }
+        // Lowest point on each side before a higher maximum, nothing past the ends.
+        // A peak has to rise well above the higher of them to be more than a ripple.
+        double leftLow = i > 0 ? smooth[i] : 0.;
+        for (size_t j = i; j > 0 && smooth[j - 1] <= smooth[i]; --j)
+        {
+            leftLow = std::min(leftLow, smooth[j - 1]);
+        }
+        double rightLow = i + 1 < bins ? smooth[i] : 0.;
+        for (size_t j = i + 1; j < bins && smooth[j] <= smooth[i]; ++j)
+        {
+            rightLow = std::min(rightLow, smooth[j]);
+        }
+        if (smooth[i] - std::max(leftLow, rightLow) >= PEAK_MIN_PROMINENCE * smooth[i])
+        {
+            maxima.push_back(std::make_pair(smooth[i], i));
+        }
+    }
+    std::sort(maxima.begin(), maxima.end(), [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b)
+    {
+        return a.first > b.first;
+    });
+    maxima.resize(std::min(maxima.size(), maxPeaks));
+
+    std::vector<HistogramPeak> peaks;
+    std::for_each(maxima.begin(), maxima.end(), [&](const std::pair<double, size_t>& maximum)
+    {
+        HistogramPeak peak;
+        peak.value = coarse.GetCenter(maximum.second);
+        peak.count = static_cast<uint64_t>(coarse.counts[maximum.second]);
+        peaks.push_back(peak);
+    });
+    std::sort(peaks.begin(), peaks.end(), [](const HistogramPeak& a, const HistogramPeak& b) { return a.value < b.value; });
+    return peaks;
+}
+
+std::vector<int> ComputeOtsuThresholds(const IntensityHistogram& histogram, int classes)
+{
+    CoarseHistogram coarse = MakeCoarseHistogram(histogram);
+    int bins = static_cast<int>(coarse.counts.size());
+    std::vector<int> thresholds;
+    if (classes < 2 || bins < classes)
+    {
+        return thresholds;
+    }
+
+    // Pixels and the sum of their values below every bin
+    std::vector<double> weights(bins + 1);
+    std::vector<double> sums(bins + 1);
+    for (int i = 0; i < bins; ++i)
+    {
+        weights[i + 1] = weights[i] + coarse.counts[i];
+        sums[i + 1] = sums[i] + coarse.counts[i] * coarse.GetCenter(i);
+    }
+    // The between class variance is largest where the sum of S^2 / W over the
+    // classes is, found for every class count and end bin from the one below
+    auto classScore = [&](int first, int end) -> double
+    {
+        double weight = weights[end] - weights[first];
+        double sum = sums[end] - sums[first];
+        return weight > 0. ? sum * sum / weight : 0.;
+    };
+    std::vector<std::vector<double> > best(classes, std::vector<double>(bins + 1, -1.));
+    std::vector<std::vector<int> > split(classes, std::vector<int>(bins + 1, 0));
+    for (int end = 1; end <= bins; ++end)
+    {
+        best[0][end] = classScore(0, end);
+    }
+    for (int k = 1; k < classes; ++k)
+    {
+        for (int end = k + 1; end <= bins; ++end)
+        {
+            for (int first = k; first < end; ++first)
+            {
+                double score = best[k - 1][first] + classScore(first, end);
+                if (score > best[k][end])
+                {
+                    best[k][end] = score;
+                    split[k][end] = first;
+                }
+            }
+        }
+    }
+
+    int end = bins;
+    for (int k = classes - 1; k > 0; --k)
+    {
+        end = split[k][end];
+        // Values up to the last one of the lower class stay out of the surface
+        thresholds.push_back(coarse.first + end * coarse.width - 1);
+    }
+    std::reverse(thresholds.begin(), thresholds.end());
+    return thresholds;
+}
+
+std::string GetHistogramReport(const IntensityHistogram& histogram, const ModalityRescale& rescale)
+{
+    std::stringstream buf;
+    if (histogram.GetTotal() == 0)
+    {
+        buf << "No pixels were read";
+        return buf.str();
+    }
+    const char* unit = rescale.isPresent && rescale.modality == "CT" ? " HU" : "";
+    buf << "Pixels " << histogram.GetTotal() << ", values " << histogram.GetMin() << unit
+        << " to " << histogram.GetMax() << unit << "\n";
+    if (histogram.GetClampedCount() > 0)
+    {
+        buf << histogram.GetClampedCount() << " pixels beyond " << IntensityHistogram::MIN_VALUE << " to "
+            << IntensityHistogram::MAX_VALUE << " are counted at the ends\n";
+    }
+    if (rescale.isPresent)
+    {
+        buf << "Rescale slope " << rescale.slope << " intercept " << rescale.intercept
+            << " is applied, isolevels are given in rescaled values\n";
+    }
+
+    std::vector<HistogramPeak> peaks = FindHistogramPeaks(histogram, 6);
+    buf << "Peaks :";
+    std::for_each(peaks.begin(), peaks.end(), [&](const HistogramPeak& peak)
+    {
+        buf << " " << peak.value << unit << " (" << std::fixed << std::setprecision(1)
+            << 100. * peak.count / histogram.GetTotal() << "%)";
+        buf.unsetf(std::ios::floatfield);
+    });
+    buf << "\n";
+
+    for (int classes = 2; classes <= 4; ++classes)
+    {
+        std::vector<int> thresholds = ComputeOtsuThresholds(histogram, classes);
+        if (thresholds.empty())
+        {
+            continue;
+        }
+        buf << (classes == 2 ? "Otsu isolevel : " : "Multi-Otsu isolevels, " + std::to_string(classes) + " classes : ");
+        for (size_t i = 0; i < thresholds.size(); ++i)
+        {
+            buf << (i > 0 ? ", " : "") << FormatLevel(thresholds[i], rescale, unit);
+        }
+        if (classes < 4)
+        {
+            buf << "\n";
+        }
+    }
+    return buf.str();
+}
+
+}
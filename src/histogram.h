@@ -0,0 +1,72 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include "formatreader.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// Count of every pixel value of a volume from -32768 to 65535, the range of 16 bit
+// pixels signed or not. Values beyond it are counted in the end bins. Add is for
+// one thread, threads fill histograms of their own and merge them into a shared one.
+class IntensityHistogram
+{
+public:
+    static const int MIN_VALUE = -32768;
+    static const int MAX_VALUE = 65535;
+
+    IntensityHistogram();
+    void Add(const int* pixels, size_t count);
+    // Thread safe on this histogram
+    void Merge(const IntensityHistogram& other);
+    uint64_t GetTotal() const;
+    // Lowest and highest value counted, beyond the range included; max < min when empty
+    int GetMin() const;
+    int GetMax() const;
+    // Pixels of the value, the end bins hold the values beyond the range too
+    uint64_t GetCount(int value) const;
+    // Pixels beyond the range
+    uint64_t GetClampedCount() const;
+private:
+    IntensityHistogram(const IntensityHistogram&);
+    IntensityHistogram& operator=(const IntensityHistogram&);
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t clamped;
+    int minValue;
+    int maxValue;
+    std::mutex mutex;
+};
+
+struct HistogramPeak
+{
+    HistogramPeak() : value(0), count(0) {}
+    int value;
+    // Pixels around the peak, in a bin of the coarse histogram
+    uint64_t count;
+};
+
+// The highest local maxima of the histogram smoothed over 256 bins between its
+// lowest and highest value, in the value order
+std::vector<HistogramPeak> FindHistogramPeaks(const IntensityHistogram& histogram, size_t maxPeaks);
+
+// Thresholds splitting the pixels into classes with the largest variance between
+// them (Otsu for two classes, multi-Otsu above), over 256 bins between the lowest
+// and highest value. A threshold t puts the values above t in the upper class, the
+// same as an isolevel. Empty for an empty histogram.
+std::vector<int> ComputeOtsuThresholds(const IntensityHistogram& histogram, int classes);
+
+// Peaks, Otsu and multi-Otsu thresholds as text, with the stored pixel values
+// matching them when the pixels were rescaled; CT values are given as HU
+std::string GetHistogramReport(const IntensityHistogram& histogram, const ModalityRescale& rescale);
+
+}
+
+#endif
@@ -1,62 +1,285 @@
-#include "logagent.h"             
-#include <utility>
-#include <dcmtk\oflog\oflog.h>
+#include "logagent.h"
+#include <dcmtk/oflog/oflog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
 
 namespace DicomToStl
 {
+
+namespace
+{
+// Records in the ring, a power of two
+const size_t RING_RECORDS = 1024;
+// Longest line a record holds with its terminating zero, longer ones are cut
+const size_t RECORD_TEXT_SIZE = 240;
+// Longest sleep of the drain thread, in case a wake up was missed
+const int DRAIN_WAIT_MS = 10;
+
+const char* GetTypeName(LogAgent::MsgType type)
+{
+    switch (type)
+    {
+    case LogAgent::MSG_INFO:
+        return "info";
+    case LogAgent::MSG_WARN:
+        return "warning";
+    default:
+        return "error";
+    }
+}
+
+uint64_t GetSecond()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+}
+
+// A slot of the ring. Its sequence equals the enqueue position while it is free,
+// the position plus one once a message is published in it.
+struct LogAgent::Record
+{
+    std::atomic<size_t> sequence;
+    MsgType type;
+    char text[RECORD_TEXT_SIZE];
+};
+
 LogAgent::LogAgent(OFLogger& logger)
     : logger(logger)
+    , records(new Record[RING_RECORDS])
+    , mask(RING_RECORDS - 1)
+    , enqueuePos(0)
+    , dequeuePos(0)
+    , enabledMask(0)
+    , isWaiting(false)
+    , isStopping(false)
+    , isStopped(false)
 {
+    for (size_t i = 0; i < RING_RECORDS; ++i)
+    {
+        this->records[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    unsigned enabled = 0;
+    enabled |= logger.isEnabledFor(OFLogger::INFO_LOG_LEVEL) ? 1u << MSG_INFO : 0u;
+    enabled |= logger.isEnabledFor(OFLogger::WARN_LOG_LEVEL) ? 1u << MSG_WARN : 0u;
+    enabled |= logger.isEnabledFor(OFLogger::FATAL_LOG_LEVEL) ? 1u << MSG_ERROR : 0u;
+    this->enabledMask.store(enabled);
 }
 
 LogAgent::~LogAgent()
 {
-    this->Stop();
+    try
+    {
+        this->Stop();
+    }
+    catch (...)
+    {
+    }
 }
 
-void LogAgent::run()
+bool LogAgent::IsEnabled(MsgType type) const
 {
-    bool done = false;
-    while (!done)
+    return (this->enabledMask.load(std::memory_order_relaxed) & (1u << type)) != 0;
+}
+
+void LogAgent::SetRateLimit(MsgType type, int perSecond)
+{
+    this->levels[type].rateLimit.store(std::max(perSecond, 0));
+}
+
+uint64_t LogAgent::GetDroppedCount(MsgType type) const
+{
+    return this->levels[type].dropped.load();
+}
+
+uint64_t LogAgent::GetLimitedCount(MsgType type) const
+{
+    return this->levels[type].limited.load();
+}
+
+LogAgent::Record* LogAgent::Claim(MsgType type, bool isLimited)
+{
+    LevelState& level = this->levels[type];
+    int limit = isLimited ? level.rateLimit.load(std::memory_order_relaxed) : 0;
+    if (limit > 0)
+    {
+        uint64_t second = GetSecond();
+        uint64_t window = level.window.load(std::memory_order_relaxed);
+        if (window != second && level.window.compare_exchange_strong(window, second))
+        {
+            level.windowCount.store(0, std::memory_order_relaxed);
+        }
+        if (level.windowCount.fetch_add(1, std::memory_order_relaxed) >= limit)
+        {
+            level.limited.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+
+    size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
     {
-        auto msg = Concurrency::receive(this->msgBuffer);
-        switch (msg.first)
+        Record& record = this->records[pos & this->mask];
+        size_t sequence = record.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                record.type = type;
+                return &record;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The drain thread is a whole ring behind
+            level.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        else
+        {
+            pos = this->enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void LogAgent::Publish(Record* record)
+{
+    record->sequence.store(record->sequence.load(std::memory_order_relaxed) + 1);
+    if (this->isWaiting.load())
+    {
+        std::lock_guard<std::mutex> lock(this->guard);
+        this->wakeUp.notify_one();
+    }
+}
+
+void LogAgent::Log(MsgType type, const std::string& msg)
+{
+    if (!IsEnabled(type))
+    {
+        return;
+    }
+    size_t begin = 0;
+    while (begin < msg.size())
+    {
+        size_t end = std::min(msg.find('\n', begin), msg.size());
+        Record* record = Claim(type, false);
+        if (record == nullptr)
+        {
+            return;
+        }
+        size_t length = std::min(end - begin, RECORD_TEXT_SIZE - 1);
+        std::memcpy(record->text, msg.data() + begin, length);
+        record->text[length] = 0;
+        Publish(record);
+        begin = end + 1;
+    }
+}
+
+void LogAgent::Logf(MsgType type, const char* format, ...)
+{
+    if (!IsEnabled(type))
+    {
+        return;
+    }
+    Record* record = Claim(type, true);
+    if (record == nullptr)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(record->text, RECORD_TEXT_SIZE, format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        record->text[0] = 0;
+    }
+    Publish(record);
+}
+
+// Writes the published records in the ring order, false when there was none
+bool LogAgent::Drain()
+{
+    bool isDrained = false;
+    for (;;)
+    {
+        Record& record = this->records[this->dequeuePos & this->mask];
+        if (record.sequence.load(std::memory_order_acquire) != this->dequeuePos + 1)
+        {
+            return isDrained;
+        }
+        switch (record.type)
         {
         case MSG_INFO:
-            OFLOG_INFO(this->logger, msg.second << OFendl);
+            OFLOG_INFO(this->logger, record.text << OFendl);
             break;
         case MSG_WARN:
-            OFLOG_WARN(this->logger, msg.second << OFendl);
-            break;
-        case MSG_ERROR:
-            OFLOG_FATAL(this->logger, msg.second << OFendl);
-            break;
-        case MSG_STOP:
-            done = true;
+            OFLOG_WARN(this->logger, record.text << OFendl);
             break;
         default:
-            OFLOG_INFO(this->logger, "Unknown log type" << OFendl);
-            done = true;
+            OFLOG_FATAL(this->logger, record.text << OFendl);
             break;
-        };
+        }
+        record.sequence.store(this->dequeuePos + RING_RECORDS, std::memory_order_release);
+        ++this->dequeuePos;
+        isDrained = true;
     }
-    this->done();
 }
 
-void LogAgent::Start()
+void LogAgent::Run()
 {
-    this->start();
+    for (;;)
+    {
+        if (Drain())
+        {
+            continue;
+        }
+        if (this->isStopping.load())
+        {
+            // Messages published before the stop request are all in the ring by now
+            Drain();
+            break;
+        }
+        std::unique_lock<std::mutex> lock(this->guard);
+        this->isWaiting.store(true);
+        this->wakeUp.wait_for(lock, std::chrono::milliseconds(DRAIN_WAIT_MS), [this]()
+        {
+            const Record& record = this->records[this->dequeuePos & this->mask];
+            return this->isStopping.load() || record.sequence.load() == this->dequeuePos + 1;
+        });
+        this->isWaiting.store(false);
+    }
 }
 
 void LogAgent::Stop()
 {
-    Concurrency::asend(this->msgBuffer, std::make_pair(MSG_STOP, std::string("")));
-    agent::wait(this);
-}
+    if (this->isStopped)
+    {
+        return;
+    }
+    this->isStopped = true;
+    {
+        std::lock_guard<std::mutex> lock(this->guard);
+        this->isStopping.store(true);
+        this->wakeUp.notify_one();
+    }
+    this->Wait();
 
-void LogAgent::Log(MsgType type, const std::string& msg)
-{
-    Concurrency::asend(this->msgBuffer, std::make_pair(type, msg));
+    for (int type = MSG_INFO; type < LEVELS_COUNT; ++type)
+    {
+        uint64_t dropped = GetDroppedCount(static_cast<MsgType>(type));
+        uint64_t limited = GetLimitedCount(static_cast<MsgType>(type));
+        if (dropped > 0 || limited > 0)
+        {
+            OFLOG_WARN(this->logger, dropped << " " << GetTypeName(static_cast<MsgType>(type)) << " messages dropped on a full log buffer, "
+                                     << limited << " over the rate limit" << OFendl);
+        }
+    }
 }
 
-}
\ No newline at end of file
+}
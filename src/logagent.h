@@ -1,16 +1,25 @@
 #ifndef _LOG_AGENT_H_
 #define _LOG_AGENT_H_
 
-#include <agents.h>
+#include "pipeline.h"
+
 #include <string>
-#include <sstream>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
 
 class OFLogger;
 
 namespace DicomToStl
 {
 
-class LogAgent : public Concurrency::agent
+// Messages of the pipeline threads written to the logger by a thread of its own.
+// A message is formatted straight into a fixed-size record of a lock-free ring,
+// nothing is allocated per call and a full ring drops the message instead of
+// blocking the caller. Disabled levels cost one atomic load.
+class LogAgent : public Agent
 {
 public:
     enum MsgType
@@ -20,18 +29,61 @@ public:
         MSG_WARN,
         MSG_ERROR
     };
+    // The enabled levels follow the logger at construction
     LogAgent(OFLogger& logger);
     virtual ~LogAgent();
-    virtual void run();
-    void Start();
+    // Writes the messages left and a summary of the dropped ones
     void Stop();
+    bool IsEnabled(MsgType type) const;
+    // Logf messages of the type beyond perSecond in a second are dropped, 0 for no limit
+    void SetRateLimit(MsgType type, int perSecond);
+    // Every line of the message goes into a record of its own, longer lines are cut.
+    // Not rate limited, for the summaries and reports that must not get lost.
     void Log(MsgType type, const std::string& msg);
+    // printf-like, for the calls on the hot path; subject to the rate limit
+    void Logf(MsgType type, const char* format, ...)
+#ifdef __GNUC__
+        __attribute__((format(printf, 3, 4)))
+#endif
+        ;
+    // Messages lost to a full ring and to the rate limit
+    uint64_t GetDroppedCount(MsgType type) const;
+    uint64_t GetLimitedCount(MsgType type) const;
+protected:
+    virtual void Run();
 private:
     LogAgent(const LogAgent&);
     LogAgent& operator=(const LogAgent&);
+    struct Record;
+    // Claims a free record, nullptr when the ring is full or, with isLimited, the rate limit is hit
+    Record* Claim(MsgType type, bool isLimited);
+    void Publish(Record* record);
+    bool Drain();
 private:
-    Concurrency::unbounded_buffer<std::pair<MsgType, std::string> > msgBuffer;
+    static const int LEVELS_COUNT = MSG_ERROR + 1;
+    struct LevelState
+    {
+        LevelState() : rateLimit(0), window(0), windowCount(0), dropped(0), limited(0) {}
+        std::atomic<int> rateLimit;
+        // Second of the rate limit window and the messages taken in it
+        std::atomic<uint64_t> window;
+        std::atomic<int> windowCount;
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> limited;
+    };
     OFLogger& logger;
+    std::unique_ptr<Record[]> records;
+    size_t mask;
+    std::atomic<size_t> enqueuePos;
+    size_t dequeuePos;
+    std::atomic<unsigned> enabledMask;
+    LevelState levels[LEVELS_COUNT];
+    // The drain thread sleeps on wakeUp while the ring is empty
+    std::mutex guard;
+    std::condition_variable wakeUp;
+    std::atomic<bool> isWaiting;
+    std::atomic<bool> isStopping;
+    bool isStopped;
 };
 
 }
@@ -2,28 +2,45 @@
 #include <dcmtk/oflog/oflog.h>
 
 #include "dirreader.h"
+#include "dirscanner.h"
 #include "volumereader.h"
 #include "formatreader.h"
+#include "chunkedmesh.h"
+#include "meshreader.h"
+#include "memorygovernor.h"
+#include "cancellation.h"
+#include "conversionjob.h"
+#include "daemon.h"
+#include "previewsource.h"
 using namespace DicomToStl;
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 #include <iostream>
 #include <functional>
-
-#include <ppl.h>
+#include <algorithm>
+#include <iomanip>
+#include <cstdio>
+#include <thread>
 
 #define SHORTCOL 3
 #define LONGCOL 20
 
-bool NeedBreak(HANDLE handleIn, OFLogger& logger);
+bool NeedBreak(OFLogger& logger);
 
 void FormatTime(double time, size_t& hours, size_t& minutes, size_t& seconds);
 
+bool GetFormatFromFileName(const std::string& fileName, MeshFormat& format);
+
+std::string InsertFileSuffix(const std::string& fileName, const std::string& suffix);
+
 int main(int argc, char* argv[])
 {
-    HANDLE handleIn = GetStdHandle(STD_INPUT_HANDLE);
-
     try
     {
         OFConsoleApplication app("DicomToStl");
@@ -33,8 +50,39 @@ int main(int argc, char* argv[])
         cmd.addParam("dcmdir-in",  "DICOM input directory");
         cmd.addParam("stldir-out", "STL output directory");
 
-        cmd.addOption("--isolevel", "-il",  1, "Edge value to build iso surface", "Signed integer value");
+        cmd.addOption("--isolevel", "-il",  1, "Edge value to build iso surface, repeat for one mesh per value", "Signed integer value");
         cmd.addOption("--stlbinary", "-sbin", "Generate binary STL file");
+        cmd.addOption("--format", "-f", 1, "Output mesh format (default stl)", "stl, ply or obj");
+        cmd.addOption("--compress", "-z", 1, "Compress the output while it is written", "none, gzip or zstd");
+        cmd.addOption("--compress-threads", "-zt", 1, "Number of compression threads (default 2)", "Positive integer value");
+        cmd.addOption("--direct-io", "-dio", "Write output asynchronously bypassing the page cache (Linux only)");
+        cmd.addOption("--chunked", "-ch", 1, "Write one mesh file per this many slices and a manifest", "Positive integer value");
+        cmd.addOption("--chunk-workers", "-cw", 1, "Number of chunks processed at once (default half of the CPU threads)", "Positive integer value");
+        cmd.addOption("--mapped", "-mm", "Count triangles first and fill a memory mapped binary STL in parallel");
+        cmd.addOption("--read-threads", "-rt", 1, "Threads decoding slices (default 1)", "Positive integer value");
+        cmd.addOption("--grid-threads", "-gt", 1, "Threads building grid cells (default 1)", "Positive integer value");
+        cmd.addOption("--pipeline-depth", "-pd", 1, "Slice pairs in flight in the pipeline (default 2)", "Positive integer value");
+        cmd.addOption("--slabs", "-sl", 1, "Split the series into this many slabs processed in parallel into one output", "Positive integer value");
+        cmd.addOption("--memory-limit", "-ml", 1, "Memory the buffers may take, the pipeline is scaled down to fit", "Size such as 512M or 2G");
+        cmd.addOption("--checkpoint", "-cp", "Keep a checkpoint after every finished slab so the conversion can be resumed");
+        cmd.addOption("--resume", "-rs", "Continue an interrupted conversion from its checkpoint");
+        cmd.addOption("--stats-json", "-st", 1, "Write the counters of every pipeline stage to a JSON file", "File name");
+        cmd.addOption("--trace", "-tr", 1, "Write a timeline of the pipeline threads in the Chrome trace-event format", "File name");
+        cmd.addOption("--progress", "-pg", 1, "Print the progress to stderr every this many milliseconds (default 1000)", "Positive integer value");
+        cmd.addOption("--progress-json", "-pj", "Print the progress to stderr as one JSON object per line");
+        cmd.addOption("--preview", "-pv", 1, "Coarse mesh in seconds from every n-th slice reduced n times in-plane", "Positive integer value");
+        cmd.addOption("--preview-filter", "-pf", 1, "Reduction of the preview pixel blocks (default box)", "box or max");
+        cmd.addOption("--preview-cache", "-pc", 1, "Keep the reduced preview slices in this file for further runs", "File name");
+        cmd.addOption("--suggest-isolevel", "-si", "Print the histogram peaks and Otsu isolevels of the series without building a mesh");
+        cmd.addOption("--sweep", "-sw", 1, "Print the cells and triangles of every isolevel of the range without building a mesh", "from:to:step");
+        cmd.addOption("--recursive", "-rc", "Look for the DICOM files in the subfolders of the input too");
+        cmd.addOption("--submit", "-sj", 1, "Send the conversion to a running daemon and wait until it is finished", "Socket path");
+        cmd.addOption("--daemon", "-dm", 1, "Serve conversion jobs on a Unix domain socket until interrupted", "Socket path", OFCommandLine::AF_Exclusive);
+        cmd.addOption("--daemon-workers", "-dw", 1, "Jobs the daemon converts at once (default 2)", "Positive integer value");
+        cmd.addOption("--cache-size", "-cs", 1, "Decoded slices the daemon keeps between jobs (default 1G)", "Size such as 512M or 2G");
+        cmd.addOption("--daemon-stats", "-ds", 1, "Print the queue, latency and cache counters of a daemon", "Socket path", OFCommandLine::AF_Exclusive);
+        cmd.addOption("--merge", "-m", 2, "Merge the chunks listed in a manifest into one mesh, the format follows the output extension", "manifest output", OFCommandLine::AF_Exclusive);
+        cmd.addOption("--convert", "-cv", 2, "Convert a mesh file, the format follows the output extension", "input output", OFCommandLine::AF_Exclusive);
 
         cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
         cmd.addOption("--help", "-h", "print this help text and exit", OFCommandLine::AF_Exclusive);
@@ -45,30 +93,312 @@ int main(int argc, char* argv[])
         {
             OFLog::configureFromCommandLine(cmd, app);
 
+            if (cmd.findOption("--merge"))
+            {
+                const char* manifestFile = nullptr;
+                const char* outFile = nullptr;
+                app.checkValue(cmd.getValue(manifestFile));
+                app.checkValue(cmd.getValue(outFile));
+
+                std::string outName = outFile;
+                OutputOptions output;
+                if (!GetFormatFromFileName(outName, output.format))
+                {
+                    OFLOG_ERROR(logger, "Unknown output format of " << outName << OFendl);
+                    return -1;
+                }
+                MergeChunks(manifestFile, outName, output);
+                OFLOG_INFO(logger, "Merged into " << outName << OFendl);
+                return 0;
+            }
+
+            if (cmd.findOption("--convert"))
+            {
+                const char* inFile = nullptr;
+                const char* outFile = nullptr;
+                app.checkValue(cmd.getValue(inFile));
+                app.checkValue(cmd.getValue(outFile));
+
+                std::string outName = outFile;
+                OutputOptions output;
+                if (!GetFormatFromFileName(outName, output.format))
+                {
+                    OFLOG_ERROR(logger, "Unknown output format of " << outName << OFendl);
+                    return -1;
+                }
+                std::unique_ptr<MeshWriter> meshWriter = CreateMeshWriter(outName, output);
+                ReadMeshFile(inFile, *meshWriter);
+                meshWriter->Close();
+                OFLOG_INFO(logger, "Converted into " << outName << " : " << meshWriter->GetTrianglesCount() << " triangles, "
+                                   << meshWriter->GetBytesWritten() << " bytes" << OFendl);
+                return 0;
+            }
+
+            if (cmd.findOption("--daemon"))
+            {
+                const char* socketPath = nullptr;
+                app.checkValue(cmd.getValue(socketPath));
+                DaemonOptions daemonOptions;
+                if (cmd.findOption("--daemon-workers"))
+                {
+                    OFCmdSignedInt workers = 0;
+                    app.checkValue(cmd.getValueAndCheckMin(workers, 1));
+                    daemonOptions.workers = static_cast<int>(workers);
+                }
+                if (cmd.findOption("--cache-size"))
+                {
+                    const char* size = nullptr;
+                    app.checkValue(cmd.getValue(size));
+                    if (!ParseMemorySize(size, daemonOptions.cacheBytes))
+                    {
+                        OFLOG_ERROR(logger, "Wrong cache size " << size << ", expected a size such as 512M or 2G" << OFendl);
+                        return -1;
+                    }
+                }
+                CancellationToken cancellation;
+                CancelOnSignals(cancellation);
+                RunDaemon(socketPath, daemonOptions, logger, cancellation);
+                return 0;
+            }
+
+            if (cmd.findOption("--daemon-stats"))
+            {
+                const char* socketPath = nullptr;
+                app.checkValue(cmd.getValue(socketPath));
+                if (!PrintDaemonStats(socketPath, std::cout))
+                {
+                    OFLOG_ERROR(logger, "No daemon listens on " << socketPath << OFendl);
+                    return -1;
+                }
+                return 0;
+            }
+
             const char* dcmdir = nullptr;
             cmd.getParam(1, dcmdir);
             const char* stldir = nullptr;
             cmd.getParam(2, stldir);
 
-            int isoLevel = 0;
-            if (cmd.findOption("--isolevel"))
-            { 
-                const char* isoLevelStr = nullptr;
-                app.checkValue(cmd.getValue(isoLevelStr));
-                std::stringstream buf;
-                buf << isoLevelStr;
-                buf >> isoLevel;
+            std::vector<int> isoLevels;
+            if (cmd.findOption("--isolevel", 0, OFCommandLine::FOM_First))
+            {
+                do
+                {
+                    int isoLevel = 0;
+                    const char* isoLevelStr = nullptr;
+                    app.checkValue(cmd.getValue(isoLevelStr));
+                    std::stringstream buf;
+                    buf << isoLevelStr;
+                    buf >> isoLevel;
+                    isoLevels.push_back(isoLevel);
+                }
+                while (cmd.findOption("--isolevel", 0, OFCommandLine::FOM_Next));
+            }
+            if (isoLevels.empty())
+            {
+                isoLevels.push_back(0);
             }
             bool binaryStl = false;
             if (cmd.findOption("--stlbinary"))
             { 
                 binaryStl = true;
             }
+            OutputOptions output;
+            output.format = binaryStl ? MESH_FORMAT_STL_BINARY : MESH_FORMAT_STL_ASCII;
+            if (cmd.findOption("--format"))
+            {
+                const char* formatStr = nullptr;
+                app.checkValue(cmd.getValue(formatStr));
+                if (!ParseMeshFormat(formatStr, !binaryStl, output.format))
+                {
+                    OFLOG_ERROR(logger, "Unknown output format " << formatStr << OFendl);
+                    return -1;
+                }
+            }
+            if (cmd.findOption("--compress"))
+            {
+                const char* compressStr = nullptr;
+                app.checkValue(cmd.getValue(compressStr));
+                if (!ParseOutputCompression(compressStr, output.stream.compression))
+                {
+                    OFLOG_ERROR(logger, "Unknown compression " << compressStr << OFendl);
+                    return -1;
+                }
+            }
+            if (cmd.findOption("--compress-threads"))
+            {
+                OFCmdSignedInt threads = 0;
+                app.checkValue(cmd.getValueAndCheckMin(threads, 1));
+                output.stream.compressThreads = static_cast<int>(threads);
+            }
+            if (cmd.findOption("--direct-io"))
+            {
+                output.stream.directIo = true;
+            }
+            if (cmd.findOption("--chunked"))
+            {
+                OFCmdSignedInt slices = 0;
+                app.checkValue(cmd.getValueAndCheckMin(slices, 1));
+                output.chunkSlices = static_cast<int>(slices);
+            }
+            if (cmd.findOption("--chunk-workers"))
+            {
+                OFCmdSignedInt workers = 0;
+                app.checkValue(cmd.getValueAndCheckMin(workers, 1));
+                output.chunkWorkers = static_cast<int>(workers);
+            }
+            if (cmd.findOption("--mapped"))
+            {
+                if (output.format != MESH_FORMAT_STL_BINARY || output.stream.compression != OUTPUT_COMPRESSION_NONE || output.stream.directIo)
+                {
+                    OFLOG_ERROR(logger, "Mapped output needs an uncompressed binary STL" << OFendl);
+                    return -1;
+                }
+                output.mappedStl = true;
+            }
+            PipelineOptions pipeline;
+            if (cmd.findOption("--read-threads"))
+            {
+                OFCmdSignedInt threads = 0;
+                app.checkValue(cmd.getValueAndCheckMin(threads, 1));
+                pipeline.readThreads = static_cast<int>(threads);
+            }
+            if (cmd.findOption("--grid-threads"))
+            {
+                OFCmdSignedInt threads = 0;
+                app.checkValue(cmd.getValueAndCheckMin(threads, 1));
+                pipeline.gridThreads = static_cast<int>(threads);
+            }
+            if (cmd.findOption("--pipeline-depth"))
+            {
+                OFCmdSignedInt depth = 0;
+                app.checkValue(cmd.getValueAndCheckMin(depth, 1));
+                pipeline.depth = static_cast<int>(depth);
+            }
+            if (cmd.findOption("--slabs"))
+            {
+                OFCmdSignedInt slabs = 0;
+                app.checkValue(cmd.getValueAndCheckMin(slabs, 1));
+                pipeline.slabs = static_cast<int>(slabs);
+            }
+            if (cmd.findOption("--memory-limit"))
+            {
+                const char* limit = nullptr;
+                app.checkValue(cmd.getValue(limit));
+                if (!ParseMemorySize(limit, pipeline.memoryLimit))
+                {
+                    OFLOG_ERROR(logger, "Wrong memory limit " << limit << ", expected a size such as 512M or 2G" << OFendl);
+                    return -1;
+                }
+            }
+            if (cmd.findOption("--checkpoint"))
+            {
+                pipeline.checkpoint = true;
+            }
+            if (cmd.findOption("--resume"))
+            {
+                pipeline.checkpoint = true;
+                pipeline.resume = true;
+            }
+            if (cmd.findOption("--stats-json"))
+            {
+                const char* statsFile = nullptr;
+                app.checkValue(cmd.getValue(statsFile));
+                pipeline.statsFile = statsFile;
+            }
+            if (cmd.findOption("--trace"))
+            {
+                const char* traceFile = nullptr;
+                app.checkValue(cmd.getValue(traceFile));
+                pipeline.traceFile = traceFile;
+            }
+            bool progressJson = cmd.findOption("--progress-json");
+            if (cmd.findOption("--progress"))
+            {
+                OFCmdSignedInt interval = 0;
+                app.checkValue(cmd.getValueAndCheckMin(interval, 1));
+                pipeline.progressInterval = static_cast<int>(interval);
+            }
+            if (cmd.findOption("--progress") || progressJson)
+            {
+                pipeline.progress = [progressJson](const ProgressEvent& event)
+                {
+                    std::cerr << (progressJson ? FormatProgressJson(event) : FormatProgressLine(event)) << std::endl;
+                };
+            }
+            int previewFactor = 0;
+            if (cmd.findOption("--preview"))
+            {
+                OFCmdSignedInt factor = 0;
+                app.checkValue(cmd.getValueAndCheckMin(factor, 1));
+                previewFactor = static_cast<int>(factor);
+            }
+            PreviewFilter previewFilter = PREVIEW_FILTER_BOX;
+            if (cmd.findOption("--preview-filter"))
+            {
+                const char* filterStr = nullptr;
+                app.checkValue(cmd.getValue(filterStr));
+                if (!ParsePreviewFilter(filterStr, previewFilter))
+                {
+                    OFLOG_ERROR(logger, "Unknown preview filter " << filterStr << OFendl);
+                    return -1;
+                }
+            }
+            const char* previewCache = nullptr;
+            if (cmd.findOption("--preview-cache"))
+            {
+                app.checkValue(cmd.getValue(previewCache));
+            }
+            bool suggestIsoLevel = cmd.findOption("--suggest-isolevel");
+            std::vector<int> sweepLevels;
+            if (cmd.findOption("--sweep"))
+            {
+                const char* sweepStr = nullptr;
+                app.checkValue(cmd.getValue(sweepStr));
+                int from = 0;
+                int to = 0;
+                int step = 0;
+                char rest = 0;
+                if (sscanf(sweepStr, "%d:%d:%d%c", &from, &to, &step, &rest) != 3 || step < 1 || from > to)
+                {
+                    OFLOG_ERROR(logger, "Wrong sweep " << sweepStr << ", expected from:to:step with from <= to and a positive step" << OFendl);
+                    return -1;
+                }
+                for (int64_t level = from; level <= to; level += step)
+                {
+                    sweepLevels.push_back(static_cast<int>(level));
+                }
+            }
+            // The histogram and sweep passes only decode and classify, all the threads
+            // work on them unless told otherwise
+            if ((suggestIsoLevel || !sweepLevels.empty()) && !cmd.findOption("--read-threads"))
+            {
+                pipeline.readThreads = std::max(1u, std::thread::hardware_concurrency());
+            }
 
-            std::string outDir = stldir;
-            if (outDir.back() != '\\')
+            if (cmd.findOption("--submit"))
             {
-                outDir += "\\";
+                const char* socketPath = nullptr;
+                app.checkValue(cmd.getValue(socketPath));
+                ConversionJob job;
+                job.inputDir = dcmdir;
+                job.outputDir = stldir;
+                job.isoLevels = isoLevels;
+                job.output = output;
+                job.pipeline = pipeline;
+                JobResult result;
+                bool succeeded = SubmitJob(socketPath, job, result);
+                std::for_each(result.outputs.begin(), result.outputs.end(), [&](const std::string& outName)
+                {
+                    OFLOG_INFO(logger, "Written " << outName << OFendl);
+                });
+                if (!succeeded)
+                {
+                    OFLOG_ERROR(logger, "Job " << result.id << " " << result.status << OFendl);
+                    return -1;
+                }
+                OFLOG_INFO(logger, "Job " << result.id << " finished in " << result.latencyMs << " ms, "
+                                   << result.queueMs << " ms in the queue" << OFendl);
+                return 0;
             }
 
             FileNames files;
@@ -97,21 +427,44 @@ int main(int argc, char* argv[])
             }
             else
             {
-                GetFileNamesFromOSDir(dcmdir, files);
+                SeriesList series;
+                ScanDicomSeries(dcmdir, cmd.findOption("--recursive"), series);
+                int seriesIndex = series.size() == 1 ? 0 : -1;
+                if (series.size() > 1)
+                {
+                    std::cout << "\n";
+                    for (size_t i = 0; i < series.size(); ++i)
+                    {
+                        std::cout << i << ". " << series[i].seriesNumber << " " << series[i].seriesInstanceUid
+                                  << " (" << series[i].files.size() << " files)\n";
+                    }
+                    std::cout << "\nEnter a number of the series to analyze :\n";
+                    std::cin >> seriesIndex;
+                }
+
+                if (seriesIndex >= 0 && seriesIndex < static_cast<int>(series.size()))
+                {
+                    files.swap(series[seriesIndex].files);
+                }
             }
 
             if (!files.empty())
             {
-                auto posStart = files[0].find_last_of('\\') + 1;
-                auto posEnd = files[0].find_last_of('.');
-                std::string fileName = files[0].substr(posStart, posEnd - posStart);
-                fileName = outDir + fileName + ".stl";
+                std::vector<std::string> fileNames;
+                for (auto i = isoLevels.begin(); i != isoLevels.end(); ++i)
+                {
+                    std::string suffix = previewFactor > 0 ? "_preview" : "";
+                    suffix += isoLevels.size() > 1 ? "_il" + std::to_string(*i) : std::string();
+                    fileNames.push_back(MakeOutputFileName(stldir, files[0], suffix, output));
+                }
 
                 int dy(0);
                 int dx(0);
                 Vec3 spacing;
                 SlicesPositions slicesPositions;
-                ReadFormatDcmFiles(files, logger, dx, dy, spacing, slicesPositions);
+                Vec3 rowDirection;
+                Vec3 columnDirection;
+                ReadFormatDcmFiles(files, logger, dx, dy, spacing, slicesPositions, rowDirection, columnDirection);
 
                 if (slicesPositions.size() < 2)
                 {
@@ -119,27 +472,119 @@ int main(int argc, char* argv[])
                     return -1;
                 }
 
-                double time = EstimateProcessingTime(dx, dy, spacing, slicesPositions, isoLevel, fileName, binaryStl, logger);
-                size_t hours(0);
-                size_t minutes(0);
-                size_t seconds(0);
-                FormatTime(time, hours, minutes, seconds);
+                DcmSliceSource source(dx, dy, spacing, slicesPositions, rowDirection, columnDirection);
+                source.SetDropCache(pipeline.memoryLimit > 0);
+                // A preview takes seconds, it is not estimated
+                std::unique_ptr<PreviewSliceSource> preview;
+                if (previewFactor > 0)
+                {
+                    preview.reset(new PreviewSliceSource(source, previewFactor, previewFilter));
+                    OFLOG_INFO(logger, "Preview of " << preview->GetSlicesCount() << " slices of " << preview->GetWidth()
+                                       << " x " << preview->GetHeight() << " pixels" << OFendl);
+                    if (previewCache != nullptr)
+                    {
+                        if (preview->LoadCache(previewCache))
+                        {
+                            OFLOG_INFO(logger, "Preview slices taken from " << previewCache << OFendl);
+                        }
+                        else
+                        {
+                            preview->SaveCache(previewCache);
+                            OFLOG_INFO(logger, "Preview slices kept in " << previewCache << OFendl);
+                        }
+                    }
+                }
+                else if (!suggestIsoLevel && sweepLevels.empty())
+                {
+                    TimeEstimate estimate = EstimateProcessingTime(source, isoLevels[0], output, pipeline, logger);
+                    double levels = static_cast<double>(isoLevels.size());
+                    size_t hours(0);
+                    size_t minutes(0);
+                    size_t seconds(0);
+                    FormatTime(levels * estimate.totalMs, hours, minutes, seconds);
 
-                OFLOG_INFO(logger, "Approximate processing time is : " << hours << " hours " << minutes << " minutes " << seconds << " seconds" << OFendl); 
+                    OFLOG_INFO(logger, "Approximate processing time is : " << hours << " hours " << minutes << " minutes " << seconds << " seconds"
+                                       << " (" << static_cast<size_t>(levels * estimate.lowMs / 1000) << " to "
+                                       << static_cast<size_t>(levels * estimate.highMs / 1000 + 1) << " seconds)" << OFendl);
 
-                if (cmd.findOption("--verbose"))
-                {
-                    char answer(0);
-                    std::cout << "Would you like to continue? [y/n]";
-                    std::cin >> answer;
-                    if (tolower(answer) == 'n')
+                    if (cmd.findOption("--verbose"))
                     {
-                        return 1;
+                        char answer(0);
+                        std::cout << "Would you like to continue? [y/n]";
+                        std::cin >> answer;
+                        if (tolower(answer) == 'n')
+                        {
+                            return 1;
+                        }
                     }
                 }
+                const SliceSource& levelSource = preview ? static_cast<const SliceSource&>(*preview) : source;
 
                 OFLOG_INFO(logger, "Start parsing DICOM files ..." << OFendl);
-                ReadVolumeFromDcmFiles(dx, dy, spacing, slicesPositions, isoLevel, fileName, binaryStl, logger, std::bind(NeedBreak, handleIn, logger));
+                CancellationToken cancellation;
+                CancelOnSignals(cancellation);
+                if (suggestIsoLevel)
+                {
+                    IntensityHistogram histogram;
+                    ModalityRescale rescale;
+                    ReadModalityRescale(files[0], rescale);
+                    bool isComplete = ComputeHistogram(levelSource, pipeline, histogram, logger, [&]() -> bool
+                    {
+                        if (!cancellation.IsCancelled() && NeedBreak(logger))
+                        {
+                            cancellation.Cancel();
+                        }
+                        return cancellation.IsCancelled();
+                    });
+                    if (isComplete)
+                    {
+                        std::cout << GetHistogramReport(histogram, rescale) << std::endl;
+                    }
+                    return 0;
+                }
+                if (!sweepLevels.empty())
+                {
+                    std::vector<SweepLevel> levels;
+                    bool isComplete = SweepIsoLevels(levelSource, sweepLevels, pipeline, levels, logger, [&]() -> bool
+                    {
+                        if (!cancellation.IsCancelled() && NeedBreak(logger))
+                        {
+                            cancellation.Cancel();
+                        }
+                        return cancellation.IsCancelled();
+                    });
+                    if (isComplete)
+                    {
+                        std::cout << std::setw(10) << "Isolevel" << std::setw(16) << "Active cells"
+                                  << std::setw(16) << "Triangles" << std::setw(20) << "Binary STL bytes" << "\n";
+                        std::for_each(levels.begin(), levels.end(), [](const SweepLevel& level)
+                        {
+                            std::cout << std::setw(10) << level.isoLevel << std::setw(16) << level.activeCells
+                                      << std::setw(16) << level.triangles << std::setw(20) << 84 + 50 * level.triangles << "\n";
+                        });
+                        std::cout.flush();
+                    }
+                    return 0;
+                }
+                for (size_t i = 0; i < isoLevels.size() && !cancellation.IsCancelled(); ++i)
+                {
+                    // Every level gets stats and trace files of its own, named like its mesh
+                    PipelineOptions levelPipeline = pipeline;
+                    if (isoLevels.size() > 1)
+                    {
+                        std::string suffix = "_il" + std::to_string(isoLevels[i]);
+                        levelPipeline.statsFile = InsertFileSuffix(pipeline.statsFile, suffix);
+                        levelPipeline.traceFile = InsertFileSuffix(pipeline.traceFile, suffix);
+                    }
+                    WriteVolume(levelSource, isoLevels[i], fileNames[i], output, levelPipeline, logger, [&]() -> bool
+                    {
+                        if (!cancellation.IsCancelled() && NeedBreak(logger))
+                        {
+                            cancellation.Cancel();
+                        }
+                        return cancellation.IsCancelled();
+                    });
+                }
             }
             else
             {
@@ -159,8 +604,10 @@ int main(int argc, char* argv[])
     return 1;
 }
 
-bool NeedBreak(HANDLE handleIn, OFLogger& logger)
+#ifdef _WIN32
+bool NeedBreak(OFLogger& logger)
 {
+    HANDLE handleIn = GetStdHandle(STD_INPUT_HANDLE);
     INPUT_RECORD recordIn;
     DWORD numberOfEvents(0);
 
@@ -180,6 +627,30 @@ bool NeedBreak(HANDLE handleIn, OFLogger& logger)
     }
     return false;
 }
+#else
+bool NeedBreak(OFLogger& logger)
+{
+    // The terminal is line buffered, Escape or q is seen once Enter is pressed
+    pollfd pfd;
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+    {
+        char key = 0;
+        if (read(STDIN_FILENO, &key, 1) != 1)
+        {
+            break;
+        }
+        if (key == 27 || key == 'q')
+        {
+            OFLOG_INFO(logger, "Processing terminated" << OFendl);
+            return true;
+        }
+    }
+    return false;
+}
+#endif
 
 void FormatTime(double time, size_t& hours, size_t& minutes, size_t& seconds)
 {
@@ -188,4 +659,26 @@ void FormatTime(double time, size_t& hours, size_t& minutes, size_t& seconds)
     hours = static_cast<size_t>(time / millisecondsInHour);
     minutes = static_cast<size_t>((time - hours * millisecondsInHour) / millisecondsInMinute);
     seconds = static_cast<size_t>((time - hours * millisecondsInHour - minutes * millisecondsInMinute) / 1000);
-}
\ No newline at end of file
+}
+
+bool GetFormatFromFileName(const std::string& fileName, MeshFormat& format)
+{
+    auto pos = fileName.find_last_of('.');
+    return pos != std::string::npos && ParseMeshFormat(fileName.substr(pos + 1), false, format);
+}
+
+// "dir/trace.json" and "_il300" give "dir/trace_il300.json", an empty name stays empty
+std::string InsertFileSuffix(const std::string& fileName, const std::string& suffix)
+{
+    if (fileName.empty())
+    {
+        return fileName;
+    }
+    size_t dot = fileName.rfind('.');
+    size_t slash = fileName.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return fileName + suffix;
+    }
+    return fileName.substr(0, dot) + suffix + fileName.substr(dot);
+}
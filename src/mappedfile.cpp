@@ -0,0 +1,169 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& fileName, uint64_t size, bool keepContents)
+    : file(INVALID_HANDLE_VALUE)
+    , mapping(nullptr)
+    , data(nullptr)
+    , size(size)
+{
+    this->file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                             keepContents ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (this->file == INVALID_HANDLE_VALUE)
+    {
+        throw std::invalid_argument("Can't create output file");
+    }
+    // The mapping extends the file to its full size
+    this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READWRITE,
+                                       static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+    if (this->mapping != nullptr)
+    {
+        this->data = static_cast<char*>(MapViewOfFile(this->mapping, FILE_MAP_WRITE, 0, 0, 0));
+    }
+    if (this->data == nullptr)
+    {
+        Unmap();
+        throw std::runtime_error("Can't map output file");
+    }
+}
+
+void MappedFile::Flush(uint64_t offset, uint64_t size)
+{
+    if (FlushViewOfFile(this->data + offset, static_cast<SIZE_T>(size)) == FALSE)
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+}
+
+void MappedFile::Close()
+{
+    if (this->file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+    bool flushed = FlushViewOfFile(this->data, 0) != FALSE;
+    Unmap();
+    if (!flushed)
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+}
+
+void MappedFile::Unmap()
+{
+    if (this->data != nullptr)
+    {
+        UnmapViewOfFile(this->data);
+        this->data = nullptr;
+    }
+    if (this->mapping != nullptr)
+    {
+        CloseHandle(this->mapping);
+        this->mapping = nullptr;
+    }
+    if (this->file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& fileName, uint64_t size, bool keepContents)
+    : fd(-1)
+    , data(nullptr)
+    , size(size)
+{
+    this->fd = open(fileName.c_str(), O_RDWR | O_CREAT | (keepContents ? 0 : O_TRUNC), 0644);
+    if (this->fd < 0)
+    {
+        throw std::invalid_argument("Can't create output file");
+    }
+    // Reserves the blocks up front so a full disk fails here rather than on a page fault
+    if (ftruncate(this->fd, static_cast<off_t>(size)) != 0 ||
+        posix_fallocate(this->fd, 0, static_cast<off_t>(size)) != 0)
+    {
+        Unmap();
+        throw std::runtime_error("Can't allocate output file");
+    }
+    void* mapped = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        Unmap();
+        throw std::runtime_error("Can't map output file");
+    }
+    this->data = static_cast<char*>(mapped);
+}
+
+void MappedFile::Flush(uint64_t offset, uint64_t size)
+{
+    // msync wants the range to start on a page
+    uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t first = offset - offset % pageSize;
+    if (msync(this->data + first, static_cast<size_t>(offset + size - first), MS_SYNC) != 0)
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+}
+
+void MappedFile::Close()
+{
+    if (this->fd < 0)
+    {
+        return;
+    }
+    bool flushed = msync(this->data, static_cast<size_t>(this->size), MS_SYNC) == 0;
+    Unmap();
+    if (!flushed)
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+}
+
+void MappedFile::Unmap()
+{
+    if (this->data != nullptr)
+    {
+        munmap(this->data, static_cast<size_t>(this->size));
+        this->data = nullptr;
+    }
+    if (this->fd >= 0)
+    {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+    Unmap();
+}
+
+char* MappedFile::GetData()
+{
+    return this->data;
+}
+
+uint64_t MappedFile::GetSize() const
+{
+    return this->size;
+}
+
+}
@@ -0,0 +1,42 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <string>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// Output file of a size known in advance, mapped into memory for writing
+// so that several threads fill their own ranges of it directly
+class MappedFile
+{
+public:
+    // Creates the file of exactly size bytes, throws if it can't be created or mapped.
+    // With keepContents an existing file is opened as is, to finish an interrupted fill.
+    MappedFile(const std::string& fileName, uint64_t size, bool keepContents = false);
+    ~MappedFile();
+    char* GetData();
+    uint64_t GetSize() const;
+    // Writes the pages of the range to disk, throws if it failed
+    void Flush(uint64_t offset, uint64_t size);
+    // Flushes the mapped pages and releases the file, throws if the flush failed
+    void Close();
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+    void Unmap();
+private:
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#else
+    int fd;
+#endif
+    char* data;
+    uint64_t size;
+};
+
+}
+
+#endif
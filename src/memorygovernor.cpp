@@ -0,0 +1,133 @@
+#include "memorygovernor.h"
+
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+
+namespace DicomToStl
+{
+
+namespace
+{
+std::string FormatMegabytes(int64_t bytes)
+{
+    std::stringstream buf;
+    buf.setf(std::ios::fixed);
+    buf.precision(1);
+    buf << bytes / (1024.0 * 1024.0) << " MB";
+    return buf.str();
+}
+}
+
+bool ParseMemorySize(const std::string& str, uint64_t& bytes)
+{
+    char* end = nullptr;
+    double value = std::strtod(str.c_str(), &end);
+    if (end == str.c_str() || value <= 0)
+    {
+        return false;
+    }
+    std::string suffix(end);
+    std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::toupper);
+    double scale = 1;
+    if (suffix == "K" || suffix == "KB")
+    {
+        scale = 1024.0;
+    }
+    else if (suffix == "M" || suffix == "MB")
+    {
+        scale = 1024.0 * 1024.0;
+    }
+    else if (suffix == "G" || suffix == "GB")
+    {
+        scale = 1024.0 * 1024.0 * 1024.0;
+    }
+    else if (!suffix.empty())
+    {
+        return false;
+    }
+    bytes = static_cast<uint64_t>(value * scale);
+    return true;
+}
+
+MemoryGovernor::MemoryGovernor(uint64_t limit)
+    : limit(limit)
+    , used(0)
+    , peak(0)
+{
+}
+
+uint64_t MemoryGovernor::GetLimit() const
+{
+    return this->limit;
+}
+
+void MemoryGovernor::Reserve(const std::string& pool, uint64_t bytes)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->limit > 0)
+    {
+        this->released.wait(lock, [&]()
+        {
+            return this->used == 0 || static_cast<uint64_t>(this->used) + bytes <= this->limit;
+        });
+    }
+    Add(pool, static_cast<int64_t>(bytes));
+}
+
+void MemoryGovernor::Release(const std::string& pool, uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Add(pool, -static_cast<int64_t>(bytes));
+    this->released.notify_all();
+}
+
+void MemoryGovernor::Track(const std::string& pool, int64_t delta)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Add(pool, delta);
+    if (delta < 0)
+    {
+        this->released.notify_all();
+    }
+}
+
+void MemoryGovernor::Add(const std::string& pool, int64_t delta)
+{
+    PoolUsage& usage = this->pools[pool];
+    usage.current += delta;
+    usage.peak = std::max(usage.peak, usage.current);
+    this->used += delta;
+    this->peak = std::max(this->peak, this->used);
+}
+
+std::string MemoryGovernor::GetReport() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::stringstream buf;
+    buf << "Peak memory of the buffers " << FormatMegabytes(this->peak);
+    if (this->limit > 0)
+    {
+        buf << " of " << FormatMegabytes(static_cast<int64_t>(this->limit)) << " allowed";
+    }
+    std::for_each(this->pools.begin(), this->pools.end(), [&](const std::pair<const std::string, PoolUsage>& pool)
+    {
+        buf << "\n  " << pool.first << " : " << FormatMegabytes(pool.second.peak);
+    });
+    return buf.str();
+}
+
+MemoryReservation::MemoryReservation(MemoryGovernor& governor, const std::string& pool, uint64_t bytes)
+    : governor(governor)
+    , pool(pool)
+    , bytes(bytes)
+{
+    this->governor.Reserve(this->pool, this->bytes);
+}
+
+MemoryReservation::~MemoryReservation()
+{
+    this->governor.Release(this->pool, this->bytes);
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef _MEMORY_GOVERNOR_H_
+#define _MEMORY_GOVERNOR_H_
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// Accepts a byte count with an optional K, M or G suffix, such as "512M"
+bool ParseMemorySize(const std::string& str, uint64_t& bytes);
+
+// Keeps the large buffers of a conversion under a memory limit. Pools reserve
+// their buffers before allocating them and wait while the limit is reached,
+// so a tight limit slows the conversion down instead of running out of memory.
+// The current and peak usage of every pool is tracked for the final report.
+class MemoryGovernor
+{
+public:
+    // 0 means no limit, the usage is tracked only
+    explicit MemoryGovernor(uint64_t limit);
+    uint64_t GetLimit() const;
+    // Blocks until the bytes fit; granted at once when nothing else is held,
+    // so a single reservation above the limit still makes progress
+    void Reserve(const std::string& pool, uint64_t bytes);
+    void Release(const std::string& pool, uint64_t bytes);
+    // Accounts memory which can't wait, such as a growing buffer
+    void Track(const std::string& pool, int64_t delta);
+    // Peak usage of every pool and of all of them together
+    std::string GetReport() const;
+private:
+    MemoryGovernor(const MemoryGovernor&);
+    MemoryGovernor& operator=(const MemoryGovernor&);
+    void Add(const std::string& pool, int64_t delta);
+private:
+    struct PoolUsage
+    {
+        PoolUsage() : current(0), peak(0) {}
+        int64_t current;
+        int64_t peak;
+    };
+    uint64_t limit;
+    int64_t used;
+    int64_t peak;
+    std::map<std::string, PoolUsage> pools;
+    mutable std::mutex mutex;
+    std::condition_variable released;
+};
+
+// Reservation held for the lifetime of the object
+class MemoryReservation
+{
+public:
+    MemoryReservation(MemoryGovernor& governor, const std::string& pool, uint64_t bytes);
+    ~MemoryReservation();
+private:
+    MemoryReservation(const MemoryReservation&);
+    MemoryReservation& operator=(const MemoryReservation&);
+private:
+    MemoryGovernor& governor;
+    std::string pool;
+    uint64_t bytes;
+};
+
+}
+
+#endif
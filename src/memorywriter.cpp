@@ -0,0 +1,68 @@
+#include "memorywriter.h"
+#include "stlwriter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+CallbackMeshWriter::CallbackMeshWriter(std::function<void (const Triangle&)> callback)
+    : callback(callback)
+{
+}
+
+CallbackMeshWriter::~CallbackMeshWriter()
+{
+}
+
+void CallbackMeshWriter::Write(const Triangle& tri)
+{
+    this->callback(tri);
+    AddToBounds(tri);
+    ++triCount;
+}
+
+void CallbackMeshWriter::Close()
+{
+}
+
+MemoryMeshWriter::MemoryMeshWriter()
+{
+}
+
+MemoryMeshWriter::~MemoryMeshWriter()
+{
+}
+
+void MemoryMeshWriter::Write(const Triangle& tri)
+{
+    this->triangles.push_back(tri);
+    AddToBounds(tri);
+    ++triCount;
+}
+
+void MemoryMeshWriter::Close()
+{
+}
+
+const Triangles& MemoryMeshWriter::GetTriangles() const
+{
+    return this->triangles;
+}
+
+void MemoryMeshWriter::GetBinaryStl(std::vector<char>& bytes) const
+{
+    bytes.assign(STL_HEADER_SIZE + this->triangles.size() * STL_RECORD_SIZE, 0);
+    uint32_t count = static_cast<uint32_t>(this->triangles.size());
+    std::memcpy(&bytes[80], &count, sizeof(count));
+    char* record = bytes.data() + STL_HEADER_SIZE;
+    std::for_each(this->triangles.begin(), this->triangles.end(), [&](const Triangle& tri)
+    {
+        MakeStlRecord(tri, record);
+        record += STL_RECORD_SIZE;
+    });
+}
+
+}
@@ -0,0 +1,47 @@
+#ifndef _MEMORY_WRITER_H_
+#define _MEMORY_WRITER_H_
+
+#include "meshwriter.h"
+
+#include <functional>
+#include <vector>
+
+namespace DicomToStl
+{
+
+// Hands every triangle to the caller, from one thread and in the slice order
+class CallbackMeshWriter : public MeshWriter
+{
+public:
+    explicit CallbackMeshWriter(std::function<void (const Triangle&)> callback);
+    virtual ~CallbackMeshWriter();
+    virtual void Write(const Triangle& tri);
+    virtual void Close();
+private:
+    CallbackMeshWriter(const CallbackMeshWriter&);
+    CallbackMeshWriter& operator=(const CallbackMeshWriter&);
+private:
+    std::function<void (const Triangle&)> callback;
+};
+
+// Keeps the mesh in memory, as triangles or as the bytes of a binary STL file
+class MemoryMeshWriter : public MeshWriter
+{
+public:
+    MemoryMeshWriter();
+    virtual ~MemoryMeshWriter();
+    virtual void Write(const Triangle& tri);
+    virtual void Close();
+    const Triangles& GetTriangles() const;
+    // Same bytes as the binary STL file of the mesh
+    void GetBinaryStl(std::vector<char>& bytes) const;
+private:
+    MemoryMeshWriter(const MemoryMeshWriter&);
+    MemoryMeshWriter& operator=(const MemoryMeshWriter&);
+private:
+    Triangles triangles;
+};
+
+}
+
+#endif
@@ -0,0 +1,329 @@
+#include "meshreader.h"
+#include "compactmesh.h"
+#include "compressstream.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+
+namespace DicomToStl
+{
+
+namespace
+{
+const size_t STL_RECORD_SIZE = 50;
+const size_t READ_BUF_SIZE = 1 << 20;
+
+std::string GetExtension(const std::string& fileName)
+{
+    auto pos = fileName.find_last_of('.');
+    if (pos == std::string::npos)
+    {
+        return "";
+    }
+    std::string ext = fileName.substr(pos);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+void ReadAsciiStl(std::ifstream& file, MeshWriter& meshWriter)
+{
+    Vec3 points[3];
+    int count = 0;
+    std::string token;
+    while (file >> token)
+    {
+        if (token == "vertex")
+        {
+            Vec3& p = points[count++];
+            file >> p.x >> p.y >> p.z;
+            if (count == 3)
+            {
+                meshWriter.Write(Triangle(points[0], points[1], points[2]));
+                count = 0;
+            }
+        }
+    }
+}
+
+void ReadStl(const std::string& fileName, MeshWriter& meshWriter)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file)
+    {
+        throw std::invalid_argument("Can't open mesh file " + fileName);
+    }
+    file.seekg(0, std::ios::end);
+    unsigned long long fileSize = static_cast<unsigned long long>(file.tellg());
+    file.seekg(0, std::ios::beg);
+
+    char header[84] = {0};
+    file.read(header, sizeof(header));
+    uint32_t count(0);
+    std::memcpy(&count, header + 80, sizeof(count));
+
+    // ASCII files can start with "solid" as binary ones may do, the size tells them apart
+    if (!file || fileSize != 84 + static_cast<unsigned long long>(count) * STL_RECORD_SIZE)
+    {
+        file.clear();
+        file.seekg(0, std::ios::beg);
+        ReadAsciiStl(file, meshWriter);
+        return;
+    }
+
+    std::vector<char> buffer(READ_BUF_SIZE / STL_RECORD_SIZE * STL_RECORD_SIZE);
+    size_t left = count;
+    while (left > 0)
+    {
+        size_t records = std::min(left, buffer.size() / STL_RECORD_SIZE);
+        if (!file.read(buffer.data(), records * STL_RECORD_SIZE))
+        {
+            throw std::runtime_error("Unexpected end of mesh file " + fileName);
+        }
+        for (size_t i = 0; i < records; ++i)
+        {
+            const char* record = buffer.data() + i * STL_RECORD_SIZE;
+            Triangle tri;
+            std::memcpy(&std::get<0>(tri), record + 12, sizeof(Vec3));
+            std::memcpy(&std::get<1>(tri), record + 24, sizeof(Vec3));
+            std::memcpy(&std::get<2>(tri), record + 36, sizeof(Vec3));
+            meshWriter.Write(tri);
+        }
+        left -= records;
+    }
+}
+
+void ReadPly(const std::string& fileName, MeshWriter& meshWriter)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file)
+    {
+        throw std::invalid_argument("Can't open mesh file " + fileName);
+    }
+
+    size_t verticesCount = 0;
+    size_t facesCount = 0;
+    // Float properties of a vertex and where x, y and z are among them
+    int vertexProperties = 0;
+    int coordIndex[3] = {-1, -1, -1};
+    int indexSize = 0;
+    std::string element;
+    std::string line;
+    bool isBinaryLE = false;
+    while (std::getline(file, line) && line != "end_header")
+    {
+        std::stringstream buf(line);
+        std::string word;
+        buf >> word;
+        if (word == "format")
+        {
+            buf >> word;
+            isBinaryLE = word == "binary_little_endian";
+        }
+        else if (word == "element")
+        {
+            buf >> element;
+            if (element == "vertex")
+            {
+                buf >> verticesCount;
+            }
+            else if (element == "face")
+            {
+                buf >> facesCount;
+            }
+            else
+            {
+                throw std::runtime_error("Unsupported PLY element " + element);
+            }
+        }
+        else if (word == "property" && element == "vertex")
+        {
+            std::string type;
+            std::string name;
+            buf >> type >> name;
+            if (type != "float" && type != "float32")
+            {
+                throw std::runtime_error("Unsupported PLY vertex property type " + type);
+            }
+            if (name == "x" || name == "y" || name == "z")
+            {
+                coordIndex[name[0] - 'x'] = vertexProperties;
+            }
+            ++vertexProperties;
+        }
+        else if (word == "property" && element == "face")
+        {
+            std::string list;
+            std::string countType;
+            std::string type;
+            buf >> list >> countType >> type;
+            if (list != "list" || (countType != "uchar" && countType != "uint8"))
+            {
+                throw std::runtime_error("Unsupported PLY face property");
+            }
+            indexSize = (type == "int" || type == "uint" || type == "int32" || type == "uint32") ? 4 : 0;
+        }
+    }
+    if (!isBinaryLE || indexSize != 4 || coordIndex[0] < 0 || coordIndex[1] < 0 || coordIndex[2] < 0)
+    {
+        throw std::runtime_error("Only binary little endian PLY with float coordinates and int indices is supported");
+    }
+
+    std::vector<Vec3> vertices(verticesCount);
+    std::vector<float> values(vertexProperties);
+    for (size_t i = 0; i < verticesCount; ++i)
+    {
+        file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(float));
+        vertices[i] = Vec3(values[coordIndex[0]], values[coordIndex[1]], values[coordIndex[2]]);
+    }
+
+    std::vector<uint32_t> indices;
+    for (size_t i = 0; i < facesCount && file; ++i)
+    {
+        unsigned char count = 0;
+        file.read(reinterpret_cast<char*>(&count), 1);
+        indices.resize(count);
+        file.read(reinterpret_cast<char*>(indices.data()), count * sizeof(uint32_t));
+        // Polygons are split into fans
+        for (unsigned char k = 2; k < count; ++k)
+        {
+            if (indices[0] >= verticesCount || indices[k - 1] >= verticesCount || indices[k] >= verticesCount)
+            {
+                throw std::runtime_error("Invalid vertex index in " + fileName);
+            }
+            meshWriter.Write(Triangle(vertices[indices[0]], vertices[indices[k - 1]], vertices[indices[k]]));
+        }
+    }
+    if (!file)
+    {
+        throw std::runtime_error("Unexpected end of mesh file " + fileName);
+    }
+}
+
+void ReadObj(const std::string& fileName, MeshWriter& meshWriter)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file)
+    {
+        throw std::invalid_argument("Can't open mesh file " + fileName);
+    }
+
+    std::vector<Vec3> vertices;
+    std::vector<size_t> face;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        const char* p = line.c_str();
+        if (p[0] == 'v' && p[1] == ' ')
+        {
+            char* end = nullptr;
+            Vec3 v;
+            v.x = std::strtof(p + 2, &end);
+            v.y = std::strtof(end, &end);
+            v.z = std::strtof(end, &end);
+            vertices.push_back(v);
+        }
+        else if (p[0] == 'f' && p[1] == ' ')
+        {
+            face.clear();
+            p += 2;
+            for (;;)
+            {
+                char* end = nullptr;
+                long index = std::strtol(p, &end, 10);
+                if (end == p)
+                {
+                    break;
+                }
+                // Negative indices count back from the last vertex
+                long absolute = index < 0 ? static_cast<long>(vertices.size()) + index : index - 1;
+                if (absolute < 0 || absolute >= static_cast<long>(vertices.size()))
+                {
+                    throw std::runtime_error("Invalid vertex index in " + fileName);
+                }
+                face.push_back(static_cast<size_t>(absolute));
+                // Skip texture and normal references
+                while (*end != '\0' && *end != ' ' && *end != '\t')
+                {
+                    ++end;
+                }
+                p = end;
+            }
+            for (size_t k = 2; k < face.size(); ++k)
+            {
+                meshWriter.Write(Triangle(vertices[face[0]], vertices[face[k - 1]], vertices[face[k]]));
+            }
+        }
+    }
+}
+
+void ReadCompact(const std::string& fileName, MeshWriter& meshWriter)
+{
+    CompactMesh mesh;
+    ReadCompactMesh(fileName, mesh);
+    for (size_t i = 0; i < mesh.indices.size(); i += 3)
+    {
+        meshWriter.Write(Triangle(mesh.GetVertex(mesh.indices[i]),
+                                  mesh.GetVertex(mesh.indices[i + 1]),
+                                  mesh.GetVertex(mesh.indices[i + 2])));
+    }
+}
+
+// Reader of the format of the extension for the file
+void ReadMeshFormat(const std::string& ext, const std::string& fileName, MeshWriter& meshWriter)
+{
+    if (ext == ".stl")
+    {
+        ReadStl(fileName, meshWriter);
+    }
+    else if (ext == ".ply")
+    {
+        ReadPly(fileName, meshWriter);
+    }
+    else if (ext == ".obj")
+    {
+        ReadObj(fileName, meshWriter);
+    }
+    else if (ext == ".qmesh")
+    {
+        ReadCompact(fileName, meshWriter);
+    }
+    else
+    {
+        throw std::invalid_argument("Unsupported mesh file " + fileName);
+    }
+}
+}
+
+void ReadMeshFile(const std::string& fileName, MeshWriter& meshWriter)
+{
+    std::string ext = GetExtension(fileName);
+    OutputCompression compression = ext == ".gz" ? OUTPUT_COMPRESSION_GZIP :
+                                    ext == ".zst" ? OUTPUT_COMPRESSION_ZSTD : OUTPUT_COMPRESSION_NONE;
+    if (compression == OUTPUT_COMPRESSION_NONE)
+    {
+        ReadMeshFormat(ext, fileName, meshWriter);
+        return;
+    }
+    // The readers seek in the file, the mesh is unpacked next to it first
+    std::string meshName = fileName.substr(0, fileName.size() - ext.size());
+    std::string tempName = fileName + ".unpacked";
+    try
+    {
+        DecompressFile(fileName, tempName, compression);
+        ReadMeshFormat(GetExtension(meshName), tempName, meshWriter);
+    }
+    catch (...)
+    {
+        std::remove(tempName.c_str());
+        throw;
+    }
+    std::remove(tempName.c_str());
+}
+
+}
@@ -0,0 +1,18 @@
+#ifndef _MESH_READER_H_
+#define _MESH_READER_H_
+
+#include "meshwriter.h"
+
+#include <string>
+
+namespace DicomToStl
+{
+
+// Feeds every triangle of a binary or ASCII STL, binary little endian PLY, OBJ
+// or compact mesh file to the writer. The format is taken from the extension; throws on errors.
+// A .gz or .zst file, such as a compressed chunk, is unpacked to a temporary file next to it first.
+void ReadMeshFile(const std::string& fileName, MeshWriter& meshWriter);
+
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include "meshwriter.h"
+#include "stlwriter.h"
+#include "plywriter.h"
+#include "objwriter.h"
+#include "compactwriter.h"
+#include "trace.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+const size_t SPOOL_COPY_BUF_SIZE = 4 << 20;
+}
+
+bool ParseMeshFormat(const std::string& name, bool asciiStl, MeshFormat& format)
+{
+    if (name == "stl")
+    {
+        format = asciiStl ? MESH_FORMAT_STL_ASCII : MESH_FORMAT_STL_BINARY;
+    }
+    else if (name == "ply")
+    {
+        format = MESH_FORMAT_PLY;
+    }
+    else if (name == "obj")
+    {
+        format = MESH_FORMAT_OBJ;
+    }
+    else if (name == "qmesh")
+    {
+        format = MESH_FORMAT_COMPACT;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+const char* GetMeshFormatName(MeshFormat format)
+{
+    switch (format)
+    {
+    case MESH_FORMAT_STL_BINARY:
+        return "binary STL";
+    case MESH_FORMAT_STL_ASCII:
+        return "ASCII STL";
+    case MESH_FORMAT_PLY:
+        return "binary PLY";
+    case MESH_FORMAT_OBJ:
+        return "OBJ";
+    case MESH_FORMAT_COMPACT:
+        return "compact mesh";
+    }
+    return "unknown";
+}
+
+const char* GetMeshFormatExtension(MeshFormat format)
+{
+    switch (format)
+    {
+    case MESH_FORMAT_PLY:
+        return ".ply";
+    case MESH_FORMAT_OBJ:
+        return ".obj";
+    case MESH_FORMAT_COMPACT:
+        return ".qmesh";
+    default:
+        return ".stl";
+    }
+}
+
+MeshWriter::MeshWriter()
+    : triCount(0)
+    , vertCount(0)
+    , boundsMin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max())
+    , boundsMax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max())
+    , bytesWritten(0)
+    , writeTime(0)
+{
+}
+
+MeshWriter::~MeshWriter()
+{
+}
+
+size_t MeshWriter::GetTrianglesCount() const
+{
+    return this->triCount;
+}
+
+size_t MeshWriter::GetVerticesCount() const
+{
+    return this->vertCount;
+}
+
+unsigned long long MeshWriter::GetBytesWritten() const
+{
+    return this->bytesWritten;
+}
+
+double MeshWriter::GetWriteTime() const
+{
+    return this->writeTime;
+}
+
+const Vec3& MeshWriter::GetBoundsMin() const
+{
+    return this->boundsMin;
+}
+
+const Vec3& MeshWriter::GetBoundsMax() const
+{
+    return this->boundsMax;
+}
+
+void MeshWriter::AddToBounds(const Triangle& tri)
+{
+    const Vec3* points[3] = {&std::get<0>(tri), &std::get<1>(tri), &std::get<2>(tri)};
+    for (int i = 0; i < 3; ++i)
+    {
+        boundsMin.x = std::min(boundsMin.x, points[i]->x);
+        boundsMin.y = std::min(boundsMin.y, points[i]->y);
+        boundsMin.z = std::min(boundsMin.z, points[i]->z);
+        boundsMax.x = std::max(boundsMax.x, points[i]->x);
+        boundsMax.y = std::max(boundsMax.y, points[i]->y);
+        boundsMax.z = std::max(boundsMax.z, points[i]->z);
+    }
+}
+
+void MeshWriter::WriteBlock(OutputStream& out, const char* data, size_t size)
+{
+    TraceSpan span("write", "write", "bytes", static_cast<int64_t>(size));
+    this->timer.Start();
+    out.Write(data, size);
+    this->writeTime += this->timer.End();
+    this->bytesWritten += size;
+}
+
+void MeshWriter::CopySpool(OutputStream& out, OutputStream& spool, const std::string& spoolName, uint64_t decodedSize)
+{
+    TraceSpan span("write", "copy spool", "bytes", static_cast<int64_t>(decodedSize));
+    this->timer.Start();
+    try
+    {
+        spool.Close();
+        std::ifstream spoolFile(spoolName.c_str(), std::ios::binary);
+        if (!spoolFile)
+        {
+            throw std::runtime_error("Can't open spool file " + spoolName);
+        }
+        std::vector<char> buffer(SPOOL_COPY_BUF_SIZE);
+        uint64_t copied = 0;
+        while (spoolFile.read(buffer.data(), buffer.size()).gcount() > 0)
+        {
+            out.WriteEncoded(buffer.data(), static_cast<size_t>(spoolFile.gcount()));
+            copied += static_cast<uint64_t>(spoolFile.gcount());
+        }
+        // The header counts were written for what went into the spool
+        if (spoolFile.bad() || copied != spool.GetBytesWritten())
+        {
+            throw std::runtime_error("Can't read back spool file " + spoolName);
+        }
+    }
+    catch (...)
+    {
+        std::remove(spoolName.c_str());
+        throw;
+    }
+    std::remove(spoolName.c_str());
+    this->writeTime += this->timer.End();
+    this->bytesWritten += decodedSize;
+}
+
+std::unique_ptr<MeshWriter> CreateMeshWriter(const std::string& fileName, const OutputOptions& options)
+{
+    switch (options.format)
+    {
+    case MESH_FORMAT_PLY:
+        return std::unique_ptr<MeshWriter>(new PlyWriter(fileName, options.stream));
+    case MESH_FORMAT_OBJ:
+        return std::unique_ptr<MeshWriter>(new ObjWriter(fileName, options.stream));
+    case MESH_FORMAT_COMPACT:
+        return std::unique_ptr<MeshWriter>(new CompactWriter(fileName, options.stream));
+    case MESH_FORMAT_STL_ASCII:
+        return std::unique_ptr<MeshWriter>(new StlWriter(fileName, false, options.stream));
+    default:
+        return std::unique_ptr<MeshWriter>(new StlWriter(fileName, true, options.stream));
+    }
+}
+
+uint32_t VertexMap::Add(const Vec3& v, bool& isNew)
+{
+    Key key;
+    // Adding zero folds -0 into +0
+    float x = v.x + 0.0f;
+    float y = v.y + 0.0f;
+    float z = v.z + 0.0f;
+    std::memcpy(&key.x, &x, sizeof(key.x));
+    std::memcpy(&key.y, &y, sizeof(key.y));
+    std::memcpy(&key.z, &z, sizeof(key.z));
+
+    auto res = this->indices.insert(std::make_pair(key, static_cast<uint32_t>(this->indices.size())));
+    isNew = res.second;
+    return res.first->second;
+}
+
+uint32_t VertexMap::GetSize() const
+{
+    return static_cast<uint32_t>(this->indices.size());
+}
+
+}
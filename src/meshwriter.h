@@ -0,0 +1,119 @@
+#ifndef _MESH_WRITER_H_
+#define _MESH_WRITER_H_
+
+#include "triangulator.h"
+#include "outputstream.h"
+#include "timer.h"
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+enum MeshFormat
+{
+    MESH_FORMAT_STL_BINARY,
+    MESH_FORMAT_STL_ASCII,
+    MESH_FORMAT_PLY,
+    MESH_FORMAT_OBJ,
+    MESH_FORMAT_COMPACT
+};
+
+// Accepts "stl", "ply", "obj" or "qmesh"; STL is binary unless asciiStl is set
+bool ParseMeshFormat(const std::string& name, bool asciiStl, MeshFormat& format);
+
+const char* GetMeshFormatName(MeshFormat format);
+
+const char* GetMeshFormatExtension(MeshFormat format);
+
+struct OutputOptions
+{
+    OutputOptions() : format(MESH_FORMAT_STL_BINARY), chunkSlices(0), chunkWorkers(0), mappedStl(false) {}
+    MeshFormat format;
+    StreamOptions stream;
+    // When positive the mesh is split into one file per this many slices
+    int chunkSlices;
+    // Slabs processed at once in the chunked mode, 0 picks half of the hardware threads
+    int chunkWorkers;
+    // Binary STL counted first and filled in place in a memory mapped file,
+    // slabs of chunkSlices slices are written in parallel instead of separate files
+    bool mappedStl;
+};
+
+// Sink for triangles produced by the triangulator
+class MeshWriter
+{
+public:
+    MeshWriter();
+    virtual ~MeshWriter();
+    virtual void Write(const Triangle& tri) = 0;
+    // Completes the output file, writers do it from the destructor if it was not called before
+    virtual void Close() = 0;
+
+    size_t GetTrianglesCount() const;
+    size_t GetVerticesCount() const;
+    unsigned long long GetBytesWritten() const;
+    // Milliseconds spent in file output
+    double GetWriteTime() const;
+    // Axis aligned box of the written triangles
+    const Vec3& GetBoundsMin() const;
+    const Vec3& GetBoundsMax() const;
+protected:
+    void WriteBlock(OutputStream& out, const char* data, size_t size);
+    // Closes a spool of CreateSpoolStream, passes it to out and removes it, counted as
+    // the decodedSize bytes written into it. Throws if the spool is not read back whole.
+    void CopySpool(OutputStream& out, OutputStream& spool, const std::string& spoolName, uint64_t decodedSize);
+    void AddToBounds(const Triangle& tri);
+protected:
+    size_t triCount;
+    size_t vertCount;
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+private:
+    MeshWriter(const MeshWriter&);
+    MeshWriter& operator=(const MeshWriter&);
+private:
+    unsigned long long bytesWritten;
+    double writeTime;
+    cpptask::Timer timer;
+};
+
+std::unique_ptr<MeshWriter> CreateMeshWriter(const std::string& fileName, const OutputOptions& options);
+
+// Index of shared vertices for the indexed formats
+class VertexMap
+{
+public:
+    // Returns the index of the vertex, isNew is set when it is seen for the first time
+    uint32_t Add(const Vec3& v, bool& isNew);
+    uint32_t GetSize() const;
+private:
+    struct Key
+    {
+        uint32_t x;
+        uint32_t y;
+        uint32_t z;
+        bool operator==(const Key& k) const
+        {
+            return x == k.x && y == k.y && z == k.z;
+        }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const
+        {
+            uint64_t h = k.x * 0x9E3779B97F4A7C15ull;
+            h ^= (h >> 29) ^ (k.y * 0xBF58476D1CE4E5B9ull);
+            h ^= (h >> 31) ^ (k.z * 0x94D049BB133111EBull);
+            return static_cast<size_t>(h ^ (h >> 32));
+        }
+    };
+    std::unordered_map<Key, uint32_t, KeyHash> indices;
+};
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "objwriter.h"
+#include "floatformat.h"
+
+namespace DicomToStl
+{
+
+namespace
+{
+const size_t TEXT_BUF_SIZE = 1 << 20;
+// "v " plus three numbers, or "f " plus three indices
+const size_t OBJ_LINE_MAX_LENGTH = 3 * (FLOAT_FORMAT_MAX_LENGTH + 1) + 3;
+
+size_t FormatIndex(uint32_t value, char* buffer)
+{
+    char digits[10];
+    size_t length = 0;
+    do
+    {
+        digits[length++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    while (value != 0);
+    for (size_t i = 0; i < length; ++i)
+    {
+        buffer[i] = digits[length - 1 - i];
+    }
+    return length;
+}
+}
+
+ObjWriter::ObjWriter(const std::string& fileName, const StreamOptions& options)
+    : out(CreateOutputStream(fileName, options))
+    , isClosed(false)
+{
+    text.reserve(TEXT_BUF_SIZE + 4 * OBJ_LINE_MAX_LENGTH);
+    text += "# DicomToStl\n";
+}
+
+ObjWriter::~ObjWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+}
+
+uint32_t ObjWriter::AddVertex(const Vec3& v)
+{
+    bool isNew = false;
+    uint32_t index = vertexMap.Add(v, isNew);
+    if (isNew)
+    {
+        char line[OBJ_LINE_MAX_LENGTH];
+        char* out = line;
+        *out++ = 'v';
+        *out++ = ' ';
+        out += FormatFloat(v.x, out);
+        *out++ = ' ';
+        out += FormatFloat(v.y, out);
+        *out++ = ' ';
+        out += FormatFloat(v.z, out);
+        *out++ = '\n';
+        text.append(line, out);
+        ++vertCount;
+    }
+    return index;
+}
+
+void ObjWriter::Write(const Triangle& tri)
+{
+    uint32_t indices[3] = {AddVertex(std::get<0>(tri)),
+                           AddVertex(std::get<1>(tri)),
+                           AddVertex(std::get<2>(tri))};
+    // Collapsed faces carry no surface
+    if (indices[0] != indices[1] && indices[1] != indices[2] && indices[0] != indices[2])
+    {
+        char line[OBJ_LINE_MAX_LENGTH];
+        char* out = line;
+        *out++ = 'f';
+        for (int i = 0; i < 3; ++i)
+        {
+            *out++ = ' ';
+            // OBJ indices are one based
+            out += FormatIndex(indices[i] + 1, out);
+        }
+        *out++ = '\n';
+        text.append(line, out);
+        AddToBounds(tri);
+        ++triCount;
+    }
+    if (text.size() >= TEXT_BUF_SIZE)
+    {
+        Flush();
+    }
+}
+
+void ObjWriter::Flush()
+{
+    if (!text.empty())
+    {
+        WriteBlock(*out, text.data(), text.size());
+        text.clear();
+    }
+}
+
+void ObjWriter::Close()
+{
+    if (this->isClosed)
+    {
+        return;
+    }
+    this->isClosed = true;
+    Flush();
+    out->Close();
+}
+
+}
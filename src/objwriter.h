@@ -0,0 +1,32 @@
+#ifndef _OBJ_WRITER_H_
+#define _OBJ_WRITER_H_
+
+#include "meshwriter.h"
+
+#include <string>
+
+namespace DicomToStl
+{
+
+// Wavefront OBJ, vertices are written right before the first face referencing them
+class ObjWriter : public MeshWriter
+{
+public:
+    ObjWriter(const std::string& fileName, const StreamOptions& options = StreamOptions());
+    virtual ~ObjWriter();
+    virtual void Write(const Triangle& tri);
+    virtual void Close();
+private:
+    ObjWriter(const ObjWriter&);
+    ObjWriter& operator=(const ObjWriter&);
+    uint32_t AddVertex(const Vec3& v);
+    void Flush();
+private:
+    std::unique_ptr<OutputStream> out;
+    bool isClosed;
+    VertexMap vertexMap;
+    std::string text;
+};
+
+}
+#endif
@@ -0,0 +1,111 @@
+#include "outputstream.h"
+#include "compressstream.h"
+#include "directstream.h"
+
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+bool ParseOutputCompression(const std::string& name, OutputCompression& compression)
+{
+    if (name == "none")
+    {
+        compression = OUTPUT_COMPRESSION_NONE;
+    }
+    else if (name == "gzip")
+    {
+        compression = OUTPUT_COMPRESSION_GZIP;
+    }
+    else if (name == "zstd")
+    {
+        compression = OUTPUT_COMPRESSION_ZSTD;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+const char* GetCompressionExtension(OutputCompression compression)
+{
+    switch (compression)
+    {
+    case OUTPUT_COMPRESSION_GZIP:
+        return ".gz";
+    case OUTPUT_COMPRESSION_ZSTD:
+        return ".zst";
+    default:
+        return "";
+    }
+}
+
+void OutputStream::WriteEncoded(const char* data, size_t size)
+{
+    Write(data, size);
+}
+
+FileOutputStream::FileOutputStream(const std::string& fileName)
+    : file(fileName.c_str(), std::ios::binary)
+    , bytesWritten(0)
+{
+    if (!file)
+    {
+        throw std::invalid_argument("Can't create output file");
+    }
+}
+
+FileOutputStream::~FileOutputStream()
+{
+}
+
+void FileOutputStream::Write(const char* data, size_t size)
+{
+    file.write(data, size);
+    bytesWritten += size;
+}
+
+void FileOutputStream::Close()
+{
+    file.close();
+    if (file.fail())
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+}
+
+uint64_t FileOutputStream::GetBytesWritten() const
+{
+    return bytesWritten;
+}
+
+std::unique_ptr<OutputStream> CreateOutputStream(const std::string& fileName, const StreamOptions& options)
+{
+    std::unique_ptr<OutputStream> file;
+#ifdef __linux__
+    if (options.directIo)
+    {
+        file.reset(new DirectOutputStream(fileName));
+    }
+#endif
+    if (!file)
+    {
+        file.reset(new FileOutputStream(fileName));
+    }
+
+    if (options.compression != OUTPUT_COMPRESSION_NONE)
+    {
+        return std::unique_ptr<OutputStream>(new CompressedOutputStream(std::move(file), options.compression, options.compressThreads));
+    }
+    return file;
+}
+
+std::unique_ptr<OutputStream> CreateSpoolStream(const std::string& fileName, const StreamOptions& options)
+{
+    StreamOptions spoolOptions = options;
+    spoolOptions.directIo = false;
+    return CreateOutputStream(fileName, spoolOptions);
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef _OUTPUT_STREAM_H_
+#define _OUTPUT_STREAM_H_
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+enum OutputCompression
+{
+    OUTPUT_COMPRESSION_NONE,
+    OUTPUT_COMPRESSION_GZIP,
+    OUTPUT_COMPRESSION_ZSTD
+};
+
+// Accepts "none", "gzip" or "zstd"
+bool ParseOutputCompression(const std::string& name, OutputCompression& compression);
+
+// File name suffix added for the compression, empty for none
+const char* GetCompressionExtension(OutputCompression compression);
+
+struct StreamOptions
+{
+    StreamOptions() : compression(OUTPUT_COMPRESSION_NONE), compressThreads(2), directIo(false) {}
+    OutputCompression compression;
+    // Workers compressing independent frames
+    int compressThreads;
+    // Asynchronous writes bypassing the page cache, Linux only
+    bool directIo;
+};
+
+// Destination of the final output bytes
+class OutputStream
+{
+public:
+    OutputStream() {}
+    virtual ~OutputStream() {}
+    virtual void Write(const char* data, size_t size) = 0;
+    // Bytes already encoded the way this stream encodes, such as a spool file of
+    // CreateSpoolStream, passed through as they are
+    virtual void WriteEncoded(const char* data, size_t size);
+    // Flushes everything to disk, throws if the output could not be completed
+    virtual void Close() = 0;
+    // Bytes handed to the file, the compressed ones behind a compression; all of
+    // them once closed
+    virtual uint64_t GetBytesWritten() const = 0;
+private:
+    OutputStream(const OutputStream&);
+    OutputStream& operator=(const OutputStream&);
+};
+
+class FileOutputStream : public OutputStream
+{
+public:
+    FileOutputStream(const std::string& fileName);
+    virtual ~FileOutputStream();
+    virtual void Write(const char* data, size_t size);
+    virtual void Close();
+    virtual uint64_t GetBytesWritten() const;
+private:
+    std::ofstream file;
+    uint64_t bytesWritten;
+};
+
+std::unique_ptr<OutputStream> CreateOutputStream(const std::string& fileName, const StreamOptions& options);
+
+// Temporary file a writer fills before its header is known and then passes to an
+// output of the same options with WriteEncoded. It is compressed like the output,
+// so the mesh reaches the disk compressed only, and never uses direct I/O.
+std::unique_ptr<OutputStream> CreateSpoolStream(const std::string& fileName, const StreamOptions& options);
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "perfcounters.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+double ToMs(uint64_t ns)
+{
+    return ns / 1e6;
+}
+
+// Units per second of thread time, 0 when nothing was timed
+double GetRate(uint64_t units, uint64_t ns)
+{
+    return ns > 0 ? units * 1e9 / ns : 0.;
+}
+}
+
+PerfCounters::PerfCounters()
+    : filesDecoded(0)
+    , bytesRead(0)
+    , decodeNs(0)
+    , cellsClassified(0)
+    , gridNs(0)
+    , activeCells(0)
+    , triangulateNs(0)
+    , trianglesEmitted(0)
+    , bytesWritten(0)
+    , writeNs(0)
+    , queueWaitNs(0)
+    , pairsDone(0)
+    , pairsToCount(0)
+    , pairsCounted(0)
+    , bytesStreamed(0)
+{
+}
+
+std::string GetPerfReport(const PerfCounters& counters, uint64_t wallNs)
+{
+    std::stringstream buf;
+    buf << std::fixed << std::setprecision(1) << std::left
+        << "Stage counters, times are summed over the threads of a stage\n"
+        << std::setw(20) << "  files decoded" << counters.filesDecoded << ", "
+        << GetRate(counters.filesDecoded, counters.decodeNs) << " per second\n"
+        << std::setw(20) << "  bytes read" << counters.bytesRead << ", "
+        << GetRate(counters.bytesRead, counters.decodeNs) / (1 << 20) << " MB per second\n"
+        << std::setw(20) << "  decode" << ToMs(counters.decodeNs) << " ms\n"
+        << std::setw(20) << "  cells classified" << counters.cellsClassified << ", "
+        << GetRate(counters.cellsClassified, counters.gridNs) / 1e6 << " M per second of grid\n"
+        << std::setw(20) << "  grid" << ToMs(counters.gridNs) << " ms\n"
+        << std::setw(20) << "  active cells" << counters.activeCells << ", "
+        << (counters.cellsClassified > 0 ? 100. * counters.activeCells / counters.cellsClassified : 0.) << " %\n"
+        << std::setw(20) << "  triangulate" << ToMs(counters.triangulateNs) << " ms\n"
+        << std::setw(20) << "  triangles emitted" << counters.trianglesEmitted << ", "
+        << GetRate(counters.trianglesEmitted, counters.triangulateNs) / 1e6 << " M per second\n"
+        << std::setw(20) << "  bytes written" << counters.bytesWritten << ", "
+        << GetRate(counters.bytesWritten, counters.writeNs) / (1 << 20) << " MB per second\n"
+        << std::setw(20) << "  write" << ToMs(counters.writeNs) << " ms\n"
+        << std::setw(20) << "  queue wait" << ToMs(counters.queueWaitNs) << " ms\n"
+        << std::setw(20) << "  wall" << ToMs(wallNs) << " ms";
+    return buf.str();
+}
+
+void WritePerfJson(const std::string& fileName, const PerfCounters& counters, uint64_t wallNs)
+{
+    std::ofstream file(fileName.c_str());
+    if (!file)
+    {
+        throw std::invalid_argument("Can't create stats file");
+    }
+    file << "{\n"
+         << "  \"files_decoded\": " << counters.filesDecoded << ",\n"
+         << "  \"bytes_read\": " << counters.bytesRead << ",\n"
+         << "  \"decode_ns\": " << counters.decodeNs << ",\n"
+         << "  \"cells_classified\": " << counters.cellsClassified << ",\n"
+         << "  \"grid_ns\": " << counters.gridNs << ",\n"
+         << "  \"active_cells\": " << counters.activeCells << ",\n"
+         << "  \"triangulate_ns\": " << counters.triangulateNs << ",\n"
+         << "  \"triangles_emitted\": " << counters.trianglesEmitted << ",\n"
+         << "  \"bytes_written\": " << counters.bytesWritten << ",\n"
+         << "  \"write_ns\": " << counters.writeNs << ",\n"
+         << "  \"queue_wait_ns\": " << counters.queueWaitNs << ",\n"
+         << "  \"wall_ns\": " << wallNs << "\n"
+         << "}\n";
+    file.close();
+    if (!file)
+    {
+        throw std::runtime_error("Can't write stats file");
+    }
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// Work done by the stages of one conversion, added to from the pipeline threads.
+// Times are thread time summed over the threads of a stage, so a stage whose
+// time is close to the wall time times its threads is the one limiting the run.
+struct PerfCounters
+{
+    PerfCounters();
+    std::atomic<uint64_t> filesDecoded;
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> decodeNs;
+    std::atomic<uint64_t> cellsClassified;
+    std::atomic<uint64_t> gridNs;
+    // Cells crossed by the surface, the others emit no triangle
+    std::atomic<uint64_t> activeCells;
+    // Includes handing the triangles to the writer
+    std::atomic<uint64_t> triangulateNs;
+    std::atomic<uint64_t> trianglesEmitted;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> writeNs;
+    // Time stages spent blocked on a full or an empty queue
+    std::atomic<uint64_t> queueWaitNs;
+    // Slice pairs through the triangulation, slabs taken from a checkpoint included
+    std::atomic<uint64_t> pairsDone;
+    // Slice pairs the mapped STL counts the triangles of before the conversion, and
+    // those counted so far
+    std::atomic<uint64_t> pairsToCount;
+    std::atomic<uint64_t> pairsCounted;
+    // Bytes of the writers still open, bytesWritten only gets them once closed
+    std::atomic<uint64_t> bytesStreamed;
+private:
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+};
+
+// Table of the counters with the rates following from them
+std::string GetPerfReport(const PerfCounters& counters, uint64_t wallNs);
+
+// The counters as one JSON object; throws std::invalid_argument if the file can't be created
+void WritePerfJson(const std::string& fileName, const PerfCounters& counters, uint64_t wallNs);
+
+}
+
+#endif
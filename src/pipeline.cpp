@@ -0,0 +1,341 @@
+#include "pipeline.h"
+
+#include <atomic>
+#include <sstream>
+#include <iomanip>
+
+namespace DicomToStl
+{
+
+namespace
+{
+double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Threads shared by all the ParallelFor calls, one less than the hardware
+// threads as the calling thread works too
+class WorkerPool
+{
+public:
+    static WorkerPool& Instance()
+    {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    ~WorkerPool()
+    {
+        this->tasks.Close();
+        std::for_each(this->threads.begin(), this->threads.end(), [](std::thread& t) { t.join(); });
+    }
+
+    size_t GetSize() const
+    {
+        return this->threads.size();
+    }
+
+    void Submit(const std::function<void (void)>& task)
+    {
+        this->tasks.Push(task);
+    }
+private:
+    WorkerPool()
+    {
+        this->tasks.SetName("worker tasks");
+        size_t count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        for (size_t i = 0; i < count; ++i)
+        {
+            this->threads.push_back(std::thread([this]()
+            {
+                std::function<void (void)> task;
+                // The pool outlives the traces, the name is given again for every one
+                SetTraceThreadName("worker");
+                while (this->tasks.Pop(task))
+                {
+                    SetTraceThreadName("worker");
+                    task();
+                }
+            }));
+        }
+    }
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+private:
+    BoundedQueue<std::function<void (void)> > tasks;
+    std::vector<std::thread> threads;
+};
+
+struct ParallelForState
+{
+    ParallelForState() : next(0), pending(0) {}
+    std::atomic<size_t> next;
+    size_t pending;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+};
+
+// Takes chunks until none is left; the state outlives the call for helpers
+// which start after the loop is over, they find no chunk and never touch body
+void RunChunks(const std::shared_ptr<ParallelForState>& state, size_t chunks, size_t first, size_t last, size_t grain,
+               const std::function<void (size_t)>* body)
+{
+    for (size_t chunk = state->next++; chunk < chunks; chunk = state->next++)
+    {
+        size_t begin = first + chunk * grain;
+        size_t end = std::min(begin + grain, last);
+        try
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                (*body)(i);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->error)
+            {
+                state->error = std::current_exception();
+            }
+        }
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (--state->pending == 0)
+        {
+            state->finished.notify_all();
+        }
+    }
+}
+}
+
+Pipeline::Pipeline()
+{
+}
+
+Pipeline::~Pipeline()
+{
+}
+
+void Pipeline::AddStage(const std::string& name, int threads, std::function<void (void)> body, std::function<void (void)> onDone)
+{
+    Stage stage;
+    stage.name = name;
+    stage.threads = std::max(threads, 1);
+    stage.running = 0;
+    stage.busyTime = 0;
+    stage.body = body;
+    stage.onDone = onDone;
+    this->stages.push_back(stage);
+}
+
+void Pipeline::Run()
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < this->stages.size(); ++i)
+    {
+        this->stages[i].running = this->stages[i].threads;
+        for (int t = 0; t < this->stages[i].threads; ++t)
+        {
+            threads.push_back(std::thread(&Pipeline::RunStageThread, this, i));
+        }
+    }
+    std::for_each(threads.begin(), threads.end(), [](std::thread& t) { t.join(); });
+
+    if (this->error)
+    {
+        std::rethrow_exception(this->error);
+    }
+}
+
+void Pipeline::RunStageThread(size_t index)
+{
+    Stage& stage = this->stages[index];
+    SetTraceThreadName(stage.name);
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        stage.body();
+    }
+    catch (...)
+    {
+        Abort(std::current_exception());
+    }
+
+    bool isLast = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        stage.busyTime += ElapsedMs(start);
+        isLast = --stage.running == 0;
+    }
+    if (isLast && stage.onDone)
+    {
+        stage.onDone();
+    }
+}
+
+void Pipeline::Abort(std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->error)
+        {
+            this->error = error;
+        }
+    }
+    std::for_each(this->queues.begin(), this->queues.end(), [](const Queue& q) { q.close(); });
+}
+
+std::string Pipeline::GetReport() const
+{
+    std::stringstream buf;
+    buf << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < this->stages.size(); ++i)
+    {
+        const Stage& stage = this->stages[i];
+        buf << "Stage " << stage.name << " : " << stage.threads << " threads, "
+            << stage.busyTime << " ms of thread time\n";
+    }
+    for (size_t i = 0; i < this->queues.size(); ++i)
+    {
+        QueueStats stats = this->queues[i].getStats();
+        buf << "Queue " << this->queues[i].name << " : " << stats.items << " items, depth max "
+            << stats.maxDepth << " mean " << (stats.items > 0 ? double(stats.depthSum) / stats.items : 0.0)
+            << ", producers stalled " << stats.pushWait << " ms, consumers stalled " << stats.popWait << " ms";
+        if (i + 1 < this->queues.size())
+        {
+            buf << "\n";
+        }
+    }
+    return buf.str();
+}
+
+double Pipeline::GetQueueWaitTime() const
+{
+    double waitTime = 0.;
+    for (size_t i = 0; i < this->queues.size(); ++i)
+    {
+        QueueStats stats = this->queues[i].getStats();
+        waitTime += stats.pushWait + stats.popWait;
+    }
+    return waitTime;
+}
+
+void ParallelFor(size_t first, size_t last, std::function<void (size_t)> body)
+{
+    if (first >= last)
+    {
+        return;
+    }
+    WorkerPool& pool = WorkerPool::Instance();
+    size_t count = last - first;
+    // A few chunks per thread even out the uneven cost of the indices
+    size_t grain = std::max<size_t>(1, count / ((pool.GetSize() + 1) * 4));
+    size_t chunks = (count + grain - 1) / grain;
+
+    std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+    state->pending = chunks;
+    size_t helpers = std::min(pool.GetSize(), chunks - 1);
+    for (size_t i = 0; i < helpers; ++i)
+    {
+        const std::function<void (size_t)>* bodyPtr = &body;
+        pool.Submit([state, chunks, first, last, grain, bodyPtr]()
+        {
+            RunChunks(state, chunks, first, last, grain, bodyPtr);
+        });
+    }
+    RunChunks(state, chunks, first, last, grain, &body);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->pending == 0; });
+    if (state->error)
+    {
+        std::rethrow_exception(state->error);
+    }
+}
+
+AsyncTask::AsyncTask()
+{
+}
+
+AsyncTask::~AsyncTask()
+{
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+}
+
+void AsyncTask::Run(std::function<void (void)> task)
+{
+    Wait();
+    this->thread = std::thread([this, task]()
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            this->error = std::current_exception();
+        }
+    });
+}
+
+void AsyncTask::Wait()
+{
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+    if (this->error)
+    {
+        std::exception_ptr error = this->error;
+        this->error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+Agent::Agent()
+{
+}
+
+Agent::~Agent()
+{
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+}
+
+void Agent::Start()
+{
+    this->thread = std::thread([this]()
+    {
+        try
+        {
+            Run();
+        }
+        catch (...)
+        {
+            this->error = std::current_exception();
+        }
+    });
+}
+
+void Agent::Wait()
+{
+    if (this->thread.joinable())
+    {
+        this->thread.join();
+    }
+    if (this->error)
+    {
+        std::exception_ptr error = this->error;
+        this->error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+}
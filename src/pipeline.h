@@ -0,0 +1,280 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "trace.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <limits>
+#include <algorithm>
+
+namespace DicomToStl
+{
+
+// Counters of a queue between the stages of a pipeline
+struct QueueStats
+{
+    QueueStats() : items(0), maxDepth(0), depthSum(0), pushWait(0), popWait(0) {}
+    size_t items;
+    size_t maxDepth;
+    // Sum of the depths seen by every push, for the mean depth
+    size_t depthSum;
+    // Milliseconds producers waited for room and consumers waited for an item
+    double pushWait;
+    double popWait;
+};
+
+// Blocking FIFO of limited capacity. Once closed, Push drops the value and
+// Pop fails as soon as the queue is drained.
+template<class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity = std::numeric_limits<size_t>::max())
+        : capacity(std::max<size_t>(capacity, 1))
+        , isClosed(false)
+        , pushWaitName("wait for room")
+        , popWaitName("wait for an item")
+    {
+    }
+
+    // Names the waits on the queue in a trace
+    void SetName(const std::string& name)
+    {
+        this->pushWaitName = "full " + name;
+        this->popWaitName = "empty " + name;
+    }
+
+    bool Push(const T& value)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->items.size() >= this->capacity && !this->isClosed)
+        {
+            TraceSpan span("queue", this->pushWaitName.c_str());
+            auto start = std::chrono::steady_clock::now();
+            this->notFull.wait(lock, [this]() { return this->items.size() < this->capacity || this->isClosed; });
+            this->stats.pushWait += ElapsedMs(start);
+        }
+        if (this->isClosed)
+        {
+            return false;
+        }
+        this->items.push_back(value);
+        ++this->stats.items;
+        this->stats.maxDepth = std::max(this->stats.maxDepth, this->items.size());
+        this->stats.depthSum += this->items.size();
+        this->notEmpty.notify_one();
+        return true;
+    }
+
+    bool Pop(T& value)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->items.empty() && !this->isClosed)
+        {
+            TraceSpan span("queue", this->popWaitName.c_str());
+            auto start = std::chrono::steady_clock::now();
+            this->notEmpty.wait(lock, [this]() { return !this->items.empty() || this->isClosed; });
+            this->stats.popWait += ElapsedMs(start);
+        }
+        if (this->items.empty())
+        {
+            return false;
+        }
+        value = this->items.front();
+        this->items.pop_front();
+        this->notFull.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->isClosed = true;
+        this->notEmpty.notify_all();
+        this->notFull.notify_all();
+    }
+
+    QueueStats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->stats;
+    }
+private:
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+
+    static double ElapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+private:
+    mutable std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+    size_t capacity;
+    bool isClosed;
+    QueueStats stats;
+    std::string pushWaitName;
+    std::string popWaitName;
+};
+
+// Fixed set of buffers passed between stages. Acquire blocks until a buffer
+// is released and returns nullptr once the pool is closed.
+template<class T>
+class BufferPool
+{
+public:
+    BufferPool(size_t count, std::function<void (T&)> init)
+        : freeBuffers(count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            this->buffers.push_back(std::unique_ptr<T>(new T()));
+            init(*this->buffers.back());
+            this->freeBuffers.Push(this->buffers.back().get());
+        }
+    }
+
+    T* Acquire()
+    {
+        T* buffer = nullptr;
+        return this->freeBuffers.Pop(buffer) ? buffer : nullptr;
+    }
+
+    void Release(T* buffer)
+    {
+        this->freeBuffers.Push(buffer);
+    }
+
+    void Close()
+    {
+        this->freeBuffers.Close();
+    }
+
+    void SetName(const std::string& name)
+    {
+        this->freeBuffers.SetName(name);
+    }
+
+    // popWait is the time spent waiting for a free buffer
+    QueueStats GetStats() const
+    {
+        return this->freeBuffers.GetStats();
+    }
+private:
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+private:
+    std::vector<std::unique_ptr<T> > buffers;
+    BoundedQueue<T*> freeBuffers;
+};
+
+// Stages of worker threads connected by queues. When the last thread of a stage
+// returns its onDone is called, which normally closes the queue the stage feeds.
+// If a stage throws, all the registered queues are closed so the other stages
+// drain, and Run rethrows the first error.
+class Pipeline
+{
+public:
+    Pipeline();
+    ~Pipeline();
+    void AddStage(const std::string& name, int threads, std::function<void (void)> body,
+                  std::function<void (void)> onDone = std::function<void (void)>());
+
+    template<class Q>
+    void AddQueue(const std::string& name, Q& queue)
+    {
+        Queue q;
+        q.name = name;
+        queue.SetName(name);
+        q.close = [&queue]() { queue.Close(); };
+        q.getStats = [&queue]() { return queue.GetStats(); };
+        this->queues.push_back(q);
+    }
+
+    void Run();
+    // One line per stage with its busy time and one per queue with its depth and stalls
+    std::string GetReport() const;
+    // Milliseconds producers and consumers were stalled on all the queues
+    double GetQueueWaitTime() const;
+private:
+    Pipeline(const Pipeline&);
+    Pipeline& operator=(const Pipeline&);
+    void RunStageThread(size_t stage);
+    void Abort(std::exception_ptr error);
+private:
+    struct Stage
+    {
+        std::string name;
+        int threads;
+        int running;
+        double busyTime;
+        std::function<void (void)> body;
+        std::function<void (void)> onDone;
+    };
+    struct Queue
+    {
+        std::string name;
+        std::function<void (void)> close;
+        std::function<QueueStats (void)> getStats;
+    };
+    std::vector<Stage> stages;
+    std::vector<Queue> queues;
+    std::mutex mutex;
+    std::exception_ptr error;
+};
+
+// Runs body for every index of [first, last) on the shared worker threads,
+// the calling thread takes part too, so nested calls do not deadlock
+void ParallelFor(size_t first, size_t last, std::function<void (size_t)> body);
+
+// A single background task at a time; Wait rethrows what the task has thrown
+class AsyncTask
+{
+public:
+    AsyncTask();
+    ~AsyncTask();
+    // Waits for the previous task first
+    void Run(std::function<void (void)> task);
+    void Wait();
+private:
+    AsyncTask(const AsyncTask&);
+    AsyncTask& operator=(const AsyncTask&);
+private:
+    std::thread thread;
+    std::exception_ptr error;
+};
+
+// Portable stand-in for the concurrency runtime agents: Run is executed on
+// a thread of its own between Start and Wait
+class Agent
+{
+public:
+    Agent();
+    virtual ~Agent();
+    void Start();
+    // Rethrows what Run has thrown
+    void Wait();
+protected:
+    virtual void Run() = 0;
+private:
+    Agent(const Agent&);
+    Agent& operator=(const Agent&);
+private:
+    std::thread thread;
+    std::exception_ptr error;
+};
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include "plywriter.h"
+
+#include <sstream>
+#include <cstring>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// vertex count byte and three indices
+const size_t PLY_FACE_SIZE = 13;
+const size_t FACES_BUF_SIZE = 1 << 20;
+}
+
+PlyWriter::PlyWriter(const std::string& fileName, const StreamOptions& options)
+    : fileName(fileName)
+    , out(CreateOutputStream(fileName, options))
+    , facesFile(CreateSpoolStream(fileName + "f", options))
+    , isClosed(false)
+{
+    faces.reserve(FACES_BUF_SIZE);
+}
+
+PlyWriter::~PlyWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+}
+
+uint32_t PlyWriter::AddVertex(const Vec3& v)
+{
+    bool isNew = false;
+    uint32_t index = vertexMap.Add(v, isNew);
+    if (isNew)
+    {
+        vertices.push_back(v);
+    }
+    return index;
+}
+
+void PlyWriter::Write(const Triangle& tri)
+{
+    uint32_t indices[3] = {AddVertex(std::get<0>(tri)),
+                           AddVertex(std::get<1>(tri)),
+                           AddVertex(std::get<2>(tri))};
+    // Collapsed faces carry no surface
+    if (indices[0] == indices[1] || indices[1] == indices[2] || indices[0] == indices[2])
+    {
+        return;
+    }
+
+    size_t pos = faces.size();
+    faces.resize(pos + PLY_FACE_SIZE);
+    faces[pos] = 3;
+    std::memcpy(&faces[pos + 1], indices, sizeof(indices));
+    if (faces.size() + PLY_FACE_SIZE > FACES_BUF_SIZE)
+    {
+        FlushFaces();
+    }
+    AddToBounds(tri);
+    ++triCount;
+}
+
+void PlyWriter::FlushFaces()
+{
+    if (!faces.empty())
+    {
+        facesFile->Write(faces.data(), faces.size());
+        faces.clear();
+    }
+}
+
+void PlyWriter::Close()
+{
+    if (this->isClosed)
+    {
+        return;
+    }
+    this->isClosed = true;
+
+    FlushFaces();
+    vertCount = vertices.size();
+
+    std::stringstream header;
+    header << "ply\n"
+           << "format binary_little_endian 1.0\n"
+           << "comment DicomToStl\n"
+           << "element vertex " << vertCount << "\n"
+           << "property float x\n"
+           << "property float y\n"
+           << "property float z\n"
+           << "element face " << triCount << "\n"
+           << "property list uchar int vertex_indices\n"
+           << "end_header\n";
+    std::string headerStr = header.str();
+    WriteBlock(*out, headerStr.data(), headerStr.size());
+    if (!vertices.empty())
+    {
+        WriteBlock(*out, reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vec3));
+    }
+    std::vector<Vec3>().swap(vertices);
+
+    CopySpool(*out, *facesFile, fileName + "f", this->triCount * PLY_FACE_SIZE);
+    out->Close();
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef _PLY_WRITER_H_
+#define _PLY_WRITER_H_
+
+#include "meshwriter.h"
+
+#include <string>
+#include <vector>
+
+namespace DicomToStl
+{
+
+// Binary little endian PLY with shared vertices. Vertices are kept in memory,
+// faces are spooled to a temporary file, compressed like the output, because the
+// header needs both counts.
+class PlyWriter : public MeshWriter
+{
+public:
+    PlyWriter(const std::string& fileName, const StreamOptions& options = StreamOptions());
+    virtual ~PlyWriter();
+    virtual void Write(const Triangle& tri);
+    virtual void Close();
+private:
+    PlyWriter(const PlyWriter&);
+    PlyWriter& operator=(const PlyWriter&);
+    uint32_t AddVertex(const Vec3& v);
+    void FlushFaces();
+private:
+    std::string fileName;
+    std::unique_ptr<OutputStream> out;
+    std::unique_ptr<OutputStream> facesFile;
+    bool isClosed;
+    VertexMap vertexMap;
+    std::vector<Vec3> vertices;
+    std::vector<char> faces;
+};
+
+}
+#endif
@@ -0,0 +1,313 @@
+#include "previewsource.h"
+#include "pipeline.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+namespace DicomToStl
+{
+
+namespace
+{
+const char* PREVIEW_CACHE_MAGIC = "dicomtostl-preview 1";
+
+// Whole blocks only, a partial one at the edge would sit off the even spacing.
+// A side shorter than a block still gives one.
+int GetReducedSize(int size, int factor)
+{
+    return std::max(1, size / factor);
+}
+
+// Rows of a block are folded into acc first, a loop over whole rows the compiler
+// vectorizes, then every factor columns of acc give one pixel
+template<class T, class Fold, class Finish>
+void ReduceRows(const std::vector<int>& pixels, int dx, int dy, int factor, std::vector<T>& acc, Fold fold,
+                Finish finish, std::vector<int>& reduced)
+{
+    int width = GetReducedSize(dx, factor);
+    int height = GetReducedSize(dy, factor);
+    reduced.resize(static_cast<size_t>(width) * height);
+    acc.resize(dx);
+    for (int by = 0; by < height; ++by)
+    {
+        int y0 = by * factor;
+        int y1 = std::min(y0 + factor, dy);
+        const int* row = &pixels[static_cast<size_t>(y0) * dx];
+        std::copy(row, row + dx, acc.begin());
+        for (int y = y0 + 1; y < y1; ++y)
+        {
+            row = &pixels[static_cast<size_t>(y) * dx];
+            for (int x = 0; x < dx; ++x)
+            {
+                acc[x] = fold(acc[x], static_cast<T>(row[x]));
+            }
+        }
+        for (int bx = 0; bx < width; ++bx)
+        {
+            int x0 = bx * factor;
+            int x1 = std::min(x0 + factor, dx);
+            T value = acc[x0];
+            for (int x = x0 + 1; x < x1; ++x)
+            {
+                value = fold(value, acc[x]);
+            }
+            reduced[static_cast<size_t>(by) * width + bx] = finish(value, (y1 - y0) * (x1 - x0));
+        }
+    }
+}
+
+void ReduceSlice(const std::vector<int>& pixels, int dx, int dy, int factor, PreviewFilter filter, std::vector<int>& reduced)
+{
+    if (filter == PREVIEW_FILTER_MAX)
+    {
+        std::vector<int> acc;
+        ReduceRows<int>(pixels, dx, dy, factor, acc, [](int a, int b) { return a > b ? a : b; },
+                        [](int value, int) { return value; }, reduced);
+    }
+    else
+    {
+        // Sums of 64 bits, large blocks of 16 bit pixels overflow an int
+        std::vector<int64_t> acc;
+        ReduceRows<int64_t>(pixels, dx, dy, factor, acc, [](int64_t a, int64_t b) { return a + b; },
+                            [](int64_t sum, int count) { return static_cast<int>(std::floor(static_cast<double>(sum) / count + 0.5)); },
+                            reduced);
+    }
+}
+}
+
+bool ParsePreviewFilter(const std::string& name, PreviewFilter& filter)
+{
+    if (name == "box")
+    {
+        filter = PREVIEW_FILTER_BOX;
+    }
+    else if (name == "max")
+    {
+        filter = PREVIEW_FILTER_MAX;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+const char* GetPreviewFilterName(PreviewFilter filter)
+{
+    return filter == PREVIEW_FILTER_MAX ? "max" : "box";
+}
+
+PreviewSliceSource::PreviewSliceSource(const SliceSource& source, int factor, PreviewFilter filter)
+    : source(source)
+    , factor(factor)
+    , filter(filter)
+{
+    if (factor < 1)
+    {
+        throw std::invalid_argument("Preview factor is less than 1");
+    }
+    this->width = GetReducedSize(source.GetWidth(), factor);
+    this->height = GetReducedSize(source.GetHeight(), factor);
+    int slicesCount = source.GetSlicesCount();
+    for (int i = 0; i < slicesCount; i += factor)
+    {
+        this->sourceSlices.push_back(i);
+    }
+    // The last slice is kept, the preview covers the whole series
+    if (slicesCount > 0 && this->sourceSlices.back() != slicesCount - 1)
+    {
+        this->sourceSlices.push_back(slicesCount - 1);
+    }
+    this->reduced.resize(this->sourceSlices.size());
+}
+
+int PreviewSliceSource::GetWidth() const
+{
+    return this->width;
+}
+
+int PreviewSliceSource::GetHeight() const
+{
+    return this->height;
+}
+
+Vec3 PreviewSliceSource::GetSpacing() const
+{
+    Vec3 spacing = this->source.GetSpacing();
+    spacing.x *= this->factor;
+    spacing.y *= this->factor;
+    if (this->sourceSlices.size() > 1)
+    {
+        spacing.z *= static_cast<float>(this->sourceSlices.back()) / (this->sourceSlices.size() - 1);
+    }
+    return spacing;
+}
+
+int PreviewSliceSource::GetSlicesCount() const
+{
+    return static_cast<int>(this->sourceSlices.size());
+}
+
+std::string PreviewSliceSource::GetSliceName(int index) const
+{
+    return this->source.GetSliceName(this->sourceSlices[index]);
+}
+
+bool PreviewSliceSource::ReadSlice(int index, std::vector<int>& buffer, std::string& error) const
+{
+    std::shared_ptr<const std::vector<int> > pixels;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        pixels = this->reduced[index];
+    }
+    if (!pixels)
+    {
+        // Two readers of the same slice may both reduce it, the pipeline rarely does
+        int sourceIndex = this->sourceSlices[index];
+        std::vector<int> full(static_cast<size_t>(this->source.GetWidth()) * this->source.GetHeight());
+        if (!this->source.ReadSlice(sourceIndex, full, error))
+        {
+            return false;
+        }
+        this->source.ReleaseSlice(sourceIndex);
+        std::shared_ptr<std::vector<int> > slice = std::make_shared<std::vector<int> >();
+        ReduceSlice(full, this->source.GetWidth(), this->source.GetHeight(), this->factor, this->filter, *slice);
+        pixels = slice;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->reduced[index] = pixels;
+    }
+    buffer.assign(pixels->begin(), pixels->end());
+    return true;
+}
+
+uint64_t PreviewSliceSource::GetSliceBytes(int index) const
+{
+    return this->source.GetSliceBytes(this->sourceSlices[index]);
+}
+
+SeriesGeometry PreviewSliceSource::GetGeometry() const
+{
+    SeriesGeometry geometry = this->source.GetGeometry();
+    // A reduced pixel stands for the centre of its block, half a block less a pixel
+    // along the row and down the column from the first pixel of the block
+    Vec3 spacing = this->source.GetSpacing();
+    Vec3 row = geometry.rowDirection;
+    Vec3 column = geometry.columnDirection;
+    VecNormalize(row);
+    VecNormalize(column);
+    float shift = 0.5f * (this->factor - 1);
+    Vec3 centre = row * (shift * spacing.x) + column * (shift * spacing.y);
+    std::vector<Vec3> positions;
+    positions.reserve(this->sourceSlices.size());
+    for (size_t i = 0; i < this->sourceSlices.size(); ++i)
+    {
+        positions.push_back(geometry.positions[this->sourceSlices[i]] + centre);
+    }
+    geometry.positions.swap(positions);
+    return geometry;
+}
+
+bool PreviewSliceSource::ReduceAll(std::string& error)
+{
+    std::vector<std::string> errors(this->sourceSlices.size());
+    ParallelFor(size_t(0), this->sourceSlices.size(), [&](size_t index)
+    {
+        std::vector<int> buffer;
+        ReadSlice(static_cast<int>(index), buffer, errors[index]);
+    });
+    auto failed = std::find_if(errors.begin(), errors.end(), [](const std::string& e) { return !e.empty(); });
+    if (failed != errors.end())
+    {
+        error = *failed;
+        return false;
+    }
+    return true;
+}
+
+std::string PreviewSliceSource::GetSignature() const
+{
+    std::stringstream buf;
+    int slicesCount = this->source.GetSlicesCount();
+    buf << this->source.GetWidth() << "x" << this->source.GetHeight() << " slices " << slicesCount
+        << " " << this->source.GetSliceName(0) << " " << this->source.GetSliceName(slicesCount - 1)
+        << " factor " << this->factor << " " << GetPreviewFilterName(this->filter);
+    return buf.str();
+}
+
+bool PreviewSliceSource::LoadCache(const std::string& fileName)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    std::string line;
+    int width = 0;
+    int height = 0;
+    size_t slicesCount = 0;
+    std::string key;
+    if (!std::getline(file, line) || line != PREVIEW_CACHE_MAGIC ||
+        !std::getline(file, line) || line != "series " + GetSignature() ||
+        !std::getline(file, line) || !(std::istringstream(line) >> key >> width >> height >> slicesCount) ||
+        width != this->width || height != this->height || slicesCount != this->sourceSlices.size())
+    {
+        return false;
+    }
+
+    std::vector<std::shared_ptr<const std::vector<int> > > loaded(slicesCount);
+    std::vector<int32_t> values(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < slicesCount; ++i)
+    {
+        if (!file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(int32_t)))
+        {
+            return false;
+        }
+        loaded[i] = std::make_shared<std::vector<int> >(values.begin(), values.end());
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->reduced.swap(loaded);
+    return true;
+}
+
+void PreviewSliceSource::SaveCache(const std::string& fileName)
+{
+    std::string error;
+    if (!ReduceAll(error))
+    {
+        throw std::runtime_error(error);
+    }
+    // Written aside and renamed, a reader never finds half a cache
+    std::string tempName = fileName + ".tmp";
+    {
+        std::ofstream file(tempName.c_str(), std::ios::binary);
+        if (!file)
+        {
+            throw std::invalid_argument("Can't create preview cache file");
+        }
+        file << PREVIEW_CACHE_MAGIC << "\n"
+             << "series " << GetSignature() << "\n"
+             << "size " << this->width << " " << this->height << " " << this->sourceSlices.size() << "\n";
+        std::vector<int32_t> values;
+        for (size_t i = 0; i < this->reduced.size(); ++i)
+        {
+            values.assign(this->reduced[i]->begin(), this->reduced[i]->end());
+            file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(int32_t));
+        }
+        file.close();
+        if (!file)
+        {
+            throw std::runtime_error("Can't write preview cache file");
+        }
+    }
+#ifdef _WIN32
+    std::remove(fileName.c_str());
+#endif
+    if (std::rename(tempName.c_str(), fileName.c_str()) != 0)
+    {
+        throw std::runtime_error("Can't write preview cache file");
+    }
+}
+
+}
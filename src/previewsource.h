@@ -0,0 +1,70 @@
+#ifndef _PREVIEW_SOURCE_H_
+#define _PREVIEW_SOURCE_H_
+
+#include "slicesource.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+namespace DicomToStl
+{
+
+enum PreviewFilter
+{
+    // Mean of the block, smooth surfaces at about the same level as the full mesh
+    PREVIEW_FILTER_BOX,
+    // Highest value of the block, keeps thin bright structures such as bone
+    PREVIEW_FILTER_MAX
+};
+
+// Accepts "box" or "max"
+bool ParsePreviewFilter(const std::string& name, PreviewFilter& filter);
+
+const char* GetPreviewFilterName(PreviewFilter filter);
+
+// Coarse copy of a series for tuning the isolevel: every factor-th slice, the last
+// one included, with every block of factor * factor pixels reduced to one at the
+// centre of the block. The pixels past the last whole block are left out. The
+// reduced slices are kept once read, so conversions at further levels decode nothing.
+class PreviewSliceSource : public SliceSource
+{
+public:
+    // Throws std::invalid_argument for a factor below 1
+    PreviewSliceSource(const SliceSource& source, int factor, PreviewFilter filter);
+    virtual int GetWidth() const;
+    virtual int GetHeight() const;
+    virtual Vec3 GetSpacing() const;
+    virtual int GetSlicesCount() const;
+    virtual std::string GetSliceName(int index) const;
+    virtual bool ReadSlice(int index, std::vector<int>& buffer, std::string& error) const;
+    virtual uint64_t GetSliceBytes(int index) const;
+    virtual SeriesGeometry GetGeometry() const;
+    // Reads and reduces the slices not kept yet on the shared workers, false with
+    // the error of the first slice which could not be read
+    bool ReduceAll(std::string& error);
+    // The reduced slices kept in a file, so further runs at other levels skip the
+    // decoding too. Load is false when the file is missing or holds another series.
+    bool LoadCache(const std::string& fileName);
+    // Throws std::invalid_argument if the file can't be created; reduces the slices first
+    void SaveCache(const std::string& fileName);
+private:
+    PreviewSliceSource(const PreviewSliceSource&);
+    PreviewSliceSource& operator=(const PreviewSliceSource&);
+    std::string GetSignature() const;
+private:
+    const SliceSource& source;
+    int factor;
+    PreviewFilter filter;
+    int width;
+    int height;
+    // Index in the source of every preview slice
+    std::vector<int> sourceSlices;
+    mutable std::vector<std::shared_ptr<const std::vector<int> > > reduced;
+    mutable std::mutex mutex;
+};
+
+}
+
+#endif
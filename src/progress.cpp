@@ -0,0 +1,167 @@
+#include "progress.h"
+#include "timer.h"
+
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// Weight of the newest sample in the smoothed rates
+const double RATE_SMOOTHING = 0.3;
+}
+
+std::string FormatProgressLine(const ProgressEvent& event)
+{
+    std::stringstream buf;
+    buf << std::fixed << std::setprecision(1)
+        << (event.isCounting ? "Counting " : "Progress ") << event.slicesDone << "/" << event.slicesTotal << " slices ("
+        << (event.slicesTotal > 0 ? 100. * event.slicesDone / event.slicesTotal : 0.) << " %), "
+        << event.slicesPerSecond << " slices/s, "
+        << event.trianglesPerSecond / 1e6 << " M triangles/s, "
+        << event.triangles << " triangles, "
+        << event.outputBytes / double(1 << 20) << " MB";
+    if (event.isFinished)
+    {
+        buf << ", finished in " << event.elapsedMs / 1000. << " s";
+    }
+    else if (event.etaMs >= 0.)
+    {
+        buf << ", ETA " << event.etaMs / 1000. << " s";
+    }
+    return buf.str();
+}
+
+std::string FormatProgressJson(const ProgressEvent& event)
+{
+    std::stringstream buf;
+    buf << std::fixed << std::setprecision(1)
+        << "{\"counting\": " << (event.isCounting ? "true" : "false")
+        << ", \"slicesDone\": " << event.slicesDone
+        << ", \"slicesTotal\": " << event.slicesTotal
+        << ", \"elapsedMs\": " << event.elapsedMs
+        << ", \"slicesPerSecond\": " << event.slicesPerSecond
+        << ", \"trianglesPerSecond\": " << event.trianglesPerSecond
+        << ", \"triangles\": " << event.triangles
+        << ", \"outputBytes\": " << event.outputBytes
+        << ", \"etaMs\": " << event.etaMs
+        << ", \"finished\": " << (event.isFinished ? "true" : "false") << "}";
+    return buf.str();
+}
+
+ProgressAgent::ProgressAgent(const PerfCounters& counters, int slicesTotal, int intervalMs, ProgressCallback callback)
+    : counters(counters)
+    , slicesTotal(slicesTotal)
+    , intervalMs(std::max(intervalMs, 1))
+    , callback(callback)
+    , isStopped(false)
+    , isJoined(false)
+    , isCounting(false)
+    , hasRate(false)
+    , lastMs(0.)
+    , lastPairs(0)
+    , lastTriangles(0)
+    , slicesRate(0.)
+    , trianglesRate(0.)
+{
+}
+
+ProgressAgent::~ProgressAgent()
+{
+    try
+    {
+        this->Stop();
+    }
+    catch (...)
+    {
+    }
+}
+
+void ProgressAgent::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->guard);
+        if (this->isJoined)
+        {
+            return;
+        }
+        this->isJoined = true;
+        this->isStopped = true;
+    }
+    this->stopped.notify_all();
+    this->Wait();
+}
+
+void ProgressAgent::Run()
+{
+    cpptask::Timer timer;
+    std::unique_lock<std::mutex> lock(this->guard);
+    while (!this->stopped.wait_for(lock, std::chrono::milliseconds(this->intervalMs), [this]() { return this->isStopped; }))
+    {
+        lock.unlock();
+        this->callback(Sample(timer.End(), false));
+        lock.lock();
+    }
+    lock.unlock();
+    this->callback(Sample(timer.End(), true));
+}
+
+ProgressEvent ProgressAgent::Sample(double elapsedMs, bool isFinished)
+{
+    int pairsTotal = std::max(this->slicesTotal - 1, 0);
+    // The mapped STL reads the series twice, the count pass goes first
+    bool isCounting = this->counters.pairsCounted < this->counters.pairsToCount;
+    uint64_t pairs = std::min<uint64_t>(isCounting ? this->counters.pairsCounted : this->counters.pairsDone, pairsTotal);
+    uint64_t triangles = this->counters.trianglesEmitted;
+    if (isCounting != this->isCounting)
+    {
+        // The conversion after the count pass starts from no pair at a rate of its own
+        this->isCounting = isCounting;
+        this->lastPairs = 0;
+        this->hasRate = false;
+    }
+
+    double seconds = (elapsedMs - this->lastMs) / 1000.;
+    if (seconds > 0.)
+    {
+        double slicesRate = (pairs - this->lastPairs) / seconds;
+        double trianglesRate = (triangles - this->lastTriangles) / seconds;
+        bool isFirst = !this->hasRate;
+        this->slicesRate = isFirst ? slicesRate : RATE_SMOOTHING * slicesRate + (1. - RATE_SMOOTHING) * this->slicesRate;
+        this->trianglesRate = isFirst ? trianglesRate : RATE_SMOOTHING * trianglesRate + (1. - RATE_SMOOTHING) * this->trianglesRate;
+        this->hasRate = true;
+    }
+    this->lastMs = elapsedMs;
+    this->lastPairs = pairs;
+    this->lastTriangles = triangles;
+
+    ProgressEvent event;
+    event.isCounting = isCounting;
+    event.slicesTotal = this->slicesTotal;
+    event.slicesDone = pairs == static_cast<uint64_t>(pairsTotal) && pairsTotal > 0 ? this->slicesTotal : static_cast<int>(pairs);
+    event.elapsedMs = elapsedMs;
+    event.slicesPerSecond = this->slicesRate;
+    event.trianglesPerSecond = this->trianglesRate;
+    event.triangles = triangles;
+    // Closed writers add their bytes at once, the open ones as they go
+    event.outputBytes = std::max<uint64_t>(this->counters.bytesWritten, this->counters.bytesStreamed);
+    event.isFinished = isFinished;
+    if (isFinished)
+    {
+        event.etaMs = 0.;
+    }
+    else if (this->slicesRate > 0.)
+    {
+        // The conversion after the count pass reads every slice again, it is taken
+        // to go at the counting rate until it has a rate of its own
+        uint64_t pairsLeft = (pairsTotal - pairs) + (isCounting ? pairsTotal : 0);
+        event.etaMs = pairsLeft / this->slicesRate * 1000.;
+    }
+    return event;
+}
+
+}
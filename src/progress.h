@@ -0,0 +1,87 @@
+#ifndef _PROGRESS_H_
+#define _PROGRESS_H_
+
+#include "pipeline.h"
+#include "perfcounters.h"
+
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// State of a running conversion. Rates are smoothed over the recent samples,
+// so the ETA follows the throughput the run actually gets.
+struct ProgressEvent
+{
+    ProgressEvent() : isCounting(false), slicesDone(0), slicesTotal(0), elapsedMs(0.), slicesPerSecond(0.),
+                      trianglesPerSecond(0.), triangles(0), outputBytes(0), etaMs(-1.), isFinished(false) {}
+    // Set while the mapped STL counts the triangles before the conversion, the
+    // slices and their rate are then those of the count pass
+    bool isCounting;
+    // A slice is done once the pair it starts went through the triangulation,
+    // the last slice with the last pair
+    int slicesDone;
+    int slicesTotal;
+    double elapsedMs;
+    double slicesPerSecond;
+    double trianglesPerSecond;
+    uint64_t triangles;
+    uint64_t outputBytes;
+    // Negative while there is no throughput to tell from
+    double etaMs;
+    // Set on the last event of the run
+    bool isFinished;
+};
+
+typedef std::function<void (const ProgressEvent&)> ProgressCallback;
+
+// One line such as "Progress 120/200 slices (60.0 %), 35.2 slices/s, ...", it
+// starts with "Counting" during the count pass
+std::string FormatProgressLine(const ProgressEvent& event);
+
+// The event as one JSON object on a single line
+std::string FormatProgressJson(const ProgressEvent& event);
+
+// Samples the counters of a run every interval and hands the events to the
+// callback from its own thread. The pipeline threads only add to the counters
+// they keep anyway, a slow callback never holds them up.
+class ProgressAgent : public Agent
+{
+public:
+    ProgressAgent(const PerfCounters& counters, int slicesTotal, int intervalMs, ProgressCallback callback);
+    virtual ~ProgressAgent();
+    // Sends the final event and waits for the thread, rethrows what the callback has thrown
+    void Stop();
+protected:
+    virtual void Run();
+private:
+    ProgressAgent(const ProgressAgent&);
+    ProgressAgent& operator=(const ProgressAgent&);
+    ProgressEvent Sample(double elapsedMs, bool isFinished);
+private:
+    const PerfCounters& counters;
+    int slicesTotal;
+    int intervalMs;
+    ProgressCallback callback;
+    std::mutex guard;
+    std::condition_variable stopped;
+    bool isStopped;
+    bool isJoined;
+    bool isCounting;
+    // Cleared when a pass starts, its first sample sets the rates as they are
+    bool hasRate;
+    // Previous sample the rates are taken from
+    double lastMs;
+    uint64_t lastPairs;
+    uint64_t lastTriangles;
+    double slicesRate;
+    double trianglesRate;
+};
+
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include "slabbuffer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace DicomToStl
+{
+
+namespace
+{
+// Three vertices, the normal is computed by the final writer
+const size_t SPOOL_TRIANGLE_SIZE = 3 * sizeof(Vec3);
+const size_t SPOOL_BLOCK_TRIANGLES = 1 << 15;
+}
+
+SlabBuffer::SlabBuffer(const std::string& spoolName, size_t memoryTriangles, MemoryGovernor& memory)
+    : spoolName(spoolName)
+    , memoryTriangles(std::max<size_t>(memoryTriangles, SPOOL_BLOCK_TRIANGLES))
+    , spooledTriangles(0)
+    , memory(memory)
+    , trackedBytes(0)
+    , isPersistent(false)
+{
+}
+
+SlabBuffer::~SlabBuffer()
+{
+    if (this->spool.is_open())
+    {
+        this->spool.close();
+    }
+    if (this->spooledTriangles > 0 && !this->isPersistent)
+    {
+        std::remove(this->spoolName.c_str());
+    }
+    this->memory.Track("slab buffers", -static_cast<int64_t>(this->trackedBytes));
+}
+
+void SlabBuffer::TrackCapacity()
+{
+    size_t bytes = this->triangles.capacity() * sizeof(Triangle);
+    this->memory.Track("slab buffers", static_cast<int64_t>(bytes) - static_cast<int64_t>(this->trackedBytes));
+    this->trackedBytes = bytes;
+}
+
+void SlabBuffer::Write(const Triangle& tri)
+{
+    if (this->triangles.size() == this->triangles.capacity())
+    {
+        this->triangles.reserve(std::min(std::max<size_t>(2 * this->triangles.size(), SPOOL_BLOCK_TRIANGLES), this->memoryTriangles));
+        TrackCapacity();
+    }
+    this->triangles.push_back(tri);
+    if (this->triangles.size() == this->memoryTriangles)
+    {
+        Spill();
+    }
+    AddToBounds(tri);
+    ++triCount;
+}
+
+void SlabBuffer::Spill()
+{
+    if (!this->spool.is_open())
+    {
+        this->spool.open(this->spoolName.c_str(), std::ios::binary);
+        if (!this->spool)
+        {
+            throw std::invalid_argument("Can't create output file");
+        }
+    }
+    std::vector<char> block;
+    block.reserve(SPOOL_BLOCK_TRIANGLES * SPOOL_TRIANGLE_SIZE);
+    for (size_t first = 0; first < this->triangles.size(); first += SPOOL_BLOCK_TRIANGLES)
+    {
+        size_t last = std::min(first + SPOOL_BLOCK_TRIANGLES, this->triangles.size());
+        block.resize((last - first) * SPOOL_TRIANGLE_SIZE);
+        char* out = block.data();
+        for (size_t i = first; i < last; ++i, out += SPOOL_TRIANGLE_SIZE)
+        {
+            std::memcpy(out, &std::get<0>(this->triangles[i]), sizeof(Vec3));
+            std::memcpy(out + sizeof(Vec3), &std::get<1>(this->triangles[i]), sizeof(Vec3));
+            std::memcpy(out + 2 * sizeof(Vec3), &std::get<2>(this->triangles[i]), sizeof(Vec3));
+        }
+        this->spool.write(block.data(), block.size());
+    }
+    if (!this->spool)
+    {
+        throw std::runtime_error("Can't write output file");
+    }
+    this->spooledTriangles += this->triangles.size();
+    this->triangles.clear();
+}
+
+void SlabBuffer::Close()
+{
+    if (this->isPersistent && !this->triangles.empty())
+    {
+        Spill();
+    }
+    if (this->spool.is_open())
+    {
+        this->spool.close();
+    }
+}
+
+void SlabBuffer::SetPersistent()
+{
+    this->isPersistent = true;
+}
+
+bool SlabBuffer::Restore(size_t triangles)
+{
+    if (triangles > 0)
+    {
+        std::ifstream in(this->spoolName.c_str(), std::ios::binary | std::ios::ate);
+        if (!in || static_cast<uint64_t>(in.tellg()) != triangles * SPOOL_TRIANGLE_SIZE)
+        {
+            return false;
+        }
+    }
+    this->isPersistent = true;
+    this->spooledTriangles = triangles;
+    this->triCount = triangles;
+    return true;
+}
+
+uint64_t SlabBuffer::GetSpoolBytes() const
+{
+    return static_cast<uint64_t>(this->spooledTriangles) * SPOOL_TRIANGLE_SIZE;
+}
+
+void SlabBuffer::Replay(MeshWriter& meshWriter)
+{
+    Close();
+    if (this->spooledTriangles > 0)
+    {
+        std::ifstream in(this->spoolName.c_str(), std::ios::binary);
+        std::vector<char> block(SPOOL_BLOCK_TRIANGLES * SPOOL_TRIANGLE_SIZE);
+        size_t left = this->spooledTriangles;
+        while (left > 0)
+        {
+            size_t count = std::min(left, SPOOL_BLOCK_TRIANGLES);
+            if (!in.read(block.data(), count * SPOOL_TRIANGLE_SIZE))
+            {
+                throw std::runtime_error("Can't read slab spool " + this->spoolName);
+            }
+            const char* data = block.data();
+            for (size_t i = 0; i < count; ++i, data += SPOOL_TRIANGLE_SIZE)
+            {
+                Triangle tri;
+                std::memcpy(&std::get<0>(tri), data, sizeof(Vec3));
+                std::memcpy(&std::get<1>(tri), data + sizeof(Vec3), sizeof(Vec3));
+                std::memcpy(&std::get<2>(tri), data + 2 * sizeof(Vec3), sizeof(Vec3));
+                meshWriter.Write(tri);
+            }
+            left -= count;
+        }
+        in.close();
+        if (!this->isPersistent)
+        {
+            std::remove(this->spoolName.c_str());
+        }
+        this->spooledTriangles = 0;
+    }
+    std::for_each(this->triangles.begin(), this->triangles.end(), [&](const Triangle& tri)
+    {
+        meshWriter.Write(tri);
+    });
+    Triangles().swap(this->triangles);
+    TrackCapacity();
+}
+
+}
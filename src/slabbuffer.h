@@ -0,0 +1,49 @@
+#ifndef _SLAB_BUFFER_H_
+#define _SLAB_BUFFER_H_
+
+#include "meshwriter.h"
+#include "memorygovernor.h"
+
+#include <string>
+#include <fstream>
+#include <vector>
+
+namespace DicomToStl
+{
+
+// Triangles of one slab held until the slabs before it have reached the output.
+// Up to memoryTriangles are kept in memory, the rest is spooled to a temporary file.
+// The memory held is accounted in the "slab buffers" pool of the governor.
+class SlabBuffer : public MeshWriter
+{
+public:
+    SlabBuffer(const std::string& spoolName, size_t memoryTriangles, MemoryGovernor& memory);
+    virtual ~SlabBuffer();
+    virtual void Write(const Triangle& tri);
+    virtual void Close();
+    // Spools every triangle on Close and keeps the spool after Replay, so the
+    // finished slab survives an interrupted run
+    void SetPersistent();
+    // Takes over the spool of a finished slab left by an earlier run, false if its size differs
+    bool Restore(size_t triangles);
+    uint64_t GetSpoolBytes() const;
+    // Passes every triangle to the writer in the order they came and drops the spool
+    void Replay(MeshWriter& meshWriter);
+private:
+    SlabBuffer(const SlabBuffer&);
+    SlabBuffer& operator=(const SlabBuffer&);
+    void Spill();
+    void TrackCapacity();
+private:
+    std::string spoolName;
+    std::ofstream spool;
+    size_t memoryTriangles;
+    size_t spooledTriangles;
+    Triangles triangles;
+    MemoryGovernor& memory;
+    size_t trackedBytes;
+    bool isPersistent;
+};
+
+}
+#endif
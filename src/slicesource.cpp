@@ -0,0 +1,341 @@
+#include "slicesource.h"
+
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmimgle/dcmimage.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmimage/diregist.h>
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+namespace DicomToStl
+{
+
+namespace
+{
+size_t GetPixelSize(PixelType pixelType)
+{
+    switch (pixelType)
+    {
+    case PIXEL_UINT8:
+    case PIXEL_INT8:
+        return 1;
+    case PIXEL_UINT16:
+    case PIXEL_INT16:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+template<class T>
+void CopyRow(const char* row, int width, int* out)
+{
+    const T* pixels = reinterpret_cast<const T*>(row);
+    std::copy(pixels, pixels + width, out);
+}
+
+void CopyFloatRow(const char* row, int width, int* out)
+{
+    const float* pixels = reinterpret_cast<const float*>(row);
+    std::transform(pixels, pixels + width, out, [](float value) { return static_cast<int>(std::floor(value + 0.5f)); });
+}
+}
+
+void SliceSource::ReleaseSlice(int) const
+{
+}
+
+uint64_t SliceSource::GetSliceBytes(int) const
+{
+    return 0;
+}
+
+SeriesGeometry SliceSource::GetGeometry() const
+{
+    SeriesGeometry geometry;
+    float spacingZ = GetSpacing().z;
+    for (int i = 0; i < GetSlicesCount(); ++i)
+    {
+        geometry.positions.push_back(Vec3(0, 0, i * spacingZ));
+    }
+    return geometry;
+}
+
+DcmSliceSource::DcmSliceSource(int dx, int dy, const Vec3& spacing, const SlicesPositions& slicesPositions,
+                               const Vec3& rowDirection, const Vec3& columnDirection)
+    : dx(dx)
+    , dy(dy)
+    , spacing(spacing)
+    , slicesPositions(slicesPositions)
+    , rowDirection(rowDirection)
+    , columnDirection(columnDirection)
+    , dropCache(false)
+{
+}
+
+int DcmSliceSource::GetWidth() const
+{
+    return this->dx;
+}
+
+int DcmSliceSource::GetHeight() const
+{
+    return this->dy;
+}
+
+Vec3 DcmSliceSource::GetSpacing() const
+{
+    return this->spacing;
+}
+
+int DcmSliceSource::GetSlicesCount() const
+{
+    return static_cast<int>(this->slicesPositions.size());
+}
+
+std::string DcmSliceSource::GetSliceName(int index) const
+{
+    return this->slicesPositions[index].first;
+}
+
+bool DcmSliceSource::ReadSlice(int index, std::vector<int>& buffer, std::string& error) const
+{
+    const string& fileName = this->slicesPositions[index].first;
+    DcmFileFormat fileformat;
+
+    OFCondition status = fileformat.loadFile(fileName.c_str(), EXS_Unknown,
+                                             EGL_withoutGL, DCM_MaxReadLength, ERM_autoDetect);
+    if (status.good())
+    {
+        DcmDataset *dataset = fileformat.getDataset();
+
+        std::shared_ptr<DicomImage> image(new DicomImage(&fileformat, dataset->getOriginalXfer()));
+        image->hideAllOverlays();
+
+        if (image->getStatus() == EIS_Normal)
+        {
+            if (!image->isMonochrome())
+            {
+                image.reset(image->createMonochromeImage());
+            }
+            image->setNoVoiTransformation();
+            const DiPixel* pixelData = image->getInterData();
+            if (pixelData->getRepresentation() == EPR_Uint16)
+            {
+                std::copy(static_cast<const unsigned short*>(pixelData->getData()),
+                         static_cast<const unsigned short*>(pixelData->getData()) + pixelData->getCount(),
+                         buffer.begin());
+            }
+            else if (pixelData->getRepresentation() == EPR_Sint16)
+            {
+                std::copy(static_cast<const short*>(pixelData->getData()),
+                         static_cast<const short*>(pixelData->getData()) + pixelData->getCount(),
+                         buffer.begin());
+            }
+            else if (pixelData->getRepresentation() == EPR_Uint8 || pixelData->getRepresentation() == EPR_MinUnsigned)
+            {
+                std::copy(static_cast<const unsigned char*>(pixelData->getData()),
+                         static_cast<const unsigned char*>(pixelData->getData()) + pixelData->getCount(),
+                         buffer.begin());
+            }
+            else if (pixelData->getRepresentation() == EPR_Sint8 || pixelData->getRepresentation() == EPR_MinSigned)
+            {
+                std::copy(static_cast<const char*>(pixelData->getData()),
+                         static_cast<const char*>(pixelData->getData()) + pixelData->getCount(),
+                         buffer.begin());
+            }
+            else
+            {
+                error = "File " + fileName + " have unsupported format";
+                return false;
+            }
+            return true;
+        }
+    }
+    error = "Can't read file " + fileName;
+    return false;
+}
+
+void DcmSliceSource::SetDropCache(bool dropCache)
+{
+    this->dropCache = dropCache;
+}
+
+// Input pages left in the page cache count against the memory of a container
+void DcmSliceSource::ReleaseSlice(int index) const
+{
+#ifdef __linux__
+    if (this->dropCache)
+    {
+        int fd = open(this->slicesPositions[index].first.c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+uint64_t DcmSliceSource::GetSliceBytes(int index) const
+{
+    struct stat info;
+    if (stat(this->slicesPositions[index].first.c_str(), &info) != 0)
+    {
+        return 0;
+    }
+    return static_cast<uint64_t>(info.st_size);
+}
+
+SeriesGeometry DcmSliceSource::GetGeometry() const
+{
+    SeriesGeometry geometry;
+    geometry.rowDirection = this->rowDirection;
+    geometry.columnDirection = this->columnDirection;
+    geometry.positions.reserve(this->slicesPositions.size());
+    std::for_each(this->slicesPositions.begin(), this->slicesPositions.end(),
+        [&](const std::pair<std::string, Vec3>& slice) { geometry.positions.push_back(slice.second); });
+    return geometry;
+}
+
+std::unique_ptr<DcmSliceSource> OpenDcmSeries(const std::vector<std::string>& files, OFLogger& logger)
+{
+    int dx(0);
+    int dy(0);
+    Vec3 spacing;
+    SlicesPositions slicesPositions;
+    Vec3 rowDirection;
+    Vec3 columnDirection;
+    ReadFormatDcmFiles(files, logger, dx, dy, spacing, slicesPositions, rowDirection, columnDirection);
+    return std::unique_ptr<DcmSliceSource>(new DcmSliceSource(dx, dy, spacing, slicesPositions, rowDirection, columnDirection));
+}
+
+MemorySliceSource::MemorySliceSource(const MemoryVolume& volume)
+    : volume(volume)
+{
+    if (volume.width < 2 || volume.height < 2 || volume.slices.empty())
+    {
+        throw std::invalid_argument("Empty volume");
+    }
+    size_t rowBytes = volume.width * GetPixelSize(volume.pixelType);
+    if (this->volume.rowStride == 0)
+    {
+        this->volume.rowStride = rowBytes;
+    }
+    if (this->volume.rowStride < rowBytes)
+    {
+        throw std::invalid_argument("Row stride is less than a row");
+    }
+    if (!volume.positions.empty())
+    {
+        if (volume.positions.size() != volume.slices.size())
+        {
+            throw std::invalid_argument("Positions do not match the slices");
+        }
+        if (volume.positions.size() > 1)
+        {
+            float sliceSpacing = VecLength(volume.positions.back() - volume.positions.front()) / (volume.positions.size() - 1);
+            this->volume.spacing.z = sliceSpacing > 0.f ? sliceSpacing : 1.f;
+        }
+    }
+}
+
+int MemorySliceSource::GetWidth() const
+{
+    return this->volume.width;
+}
+
+int MemorySliceSource::GetHeight() const
+{
+    return this->volume.height;
+}
+
+Vec3 MemorySliceSource::GetSpacing() const
+{
+    return this->volume.spacing;
+}
+
+int MemorySliceSource::GetSlicesCount() const
+{
+    return static_cast<int>(this->volume.slices.size());
+}
+
+std::string MemorySliceSource::GetSliceName(int index) const
+{
+    std::stringstream buf;
+    buf << "memory slice " << index;
+    return buf.str();
+}
+
+bool MemorySliceSource::ReadSlice(int index, std::vector<int>& buffer, std::string& error) const
+{
+    const char* row = static_cast<const char*>(this->volume.slices[index]);
+    if (row == nullptr)
+    {
+        error = "No pixels for the " + GetSliceName(index);
+        return false;
+    }
+    int width = this->volume.width;
+    for (int y = 0; y < this->volume.height; ++y, row += this->volume.rowStride)
+    {
+        int* out = buffer.data() + static_cast<size_t>(y) * width;
+        switch (this->volume.pixelType)
+        {
+        case PIXEL_UINT8:
+            CopyRow<uint8_t>(row, width, out);
+            break;
+        case PIXEL_INT8:
+            CopyRow<int8_t>(row, width, out);
+            break;
+        case PIXEL_UINT16:
+            CopyRow<uint16_t>(row, width, out);
+            break;
+        case PIXEL_INT16:
+            CopyRow<int16_t>(row, width, out);
+            break;
+        case PIXEL_INT32:
+            CopyRow<int32_t>(row, width, out);
+            break;
+        case PIXEL_FLOAT32:
+            CopyFloatRow(row, width, out);
+            break;
+        }
+    }
+    return true;
+}
+
+uint64_t MemorySliceSource::GetSliceBytes(int) const
+{
+    return static_cast<uint64_t>(this->volume.rowStride) * this->volume.height;
+}
+
+SeriesGeometry MemorySliceSource::GetGeometry() const
+{
+    if (this->volume.positions.empty())
+    {
+        return SliceSource::GetGeometry();
+    }
+    SeriesGeometry geometry;
+    geometry.rowDirection = this->volume.rowDirection;
+    geometry.columnDirection = this->volume.columnDirection;
+    geometry.positions = this->volume.positions;
+    return geometry;
+}
+
+}
@@ -0,0 +1,128 @@
+#ifndef _SLICE_SOURCE_H_
+#define _SLICE_SOURCE_H_
+
+#include "formatreader.h"
+#include "vec3.h"
+#include "gridframe.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+class OFLogger;
+
+namespace DicomToStl
+{
+
+// Images of a series in the z order. The pipeline reads slices from several
+// threads at once, so ReadSlice must be safe to call concurrently.
+class SliceSource
+{
+public:
+    virtual ~SliceSource() {}
+    virtual int GetWidth() const = 0;
+    virtual int GetHeight() const = 0;
+    virtual Vec3 GetSpacing() const = 0;
+    virtual int GetSlicesCount() const = 0;
+    // Name of the slice in messages and checkpoints
+    virtual std::string GetSliceName(int index) const = 0;
+    // Copies the width * height pixels of the slice into buffer, on failure error tells why
+    virtual bool ReadSlice(int index, std::vector<int>& buffer, std::string& error) const = 0;
+    // Called once a slice is decoded, a source may drop what it caches of it
+    virtual void ReleaseSlice(int index) const;
+    // Stored size of the slice for the read counters, 0 when unknown
+    virtual uint64_t GetSliceBytes(int index) const;
+    // Position of every slice and orientation of the images. By default the slices
+    // are spacing.z apart along z with the rows along x, the first one at the origin.
+    virtual SeriesGeometry GetGeometry() const;
+};
+
+// DICOM files sorted by ReadFormatDcmFiles, one slice per file
+class DcmSliceSource : public SliceSource
+{
+public:
+    // The directions are the ImageOrientationPatient of the files
+    DcmSliceSource(int dx, int dy, const Vec3& spacing, const SlicesPositions& slicesPositions,
+                   const Vec3& rowDirection = Vec3(1, 0, 0), const Vec3& columnDirection = Vec3(0, 1, 0));
+    virtual int GetWidth() const;
+    virtual int GetHeight() const;
+    virtual Vec3 GetSpacing() const;
+    virtual int GetSlicesCount() const;
+    virtual std::string GetSliceName(int index) const;
+    virtual bool ReadSlice(int index, std::vector<int>& buffer, std::string& error) const;
+    // With dropCache the file is evicted from the page cache once decoded
+    void SetDropCache(bool dropCache);
+    virtual void ReleaseSlice(int index) const;
+    virtual uint64_t GetSliceBytes(int index) const;
+    virtual SeriesGeometry GetGeometry() const;
+private:
+    DcmSliceSource(const DcmSliceSource&);
+    DcmSliceSource& operator=(const DcmSliceSource&);
+private:
+    int dx;
+    int dy;
+    Vec3 spacing;
+    SlicesPositions slicesPositions;
+    Vec3 rowDirection;
+    Vec3 columnDirection;
+    bool dropCache;
+};
+
+// Reads the format of the DICOM files and sorts them along the series axis
+std::unique_ptr<DcmSliceSource> OpenDcmSeries(const std::vector<std::string>& files, OFLogger& logger);
+
+enum PixelType
+{
+    PIXEL_UINT8,
+    PIXEL_INT8,
+    PIXEL_UINT16,
+    PIXEL_INT16,
+    PIXEL_INT32,
+    PIXEL_FLOAT32
+};
+
+// Series held by the caller, one pointer per slice in the z order. The memory
+// has to stay valid until the conversion is over, nothing is copied up front.
+struct MemoryVolume
+{
+    MemoryVolume() : width(0), height(0), pixelType(PIXEL_INT16), rowStride(0), rowDirection(1, 0, 0), columnDirection(0, 1, 0) {}
+    int width;
+    int height;
+    PixelType pixelType;
+    // Bytes from one row to the next, 0 for rows packed one after another
+    size_t rowStride;
+    Vec3 spacing;
+    std::vector<const void*> slices;
+    // Position of every slice, optional; when given the z spacing follows from them
+    // and the mesh is placed at them, turned by the row and column directions
+    std::vector<Vec3> positions;
+    Vec3 rowDirection;
+    Vec3 columnDirection;
+};
+
+// Pixels of a MemoryVolume converted to the pipeline values, floats are rounded
+class MemorySliceSource : public SliceSource
+{
+public:
+    // Throws std::invalid_argument for an empty or inconsistent volume
+    explicit MemorySliceSource(const MemoryVolume& volume);
+    virtual int GetWidth() const;
+    virtual int GetHeight() const;
+    virtual Vec3 GetSpacing() const;
+    virtual int GetSlicesCount() const;
+    virtual std::string GetSliceName(int index) const;
+    virtual bool ReadSlice(int index, std::vector<int>& buffer, std::string& error) const;
+    virtual uint64_t GetSliceBytes(int index) const;
+    virtual SeriesGeometry GetGeometry() const;
+private:
+    MemorySliceSource(const MemorySliceSource&);
+    MemorySliceSource& operator=(const MemorySliceSource&);
+private:
+    MemoryVolume volume;
+};
+
+}
+
+#endif
@@ -1,9 +1,9 @@
 #include "stlwriter.h"
+#include "floatformat.h"
 
-#include <windows.h>
-
-#include <fstream>
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 namespace DicomToStl
 {
@@ -18,97 +18,224 @@ Vec3 MakeNormal(const Triangle& t)
     VecNormalize(n);
     return n;
 }
+
+const size_t RECORDS_BUF_SIZE = 1 << 20;
+
+const size_t ASCII_BATCH_SIZE = 1 << 16;
+const size_t ASCII_BLOCK_SIZE = 1 << 12;
+// Upper bound of one facet: four lines of three numbers plus the keywords
+const size_t ASCII_FACET_MAX_LENGTH = 12 * (FLOAT_FORMAT_MAX_LENGTH + 1) + 100;
+
+template<size_t N>
+char* AppendLiteral(char* out, const char (&literal)[N])
+{
+    std::copy(literal, literal + N - 1, out);
+    return out + N - 1;
 }
 
-StlWriter::StlWriter(const std::string& fileName, bool binary)
-    : fileName(fileName)
-    , isBinary(binary)
-    , triCount(0)
+char* AppendVec3(char* out, const Vec3& v)
 {
-    if (!file)
+    out += FormatFloat(v.x, out);
+    *out++ = ' ';
+    out += FormatFloat(v.y, out);
+    *out++ = ' ';
+    out += FormatFloat(v.z, out);
+    *out++ = '\n';
+    return out;
+}
+
+void FormatAsciiBlock(const Triangle* tris, size_t count, std::string& block)
+{
+    block.resize(count * ASCII_FACET_MAX_LENGTH);
+    char* begin = &block[0];
+    char* out = begin;
+    for (size_t i = 0; i < count; ++i)
     {
-        throw std::invalid_argument("Can't create output file");
+        const Triangle& tri = tris[i];
+        out = AppendLiteral(out, "facet normal ");
+        out = AppendVec3(out, MakeNormal(tri));
+        out = AppendLiteral(out, "outer loop\n");
+        out = AppendLiteral(out, "vertex ");
+        out = AppendVec3(out, std::get<0>(tri));
+        out = AppendLiteral(out, "vertex ");
+        out = AppendVec3(out, std::get<1>(tri));
+        out = AppendLiteral(out, "vertex ");
+        out = AppendVec3(out, std::get<2>(tri));
+        out = AppendLiteral(out, "endloop\nendfacet\n");
     }
+    block.resize(out - begin);
+}
+}
+
+void MakeStlRecord(const Triangle& tri, char* record)
+{
+    Vec3 n = MakeNormal(tri);
+    std::memcpy(record, &n, sizeof(Vec3));
+    std::memcpy(record + 12, &std::get<0>(tri), sizeof(Vec3));
+    std::memcpy(record + 24, &std::get<1>(tri), sizeof(Vec3));
+    std::memcpy(record + 36, &std::get<2>(tri), sizeof(Vec3));
+    record[48] = 0;
+    record[49] = 0;
+}
+
+StlWriter::StlWriter(const std::string& fileName, bool binary, const StreamOptions& options)
+    : fileName(fileName)
+    , out(CreateOutputStream(fileName, options))
+    , isBinary(binary)
+    , isClosed(false)
+{
     if (!this->isBinary)
     {
-        file.open(fileName.c_str());
-        file << "solid\n";
+        asciiBatch.reserve(ASCII_BATCH_SIZE);
+        const char solid[] = "solid\n";
+        WriteBlock(*out, solid, sizeof(solid) - 1);
     }
     else
     {
-        file.open((fileName + "b").c_str(), std::ios::binary);
+        spool = CreateSpoolStream(fileName + "b", options);
+        records.reserve(RECORDS_BUF_SIZE);
     }
 }
 
 StlWriter::~StlWriter()
 {
-    file.flush();
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void StlWriter::Close()
+{
+    if (this->isClosed)
+    {
+        return;
+    }
+    this->isClosed = true;
+
     if (!this->isBinary)
     {
-        file << "endsolid\n";
+        if (!asciiBatch.empty())
+        {
+            FlushAsciiBatch();
+        }
+        writeTask.Wait();
+        const char endsolid[] = "endsolid\n";
+        WriteBlock(*out, endsolid, sizeof(endsolid) - 1);
+        out->Close();
     }
     else
     {
-        file.close();
-        file.open(fileName.c_str(), std::ios::binary);
+        FlushRecords();
         char header[80] = {0};
-        file.write(header, sizeof(header));
-        file.write(reinterpret_cast<char*>(&this->triCount), sizeof(this->triCount));
+        WriteBlock(*out, header, sizeof(header));
+        uint32_t count = static_cast<uint32_t>(this->triCount);
+        WriteBlock(*out, reinterpret_cast<const char*>(&count), sizeof(count));
 
-        {
-            std::ifstream triFile((fileName + "b").c_str(), std::ios::binary);
-            const size_t COPY_BUF_SIZE = 1024;
-            std::vector<char> buffer(COPY_BUF_SIZE);
-
-            while (triFile.read(buffer.data(), COPY_BUF_SIZE))
-            {
-                file.write(buffer.data(), triFile.gcount());
-            }
-            if (triFile.gcount() > 0)
-            {
-                file.write(buffer.data(), triFile.gcount());
-            }
-        }
-        file.close();
-        DeleteFile((fileName + "b").c_str());
+        CopySpool(*out, *spool, fileName + "b", this->triCount * STL_RECORD_SIZE);
+        out->Close();
     }
 }
 
 void StlWriter::Write(const Triangle& tri)
 {
-    Vec3 n = MakeNormal(tri);
     if (!this->isBinary)
     {
-        file << "facet normal " << n.x << " " << n.y << " " << n.z << "\n";
-        file << "outer loop\n";
-        file << "Vector " << std::get<0>(tri).x << " " << std::get<0>(tri).y << " " << std::get<0>(tri).z << "\n";
-        file << "Vector " << std::get<1>(tri).x << " " << std::get<1>(tri).y << " " << std::get<1>(tri).z << "\n";
-        file << "Vector " << std::get<2>(tri).x << " " << std::get<2>(tri).y << " " << std::get<2>(tri).z << "\n";
-        file << "endloop\n";
-        file << "endfacet\n";
+        asciiBatch.push_back(tri);
+        if (asciiBatch.size() == ASCII_BATCH_SIZE)
+        {
+            FlushAsciiBatch();
+        }
     }
     else
     {
-        file.write(reinterpret_cast<char*>(&n.x), sizeof(n.x));
-        file.write(reinterpret_cast<char*>(&n.y), sizeof(n.y));
-        file.write(reinterpret_cast<char*>(&n.z), sizeof(n.z));
+        size_t pos = records.size();
+        records.resize(pos + STL_RECORD_SIZE);
+        MakeStlRecord(tri, &records[pos]);
+        if (records.size() + STL_RECORD_SIZE > RECORDS_BUF_SIZE)
+        {
+            FlushRecords();
+        }
+    }
+    AddToBounds(tri);
+    ++triCount;
+}
 
-        file.write(reinterpret_cast<const char*>(&std::get<0>(tri).x), sizeof(std::get<0>(tri).x));
-        file.write(reinterpret_cast<const char*>(&std::get<0>(tri).y), sizeof(std::get<0>(tri).y));
-        file.write(reinterpret_cast<const char*>(&std::get<0>(tri).z), sizeof(std::get<0>(tri).z));
+void StlWriter::FlushRecords()
+{
+    if (!records.empty())
+    {
+        // The spool file is an intermediate, only the final file counts as output
+        spool->Write(records.data(), records.size());
+        records.clear();
+    }
+}
+
+void StlWriter::FlushAsciiBatch()
+{
+    size_t blocksCount = (asciiBatch.size() + ASCII_BLOCK_SIZE - 1) / ASCII_BLOCK_SIZE;
+    std::vector<std::string> blocks(blocksCount);
+    ParallelFor(size_t(0), blocksCount,
+        [&](size_t index)
+    {
+        size_t first = index * ASCII_BLOCK_SIZE;
+        size_t count = std::min(ASCII_BLOCK_SIZE, asciiBatch.size() - first);
+        FormatAsciiBlock(&asciiBatch[first], count, blocks[index]);
+    });
+    asciiBatch.clear();
+
+    // The previous batch has to reach the file first to keep facets in order
+    writeTask.Wait();
+    writtenBlocks.swap(blocks);
+    writeTask.Run([this]()
+    {
+        std::for_each(writtenBlocks.begin(), writtenBlocks.end(),
+            [&](const std::string& block)
+        {
+            WriteBlock(*out, block.data(), block.size());
+        });
+    });
+}
 
-        file.write(reinterpret_cast<const char*>(&std::get<1>(tri).x), sizeof(std::get<1>(tri).x));
-        file.write(reinterpret_cast<const char*>(&std::get<1>(tri).y), sizeof(std::get<1>(tri).y));
-        file.write(reinterpret_cast<const char*>(&std::get<1>(tri).z), sizeof(std::get<1>(tri).z));
+MappedStlWriter::MappedStlWriter(char* records, size_t capacity)
+    : records(records)
+    , capacity(capacity)
+{
+}
 
-        file.write(reinterpret_cast<const char*>(&std::get<2>(tri).x), sizeof(std::get<2>(tri).x));
-        file.write(reinterpret_cast<const char*>(&std::get<2>(tri).y), sizeof(std::get<2>(tri).y));
-        file.write(reinterpret_cast<const char*>(&std::get<2>(tri).z), sizeof(std::get<2>(tri).z));
+MappedStlWriter::~MappedStlWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+}
 
-        unsigned short abc(0);
-        file.write(reinterpret_cast<char*>(&abc), sizeof(abc));
+void MappedStlWriter::Write(const Triangle& tri)
+{
+    if (this->triCount == this->capacity)
+    {
+        throw std::length_error("More triangles than counted for the slab");
     }
+    MakeStlRecord(tri, this->records + this->triCount * STL_RECORD_SIZE);
+    AddToBounds(tri);
     ++triCount;
 }
 
+void MappedStlWriter::Close()
+{
+    if (this->triCount < this->capacity)
+    {
+        std::fill(this->records + this->triCount * STL_RECORD_SIZE,
+                  this->records + this->capacity * STL_RECORD_SIZE, 0);
+        this->capacity = this->triCount;
+    }
+}
+
 }
@@ -1,28 +1,69 @@
 #ifndef _STL_WRITER_H_
 #define _STL_WRITER_H_
 
-#include "triangulator.h"
+#include "meshwriter.h"
+#include "pipeline.h"
 
 #include <string>
-#include <fstream>
+#include <vector>
 
 namespace DicomToStl
 {
 
-class StlWriter 
+// normal, three vertices and the attribute byte count
+const size_t STL_RECORD_SIZE = 50;
+// 80 byte header and the triangles count
+const size_t STL_HEADER_SIZE = 84;
+
+// Fills one binary STL facet record
+void MakeStlRecord(const Triangle& tri, char* record);
+
+class StlWriter : public MeshWriter
 {
 public:
-    StlWriter(const std::string& fileName, bool binary = false);
+    StlWriter(const std::string& fileName, bool binary = false, const StreamOptions& options = StreamOptions());
     virtual ~StlWriter();
     virtual void Write(const Triangle& tri);
+    virtual void Close();
 private:
     StlWriter(const StlWriter&);
     StlWriter& operator=(const StlWriter&);
+    void FlushAsciiBatch();
+    void FlushRecords();
 private:
     std::string fileName;
-    std::ofstream file;
+    std::unique_ptr<OutputStream> out;
+    // Binary facets are spooled, compressed like the output, until the count for
+    // the header is known
+    std::unique_ptr<OutputStream> spool;
     bool isBinary;
-    size_t triCount;
+    bool isClosed;
+    // Binary output: 50 byte facet records spooled in large blocks
+    std::vector<char> records;
+    // ASCII output: triangles are collected in batches, formatted into text blocks
+    // in parallel and written in order while the next batch is being formatted
+    Triangles asciiBatch;
+    std::vector<std::string> writtenBlocks;
+    AsyncTask writeTask;
+};
+
+// Writes binary STL facet records into a range of a file mapped in memory,
+// the range is sized beforehand for exactly the triangles of one slab
+class MappedStlWriter : public MeshWriter
+{
+public:
+    MappedStlWriter(char* records, size_t capacity);
+    virtual ~MappedStlWriter();
+    // Throws std::length_error if the range is full
+    virtual void Write(const Triangle& tri);
+    // Zero fills the records left unused, so the file stays valid
+    virtual void Close();
+private:
+    MappedStlWriter(const MappedStlWriter&);
+    MappedStlWriter& operator=(const MappedStlWriter&);
+private:
+    char* records;
+    size_t capacity;
 };
 
 }
@@ -28,52 +28,41 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
-#include <windows.h>
+#include <chrono>
+#include <cstdint>
 
 namespace cpptask
 {
+// Monotonic interval timer, safe to use from any thread. steady_clock is
+// QueryPerformanceCounter on Windows and CLOCK_MONOTONIC elsewhere, so the
+// thread is no longer pinned to one CPU around every reading.
 class Timer
 {
 public:
     Timer()
+        : startTime(std::chrono::steady_clock::now())
     {
-         threadHandle = ::GetCurrentThread();
-        ::GetProcessAffinityMask(GetCurrentProcess(), &processAffinityMask, &systemMask);
-        ::SetThreadAffinityMask(threadHandle, 1);
-        ::QueryPerformanceFrequency(&frequency);
-        ::SetThreadAffinityMask(threadHandle, processAffinityMask);
     }
     void Start()
     {
-        ::SetThreadAffinityMask(threadHandle, 1);
-        ::QueryPerformanceCounter(&startTime);
-        ::SetThreadAffinityMask(threadHandle, processAffinityMask);
+        startTime = std::chrono::steady_clock::now();
     }
-    double End()
+    // Milliseconds since Start
+    double End() const
     {
-        ::SetThreadAffinityMask(threadHandle, 1);
-        ::QueryPerformanceCounter(&endTime);
-        ::SetThreadAffinityMask(threadHandle, processAffinityMask);
-
-         __int64 elapsedTime = endTime.QuadPart - startTime.QuadPart;
-        double const mseconds = double(elapsedTime) / (double(frequency.QuadPart) / 1000.0);
-        return mseconds;
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    }
+    // Nanoseconds since Start, for the counters summed over many short intervals
+    uint64_t EndNs() const
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count());
     }
 private:
     Timer(const Timer&);
     const Timer& operator=(const Timer&);
 private:
-    LARGE_INTEGER startTime;
-    LARGE_INTEGER endTime;
-	LARGE_INTEGER frequency;
-    void* threadHandle;
-#if defined(_WIN64)
-    unsigned __int64 processAffinityMask;
-#else
-    unsigned long processAffinityMask;
-#endif
-    DWORD_PTR systemMask;
+    std::chrono::steady_clock::time_point startTime;
 };
 }
 
-#endif
\ No newline at end of file
+#endif
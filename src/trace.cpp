@@ -0,0 +1,185 @@
+#include "trace.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+namespace DicomToStl
+{
+
+std::atomic<bool> traceEnabled(false);
+
+namespace
+{
+// Longest span name kept, longer ones are cut
+const size_t TRACE_NAME_SIZE = 40;
+// Spans a thread buffer takes before it grows
+const size_t TRACE_THREAD_RESERVE = 4096;
+
+struct TraceEvent
+{
+    char name[TRACE_NAME_SIZE];
+    const char* category;
+    const char* argName;
+    int64_t arg;
+    uint64_t startNs;
+    uint64_t durationNs;
+};
+
+// Spans of one thread, only that thread appends to them
+struct ThreadTrace
+{
+    unsigned id;
+    std::string name;
+    std::vector<TraceEvent> events;
+};
+
+// Buffers of all the threads which recorded a span since StartTrace
+struct TraceState
+{
+    TraceState() : generation(0), startNs(0) {}
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadTrace> > threads;
+    std::atomic<unsigned> generation;
+    uint64_t startNs;
+};
+
+TraceState& GetTraceState()
+{
+    static TraceState state;
+    return state;
+}
+
+thread_local std::shared_ptr<ThreadTrace> threadTrace;
+thread_local unsigned threadGeneration = 0;
+
+// Buffer of the calling thread, registered with the running trace on first use
+ThreadTrace& GetThreadTrace()
+{
+    TraceState& state = GetTraceState();
+    unsigned generation = state.generation.load();
+    if (!threadTrace || threadGeneration != generation)
+    {
+        std::string name = threadTrace ? threadTrace->name : std::string();
+        threadTrace = std::make_shared<ThreadTrace>();
+        threadTrace->name = name;
+        threadTrace->events.reserve(TRACE_THREAD_RESERVE);
+        threadGeneration = generation;
+        std::lock_guard<std::mutex> lock(state.mutex);
+        threadTrace->id = static_cast<unsigned>(state.threads.size()) + 1;
+        state.threads.push_back(threadTrace);
+    }
+    return *threadTrace;
+}
+
+std::string EscapeJson(const std::string& text)
+{
+    std::string escaped;
+    for (auto c = text.begin(); c != text.end(); ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += *c;
+    }
+    return escaped;
+}
+
+double ToUs(uint64_t ns)
+{
+    return ns / 1000.;
+}
+}
+
+uint64_t TraceSpan::GetClockNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void TraceSpan::End()
+{
+    TraceEvent event;
+    std::strncpy(event.name, this->name, TRACE_NAME_SIZE - 1);
+    event.name[TRACE_NAME_SIZE - 1] = 0;
+    event.category = this->category;
+    event.argName = this->argName;
+    event.arg = this->arg;
+    event.startNs = this->startNs;
+    event.durationNs = GetClockNs() - this->startNs;
+    GetThreadTrace().events.push_back(event);
+}
+
+void StartTrace()
+{
+    TraceState& state = GetTraceState();
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.threads.clear();
+        state.startNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        ++state.generation;
+    }
+    traceEnabled.store(true);
+}
+
+void SetTraceThreadName(const std::string& name)
+{
+    if (IsTraceEnabled())
+    {
+        GetThreadTrace().name = name;
+    }
+}
+
+void WriteTrace(const std::string& fileName)
+{
+    traceEnabled.store(false);
+    TraceState& state = GetTraceState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    std::ofstream out(fileName.c_str());
+    if (!out)
+    {
+        throw std::invalid_argument("Can't create trace file " + fileName);
+    }
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool isFirst = true;
+    for (auto thread = state.threads.begin(); thread != state.threads.end(); ++thread)
+    {
+        std::stringstream name;
+        name << ((*thread)->name.empty() ? "thread" : (*thread)->name) << " " << (*thread)->id;
+        out << (isFirst ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << (*thread)->id
+            << ", \"args\": {\"name\": \"" << EscapeJson(name.str()) << "\"}}";
+        isFirst = false;
+        const std::vector<TraceEvent>& events = (*thread)->events;
+        for (auto event = events.begin(); event != events.end(); ++event)
+        {
+            // Spans of an earlier run have a start before this trace
+            uint64_t startNs = std::max(event->startNs, state.startNs);
+            out << ",\n{\"name\": \"" << EscapeJson(event->name) << "\", \"cat\": \"" << event->category
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << (*thread)->id
+                << ", \"ts\": " << ToUs(startNs - state.startNs) << ", \"dur\": " << ToUs(event->durationNs);
+            if (event->argName != nullptr)
+            {
+                out << ", \"args\": {\"" << event->argName << "\": " << event->arg << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    if (!out)
+    {
+        throw std::invalid_argument("Can't write trace file " + fileName);
+    }
+    state.threads.clear();
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+// Timeline of the pipeline threads in the Chrome trace-event format, for a trace
+// viewer to show how the stages overlap and where they stall. Every thread
+// records its spans into a buffer of its own; while no trace is running a span
+// costs one relaxed atomic load. One trace runs at a time in a process.
+
+extern std::atomic<bool> traceEnabled;
+
+inline bool IsTraceEnabled()
+{
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+// Drops the spans of an earlier trace and starts recording
+void StartTrace();
+
+// Stops recording and writes the spans as a JSON file; call it once the traced
+// threads are done. Throws std::invalid_argument if the file can't be created.
+void WriteTrace(const std::string& fileName);
+
+// Name of the calling thread in the viewer, such as the pipeline stage it runs
+void SetTraceThreadName(const std::string& name);
+
+// Span from the construction to the destruction, with an optional argument such as
+// the slice index. The name must stay valid for the life of the span, it is copied
+// when the span ends.
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const char* name, const char* argName = nullptr, int64_t arg = 0)
+        : category(category)
+        , name(name)
+        , argName(argName)
+        , arg(arg)
+        , isActive(IsTraceEnabled())
+        , startNs(isActive ? GetClockNs() : 0)
+    {
+    }
+    ~TraceSpan()
+    {
+        if (this->isActive)
+        {
+            End();
+        }
+    }
+private:
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+    static uint64_t GetClockNs();
+    void End();
+private:
+    const char* category;
+    const char* name;
+    const char* argName;
+    int64_t arg;
+    bool isActive;
+    uint64_t startNs;
+};
+
+}
+
+#endif
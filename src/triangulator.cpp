@@ -1,5 +1,8 @@
 #include "triangulator.h"
-#include "stlwriter.h"
+#include "meshwriter.h"
+#include "pipeline.h"
+
+#include <algorithm>
 
 namespace DicomToStl
 {
@@ -297,6 +300,13 @@ int triTable[256][16] =
 {0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}};
 
+bool VecLess(const Vec3& a, const Vec3& b)
+{
+    if (a.x != b.x) return a.x < b.x;
+    if (a.y != b.y) return a.y < b.y;
+    return a.z < b.z;
+}
+
 Vec3 VertexInterp(int isolevel, const Vec3& p1, const Vec3& p2, int valp1, int valp2)
 {
    if (isolevel == valp1)
@@ -320,9 +330,61 @@ Vec3 VertexInterp(int isolevel, const Vec3& p1, const Vec3& p2, int valp1, int v
 
    return p;
 }
+
+// Interpolates from the same end point whichever cell visits the edge,
+// so that neighbouring cells produce bit identical shared vertices
+Vec3 EdgeInterp(int isolevel, const Vec3& p1, const Vec3& p2, int valp1, int valp2)
+{
+    if (VecLess(p2, p1))
+    {
+        return VertexInterp(isolevel, p2, p1, valp2, valp1);
+    }
+    return VertexInterp(isolevel, p1, p2, valp1, valp2);
+}
+
+// Lengths of the triTable rows in triangles
+struct TriCountTable
+{
+    TriCountTable()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            int len = 0;
+            while (len < 16 && triTable[i][len] != -1)
+            {
+                ++len;
+            }
+            counts[i] = static_cast<unsigned char>(len / 3);
+        }
+    }
+    unsigned char counts[256];
+};
+
+const TriCountTable triCountTable;
+
+template<class T>
+class PixelReader
+{
+public:
+    PixelReader(const std::vector<T>& buf, int w) : buf(buf), w(w) {}
+    T GetPixel(int x, int y)
+    {
+        return buf[x + w *y];
+    }
+private:
+    PixelReader& operator=(const PixelReader&);
+    const std::vector<T>& buf;
+    int w;
+};
+}
+
+int TriangulateGridCell(const GridCell& cell, int isolevel, MeshWriter& meshWriter)
+{
+    static const PatientTransform identity;
+    return TriangulateGridCell(cell, isolevel, identity, meshWriter);
 }
 
-void TriangulateGridCell(const GridCell& cell, int isolevel, StlWriter& stlWriter)
+int TriangulateGridCell(const GridCell& cell, int isolevel, const PatientTransform& transform, MeshWriter& meshWriter)
 {
     /*
     Determine the index into the edge table which
@@ -346,74 +408,198 @@ void TriangulateGridCell(const GridCell& cell, int isolevel, StlWriter& stlWrite
         if (edgeTable[cubeindex] & 1)
         {
             vertlist[0] =
-                VertexInterp(isolevel,cell.p[0],cell.p[1],cell.val[0],cell.val[1]);
+                EdgeInterp(isolevel,cell.p[0],cell.p[1],cell.val[0],cell.val[1]);
         }
         if (edgeTable[cubeindex] & 2)
         {
             vertlist[1] =
-                VertexInterp(isolevel,cell.p[1],cell.p[2],cell.val[1],cell.val[2]);
+                EdgeInterp(isolevel,cell.p[1],cell.p[2],cell.val[1],cell.val[2]);
         }
         if (edgeTable[cubeindex] & 4)
         {
             vertlist[2] =
-                VertexInterp(isolevel,cell.p[2],cell.p[3],cell.val[2],cell.val[3]);
+                EdgeInterp(isolevel,cell.p[2],cell.p[3],cell.val[2],cell.val[3]);
         }
         if (edgeTable[cubeindex] & 8)
         {
             vertlist[3] =
-                VertexInterp(isolevel,cell.p[3],cell.p[0],cell.val[3],cell.val[0]);
+                EdgeInterp(isolevel,cell.p[3],cell.p[0],cell.val[3],cell.val[0]);
         }
         if (edgeTable[cubeindex] & 16)
         {
             vertlist[4] =
-                VertexInterp(isolevel,cell.p[4],cell.p[5],cell.val[4],cell.val[5]);
+                EdgeInterp(isolevel,cell.p[4],cell.p[5],cell.val[4],cell.val[5]);
         }
         if (edgeTable[cubeindex] & 32)
         {
             vertlist[5] =
-                VertexInterp(isolevel,cell.p[5],cell.p[6],cell.val[5],cell.val[6]);
+                EdgeInterp(isolevel,cell.p[5],cell.p[6],cell.val[5],cell.val[6]);
         }
         if (edgeTable[cubeindex] & 64)
         {
             vertlist[6] =
-                VertexInterp(isolevel,cell.p[6],cell.p[7],cell.val[6],cell.val[7]);
+                EdgeInterp(isolevel,cell.p[6],cell.p[7],cell.val[6],cell.val[7]);
         }
         if (edgeTable[cubeindex] & 128)
         {
             vertlist[7] =
-                VertexInterp(isolevel,cell.p[7],cell.p[4],cell.val[7],cell.val[4]);
+                EdgeInterp(isolevel,cell.p[7],cell.p[4],cell.val[7],cell.val[4]);
         }
         if (edgeTable[cubeindex] & 256)
         {
             vertlist[8] =
-                VertexInterp(isolevel,cell.p[0],cell.p[4],cell.val[0],cell.val[4]);
+                EdgeInterp(isolevel,cell.p[0],cell.p[4],cell.val[0],cell.val[4]);
         }
         if (edgeTable[cubeindex] & 512)
         {
             vertlist[9] =
-                VertexInterp(isolevel,cell.p[1],cell.p[5],cell.val[1],cell.val[5]);
+                EdgeInterp(isolevel,cell.p[1],cell.p[5],cell.val[1],cell.val[5]);
         }
         if (edgeTable[cubeindex] & 1024)
         {
             vertlist[10] =
-                VertexInterp(isolevel,cell.p[2],cell.p[6],cell.val[2],cell.val[6]);
+                EdgeInterp(isolevel,cell.p[2],cell.p[6],cell.val[2],cell.val[6]);
         }
         if (edgeTable[cubeindex] & 2048)
         {
             vertlist[11] =
-                VertexInterp(isolevel,cell.p[3],cell.p[7],cell.val[3],cell.val[7]);
+                EdgeInterp(isolevel,cell.p[3],cell.p[7],cell.val[3],cell.val[7]);
+        }
+
+        /* Move the vertices once, several triangles share them */
+        if (!transform.IsIdentity())
+        {
+            for (int i = 0; i < 12; ++i)
+            {
+                if (edgeTable[cubeindex] & (1 << i))
+                {
+                    vertlist[i] = transform.Apply(vertlist[i]);
+                }
+            }
         }
 
         /* Create the triangle */
+        int second = transform.IsMirrored() ? 2 : 1;
+        int third = transform.IsMirrored() ? 1 : 2;
         Triangle tri;
         for (int i=0; triTable[cubeindex][i] != -1; i += 3) 
         {
             std::get<0>(tri) = vertlist[triTable[cubeindex][i  ]];
-            std::get<1>(tri) = vertlist[triTable[cubeindex][i+1]];
-            std::get<2>(tri) = vertlist[triTable[cubeindex][i+2]];
-            stlWriter.Write(tri);
+            std::get<1>(tri) = vertlist[triTable[cubeindex][i+second]];
+            std::get<2>(tri) = vertlist[triTable[cubeindex][i+third]];
+            meshWriter.Write(tri);
+        }
+        return triCountTable.counts[cubeindex];
+    }
+    return 0;
+}
+
+size_t CountSliceTriangles(const std::vector<int>& topSlice, const std::vector<int>& bottomSlice,
+                           int dx, int dy, int isolevel)
+{
+    size_t count = 0;
+    for (int y = 0; y + 1 < dy; ++y)
+    {
+        const int* top = &topSlice[y * dx];
+        const int* topNext = top + dx;
+        const int* bottom = &bottomSlice[y * dx];
+        const int* bottomNext = bottom + dx;
+        for (int x = 0; x + 1 < dx; ++x)
+        {
+            // Same corner order as the cells built for TriangulateGridCell
+            int cubeindex = 0;
+            if (bottom[x] > isolevel) cubeindex |= 1;
+            if (bottom[x + 1] > isolevel) cubeindex |= 2;
+            if (bottomNext[x + 1] > isolevel) cubeindex |= 4;
+            if (bottomNext[x] > isolevel) cubeindex |= 8;
+            if (top[x] > isolevel) cubeindex |= 16;
+            if (top[x + 1] > isolevel) cubeindex |= 32;
+            if (topNext[x + 1] > isolevel) cubeindex |= 64;
+            if (topNext[x] > isolevel) cubeindex |= 128;
+            count += triCountTable.counts[cubeindex];
+        }
+    }
+    return count;
+}
+
+void CountSliceTrianglesSweep(const std::vector<int>& topSlice, const std::vector<int>& bottomSlice,
+                              int dx, int dy, const std::vector<int>& isolevels,
+                              std::vector<uint64_t>& activeCells, std::vector<uint64_t>& triangles)
+{
+    for (int y = 0; y + 1 < dy; ++y)
+    {
+        const int* top = &topSlice[y * dx];
+        const int* topNext = top + dx;
+        const int* bottom = &bottomSlice[y * dx];
+        const int* bottomNext = bottom + dx;
+        for (int x = 0; x + 1 < dx; ++x)
+        {
+            // Same corner order as the cells built for TriangulateGridCell
+            const int corners[8] = { bottom[x], bottom[x + 1], bottomNext[x + 1], bottomNext[x],
+                                     top[x], top[x + 1], topNext[x + 1], topNext[x] };
+            int low = *std::min_element(corners, corners + 8);
+            int high = *std::max_element(corners, corners + 8);
+            // Levels below the lowest corner or from the highest one up leave the cell
+            // all inside or all outside
+            auto first = std::lower_bound(isolevels.begin(), isolevels.end(), low);
+            auto last = std::lower_bound(first, isolevels.end(), high);
+            for (auto level = first; level != last; ++level)
+            {
+                int cubeindex = 0;
+                for (int i = 0; i < 8; ++i)
+                {
+                    cubeindex |= corners[i] > *level ? (1 << i) : 0;
+                }
+                size_t index = level - isolevels.begin();
+                ++activeCells[index];
+                triangles[index] += triCountTable.counts[cubeindex];
+            }
         }
     }
 }
 
-}
\ No newline at end of file
+void BuildGridCells(std::vector<GridCell>& cells, const GridAxes& axes, int pair,
+                    const std::vector<int>& topSlice, const std::vector<int>& bottomSlice)
+{
+    int dx = static_cast<int>(axes.x.size());
+    int cellsWidth = dx - 1;
+    const Vec3& top = axes.slices[pair];
+    const Vec3& bottom = axes.slices[pair + 1];
+   
+    PixelReader<int> topReader(topSlice, dx);
+    PixelReader<int> bottomReader(bottomSlice, dx);
+
+    ParallelFor(size_t(0), cells.size(),
+        [&](size_t index)
+    {
+        int y = index / cellsWidth;
+        int x = index - y * cellsWidth;
+        float x0 = axes.x[x];
+        float x1 = axes.x[x + 1];
+        float y0 = axes.y[y];
+        float y1 = axes.y[y + 1];
+        
+        GridCell cell;
+        cell.p[4] = Vec3(x0 + top.x, y0 + top.y, top.z);
+        cell.val[4] = topReader.GetPixel(x ,y);
+        cell.p[5] = Vec3(x1 + top.x, y0 + top.y, top.z);
+        cell.val[5] = topReader.GetPixel(x + 1, y);
+        cell.p[6] = Vec3(x1 + top.x, y1 + top.y, top.z);
+        cell.val[6] = topReader.GetPixel(x + 1, y + 1);
+        cell.p[7] = Vec3(x0 + top.x, y1 + top.y, top.z);
+        cell.val[7] = topReader.GetPixel(x, y + 1);
+
+        cell.p[0] = Vec3(x0 + bottom.x, y0 + bottom.y, bottom.z);
+        cell.val[0] = bottomReader.GetPixel(x, y);
+        cell.p[1] = Vec3(x1 + bottom.x, y0 + bottom.y, bottom.z);
+        cell.val[1] = bottomReader.GetPixel(x + 1, y);
+        cell.p[2] = Vec3(x1 + bottom.x, y1 + bottom.y, bottom.z);
+        cell.val[2] = bottomReader.GetPixel(x + 1, y + 1);
+        cell.p[3] = Vec3(x0 + bottom.x, y1 + bottom.y, bottom.z);
+        cell.val[3] = bottomReader.GetPixel(x, y + 1);
+
+        cells[index] = cell;
+    });
+}
+
+}
@@ -2,9 +2,11 @@
 #define _TRIANGULATOR_H_
 
 #include "vec3.h"
+#include "gridframe.h"
 
 #include <vector>
 #include <tuple>
+#include <cstdint>
 
 namespace DicomToStl
 {
@@ -19,9 +21,30 @@ struct GridCell
     std::vector<int> val;
 };
 
-class StlWriter;
+class MeshWriter;
 
-void TriangulateGridCell(const GridCell& cell, int isolevel, StlWriter& stlWriter);
+// Cells between the slices pair and pair + 1 of the axes, corners 0-3 on the bottom
+// slice. The cells are built on the shared workers.
+void BuildGridCells(std::vector<GridCell>& cells, const GridAxes& axes, int pair,
+                    const std::vector<int>& topSlice, const std::vector<int>& bottomSlice);
+
+// Returns the number of triangles written, 0 for a cell the surface does not cross
+int TriangulateGridCell(const GridCell& cell, int isolevel, MeshWriter& meshWriter);
+
+// Same, every vertex is moved by the transform before the triangles are written
+int TriangulateGridCell(const GridCell& cell, int isolevel, const PatientTransform& transform, MeshWriter& meshWriter);
+
+// Number of triangles TriangulateGridCell emits for the cells between two slices,
+// found from the cube indices alone without building the cells
+size_t CountSliceTriangles(const std::vector<int>& topSlice, const std::vector<int>& bottomSlice,
+                           int dx, int dy, int isolevel);
+
+// Same for every level of isolevels, sorted ascending: the cells the surface crosses
+// and the triangles are added to activeCells and triangles at the index of the level.
+// A cell is classified only for the levels from its lowest corner to below its highest.
+void CountSliceTrianglesSweep(const std::vector<int>& topSlice, const std::vector<int>& bottomSlice,
+                              int dx, int dy, const std::vector<int>& isolevels,
+                              std::vector<uint64_t>& activeCells, std::vector<uint64_t>& triangles);
 
 }
 
@@ -21,6 +21,21 @@ inline Vec3 operator-(const Vec3& a, const Vec3& b)
     return Vec3(a.x - b.x, a.y - b.y, a.z - b.z);
 }
 
+inline Vec3 operator+(const Vec3& a, const Vec3& b)
+{
+    return Vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+inline Vec3 operator*(const Vec3& a, float s)
+{
+    return Vec3(a.x * s, a.y * s, a.z * s);
+}
+
+inline float VecDot(const Vec3& a, const Vec3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
 inline Vec3 VecAbs(const Vec3& a)
 {
     return Vec3(abs(a.x), abs(a.y), abs(a.z));
@@ -0,0 +1,135 @@
+#include "volumecache.h"
+
+#include <sys/stat.h>
+#include <sstream>
+#include <algorithm>
+
+namespace DicomToStl
+{
+
+VolumeCache::VolumeCache(uint64_t capacity)
+    : capacity(capacity)
+{
+}
+
+std::shared_ptr<const std::vector<int> > VolumeCache::Find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto i = this->index.find(key);
+    if (i == this->index.end())
+    {
+        ++this->stats.misses;
+        return std::shared_ptr<const std::vector<int> >();
+    }
+    ++this->stats.hits;
+    this->entries.splice(this->entries.begin(), this->entries, i->second);
+    return i->second->second;
+}
+
+void VolumeCache::Insert(const std::string& key, std::shared_ptr<const std::vector<int> > pixels)
+{
+    uint64_t bytes = pixels->size() * sizeof(int);
+    if (bytes > this->capacity)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->index.count(key) > 0)
+    {
+        return;
+    }
+    while (!this->entries.empty() && this->stats.bytes + bytes > this->capacity)
+    {
+        this->stats.bytes -= this->entries.back().second->size() * sizeof(int);
+        this->index.erase(this->entries.back().first);
+        this->entries.pop_back();
+    }
+    this->entries.push_front(Entry(key, pixels));
+    this->index[key] = this->entries.begin();
+    this->stats.bytes += bytes;
+    this->stats.entries = this->entries.size();
+}
+
+CacheStats VolumeCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    CacheStats stats = this->stats;
+    stats.entries = this->entries.size();
+    return stats;
+}
+
+CachedSliceSource::CachedSliceSource(const DcmSliceSource& files, VolumeCache& cache)
+    : files(files)
+    , cache(cache)
+{
+    for (int i = 0; i < files.GetSlicesCount(); ++i)
+    {
+        struct stat info;
+        std::stringstream key;
+        key << files.GetSliceName(i);
+        if (stat(files.GetSliceName(i).c_str(), &info) == 0)
+        {
+            key << "@" << static_cast<long long>(info.st_mtime) << ":" << static_cast<long long>(info.st_size);
+        }
+        this->keys.push_back(key.str());
+    }
+}
+
+int CachedSliceSource::GetWidth() const
+{
+    return this->files.GetWidth();
+}
+
+int CachedSliceSource::GetHeight() const
+{
+    return this->files.GetHeight();
+}
+
+Vec3 CachedSliceSource::GetSpacing() const
+{
+    return this->files.GetSpacing();
+}
+
+int CachedSliceSource::GetSlicesCount() const
+{
+    return this->files.GetSlicesCount();
+}
+
+std::string CachedSliceSource::GetSliceName(int index) const
+{
+    return this->files.GetSliceName(index);
+}
+
+bool CachedSliceSource::ReadSlice(int index, std::vector<int>& buffer, std::string& error) const
+{
+    std::shared_ptr<const std::vector<int> > pixels = this->cache.Find(this->keys[index]);
+    if (!pixels)
+    {
+        std::shared_ptr<std::vector<int> > decoded = std::make_shared<std::vector<int> >(buffer.size());
+        if (!this->files.ReadSlice(index, *decoded, error))
+        {
+            return false;
+        }
+        this->cache.Insert(this->keys[index], decoded);
+        pixels = decoded;
+    }
+    std::copy(pixels->begin(), pixels->end(), buffer.begin());
+    return true;
+}
+
+void CachedSliceSource::ReleaseSlice(int index) const
+{
+    this->files.ReleaseSlice(index);
+}
+
+uint64_t CachedSliceSource::GetSliceBytes(int index) const
+{
+    return this->files.GetSliceBytes(index);
+}
+
+SeriesGeometry CachedSliceSource::GetGeometry() const
+{
+    return this->files.GetGeometry();
+}
+
+}
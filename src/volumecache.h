@@ -0,0 +1,75 @@
+#ifndef _VOLUME_CACHE_H_
+#define _VOLUME_CACHE_H_
+
+#include "slicesource.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+namespace DicomToStl
+{
+
+struct CacheStats
+{
+    CacheStats() : hits(0), misses(0), entries(0), bytes(0) {}
+    size_t hits;
+    size_t misses;
+    size_t entries;
+    uint64_t bytes;
+};
+
+// Decoded slices kept between conversions, the least recently used ones are
+// dropped once the capacity in bytes is exceeded. Thread safe.
+class VolumeCache
+{
+public:
+    explicit VolumeCache(uint64_t capacity);
+    // nullptr when the slice is not cached
+    std::shared_ptr<const std::vector<int> > Find(const std::string& key);
+    void Insert(const std::string& key, std::shared_ptr<const std::vector<int> > pixels);
+    CacheStats GetStats() const;
+private:
+    VolumeCache(const VolumeCache&);
+    VolumeCache& operator=(const VolumeCache&);
+private:
+    typedef std::pair<std::string, std::shared_ptr<const std::vector<int> > > Entry;
+    // Most recently used first
+    std::list<Entry> entries;
+    std::map<std::string, std::list<Entry>::iterator> index;
+    uint64_t capacity;
+    CacheStats stats;
+    mutable std::mutex mutex;
+};
+
+// DICOM slices decoded once and then served from the cache. A slice is keyed
+// by its file name and modification time, so a rewritten file is decoded again.
+class CachedSliceSource : public SliceSource
+{
+public:
+    CachedSliceSource(const DcmSliceSource& files, VolumeCache& cache);
+    virtual int GetWidth() const;
+    virtual int GetHeight() const;
+    virtual Vec3 GetSpacing() const;
+    virtual int GetSlicesCount() const;
+    virtual std::string GetSliceName(int index) const;
+    virtual bool ReadSlice(int index, std::vector<int>& buffer, std::string& error) const;
+    virtual void ReleaseSlice(int index) const;
+    virtual uint64_t GetSliceBytes(int index) const;
+    virtual SeriesGeometry GetGeometry() const;
+private:
+    CachedSliceSource(const CachedSliceSource&);
+    CachedSliceSource& operator=(const CachedSliceSource&);
+private:
+    const DcmSliceSource& files;
+    VolumeCache& cache;
+    std::vector<std::string> keys;
+};
+
+}
+
+#endif
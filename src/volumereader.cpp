@@ -1,19 +1,37 @@
 #include "volumereader.h"
 #include "logagent.h"
+#include "meshwriter.h"
+#include "chunkedmesh.h"
 #include "stlwriter.h"
+#include "mappedfile.h"
+#include "pipeline.h"
+#include "slabbuffer.h"
+#include "memorygovernor.h"
+#include "checkpoint.h"
+#include "slicesource.h"
+#include "perfcounters.h"
+#include "progress.h"
+#include "trace.h"
 
-#include <ppl.h>
-#include <agents.h>
-
-#include <dcmtk/dcmdata/dcfilefo.h>
-#include <dcmtk/dcmimgle/dcmimage.h>
-#include <dcmtk/dcmdata/dcdeftag.h>
-#include <dcmtk/dcmimage/diregist.h>
+#include <dcmtk/oflog/oflog.h>
 
 #include "vec3.h"
 
 #include <algorithm>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <iomanip>
+#include <map>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <cmath>
+#include <exception>
 
 #include "timer.h"
 
@@ -35,423 +53,1510 @@ namespace
 
 typedef vector<int> ImgBuf;
 typedef std::vector<GridCell> CellsBuf;
-typedef Concurrency::unbounded_buffer<std::pair<ImgBuf*, ImgBuf*>> MsgImgBuf;
-typedef Concurrency::unbounded_buffer<CellsBuf*> MsgCellsBuf;
 
-bool ReadDcmFile(const string& fileName, vector<int>& buffer, LogAgent& logAgent);
-void BuildGridCells(vector<GridCell>& cells, int dx, float z1, float z2, 
-                     const Vec3& spacing, const vector<int>& topSlice, const vector<int>& bottomSlice);
+// Sampled slice pairs of the time estimation, one in ESTIMATE_PAIRS_FRACTION within the bounds
+const int ESTIMATE_MIN_PAIRS = 3;
+const int ESTIMATE_MAX_PAIRS = 16;
+const int ESTIMATE_PAIRS_FRACTION = 25;
+// Share of the projected wall time of the conversion the sampling may take
+const double ESTIMATE_MAX_SHARE = 0.05;
+// Least relative width of the estimated range, for what the cost model leaves out
+const double ESTIMATE_MIN_SPREAD = 0.15;
+// Slab height of the mapped output when no chunk size is given
+const int MAPPED_SLAB_SLICES = 32;
+// Triangles a slab keeps in memory before spooling to disk while it waits to be stitched
+const size_t SLAB_MEMORY_TRIANGLES = 1 << 20;
+// Allocator bookkeeping of a heap block
+const uint64_t HEAP_BLOCK_OVERHEAD = 16;
+// Slice messages a run logs in a second at most, a fast source would flood the log with them
+const int INFO_MESSAGES_PER_SECOND = 200;
+// Slice pairs a thread of a sweep takes at once
+const int SWEEP_SLAB_PAIRS = 16;
+
+// One pair of neighbour slices in flight. A pair owns its images and cells for
+// the whole way through the pipeline, so reordering before the writer can't
+// starve the stages of buffers.
+struct PairSlot
+{
+    PairSlot() : index(0), isRead(false) {}
+    // Pair index within the slab
+    int index;
+    bool isRead;
+    ImgBuf topSlice;
+    ImgBuf bottomSlice;
+    CellsBuf cells;
+};
+
+// Two images and the cells built from them, a cell holds its corners in two vectors
+uint64_t GetPairSlotBytes(int dx, int dy)
+{
+    const uint64_t cellBytes = sizeof(GridCell) + 8 * sizeof(Vec3) + 8 * sizeof(int) + 2 * HEAP_BLOCK_OVERHEAD;
+    return 2 * static_cast<uint64_t>(dx) * dy * sizeof(int) + static_cast<uint64_t>(dx - 1) * (dy - 1) * cellBytes;
+}
+
+bool ReadSlice(const SliceSource& source, int index, ImgBuf& buffer, PerfCounters& counters, LogAgent& logAgent)
+{
+    TraceSpan span("decode", "decode", "slice", index);
+    std::string error;
+    cpptask::Timer timer;
+    bool isRead = source.ReadSlice(index, buffer, error);
+    counters.decodeNs += timer.EndNs();
+    if (!isRead)
+    {
+        logAgent.Log(LogAgent::MSG_WARN, error);
+        return false;
+    }
+    ++counters.filesDecoded;
+    counters.bytesRead += source.GetSliceBytes(index);
+    if (logAgent.IsEnabled(LogAgent::MSG_INFO))
+    {
+        logAgent.Logf(LogAgent::MSG_INFO, "Slice %s processed", source.GetSliceName(index).c_str());
+    }
+    return true;
+}
+
+// Starts recording the timeline of the run when a trace file is asked for
+void StartRunTrace(const PipelineOptions& pipeline)
+{
+    if (!pipeline.traceFile.empty())
+    {
+        StartTrace();
+        SetTraceThreadName("main");
+    }
+}
+
+// Logs the stage counters and writes them to the stats file when one is asked for,
+// the same for the trace
+void ReportCounters(const PerfCounters& counters, uint64_t wallNs, const PipelineOptions& pipeline, LogAgent& logAgent)
+{
+    if (!pipeline.traceFile.empty())
+    {
+        try
+        {
+            WriteTrace(pipeline.traceFile);
+            logAgent.Log(LogAgent::MSG_INFO, "Trace " + pipeline.traceFile + " written");
+        }
+        catch (std::exception& err)
+        {
+            logAgent.Log(LogAgent::MSG_ERROR, err.what());
+        }
+    }
+    logAgent.Log(LogAgent::MSG_INFO, GetPerfReport(counters, wallNs));
+    if (!pipeline.statsFile.empty())
+    {
+        try
+        {
+            WritePerfJson(pipeline.statsFile, counters, wallNs);
+        }
+        catch (std::exception& err)
+        {
+            logAgent.Log(LogAgent::MSG_ERROR, err.what());
+        }
+    }
+}
+
+// Progress events of the run on their own thread, when the caller asked for them
+std::unique_ptr<ProgressAgent> StartProgress(const SliceSource& source, const PipelineOptions& pipeline, const PerfCounters& counters)
+{
+    std::unique_ptr<ProgressAgent> progress;
+    if (pipeline.progress)
+    {
+        progress.reset(new ProgressAgent(counters, source.GetSlicesCount(), pipeline.progressInterval, pipeline.progress));
+        progress->Start();
+    }
+    return progress;
+}
+
+// Costs of one slice pair sampled by the time estimation
+struct PairSample
+{
+    PairSample() : isRead(false), decodeMs(0.), gridMs(0.), triangulateMs(0.), triangles(0) {}
+    bool isRead;
+    std::string error;
+    double decodeMs;
+    double gridMs;
+    double triangulateMs;
+    size_t triangles;
+};
 
-class FileReadAgent : public Concurrency::agent
+// Counts the triangles of the time estimation instead of writing them
+class CountingMeshWriter : public MeshWriter
 {
 public:
+    virtual void Write(const Triangle&)
+    {
+        ++this->triCount;
+    }
+    virtual void Close()
+    {
+    }
+};
 
-    FileReadAgent(std::function<bool (void)> needBreak,
-                const SlicesPositions& slicesPositions,
-                MsgImgBuf& freeBuffers,
-                MsgImgBuf& filledBuffers,
-                LogAgent& logAgent)
-        : needBreak(needBreak),
-          slicesPositions(slicesPositions),
-          freeBuffers(freeBuffers),
-          filledBuffers(filledBuffers),
-          logAgent(logAgent)
+// Mean size of a triangle in the output, indexed formats share every vertex by about six triangles
+double GetBytesPerTriangle(MeshFormat format)
+{
+    switch (format)
     {
+    case MESH_FORMAT_STL_ASCII:
+        return 250.;
+    case MESH_FORMAT_PLY:
+        return 0.5 * 12. + 13.;
+    case MESH_FORMAT_OBJ:
+        return 0.5 * 30. + 24.;
+    case MESH_FORMAT_COMPACT:
+        return 0.5 * 6. + 4.;
+    default:
+        return 50.;
     }
+}
+
+// Assumed rates of a local disk and of one compression thread, the estimation writes nothing to measure them
+double GetWriteBytesPerMs(const StreamOptions& stream)
+{
+    const double diskBytesPerMs = 300000.;
+    double compressBytesPerMs = stream.compression == OUTPUT_COMPRESSION_GZIP ? 40000. :
+                                stream.compression == OUTPUT_COMPRESSION_ZSTD ? 200000. : diskBytesPerMs;
+    return std::min(diskBytesPerMs, compressBytesPerMs * std::max(stream.compressThreads, 1));
+}
+
+// Runs the read - build grid - triangulate pipeline over the slices [firstSlice, endSlice)
+void TriangulateSlab(const SliceSource& source,
+                     int firstSlice,
+                     int endSlice,
+                     int isoLevel,
+                     MeshWriter& meshWriter,
+                     const PipelineOptions& options,
+                     MemoryGovernor& memory,
+                     PerfCounters& counters,
+                     LogAgent& logAgent,
+                     std::function<bool (void)> needBreak)
+{
+    int dx = source.GetWidth();
+    int dy = source.GetHeight();
+    size_t bufLen = dx * dy;
+    int pairsCount = endSlice - firstSlice - 1;
+    GridAxes axes;
+    PatientTransform transform;
+    MakeGridFrame(dx, dy, source.GetSpacing(), source.GetGeometry(), axes, transform);
+    size_t depth = static_cast<size_t>(std::max(options.depth, 1));
+
+    // Waits here while other slabs hold the memory
+    MemoryReservation reservation(memory, "pair slots", depth * GetPairSlotBytes(dx, dy));
 
-    virtual void run()
+    BufferPool<PairSlot> slots(depth, [&](PairSlot& slot)
     {
-        auto i = slicesPositions.begin();
-        auto n = next(i);
-        auto e = slicesPositions.end();
-   
-        MsgImgBuf::type buffers;
+        slot.topSlice.resize(bufLen);
+        slot.bottomSlice.resize(bufLen);
+        slot.cells.resize((dx - 1) * (dy - 1));
+    });
+    BoundedQueue<PairSlot*> readPairs(depth);
+    BoundedQueue<PairSlot*> builtPairs(depth);
+    std::atomic<int> nextPair(0);
+
+    Pipeline pipeline;
+    pipeline.AddQueue("free pairs", slots);
+    pipeline.AddQueue("read pairs", readPairs);
+    pipeline.AddQueue("built pairs", builtPairs);
 
-        bool skipFailedFiles = false;
-        for(;n != e; ++i, ++n)
+    int lastSlice = source.GetSlicesCount() - 1;
+    pipeline.AddStage("read", options.readThreads, [&]()
+    {
+        // Every pair counts its top slice, the last one its bottom slice too
+        std::unique_ptr<IntensityHistogram> histogram(options.histogram != nullptr ? new IntensityHistogram() : nullptr);
+        // The slot is taken before the pair index, every claimed pair can complete
+        PairSlot* slot = slots.Acquire();
+        while (slot != nullptr)
         {
-            if (needBreak())
+            int index = nextPair++;
+            if (index >= pairsCount || needBreak())
             {
+                slots.Release(slot);
                 break;
             }
-
-            if (!skipFailedFiles)
+            int top = firstSlice + index;
+            slot->index = index;
+            slot->isRead = ReadSlice(source, top, slot->topSlice, counters, logAgent) &&
+                           ReadSlice(source, top + 1, slot->bottomSlice, counters, logAgent);
+            source.ReleaseSlice(top);
+            if (histogram && slot->isRead)
             {
-                buffers = Concurrency::receive(this->freeBuffers);
+                histogram->Add(slot->topSlice.data(), slot->topSlice.size());
+                if (top + 1 == lastSlice)
+                {
+                    histogram->Add(slot->bottomSlice.data(), slot->bottomSlice.size());
+                }
             }
+            readPairs.Push(slot);
+            slot = slots.Acquire();
+        }
+        if (histogram)
+        {
+            options.histogram->Merge(*histogram);
+        }
+    },
+    [&]() { readPairs.Close(); });
 
-            if (ReadDcmFile(i->first, *buffers.first, logAgent) &&
-                ReadDcmFile(n->first, *buffers.second, logAgent))
+    pipeline.AddStage("grid", options.gridThreads, [&]()
+    {
+        PairSlot* slot = nullptr;
+        while (readPairs.Pop(slot))
+        {
+            // Pairs already read are dropped once cancelled
+            slot->isRead = slot->isRead && !needBreak();
+            if (slot->isRead)
             {
-                Concurrency::send(this->filledBuffers, buffers);
-                skipFailedFiles = false;
+                int pairZ = firstSlice + slot->index;
+                TraceSpan span("grid", "build grid", "slice", pairZ);
+                cpptask::Timer timer;
+                BuildGridCells(slot->cells, axes, pairZ, slot->topSlice, slot->bottomSlice);
+                counters.gridNs += timer.EndNs();
             }
-            else
+            builtPairs.Push(slot);
+        }
+    },
+    [&]() { builtPairs.Close(); });
+
+    pipeline.AddStage("triangulate", 1, [&]()
+    {
+        // Pairs come out of order from several readers, the writer gets them in the slice order
+        std::map<int, PairSlot*> pending;
+        int nextIndex = 0;
+        uint64_t writerBytes = meshWriter.GetBytesWritten();
+        PairSlot* slot = nullptr;
+        while (builtPairs.Pop(slot))
+        {
+            pending[slot->index] = slot;
+            auto i = pending.begin();
+            while (i != pending.end() && i->first == nextIndex)
             {
-                skipFailedFiles = true;
+                PairSlot* ready = i->second;
+                if (ready->isRead)
+                {
+                    TraceSpan span("triangulate", "triangulate", "slice", firstSlice + ready->index);
+                    cpptask::Timer timer;
+                    uint64_t activeCells = 0;
+                    uint64_t triangles = 0;
+                    std::for_each(ready->cells.begin(), ready->cells.end(),
+                    [&](const GridCell& cell)
+                    {
+                        int cellTriangles = TriangulateGridCell(cell, isoLevel, transform, meshWriter);
+                        activeCells += cellTriangles > 0 ? 1 : 0;
+                        triangles += cellTriangles;
+                    });
+                    counters.triangulateNs += timer.EndNs();
+                    counters.cellsClassified += ready->cells.size();
+                    counters.activeCells += activeCells;
+                    counters.trianglesEmitted += triangles;
+                    uint64_t bytes = meshWriter.GetBytesWritten();
+                    counters.bytesStreamed += bytes - writerBytes;
+                    writerBytes = bytes;
+                }
+                ++counters.pairsDone;
+                slots.Release(ready);
+                ++nextIndex;
+                i = pending.erase(i);
             }
         }
-        buffers.first = nullptr;
-        buffers.second = nullptr;
-        Concurrency::send(this->filledBuffers, buffers);
-
-        this->done();
-    }
-private:
-    FileReadAgent(const FileReadAgent&);
-    FileReadAgent& operator= (const FileReadAgent&);
-private:
-    std::function<bool (void)> needBreak;
-    const SlicesPositions& slicesPositions;
-    MsgImgBuf& freeBuffers;
-    MsgImgBuf& filledBuffers;
-    LogAgent& logAgent;
-};
+    });
 
-class BuildGridAgent : public Concurrency::agent
+    pipeline.Run();
+    counters.queueWaitNs += static_cast<uint64_t>(pipeline.GetQueueWaitTime() * 1e6);
+    logAgent.Log(LogAgent::MSG_INFO, pipeline.GetReport());
+}
+
+// Buffers of one output writer and its stream, following the block sizes they use
+uint64_t GetOutputBufferBytes(const OutputOptions& output)
 {
-public:
+    // Binary records block, or ASCII triangles batch and two batches of text
+    uint64_t bytes = output.format == MESH_FORMAT_STL_ASCII ? (48 << 20) : (1 << 20);
+    if (output.stream.compression != OUTPUT_COMPRESSION_NONE)
+    {
+        // Input and compressed copies of the 4 MB blocks in flight
+        bytes += static_cast<uint64_t>(2 * output.stream.compressThreads + 2) * 2 * (4 << 20);
+    }
+    if (output.stream.directIo)
+    {
+        bytes += 32 << 20;
+    }
+    return bytes;
+}
+
+bool CloseMeshWriter(MeshWriter& meshWriter, const OutputOptions& output, PerfCounters& counters, LogAgent& logAgent)
+{
+    try
+    {
+        TraceSpan span("write", "close output");
+        meshWriter.Close();
+        counters.bytesWritten += meshWriter.GetBytesWritten();
+        counters.writeNs += static_cast<uint64_t>(meshWriter.GetWriteTime() * 1e6);
 
-    BuildGridAgent(MsgImgBuf& freeBuffers,
-                   MsgImgBuf& filledBuffers,
-                   MsgCellsBuf& freeCells,
-                   MsgCellsBuf& filledCells,
-                   int dx,
-                   Vec3 spacing)
-        : freeBuffers(freeBuffers),
-          filledBuffers(filledBuffers),
-          freeCells(freeCells),
-          filledCells(filledCells),
-          dx(dx),
-          spacing(spacing)
+        stringstream buf;
+        buf << "Output " << GetMeshFormatName(output.format) << " : "
+            << meshWriter.GetTrianglesCount() << " triangles, "
+            << meshWriter.GetVerticesCount() << " vertices, "
+            << meshWriter.GetBytesWritten() << " bytes written in "
+            << meshWriter.GetWriteTime() << " ms";
+        logAgent.Log(LogAgent::MSG_INFO, buf.str());
+        return true;
+    }
+    catch (std::exception& err)
     {
+        logAgent.Log(LogAgent::MSG_ERROR, err.what());
     }
+    return false;
+}
+
+int GetSlabWorkersCount(const OutputOptions& output, int slabsCount)
+{
+    int workersCount = output.chunkWorkers > 0 ? output.chunkWorkers : std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / 2);
+    return std::min(workersCount, slabsCount);
+}
 
-    virtual void run()
+// Processes slabs [0, slabsCount) on workersCount threads, processSlab handles its own errors
+void RunSlabs(int slabsCount, int workersCount, std::function<void (int)> processSlab)
+{
+    std::atomic<int> nextSlab(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workersCount; ++i)
     {
-        bool done = false;
-        int z = 0;
-        while (!done)
+        workers.push_back(std::thread([&]()
         {
-            auto buffers = Concurrency::receive(this->filledBuffers);
-            if (buffers.first != nullptr &&
-                buffers.second != nullptr)
+            for (int slab = nextSlab++; slab < slabsCount; slab = nextSlab++)
             {
-                auto cells = Concurrency::receive(this->freeCells);
-                BuildGridCells(*cells, dx, z * spacing.z, (z + 1) * spacing.z, 
-                                    spacing,
-                                    *buffers.first, *buffers.second);
-                Concurrency::send(this->freeBuffers, buffers);
-                Concurrency::send(this->filledCells, cells);
-                ++z;
+                processSlab(slab);
+            }
+        }));
+    }
+    std::for_each(workers.begin(), workers.end(), [](std::thread& t) { t.join(); });
+}
+
+// Fits the buffers into the memory limit: the compression pool first, then the
+// pipeline depth and then the number of slabs processed at once are lowered
+void PlanMemory(int dx, int dy, int pairsCount, OutputOptions& output, PipelineOptions& pipeline, LogAgent& logAgent)
+{
+    uint64_t limit = pipeline.memoryLimit;
+    uint64_t slotBytes = GetPairSlotBytes(dx, dy);
+
+    int slabsCount = 1;
+    int workersCount = 1;
+    bool slabOutputs = false;
+    uint64_t slabBuffersBytes = 0;
+    if (output.mappedStl || output.chunkSlices > 0)
+    {
+        int slabSlices = output.chunkSlices > 0 ? output.chunkSlices : MAPPED_SLAB_SLICES;
+        slabsCount = (pairsCount + slabSlices - 1) / slabSlices;
+        workersCount = GetSlabWorkersCount(output, slabsCount);
+        slabOutputs = !output.mappedStl;
+    }
+    else if (pipeline.slabs > 1)
+    {
+        slabsCount = std::min(pipeline.slabs, pairsCount);
+        workersCount = output.chunkWorkers > 0 ? std::min(output.chunkWorkers, slabsCount) : slabsCount;
+        slabBuffersBytes = limit / 4;
+    }
+
+    while (output.stream.compressThreads > 1 &&
+           GetOutputBufferBytes(output) * (slabOutputs ? workersCount : 1) > limit / 4)
+    {
+        --output.stream.compressThreads;
+    }
+    uint64_t reserved = GetOutputBufferBytes(output) * (slabOutputs ? workersCount : 1) + slabBuffersBytes;
+    uint64_t available = limit > reserved ? limit - reserved : 0;
+
+    int depth = std::max(pipeline.depth, 1);
+    while (depth > 1 && workersCount * depth * slotBytes > available)
+    {
+        --depth;
+    }
+    while (workersCount > 1 && workersCount * depth * slotBytes > available)
+    {
+        --workersCount;
+    }
+    pipeline.depth = depth;
+    if (slabsCount > 1)
+    {
+        output.chunkWorkers = workersCount;
+    }
+
+    stringstream buf;
+    buf << "Memory plan : " << workersCount << " slabs at once, pipeline depth " << depth
+        << ", " << output.stream.compressThreads << " compression threads, "
+        << slotBytes / (1024 * 1024) << " MB per slice pair";
+    logAgent.Log(LogAgent::MSG_INFO, buf.str());
+    if (workersCount * depth * slotBytes > available)
+    {
+        logAgent.Log(LogAgent::MSG_WARN, "The memory limit is below one slice pair in flight, it will be exceeded");
+    }
+    if (output.format == MESH_FORMAT_PLY || output.format == MESH_FORMAT_OBJ || output.format == MESH_FORMAT_COMPACT)
+    {
+        logAgent.Log(LogAgent::MSG_WARN, "Indexed formats keep every vertex in memory, which is not covered by the limit");
+    }
+}
+
+// Triangles the pipeline will emit for the slices [firstSlice, endSlice); every slice
+// is read once and only the cube indices are classified. A pair with an unreadable
+// slice is counted as empty, as the pipeline skips it.
+size_t CountSlabTriangles(const SliceSource& source,
+                          int firstSlice,
+                          int endSlice,
+                          int isoLevel,
+                          MemoryGovernor& memory,
+                          PerfCounters& counters,
+                          LogAgent& logAgent,
+                          std::function<bool (void)> needBreak)
+{
+    int dx = source.GetWidth();
+    int dy = source.GetHeight();
+    size_t bufLen = dx * dy;
+    MemoryReservation reservation(memory, "count images", 2 * bufLen * sizeof(int));
+    ImgBuf topSlice(bufLen);
+    ImgBuf bottomSlice(bufLen);
+
+    size_t count = 0;
+    bool topRead = ReadSlice(source, firstSlice, topSlice, counters, logAgent);
+    source.ReleaseSlice(firstSlice);
+    for (int i = firstSlice + 1; i != endSlice && !needBreak(); ++i)
+    {
+        bool bottomRead = ReadSlice(source, i, bottomSlice, counters, logAgent);
+        source.ReleaseSlice(i);
+        if (topRead && bottomRead)
+        {
+            TraceSpan span("classify", "classify", "slice", i - 1);
+            cpptask::Timer timer;
+            count += CountSliceTriangles(topSlice, bottomSlice, dx, dy, isoLevel);
+            counters.gridNs += timer.EndNs();
+            counters.cellsClassified += static_cast<uint64_t>(dx - 1) * (dy - 1);
+        }
+        ++counters.pairsCounted;
+        topSlice.swap(bottomSlice);
+        topRead = bottomRead;
+    }
+    return count;
+}
+
+std::string GetSlabSpoolName(const std::string& fileName, int slab)
+{
+    stringstream spoolName;
+    spoolName << fileName << ".slab" << std::setw(4) << std::setfill('0') << slab;
+    return spoolName.str();
+}
+
+// Size of the file, or the maximum value when it can't be opened
+uint64_t GetFileBytes(const std::string& fileName)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    return file ? static_cast<uint64_t>(file.tellg()) : std::numeric_limits<uint64_t>::max();
+}
+
+// Everything the output of a slab depends on, a checkpoint is resumed only by the same run
+std::string GetRunSignature(const SliceSource& source,
+                            int isoLevel,
+                            const OutputOptions& output,
+                            const std::string& mode,
+                            int slabSlices)
+{
+    stringstream buf;
+    buf << mode << " " << GetMeshFormatName(output.format) << GetCompressionExtension(output.stream.compression)
+        << " " << source.GetWidth() << "x" << source.GetHeight() << " iso " << isoLevel << " slabs of " << slabSlices
+        << " slices " << source.GetSlicesCount() << " " << source.GetSliceName(0) << " " << source.GetSliceName(source.GetSlicesCount() - 1);
+    return buf.str();
+}
+
+// Checkpoint of a slabbed run, none when checkpoints are off. On resume the saved
+// progress is loaded, resumed tells whether there was one for this run.
+std::unique_ptr<Checkpoint> OpenCheckpoint(const std::string& fileName,
+                                           const std::string& run,
+                                           int slabsCount,
+                                           const PipelineOptions& pipeline,
+                                           LogAgent& logAgent,
+                                           bool& resumed)
+{
+    resumed = false;
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (pipeline.checkpoint)
+    {
+        checkpoint.reset(new Checkpoint(GetCheckpointFileName(fileName), run, slabsCount));
+        if (pipeline.resume)
+        {
+            resumed = checkpoint->Load();
+            if (resumed)
+            {
+                int done = 0;
+                for (int slab = 0; slab < slabsCount; ++slab)
+                {
+                    done += checkpoint->Get(slab).done ? 1 : 0;
+                }
+                stringstream buf;
+                buf << "Resuming : " << done << " of " << slabsCount << " slabs are done";
+                logAgent.Log(LogAgent::MSG_INFO, buf.str());
             }
             else
             {
-                CellsBuf* p = nullptr;
-                Concurrency::send(this->filledCells, p);
-                done = true;
+                logAgent.Log(LogAgent::MSG_WARN, "No checkpoint of this conversion to resume, starting from the first slice");
             }
         }
-        this->done();
-    }
-private:
-    BuildGridAgent(const BuildGridAgent&);
-    BuildGridAgent& operator= (const BuildGridAgent&);
-private:
-    MsgImgBuf& freeBuffers;
-    MsgImgBuf& filledBuffers;
-    MsgCellsBuf& freeCells;
-    MsgCellsBuf& filledCells;
-    int dx;
-    Vec3 spacing;
-};
+    }
+    return checkpoint;
+}
 
-class TriangulateAgent : public Concurrency::agent
+// The console is polled by several readers at once, the answer is kept once given
+std::function<bool (void)> MakeSharedNeedBreak(std::function<bool (void)> needBreak)
 {
-public:
+    struct SharedBreak
+    {
+        SharedBreak() : isRequested(false) {}
+        std::mutex mutex;
+        bool isRequested;
+    };
+    std::shared_ptr<SharedBreak> state = std::make_shared<SharedBreak>();
+    return [state, needBreak]() -> bool
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->isRequested = state->isRequested || (needBreak && needBreak());
+        return state->isRequested;
+    };
+}
 
-    TriangulateAgent(MsgCellsBuf& freeCells,
-                     MsgCellsBuf& filledCells,
-                     int isoLevel,
-                     std::string fileName,
-                     bool binaryStl)
-        : freeCells(freeCells),
-          filledCells(filledCells),
-          isoLevel(isoLevel),
-          fileName(fileName),
-          binaryStl(binaryStl)
-    {}
-    virtual void run()
-    {
-        {
-            StlWriter stlWriter(fileName, binaryStl);
-            bool done = false;
-            while (!done)
+void LogCancelled(const Checkpoint* checkpoint, LogAgent& logAgent)
+{
+    logAgent.Log(LogAgent::MSG_WARN, checkpoint != nullptr ?
+        "Cancelled, the finished slabs are kept, run again with --resume to continue" :
+        "Cancelled, the incomplete output is removed");
+}
+
+void WriteChunkedVolume(const SliceSource& source,
+                        int isoLevel,
+                        const std::string& fileName,
+                        const OutputOptions& output,
+                        const PipelineOptions& pipeline,
+                        MemoryGovernor& memory,
+                        PerfCounters& counters,
+                        LogAgent& logAgent,
+                        std::function<bool (void)> needBreak)
+{
+    int pairsCount = source.GetSlicesCount() - 1;
+    int slabsCount = (pairsCount + output.chunkSlices - 1) / output.chunkSlices;
+
+    bool resumed = false;
+    std::unique_ptr<Checkpoint> checkpoint = OpenCheckpoint(fileName,
+        GetRunSignature(source, isoLevel, output, "chunked", output.chunkSlices),
+        slabsCount, pipeline, logAgent, resumed);
+
+    std::vector<ChunkInfo> chunks(slabsCount);
+    std::vector<int> pendingSlabs;
+    for (int slab = 0; slab < slabsCount; ++slab)
+    {
+        // Neighbour slabs share one slice, so the chunks join without gaps
+        ChunkInfo& chunk = chunks[slab];
+        chunk.fileName = GetChunkFileName(fileName, slab);
+        chunk.firstSlice = slab * output.chunkSlices;
+        chunk.lastSlice = std::min(chunk.firstSlice + output.chunkSlices, pairsCount);
+
+        SlabProgress progress = resumed ? checkpoint->Get(slab) : SlabProgress();
+        if (progress.done && GetFileBytes(chunk.fileName) == progress.bytes)
+        {
+            counters.pairsDone += chunk.lastSlice - chunk.firstSlice;
+            chunk.triangles = progress.triangles;
+            chunk.boundsMin = progress.boundsMin;
+            chunk.boundsMax = progress.boundsMax;
+        }
+        else
+        {
+            pendingSlabs.push_back(slab);
+        }
+    }
+
+    std::atomic<int> failedCount(0);
+    int pendingCount = static_cast<int>(pendingSlabs.size());
+    RunSlabs(pendingCount, GetSlabWorkersCount(output, pendingCount), [&](int pending)
+    {
+        int slab = pendingSlabs[pending];
+        ChunkInfo& chunk = chunks[slab];
+        bool isWritten = false;
+        try
+        {
+            std::unique_ptr<MeshWriter> meshWriter = CreateMeshWriter(chunk.fileName, output);
+            TriangulateSlab(source, chunk.firstSlice, chunk.lastSlice + 1, isoLevel, *meshWriter, pipeline, memory, counters, logAgent, needBreak);
+            isWritten = CloseMeshWriter(*meshWriter, output, counters, logAgent);
+            if (isWritten)
             {
-                auto cells = Concurrency::receive(this->filledCells);
-                if (cells != nullptr)
+                chunk.triangles = meshWriter->GetTrianglesCount();
+                chunk.boundsMin = meshWriter->GetBoundsMin();
+                chunk.boundsMax = meshWriter->GetBoundsMax();
+                if (checkpoint && !needBreak())
                 {
-                    std::for_each(cells->begin(), cells->end(),
-                    [&](const GridCell& cell)
-                    {
-                        TriangulateGridCell(cell, isoLevel, stlWriter);
-                    });
+                    SlabProgress progress;
+                    progress.done = true;
+                    progress.triangles = chunk.triangles;
+                    progress.bytes = GetFileBytes(chunk.fileName);
+                    progress.boundsMin = chunk.boundsMin;
+                    progress.boundsMax = chunk.boundsMax;
+                    checkpoint->Update(slab, progress);
+                }
+            }
+        }
+        catch (std::exception& err)
+        {
+            logAgent.Log(LogAgent::MSG_ERROR, err.what());
+        }
+        if (!isWritten && !needBreak())
+        {
+            ++failedCount;
+        }
+        if (!isWritten || needBreak())
+        {
+            // The slab may have stopped half way
+            std::remove(chunk.fileName.c_str());
+        }
+    });
 
-                    Concurrency::send(this->freeCells, cells);
+    if (needBreak())
+    {
+        LogCancelled(checkpoint.get(), logAgent);
+        return;
+    }
+    if (failedCount > 0)
+    {
+        // The manifest would list chunks that are missing, the checkpoint still has the finished ones
+        stringstream buf;
+        buf << failedCount << " of " << slabsCount << " chunks failed, no manifest is written";
+        if (checkpoint)
+        {
+            buf << ", run again with --resume to redo them";
+        }
+        throw std::runtime_error(buf.str());
+    }
+    std::string manifestFile = GetManifestFileName(fileName);
+    WriteManifest(manifestFile, output.format, output.chunkSlices, chunks);
+    logAgent.Log(LogAgent::MSG_INFO, "Manifest " + manifestFile + " written");
+    if (checkpoint)
+    {
+        checkpoint->Remove();
+    }
+}
+
+// The series split into slabs overlapping by one slice, each one triangulated end
+// to end on its own worker into a SlabBuffer. The buffers are replayed into the
+// single output in the slab order as soon as all the slabs before them are done,
+// so the facets come out exactly as from one pipeline. With a checkpoint the
+// buffers are spooled in full and kept until the output is complete, a resumed
+// run replays the finished slabs from their spools. A failed slab fails the run.
+void WriteSlabParallel(const SliceSource& source,
+                       int isoLevel,
+                       const std::string& fileName,
+                       const OutputOptions& output,
+                       const PipelineOptions& pipeline,
+                       MemoryGovernor& memory,
+                       PerfCounters& counters,
+                       LogAgent& logAgent,
+                       std::function<bool (void)> needBreak)
+{
+    int pairsCount = source.GetSlicesCount() - 1;
+    int slabSlices = (pairsCount + pipeline.slabs - 1) / pipeline.slabs;
+    int slabsCount = (pairsCount + slabSlices - 1) / slabSlices;
+    int workersCount = output.chunkWorkers > 0 ? std::min(output.chunkWorkers, slabsCount) : slabsCount;
+    // Slabs wait in their buffers until stitched, together they get a quarter of the memory limit
+    size_t memoryTriangles = SLAB_MEMORY_TRIANGLES;
+    if (memory.GetLimit() > 0)
+    {
+        memoryTriangles = std::min<size_t>(memoryTriangles, static_cast<size_t>(memory.GetLimit() / 4 / slabsCount / sizeof(Triangle)));
+    }
+
+    bool resumed = false;
+    std::unique_ptr<Checkpoint> checkpoint = OpenCheckpoint(fileName,
+        GetRunSignature(source, isoLevel, output, "stitched", slabSlices),
+        slabsCount, pipeline, logAgent, resumed);
+
+    std::unique_ptr<MeshWriter> meshWriter = CreateMeshWriter(fileName, output);
+
+    // A failed slab leaves no buffer, the output stops before it
+    std::vector<std::unique_ptr<SlabBuffer> > buffers(slabsCount);
+    std::vector<bool> finished(slabsCount, false);
+    std::vector<int> pendingSlabs;
+    int failedCount = 0;
+    std::mutex finishedGuard;
+    std::condition_variable slabFinished;
+
+    for (int slab = 0; slab < slabsCount; ++slab)
+    {
+        if (resumed && checkpoint->Get(slab).done)
+        {
+            std::unique_ptr<SlabBuffer> buffer(new SlabBuffer(GetSlabSpoolName(fileName, slab), memoryTriangles, memory));
+            if (buffer->Restore(checkpoint->Get(slab).triangles))
+            {
+                counters.pairsDone += std::min(slabSlices, pairsCount - slab * slabSlices);
+                buffers[slab] = std::move(buffer);
+                finished[slab] = true;
+                continue;
+            }
+            checkpoint->Reset(slab);
+        }
+        pendingSlabs.push_back(slab);
+    }
+
+    std::thread workers([&]()
+    {
+        int pendingCount = static_cast<int>(pendingSlabs.size());
+        RunSlabs(pendingCount, std::min(workersCount, pendingCount), [&](int pending)
+        {
+            int slab = pendingSlabs[pending];
+            int first = slab * slabSlices;
+            int last = std::min(first + slabSlices, pairsCount);
+
+            std::unique_ptr<SlabBuffer> buffer;
+            bool isFailed = false;
+            try
+            {
+                buffer.reset(new SlabBuffer(GetSlabSpoolName(fileName, slab), memoryTriangles, memory));
+                if (checkpoint)
+                {
+                    buffer->SetPersistent();
                 }
-                else
+                TriangulateSlab(source, first, last + 1, isoLevel, *buffer, pipeline, memory, counters, logAgent, needBreak);
+                buffer->Close();
+                if (checkpoint && !needBreak())
                 {
-                     done = true;
+                    SlabProgress progress;
+                    progress.done = true;
+                    progress.triangles = buffer->GetTrianglesCount();
+                    progress.bytes = buffer->GetSpoolBytes();
+                    progress.boundsMin = buffer->GetBoundsMin();
+                    progress.boundsMax = buffer->GetBoundsMax();
+                    checkpoint->Update(slab, progress);
                 }
             }
+            catch (std::exception& err)
+            {
+                logAgent.Log(LogAgent::MSG_ERROR, err.what());
+                isFailed = true;
+            }
+            if (isFailed)
+            {
+                // Whatever the slab spooled is incomplete
+                buffer.reset();
+                std::remove(GetSlabSpoolName(fileName, slab).c_str());
+            }
+
+            std::lock_guard<std::mutex> lock(finishedGuard);
+            buffers[slab] = std::move(buffer);
+            finished[slab] = true;
+            failedCount += isFailed ? 1 : 0;
+            slabFinished.notify_all();
+        });
+    });
+
+    // The output is written while the later slabs are still being triangulated
+    try
+    {
+        for (int slab = 0; slab < slabsCount && !needBreak(); ++slab)
+        {
+            std::unique_ptr<SlabBuffer> buffer;
+            {
+                std::unique_lock<std::mutex> lock(finishedGuard);
+                slabFinished.wait(lock, [&]() { return finished[slab]; });
+                buffer = std::move(buffers[slab]);
+            }
+            if (!buffer)
+            {
+                break;
+            }
+            TraceSpan span("write", "stitch slab", "slab", slab);
+            buffer->Replay(*meshWriter);
         }
-        this->done();
-    }
-private:
-    TriangulateAgent(const TriangulateAgent&);
-    TriangulateAgent& operator= (const TriangulateAgent&);
-private:
-    MsgCellsBuf& freeCells;
-    MsgCellsBuf& filledCells;
-    int isoLevel;
-    std::string fileName;
-    bool binaryStl;
-};
+    }
+    catch (...)
+    {
+        workers.join();
+        throw;
+    }
+    workers.join();
+
+    if (needBreak())
+    {
+        meshWriter.reset();
+        std::remove(fileName.c_str());
+        LogCancelled(checkpoint.get(), logAgent);
+        return;
+    }
+    if (failedCount > 0)
+    {
+        meshWriter.reset();
+        std::remove(fileName.c_str());
+        stringstream buf;
+        buf << failedCount << " of " << slabsCount << " slabs failed, the incomplete output is removed";
+        if (checkpoint)
+        {
+            buf << ", run again with --resume to redo them";
+        }
+        throw std::runtime_error(buf.str());
+    }
+    if (!CloseMeshWriter(*meshWriter, output, counters, logAgent))
+    {
+        // The slabs are complete, a resumed run only writes the output again
+        meshWriter.reset();
+        std::remove(fileName.c_str());
+        throw std::runtime_error(checkpoint ? "The output could not be completed and is removed, run again with --resume to write it"
+                                            : "The output could not be completed and is removed");
+    }
+    if (checkpoint)
+    {
+        for (int slab = 0; slab < slabsCount; ++slab)
+        {
+            std::remove(GetSlabSpoolName(fileName, slab).c_str());
+        }
+        checkpoint->Remove();
+    }
+}
 
-bool ReadDcmFile(const string& fileName, vector<int>& buffer, LogAgent& logAgent)
+// Binary STL in two passes: the triangles of every slab are counted first, then the
+// file is created of the exact size, mapped, and the slabs are triangulated in
+// parallel, each one straight into its records at the prefix sum offset. The
+// checkpoint keeps the counts and the slabs whose records are flushed, a resumed
+// run maps the same file again and fills the rest.
+void WriteMappedStl(const SliceSource& source,
+                    int isoLevel,
+                    const std::string& fileName,
+                    const OutputOptions& output,
+                    const PipelineOptions& pipeline,
+                    MemoryGovernor& memory,
+                    PerfCounters& counters,
+                    LogAgent& logAgent,
+                    std::function<bool (void)> needBreak)
 {
-    DcmFileFormat fileformat;
+    int pairsCount = source.GetSlicesCount() - 1;
+    int slabSlices = output.chunkSlices > 0 ? output.chunkSlices : MAPPED_SLAB_SLICES;
+    int slabsCount = (pairsCount + slabSlices - 1) / slabSlices;
+    int workersCount = GetSlabWorkersCount(output, slabsCount);
 
-    OFCondition status = fileformat.loadFile(fileName.c_str(), EXS_Unknown,
-                                             EGL_withoutGL, DCM_MaxReadLength, ERM_autoDetect);
-    if (status.good()) 
-    {
-        DcmDataset *dataset = fileformat.getDataset();
+    // The checkpoint is first saved after the count pass, a loaded one always has the counts
+    bool resumed = false;
+    std::unique_ptr<Checkpoint> checkpoint = OpenCheckpoint(fileName,
+        GetRunSignature(source, isoLevel, output, "mapped", slabSlices),
+        slabsCount, pipeline, logAgent, resumed);
 
-        std::shared_ptr<DicomImage> image(new DicomImage(&fileformat, dataset->getOriginalXfer()));
-        image->hideAllOverlays();
+    cpptask::Timer timer;
+    timer.Start();
 
-        if (image->getStatus() == EIS_Normal)
+    std::vector<size_t> counts(slabsCount);
+    if (resumed)
+    {
+        for (int slab = 0; slab < slabsCount; ++slab)
         {
-            if (!image->isMonochrome())
+            counts[slab] = checkpoint->Get(slab).triangles;
+        }
+    }
+    else
+    {
+        std::atomic<int> failedCount(0);
+        counters.pairsToCount = pairsCount;
+        RunSlabs(slabsCount, workersCount, [&](int slab)
+        {
+            int first = slab * slabSlices;
+            int last = std::min(first + slabSlices, pairsCount);
+            try
             {
-                image.reset(image->createMonochromeImage());
+                counts[slab] = CountSlabTriangles(source, first, last + 1, isoLevel, memory, counters, logAgent, needBreak);
             }
-            image->setNoVoiTransformation();
-            const DiPixel* pixelData = image->getInterData();
-            if (pixelData->getRepresentation() == EPR_Uint16)
+            catch (std::exception& err)
             {
-                std::copy(static_cast<const unsigned short*>(pixelData->getData()), 
-                         static_cast<const unsigned short*>(pixelData->getData()) + pixelData->getCount(), 
-                         buffer.begin());
+                logAgent.Log(LogAgent::MSG_ERROR, err.what());
+                ++failedCount;
             }
-            else if (pixelData->getRepresentation() == EPR_Sint16)
+        });
+        if (needBreak())
+        {
+            LogCancelled(nullptr, logAgent);
+            return;
+        }
+        if (failedCount > 0)
+        {
+            throw std::runtime_error("Counting the triangles failed, no output is written");
+        }
+    }
+
+    std::vector<size_t> offsets(slabsCount + 1, 0);
+    for (int i = 0; i < slabsCount; ++i)
+    {
+        offsets[i + 1] = offsets[i] + counts[i];
+    }
+    size_t total = offsets.back();
+    if (total > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Too many triangles for a binary STL file");
+    }
+    if (!resumed)
+    {
+        stringstream buf;
+        buf << "Counted " << total << " triangles in " << timer.End() << " ms";
+        logAgent.Log(LogAgent::MSG_INFO, buf.str());
+    }
+
+    uint64_t fileSize = STL_HEADER_SIZE + static_cast<uint64_t>(total) * STL_RECORD_SIZE;
+    bool keepFile = resumed && GetFileBytes(fileName) == fileSize;
+    std::vector<int> pendingSlabs;
+    for (int slab = 0; slab < slabsCount; ++slab)
+    {
+        SlabProgress progress = resumed ? checkpoint->Get(slab) : SlabProgress();
+        if (keepFile && progress.done)
+        {
+            counters.pairsDone += std::min(slabSlices, pairsCount - slab * slabSlices);
+        }
+        else
+        {
+            pendingSlabs.push_back(slab);
+            if (checkpoint)
             {
-                std::copy(static_cast<const short*>(pixelData->getData()), 
-                         static_cast<const short*>(pixelData->getData()) + pixelData->getCount(), 
-                         buffer.begin());
+                progress.done = false;
+                progress.triangles = counts[slab];
+                checkpoint->Update(slab, progress);
             }
-            else if (pixelData->getRepresentation() == EPR_Uint8 || pixelData->getRepresentation() == EPR_MinUnsigned)
+        }
+    }
+
+    MappedFile file(fileName, fileSize, keepFile);
+    char* data = file.GetData();
+    std::fill(data, data + STL_HEADER_SIZE, 0);
+    uint32_t count = static_cast<uint32_t>(total);
+    std::memcpy(data + 80, &count, sizeof(count));
+
+    timer.Start();
+    std::atomic<int> failedCount(0);
+    int pendingCount = static_cast<int>(pendingSlabs.size());
+    RunSlabs(pendingCount, std::min(workersCount, pendingCount), [&](int pending)
+    {
+        int slab = pendingSlabs[pending];
+        int first = slab * slabSlices;
+        int last = std::min(first + slabSlices, pairsCount);
+        uint64_t offset = STL_HEADER_SIZE + static_cast<uint64_t>(offsets[slab]) * STL_RECORD_SIZE;
+        MappedStlWriter meshWriter(data + offset, counts[slab]);
+        try
+        {
+            TriangulateSlab(source, first, last + 1, isoLevel, meshWriter, pipeline, memory, counters, logAgent, needBreak);
+        }
+        catch (std::exception& err)
+        {
+            logAgent.Log(LogAgent::MSG_ERROR, err.what());
+        }
+        meshWriter.Close();
+        counters.bytesWritten += meshWriter.GetTrianglesCount() * STL_RECORD_SIZE;
+        if (meshWriter.GetTrianglesCount() != counts[slab])
+        {
+            // The records left zero filled would look like degenerate triangles
+            if (!needBreak())
             {
-                std::copy(static_cast<const unsigned char*>(pixelData->getData()), 
-                         static_cast<const unsigned char*>(pixelData->getData()) + pixelData->getCount(), 
-                         buffer.begin());
+                ++failedCount;
             }
-            else if (pixelData->getRepresentation() == EPR_Sint8 || pixelData->getRepresentation() == EPR_MinSigned)
+        }
+        else if (checkpoint && !needBreak())
+        {
+            try
             {
-                std::copy(static_cast<const char*>(pixelData->getData()), 
-                         static_cast<const char*>(pixelData->getData()) + pixelData->getCount(), 
-                         buffer.begin());
+                file.Flush(offset, counts[slab] * STL_RECORD_SIZE);
+                SlabProgress progress;
+                progress.done = true;
+                progress.triangles = counts[slab];
+                progress.bytes = offset + counts[slab] * STL_RECORD_SIZE;
+                progress.boundsMin = meshWriter.GetBoundsMin();
+                progress.boundsMax = meshWriter.GetBoundsMax();
+                checkpoint->Update(slab, progress);
             }
-            else
+            catch (std::exception& err)
             {
-                stringstream buf;
-                buf << "File " << fileName << " have unsupported format";
-                logAgent.Log(LogAgent::MSG_WARN, buf.str());
-                return false;
+                logAgent.Log(LogAgent::MSG_ERROR, err.what());
             }
-            stringstream buf;
-            buf << "File " << fileName << " processed";
-            logAgent.Log(LogAgent::MSG_INFO, buf.str());
-            return true;
         }
+    });
+    file.Close();
+
+    if (needBreak())
+    {
+        if (!checkpoint)
+        {
+            std::remove(fileName.c_str());
+        }
+        LogCancelled(checkpoint.get(), logAgent);
+        return;
     }
-    else
+
+    if (failedCount > 0)
     {
+        // With a checkpoint the file keeps its size and the finished slabs, a resumed run redoes the rest
         stringstream buf;
-        buf << "Can't read file " << fileName;
-        logAgent.Log(LogAgent::MSG_WARN, buf.str());
+        buf << failedCount << " of " << slabsCount << " slabs produced other triangles than counted";
+        if (checkpoint)
+        {
+            buf << ", run again with --resume to redo them";
+        }
+        else
+        {
+            std::remove(fileName.c_str());
+            buf << ", the incomplete output is removed";
+        }
+        throw std::runtime_error(buf.str());
+    }
+
+    stringstream buf;
+    buf << "Output " << GetMeshFormatName(output.format) << " : " << total << " triangles, "
+        << file.GetSize() << " bytes mapped, filled in " << timer.End() << " ms";
+    logAgent.Log(LogAgent::MSG_INFO, buf.str());
+    if (checkpoint)
+    {
+        checkpoint->Remove();
     }
-    return false;
 }
 
-template<class T>
-class PixelReader
+}
+
+void WriteVolume(const SliceSource& source,
+                 int isoLevel,
+                 const std::string& fileName,
+                 const OutputOptions& requestedOutput,
+                 const PipelineOptions& requestedPipeline,
+                 OFLogger& logger,
+                 std::function<bool (void)> needBreak)
 {
-public:
-    PixelReader(const vector<T>& buf, int w) : buf(buf), w(w) {}
-    T GetPixel(int x, int y)
+    OFLOG_INFO(logger, "Start triangulation ..." << OFendl);
+
+    LogAgent logAgent(logger);
+    logAgent.SetRateLimit(LogAgent::MSG_INFO, INFO_MESSAGES_PER_SECOND);
+    logAgent.Start();
+    PerfCounters counters;
+    cpptask::Timer wallTimer;
+    std::unique_ptr<ProgressAgent> progress = StartProgress(source, requestedPipeline, counters);
+    StartRunTrace(requestedPipeline);
+
+    OutputOptions output = requestedOutput;
+    PipelineOptions pipeline = requestedPipeline;
+    int pairsCount = source.GetSlicesCount() - 1;
+    if (pipeline.checkpoint && !output.mappedStl && output.chunkSlices == 0 && pipeline.slabs <= 1)
+    {
+        // Progress is kept per slab, the single output is stitched from slabs processed one at a time
+        pipeline.slabs = (pairsCount + MAPPED_SLAB_SLICES - 1) / MAPPED_SLAB_SLICES;
+        if (output.chunkWorkers == 0)
+        {
+            output.chunkWorkers = 1;
+        }
+    }
+    MemoryGovernor memory(pipeline.memoryLimit);
+    if (pipeline.memoryLimit > 0)
     {
-        return buf[x + w *y];
+        PlanMemory(source.GetWidth(), source.GetHeight(), pairsCount, output, pipeline, logAgent);
     }
-private:
-    PixelReader& operator=(const PixelReader&);
-    const vector<T>& buf;
-    int w;
-};
 
-void BuildGridCells(vector<GridCell>& cells, int dx, float z1, float z2, 
-                     const Vec3& spacing, const vector<int>& topSlice, const vector<int>& bottomSlice)
-{
-    int cellsWidth = dx - 1;
-   
-    PixelReader<int> topReader(topSlice, dx);
-    PixelReader<int> bottomReader(bottomSlice, dx);
-
-    Concurrency::parallel_for(size_t(0), cells.size() - 1,
-        [&](size_t index)
-    {
-        int y = index / cellsWidth;
-        int x = index - y * cellsWidth;
-        
-        GridCell cell;
-        cell.p[4] = Vec3(x * spacing.x, y * spacing.y, z1);
-        cell.val[4] = topReader.GetPixel(x ,y);
-        cell.p[5] = Vec3((x + 1) * spacing.x, y * spacing.y, z1);
-        cell.val[5] = topReader.GetPixel(x + 1, y);
-        cell.p[6] = Vec3((x + 1) * spacing.x, (y + 1) * spacing.y, z1);
-        cell.val[6] = topReader.GetPixel(x + 1, y + 1);
-        cell.p[7] = Vec3(x * spacing.x, (y + 1) * spacing.y, z1);
-        cell.val[7] = topReader.GetPixel(x, y + 1);
-
-        cell.p[0] = Vec3(x * spacing.x, y * spacing.y, z2);
-        cell.val[0] = bottomReader.GetPixel(x, y);
-        cell.p[1] = Vec3((x + 1) * spacing.x, y * spacing.y, z2);
-        cell.val[1] = bottomReader.GetPixel(x + 1, y);
-        cell.p[2] = Vec3((x + 1) * spacing.x, (y + 1) * spacing.y, z2);
-        cell.val[2] = bottomReader.GetPixel(x + 1, y + 1);
-        cell.p[3] = Vec3(x * spacing.x, (y + 1) * spacing.y, z2);
-        cell.val[3] = bottomReader.GetPixel(x, y + 1);
-
-        cells[index] = cell;
-    });
+    std::function<bool (void)> sharedNeedBreak = MakeSharedNeedBreak(needBreak);
+
+    // A failed conversion is reported like a finished one and then thrown to the caller
+    std::exception_ptr failure;
+    try
+    {
+        if (output.mappedStl)
+        {
+            WriteMappedStl(source, isoLevel, fileName, output, pipeline, memory, counters, logAgent, sharedNeedBreak);
+        }
+        else if (output.chunkSlices > 0)
+        {
+            WriteChunkedVolume(source, isoLevel, fileName, output, pipeline, memory, counters, logAgent, sharedNeedBreak);
+        }
+        else if (pipeline.slabs > 1 && pairsCount > 1)
+        {
+            WriteSlabParallel(source, isoLevel, fileName, output, pipeline, memory, counters, logAgent, sharedNeedBreak);
+        }
+        else
+        {
+            std::unique_ptr<MeshWriter> meshWriter = CreateMeshWriter(fileName, output);
+            try
+            {
+                TriangulateSlab(source, 0, source.GetSlicesCount(), isoLevel, *meshWriter, pipeline, memory, counters, logAgent, sharedNeedBreak);
+            }
+            catch (...)
+            {
+                meshWriter.reset();
+                std::remove(fileName.c_str());
+                throw;
+            }
+            if (sharedNeedBreak())
+            {
+                meshWriter.reset();
+                std::remove(fileName.c_str());
+                LogCancelled(nullptr, logAgent);
+            }
+            else if (!CloseMeshWriter(*meshWriter, output, counters, logAgent))
+            {
+                meshWriter.reset();
+                std::remove(fileName.c_str());
+                throw std::runtime_error("The output could not be completed and is removed");
+            }
+        }
+    }
+    catch (std::exception& err)
+    {
+        logAgent.Log(LogAgent::MSG_ERROR, err.what());
+        failure = std::current_exception();
+    }
+
+    if (progress)
+    {
+        progress->Stop();
+    }
+    logAgent.Log(LogAgent::MSG_INFO, memory.GetReport());
+    ReportCounters(counters, wallTimer.EndNs(), pipeline, logAgent);
+    logAgent.Stop();
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
 }
 
+bool TriangulateVolume(const SliceSource& source,
+                       int isoLevel,
+                       MeshWriter& meshWriter,
+                       const PipelineOptions& requestedPipeline,
+                       OFLogger& logger,
+                       std::function<bool (void)> needBreak)
+{
+    LogAgent logAgent(logger);
+    logAgent.SetRateLimit(LogAgent::MSG_INFO, INFO_MESSAGES_PER_SECOND);
+    logAgent.Start();
+    PerfCounters counters;
+    cpptask::Timer wallTimer;
+    std::unique_ptr<ProgressAgent> progress = StartProgress(source, requestedPipeline, counters);
+    StartRunTrace(requestedPipeline);
+
+    PipelineOptions pipeline = requestedPipeline;
+    MemoryGovernor memory(pipeline.memoryLimit);
+    if (pipeline.memoryLimit > 0)
+    {
+        OutputOptions output;
+        PlanMemory(source.GetWidth(), source.GetHeight(), source.GetSlicesCount() - 1, output, pipeline, logAgent);
+    }
+
+    std::function<bool (void)> sharedNeedBreak = MakeSharedNeedBreak(needBreak);
+    bool isComplete = false;
+    try
+    {
+        if (source.GetSlicesCount() > 1)
+        {
+            TriangulateSlab(source, 0, source.GetSlicesCount(), isoLevel, meshWriter, pipeline, memory, counters, logAgent, sharedNeedBreak);
+        }
+        isComplete = !sharedNeedBreak();
+    }
+    catch (...)
+    {
+        progress.reset();
+        logAgent.Stop();
+        throw;
+    }
+    if (progress)
+    {
+        progress->Stop();
+    }
+    ReportCounters(counters, wallTimer.EndNs(), pipeline, logAgent);
+    logAgent.Stop();
+    return isComplete;
 }
 
 void ReadVolumeFromDcmFiles(int dx,
                             int dy,
                             const Vec3& spacing,
                             const SlicesPositions& slicesPositions, 
+                            const Vec3& rowDirection,
+                            const Vec3& columnDirection,
                             int isoLevel, 
                             const std::string& fileName, 
-                            bool binaryStl,
+                            const OutputOptions& output,
+                            const PipelineOptions& pipeline,
                             OFLogger& logger, 
                             std::function<bool (void)> needBreak)
 {
-    OFLOG_INFO(logger, "Start triangulation ..." << OFendl);
-
-    size_t bufLen = dx * dy;
-    
-    ImgBuf topSlice1(bufLen);
-    ImgBuf bottomSlice1(bufLen);
-    ImgBuf topSlice2(bufLen);
-    ImgBuf bottomSlice2(bufLen);
-
-    CellsBuf cells1((dx - 1) * (dy - 1));
-    CellsBuf cells2((dx - 1) * (dy - 1));
-
-    MsgImgBuf freeBuffers;
-    MsgImgBuf filledBuffers;
-    MsgCellsBuf freeCells;
-    MsgCellsBuf filledCells;
+    DcmSliceSource source(dx, dy, spacing, slicesPositions, rowDirection, columnDirection);
+    source.SetDropCache(pipeline.memoryLimit > 0);
+    WriteVolume(source, isoLevel, fileName, output, pipeline, logger, needBreak);
+}
 
+bool ComputeHistogram(const SliceSource& source,
+                      const PipelineOptions& pipelineOptions,
+                      IntensityHistogram& histogram,
+                      OFLogger& logger,
+                      std::function<bool (void)> needBreak)
+{
     LogAgent logAgent(logger);
+    logAgent.SetRateLimit(LogAgent::MSG_INFO, INFO_MESSAGES_PER_SECOND);
     logAgent.Start();
+    PerfCounters counters;
+    cpptask::Timer wallTimer;
+    StartRunTrace(pipelineOptions);
+    std::function<bool (void)> sharedNeedBreak = MakeSharedNeedBreak(needBreak);
+    size_t bufLen = static_cast<size_t>(source.GetWidth()) * source.GetHeight();
+    std::atomic<int> nextSlice(0);
 
-    FileReadAgent frAgent(needBreak, slicesPositions, freeBuffers, filledBuffers, logAgent);
-    BuildGridAgent bgAgent(freeBuffers, filledBuffers, freeCells, filledCells, dx, spacing);
-    TriangulateAgent trAgent(freeCells, filledCells, isoLevel, fileName, binaryStl);
+    Pipeline pipeline;
+    pipeline.AddStage("read", pipelineOptions.readThreads, [&]()
+    {
+        IntensityHistogram local;
+        ImgBuf buffer(bufLen);
+        for (int index = nextSlice++; index < source.GetSlicesCount() && !sharedNeedBreak(); index = nextSlice++)
+        {
+            if (ReadSlice(source, index, buffer, counters, logAgent))
+            {
+                local.Add(buffer.data(), buffer.size());
+            }
+            source.ReleaseSlice(index);
+        }
+        histogram.Merge(local);
+    });
+    try
+    {
+        pipeline.Run();
+    }
+    catch (...)
+    {
+        logAgent.Stop();
+        throw;
+    }
+    ReportCounters(counters, wallTimer.EndNs(), pipelineOptions, logAgent);
+    logAgent.Stop();
+    return !sharedNeedBreak();
+}
 
-    Concurrency::send(freeBuffers, make_pair(&topSlice1, &bottomSlice1));
-    Concurrency::send(freeBuffers, make_pair(&topSlice2, &bottomSlice2));
+bool SweepIsoLevels(const SliceSource& source,
+                    const std::vector<int>& isoLevels,
+                    const PipelineOptions& pipelineOptions,
+                    std::vector<SweepLevel>& levels,
+                    OFLogger& logger,
+                    std::function<bool (void)> needBreak)
+{
+    LogAgent logAgent(logger);
+    logAgent.SetRateLimit(LogAgent::MSG_INFO, INFO_MESSAGES_PER_SECOND);
+    logAgent.Start();
+    PerfCounters counters;
+    cpptask::Timer wallTimer;
+    StartRunTrace(pipelineOptions);
+    std::function<bool (void)> sharedNeedBreak = MakeSharedNeedBreak(needBreak);
 
-    Concurrency::send(freeCells, &cells1);
-    Concurrency::send(freeCells, &cells2);
+    std::vector<int> sorted(isoLevels);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    std::vector<uint64_t> activeCells(sorted.size());
+    std::vector<uint64_t> triangles(sorted.size());
+    std::mutex mutex;
 
-    frAgent.start();
-    bgAgent.start();
-    trAgent.start();
+    int dx = source.GetWidth();
+    int dy = source.GetHeight();
+    int pairsCount = source.GetSlicesCount() - 1;
+    std::atomic<int> nextSlab(0);
 
-    Concurrency::agent* agents[3]={&frAgent, &bgAgent, &trAgent};
-    Concurrency::agent::wait_for_all(3, agents);
+    Pipeline pipeline;
+    pipeline.AddStage("sweep", pipelineOptions.readThreads, [&]()
+    {
+        std::vector<uint64_t> localCells(sorted.size());
+        std::vector<uint64_t> localTriangles(sorted.size());
+        ImgBuf topSlice(static_cast<size_t>(dx) * dy);
+        ImgBuf bottomSlice(static_cast<size_t>(dx) * dy);
+        for (int first = nextSlab++ * SWEEP_SLAB_PAIRS; first < pairsCount && !sharedNeedBreak();
+             first = nextSlab++ * SWEEP_SLAB_PAIRS)
+        {
+            int end = std::min(first + SWEEP_SLAB_PAIRS, pairsCount) + 1;
+            bool topRead = ReadSlice(source, first, topSlice, counters, logAgent);
+            source.ReleaseSlice(first);
+            for (int i = first + 1; i != end && !sharedNeedBreak(); ++i)
+            {
+                bool bottomRead = ReadSlice(source, i, bottomSlice, counters, logAgent);
+                source.ReleaseSlice(i);
+                if (topRead && bottomRead)
+                {
+                    TraceSpan span("classify", "classify", "slice", i - 1);
+                    cpptask::Timer timer;
+                    CountSliceTrianglesSweep(topSlice, bottomSlice, dx, dy, sorted, localCells, localTriangles);
+                    counters.gridNs += timer.EndNs();
+                    counters.cellsClassified += static_cast<uint64_t>(dx - 1) * (dy - 1);
+                    ++counters.pairsDone;
+                }
+                topSlice.swap(bottomSlice);
+                topRead = bottomRead;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < sorted.size(); ++i)
+        {
+            activeCells[i] += localCells[i];
+            triangles[i] += localTriangles[i];
+        }
+    });
+    try
+    {
+        pipeline.Run();
+    }
+    catch (...)
+    {
+        logAgent.Stop();
+        throw;
+    }
 
+    levels.clear();
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        SweepLevel level;
+        level.isoLevel = sorted[i];
+        level.activeCells = activeCells[i];
+        level.triangles = triangles[i];
+        levels.push_back(level);
+        counters.activeCells += level.activeCells;
+        counters.trianglesEmitted += level.triangles;
+    }
+    ReportCounters(counters, wallTimer.EndNs(), pipelineOptions, logAgent);
     logAgent.Stop();
+    return !sharedNeedBreak();
 }
 
-double EstimateProcessingTime(int dx,
-                              int dy,
-                              const Vec3& spacing,
-                              const SlicesPositions& slicesPositions, 
-                              int isoLevel,
-                              const std::string& fileName,
-                              bool binaryStl,
-                              OFLogger& logger)
+TimeEstimate EstimateProcessingTime(const SliceSource& source,
+                                    int isoLevel,
+                                    const OutputOptions& output,
+                                    const PipelineOptions& pipeline,
+                                    OFLogger& logger)
 {
     OFLOG_INFO(logger, "Start time estimation ..." << OFendl);
 
-    cpptask::Timer timer;
-    timer.Start();
-
-    auto i = slicesPositions.begin();
-    if (i == slicesPositions.end())
+    TimeEstimate estimate;
+    int pairsCount = source.GetSlicesCount() - 1;
+    if (pairsCount < 1)
     {
-        return 0.;
-    }
-    auto n = next(i);
-    if (n == slicesPositions.end())
-    {
-        return 0.;
+        return estimate;
     }
 
+    cpptask::Timer samplingTimer;
+    samplingTimer.Start();
 
-    size_t bufLen = dx * dy;
-    ImgBuf topSlice(bufLen);
-    ImgBuf bottomSlice(bufLen);
-
-    CellsBuf cells((dx - 1) * (dy - 1));
+    int dx = source.GetWidth();
+    int dy = source.GetHeight();
+    GridAxes axes;
+    PatientTransform transform;
+    MakeGridFrame(dx, dy, source.GetSpacing(), source.GetGeometry(), axes, transform);
 
-    LogAgent logAgent(logger);
-    logAgent.Start();
-
-    double time = 0;
+    // One pair in ESTIMATE_PAIRS_FRACTION is sampled. The pairs are sampled in parallel,
+    // a round of one pair per thread takes about one pair of wall time while a conversion
+    // on the same threads takes pairsCount / threads, so the rounds are capped to
+    // ESTIMATE_MAX_SHARE of that. A short series still takes the one round. Each
+    // sampled pair holds the memory of a pair slot, a round keeps to the limit.
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    if (pipeline.memoryLimit > 0)
     {
-        StlWriter stlWriter(fileName, binaryStl);
-
-        int z = 0;
-        if (ReadDcmFile(i->first, topSlice, logAgent) &&
-            ReadDcmFile(n->first, bottomSlice, logAgent))
+        threads = static_cast<int>(std::max<uint64_t>(1, std::min<uint64_t>(threads, pipeline.memoryLimit / GetPairSlotBytes(dx, dy))));
+    }
+    int rounds = std::max(1, static_cast<int>(pairsCount * ESTIMATE_MAX_SHARE / threads));
+    int samplesCount = std::max(ESTIMATE_MIN_PAIRS, std::min(ESTIMATE_MAX_PAIRS, pairsCount / ESTIMATE_PAIRS_FRACTION));
+    samplesCount = std::min(std::min(samplesCount, rounds * threads), pairsCount);
+    std::vector<PairSample> samples(samplesCount);
+    std::vector<PairSlot> slots(std::min(threads, samplesCount));
+    std::for_each(slots.begin(), slots.end(), [&](PairSlot& slot)
+    {
+        slot.topSlice.resize(static_cast<size_t>(dx) * dy);
+        slot.bottomSlice.resize(static_cast<size_t>(dx) * dy);
+        slot.cells.resize(static_cast<size_t>(dx - 1) * (dy - 1));
+    });
+    for (int first = 0; first < samplesCount; first += threads)
+    {
+        ParallelFor(size_t(first), size_t(std::min(first + threads, samplesCount)), [&](size_t sample)
         {
-            BuildGridCells(cells, dx, z * spacing.z, (z + 1) * spacing.z, 
-                            spacing,
-                            topSlice, bottomSlice);
-            std::for_each(cells.begin(), cells.end(),
-                [&](const GridCell& cell)
+            // Middles of equal parts of the series, the first pairs are often empty air
+            int pair = static_cast<int>((2 * static_cast<int64_t>(sample) + 1) * pairsCount / (2 * samplesCount));
+            PairSample& result = samples[sample];
+            PairSlot& slot = slots[sample - first];
+            cpptask::Timer timer;
+            timer.Start();
+            if (!source.ReadSlice(pair, slot.topSlice, result.error) || !source.ReadSlice(pair + 1, slot.bottomSlice, result.error))
             {
-                TriangulateGridCell(cell, isoLevel, stlWriter);
+                return;
+            }
+            source.ReleaseSlice(pair);
+            source.ReleaseSlice(pair + 1);
+            result.decodeMs = timer.End();
+            result.isRead = true;
+
+            timer.Start();
+            BuildGridCells(slot.cells, axes, pair, slot.topSlice, slot.bottomSlice);
+            result.gridMs = timer.End();
+
+            CountingMeshWriter counter;
+            timer.Start();
+            std::for_each(slot.cells.begin(), slot.cells.end(), [&](const GridCell& cell)
+            {
+                TriangulateGridCell(cell, isoLevel, transform, counter);
             });
-        }
+            result.triangulateMs = timer.End();
+            result.triangles = counter.GetTrianglesCount();
+        });
+    }
 
-        logAgent.Stop();
+    std::vector<double> decodeMs;
+    std::vector<double> gridMs;
+    std::vector<double> triangulateMs;
+    std::vector<size_t> triangles;
+    std::for_each(samples.begin(), samples.end(), [&](const PairSample& sample)
+    {
+        if (!sample.isRead)
+        {
+            OFLOG_WARN(logger, sample.error << OFendl);
+            return;
+        }
+        decodeMs.push_back(sample.decodeMs);
+        gridMs.push_back(sample.gridMs);
+        triangulateMs.push_back(sample.triangulateMs);
+        triangles.push_back(sample.triangles);
+    });
+    if (decodeMs.empty())
+    {
+        return estimate;
+    }
 
-        time = timer.End();
+    double scale = static_cast<double>(pairsCount) / decodeMs.size();
+    estimate.sampledPairs = static_cast<int>(decodeMs.size());
+    estimate.decodeMs = std::accumulate(decodeMs.begin(), decodeMs.end(), 0.) * scale;
+    double gridTotal = std::accumulate(gridMs.begin(), gridMs.end(), 0.) * scale;
+    double triangulateTotal = std::accumulate(triangulateMs.begin(), triangulateMs.end(), 0.) * scale;
+    estimate.extractMs = gridTotal + triangulateTotal;
+    estimate.triangles = static_cast<uint64_t>(std::accumulate(triangles.begin(), triangles.end(), 0.) * scale);
+    estimate.bytes = static_cast<uint64_t>(estimate.triangles * GetBytesPerTriangle(output.format));
+    estimate.writeMs = estimate.bytes / GetWriteBytesPerMs(output.stream);
 
-        time = time * (slicesPositions.size() / 2);
+    // The stages overlap: the readers and the grid builders run on their own threads,
+    // the triangulation and the writer share one. Slabs split all but the final write.
+    double readStage = estimate.decodeMs / std::max(pipeline.readThreads, 1);
+    double gridStage = gridTotal / std::max(pipeline.gridThreads, 1);
+    int slabsCount = pipeline.slabs > 1 ? pipeline.slabs :
+                     output.chunkSlices > 0 ? (pairsCount + output.chunkSlices - 1) / output.chunkSlices :
+                     output.mappedStl ? (pairsCount + MAPPED_SLAB_SLICES - 1) / MAPPED_SLAB_SLICES : 1;
+    int workersCount = slabsCount > 1 ? GetSlabWorkersCount(output, slabsCount) : 1;
+    if (workersCount > 1)
+    {
+        double slabWrite = output.chunkSlices > 0 ? estimate.writeMs / workersCount : estimate.writeMs;
+        estimate.totalMs = std::max(std::max(readStage, std::max(gridStage, triangulateTotal)) / workersCount, slabWrite);
+    }
+    else
+    {
+        estimate.totalMs = std::max(readStage, std::max(gridStage, triangulateTotal + estimate.writeMs));
     }
 
-    ::DeleteFile(fileName.c_str());
+    // The spread of the sampled pairs gives the range, about two standard errors
+    std::vector<double> pairMs(decodeMs.size());
+    for (size_t i = 0; i < pairMs.size(); ++i)
+    {
+        pairMs[i] = decodeMs[i] + gridMs[i] + triangulateMs[i] + triangles[i] * GetBytesPerTriangle(output.format) / GetWriteBytesPerMs(output.stream);
+    }
+    double mean = std::accumulate(pairMs.begin(), pairMs.end(), 0.) / pairMs.size();
+    double variance = 0.;
+    std::for_each(pairMs.begin(), pairMs.end(), [&](double ms) { variance += (ms - mean) * (ms - mean); });
+    variance = pairMs.size() > 1 ? variance / (pairMs.size() - 1) : mean * mean;
+    double spread = mean > 0. ? 2. * std::sqrt(variance / pairMs.size()) / mean : 0.;
+    spread = std::min(std::max(spread, ESTIMATE_MIN_SPREAD), 1.);
+    estimate.lowMs = estimate.totalMs * (1. - spread);
+    estimate.highMs = estimate.totalMs * (1. + spread);
+    estimate.samplingMs = samplingTimer.End();
 
-    return time;
+    OFLOG_INFO(logger, "Sampled " << estimate.sampledPairs << " of " << pairsCount << " slice pairs in " << estimate.samplingMs
+                       << " ms : decode " << estimate.decodeMs << " ms, extraction " << estimate.extractMs << " ms, write "
+                       << estimate.writeMs << " ms, about " << estimate.triangles << " triangles and " << estimate.bytes << " bytes" << OFendl);
+    return estimate;
 }
 
+
 }
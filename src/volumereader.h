@@ -3,34 +3,151 @@
 
 #include "triangulator.h"
 #include "formatreader.h"
+#include "meshwriter.h"
+#include "slicesource.h"
+#include "progress.h"
+#include "histogram.h"
 
 #include <vector>
 #include <string>
 #include <functional>
+#include <cstdint>
 
 class OFLogger;
 
 namespace DicomToStl
 {
 
+// Threads and buffers of the read - build grid - triangulate pipeline
+struct PipelineOptions
+{
+    PipelineOptions() : readThreads(1), gridThreads(1), depth(2), slabs(0), memoryLimit(0), checkpoint(false), resume(false), progressInterval(1000), histogram(nullptr) {}
+    // Threads decoding slices
+    int readThreads;
+    // Threads building grid cells, each one spreads its pair over the shared workers too
+    int gridThreads;
+    // Slice pairs in flight, each one holds two images and the cells built from them
+    int depth;
+    // When above one the series is split into this many z-slabs, each one runs the
+    // whole pipeline on its own worker and the slabs are stitched into one output
+    int slabs;
+    // Bytes the buffers may take, 0 for no limit. The depth, the slabs processed at
+    // once and the compression pool are lowered to fit, and slabs wait for memory.
+    uint64_t memoryLimit;
+    // Keep a checkpoint after every finished slab, the output of a single pipeline
+    // is then stitched from slabs. With resume the slabs finished by an
+    // interrupted run are taken from the disk instead of being processed again.
+    bool checkpoint;
+    bool resume;
+    // When set the stage counters of the run are written there as JSON
+    std::string statsFile;
+    // When set the spans of every thread are written there as a Chrome trace-event file
+    std::string traceFile;
+    // When set it gets a ProgressEvent about every progressInterval milliseconds while
+    // the series is converted and a last one at the end, from a thread of its own
+    ProgressCallback progress;
+    int progressInterval;
+    // When set the read stage counts the pixels of every slice into it, each thread
+    // in a histogram of its own merged at the end. Slabs taken from a checkpoint and
+    // the counting pass of the mapped STL are not counted.
+    IntensityHistogram* histogram;
+};
+
+// Converts the series into the mesh file, the output and pipeline options choose
+// between the single pipeline, the slabs, the chunks and the mapped STL. A failed
+// conversion throws once its counters are reported; the incomplete output is
+// removed unless a checkpoint keeps it for --resume.
+void WriteVolume(const SliceSource& source,
+                 int isoLevel,
+                 const std::string& fileName,
+                 const OutputOptions& output,
+                 const PipelineOptions& pipeline,
+                 OFLogger& logger,
+                 std::function<bool (void)> needBreak);
+
+// Triangulates the series through one pipeline into meshWriter, which gets the
+// triangles in the slice order from a single thread and is left open.
+// Slabs and checkpoints need a file output and are ignored here.
+// Returns false when cancelled.
+bool TriangulateVolume(const SliceSource& source,
+                       int isoLevel,
+                       MeshWriter& meshWriter,
+                       const PipelineOptions& pipeline,
+                       OFLogger& logger,
+                       std::function<bool (void)> needBreak);
+
+// WriteVolume of the DICOM files sorted by ReadFormatDcmFiles
 void ReadVolumeFromDcmFiles(int dx,
                             int dy,
                             const Vec3& spacing,
                             const SlicesPositions& slicesPositions, 
+                            const Vec3& rowDirection,
+                            const Vec3& columnDirection,
                             int isoLevel, 
                             const std::string& fileName,
-                            bool binaryStl,
+                            const OutputOptions& output,
+                            const PipelineOptions& pipeline,
                             OFLogger& logger, 
                             std::function<bool (void)> needBreak);
 
-double EstimateProcessingTime(int dx,
-                              int dy,
-                              const Vec3& spacing,
-                              const SlicesPositions& slicesPositions, 
-                              int isoLevel,
-                              const std::string& fileName,
-                              bool binaryStl,
-                              OFLogger& logger);
+// Reads every slice once on pipeline.readThreads threads and counts the pixels into
+// histogram, nothing is triangulated. Returns false when cancelled.
+bool ComputeHistogram(const SliceSource& source,
+                      const PipelineOptions& pipeline,
+                      IntensityHistogram& histogram,
+                      OFLogger& logger,
+                      std::function<bool (void)> needBreak);
+
+// Size of the mesh of one isolevel of a sweep
+struct SweepLevel
+{
+    SweepLevel() : isoLevel(0), activeCells(0), triangles(0) {}
+    int isoLevel;
+    // Cells the surface crosses
+    uint64_t activeCells;
+    // Exactly the triangles a conversion at the level emits
+    uint64_t triangles;
+};
+
+// Classifies the cells of the series for every level of isoLevels over one read of
+// the slices, nothing is interpolated or written. Slabs of the series go to
+// pipeline.readThreads threads, each one reads the first slice of its slab again.
+// Returns false when cancelled.
+bool SweepIsoLevels(const SliceSource& source,
+                    const std::vector<int>& isoLevels,
+                    const PipelineOptions& pipeline,
+                    std::vector<SweepLevel>& levels,
+                    OFLogger& logger,
+                    std::function<bool (void)> needBreak);
+
+// Projected duration of a conversion, from slice pairs sampled across the series
+struct TimeEstimate
+{
+    TimeEstimate() : decodeMs(0.), extractMs(0.), writeMs(0.), totalMs(0.), lowMs(0.), highMs(0.),
+                     triangles(0), bytes(0), sampledPairs(0), samplingMs(0.) {}
+    // Thread time of decoding the slices, of building and triangulating the cells
+    // and of writing the output, each one summed over the whole series
+    double decodeMs;
+    double extractMs;
+    double writeMs;
+    // Wall time with the stages overlapped on the pipeline threads, and its likely range
+    double totalMs;
+    double lowMs;
+    double highMs;
+    uint64_t triangles;
+    uint64_t bytes;
+    int sampledPairs;
+    // Time the estimation itself took
+    double samplingMs;
+};
+
+// Decodes and triangulates a few slice pairs spread over the series in parallel without
+// writing anything, the write cost follows from the triangle count and the output options
+TimeEstimate EstimateProcessingTime(const SliceSource& source,
+                                    int isoLevel,
+                                    const OutputOptions& output,
+                                    const PipelineOptions& pipeline,
+                                    OFLogger& logger);
 }
 
 #endif
\ No newline at end of file